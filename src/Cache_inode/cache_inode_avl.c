@@ -40,6 +40,7 @@
 #include "config.h"
 
 #include "log.h"
+#include "abstract_atomic.h"
 #include "fsal.h"
 #include "cache_inode.h"
 #include "cache_inode_avl.h"
@@ -53,10 +54,14 @@
 #include <pthread.h>
 #include <assert.h>
 
+struct cache_inode_neg_stats neg_dirent_stats;
+
 void cache_inode_avl_init(cache_entry_t *entry)
 {
     avltree_init(&entry->object.dir.avl.t, avl_dirent_hk_cmpf, 0 /* flags */);
     avltree_init(&entry->object.dir.avl.c, avl_dirent_hk_cmpf, 0 /* flags */);
+    avltree_init(&entry->object.dir.avl.neg, avl_dirent_hk_cmpf,
+                 0 /* flags */);
 }
 
 static inline struct avltree_node *
@@ -97,6 +102,7 @@ avl_dirent_set_deleted(cache_entry_t *entry, cache_inode_dir_entry_t *v)
 #endif
 
     v->flags |= DIR_ENTRY_FLAG_DELETED;
+    cache_inode_mem_discharge(entry, CACHE_INODE_MEM_DIRENT, v->ckey.kv.len);
     cache_inode_key_delete(&v->ckey);
 
     /* save cookie in deleted avl */
@@ -161,7 +167,14 @@ cache_inode_avl_insert_impl(cache_entry_t *entry, cache_inode_dir_entry_t *v,
 #endif /* 0 */
 
     if (node) {
+        cache_inode_dir_entry_t *v_del =
+            avltree_container_of(node, cache_inode_dir_entry_t, node_hk);
+
         avltree_remove(node, c);
+        /* Its key went with the delete, the rest goes now */
+        cache_inode_mem_discharge(entry, CACHE_INODE_MEM_DIRENT,
+                                  cache_inode_dirent_footprint(v_del));
+        gsh_free(v_del);
         node = NULL;
     }
     node = avltree_insert(&v->node_hk, t);
@@ -357,4 +370,157 @@ cache_inode_avl_qp_lookup_s(cache_entry_t *entry,
     return (NULL);
 }
 
+/*
+ * Negative dirents.  A name the FSAL said does not exist is kept in
+ * its own tree, keyed by the unprobed name hash, so it is never seen
+ * by readdir or cookie lookups.  On a hash collision the newer name
+ * simply replaces the older one.
+ */
+
+static inline uint64_t
+avl_dirent_name_hash(const char *name, size_t namelen)
+{
+    uint64_t k;
+#if AVL_HASH_MURMUR3
+    uint32_t hashbuff[4];
+
+    MurmurHash3_x64_128(name, namelen, 67, hashbuff);
+    memcpy(&k, hashbuff, 8);
+#else
+    k = CityHash64WithSeed(name, namelen, 67);
+#endif
+    return (k);
+}
+
+static inline cache_inode_dir_entry_t *
+avl_neg_lookup_impl(cache_entry_t *entry, const char *name)
+{
+    struct avltree_node *node;
+    cache_inode_dir_entry_t v;
+
+    v.hk.k = avl_dirent_name_hash(name, strlen(name));
+    node = avltree_inline_lookup(&v.node_hk, &entry->object.dir.avl.neg);
+    if (! node)
+        return (NULL);
+
+    return (avltree_container_of(node, cache_inode_dir_entry_t, node_hk));
+}
+
+static inline void
+avl_neg_remove_impl(cache_entry_t *entry, cache_inode_dir_entry_t *v)
+{
+    avltree_remove(&v->node_hk, &entry->object.dir.avl.neg);
+    entry->object.dir.avl.nneg--;
+    cache_inode_mem_discharge(entry, CACHE_INODE_MEM_DIRENT,
+                              cache_inode_dirent_footprint(v));
+    gsh_free(v);
+}
+
+/**
+ * @brief Is name a live negative dirent of this directory?
+ *
+ * The caller holds the content lock for read or write.  Expired
+ * entries are left for the next writer to clean up.
+ *
+ * @param[in] entry The directory
+ * @param[in] name  The name looked up
+ *
+ * @return true if the name is known not to exist.
+ */
+
+bool cache_inode_avl_neg_lookup(cache_entry_t *entry, const char *name)
+{
+    cache_inode_dir_entry_t *v;
+
+    if (entry->object.dir.avl.nneg == 0)
+        return (false);
+
+    v = avl_neg_lookup_impl(entry, name);
+    if ((! v) || (strcmp(v->name, name) != 0))
+        return (false);
+
+    return (v->neg_expire > time(NULL));
+}
+
+/**
+ * @brief Remember that name does not exist in this directory
+ *
+ * The caller holds the content lock for write.  An existing negative
+ * dirent for the name just gets a fresh expiry.  When the directory
+ * is at Negative_Dirents_Max, the entry with the lowest key makes
+ * room.
+ *
+ * @param[in,out] entry The directory
+ * @param[in]     name  The name the FSAL did not find
+ */
+
+void cache_inode_avl_neg_insert(cache_entry_t *entry, const char *name)
+{
+    time_t ttl = nfs_param.cache_param.neg_dirent_ttl;
+    size_t namesize = strlen(name) + 1;
+    cache_inode_dir_entry_t *v;
+    struct avltree_node *node;
+
+    if (ttl == 0)
+        return;
+
+    v = avl_neg_lookup_impl(entry, name);
+    if (v) {
+        if (strcmp(v->name, name) == 0) {
+            v->neg_expire = time(NULL) + ttl;
+            return;
+        }
+        avl_neg_remove_impl(entry, v);
+    }
+
+    if (entry->object.dir.avl.nneg >= nfs_param.cache_param.neg_dirent_max) {
+        node = avltree_first(&entry->object.dir.avl.neg);
+        if (! node)
+            return;
+        avl_neg_remove_impl(entry,
+                            avltree_container_of(node,
+                                                 cache_inode_dir_entry_t,
+                                                 node_hk));
+    }
+
+    v = gsh_malloc(sizeof(cache_inode_dir_entry_t) + namesize);
+    if (! v)
+        return;
+
+    memset(v, 0, sizeof(cache_inode_dir_entry_t));
+    memcpy(v->name, name, namesize);
+    v->flags = DIR_ENTRY_FLAG_NEGATIVE;
+    v->hk.k = avl_dirent_name_hash(name, namesize - 1);
+    v->neg_expire = time(NULL) + ttl;
+
+    node = avltree_insert(&v->node_hk, &entry->object.dir.avl.neg);
+    assert(! node);
+    entry->object.dir.avl.nneg++;
+    cache_inode_mem_charge(entry, CACHE_INODE_MEM_DIRENT,
+                           cache_inode_dirent_footprint(v));
+    atomic_inc_uint64_t(&neg_dirent_stats.inserts);
+}
+
+/**
+ * @brief Forget a negative dirent
+ *
+ * Called with the content lock held for write whenever name comes
+ * into existence in the directory.
+ *
+ * @param[in,out] entry The directory
+ * @param[in]     name  The name now present
+ */
+
+void cache_inode_avl_neg_remove(cache_entry_t *entry, const char *name)
+{
+    cache_inode_dir_entry_t *v;
+
+    if (entry->object.dir.avl.nneg == 0)
+        return;
+
+    v = avl_neg_lookup_impl(entry, name);
+    if (v && (strcmp(v->name, name) == 0))
+        avl_neg_remove_impl(entry, v);
+}
+
 /** @} */
@@ -456,6 +456,7 @@ void state_del_for_shutdown(state_t *state,
 
 	/* Remove from the list of states for a particular cache entry */
 	glist_del(&state->state_list);
+	avltree_remove(&state->state_node, &entry->state_index);
 
 	/* Remove from the list of lock states for a particular open state */
 	if (state->state_type == STATE_TYPE_LOCK) {
@@ -46,6 +46,9 @@
 #include <assert.h>
 #include "nfs_exports.h"
 #include "export_mgr.h"
+#include "abstract_atomic.h"
+
+struct cache_inode_attr_blob_stats cache_inode_attr_blob_stats;
 
 /**
  * @brief Gets the attributes for a cached entry
@@ -105,6 +108,166 @@ out:
         return status;
 }
 
+/**
+ * @brief Set up the encoded attribute blobs of a new entry
+ *
+ * @param[in] entry The entry
+ */
+void
+cache_inode_attr_blobs_init(cache_entry_t *entry)
+{
+	struct cache_inode_attr_blobs *blobs = &entry->attr_blobs;
+
+	pthread_spin_init(&blobs->lock, PTHREAD_PROCESS_PRIVATE);
+	blobs->next = 0;
+	memset(blobs->b, 0, sizeof(blobs->b));
+}
+
+/**
+ * @brief Free the encoded attribute blobs of an entry
+ *
+ * The entry must be unreachable.  Safe to call on an entry whose
+ * blobs were already released.
+ *
+ * @param[in] entry The entry
+ */
+void
+cache_inode_attr_blobs_release(cache_entry_t *entry)
+{
+	struct cache_inode_attr_blobs *blobs = &entry->attr_blobs;
+	int i;
+
+	for (i = 0; i < CACHE_INODE_ATTR_BLOBS; i++) {
+		if (blobs->b[i].buf == NULL)
+			continue;
+		cache_inode_mem_discharge(entry, CACHE_INODE_MEM_ATTR_BLOB,
+					  blobs->b[i].len);
+		gsh_free(blobs->b[i].buf);
+		blobs->b[i].buf = NULL;
+	}
+	pthread_spin_destroy(&blobs->lock);
+}
+
+/**
+ * @brief Look up an encoding of the current attributes
+ *
+ * The caller must hold the attribute lock, so attr_gen cannot move
+ * between here and its use of the encoding.
+ *
+ * @param[in]  entry  The entry
+ * @param[in]  key    CACHE_INODE_ATTR_BLOB_WORDS words naming the
+ *                    request
+ * @param[out] mask   CACHE_INODE_ATTR_BLOB_WORDS words given to
+ *                    cache_inode_attr_blob_put with the encoding
+ * @param[out] buf    Where to copy the encoding
+ * @param[in]  buflen Size of buf
+ * @param[out] len    Size of the encoding
+ *
+ * @return true if an encoding was copied out.
+ */
+bool
+cache_inode_attr_blob_get(cache_entry_t *entry,
+			  const uint32_t *key,
+			  uint32_t *mask,
+			  char *buf,
+			  size_t buflen,
+			  size_t *len)
+{
+	struct cache_inode_attr_blobs *blobs = &entry->attr_blobs;
+	struct cache_inode_attr_blob *blob;
+	bool found = false;
+	int i;
+
+	pthread_spin_lock(&blobs->lock);
+	for (i = 0; i < CACHE_INODE_ATTR_BLOBS; i++) {
+		blob = &blobs->b[i];
+		if (blob->buf == NULL || blob->gen != entry->attr_gen ||
+		    blob->len > buflen ||
+		    memcmp(blob->key, key, sizeof(blob->key)) != 0)
+			continue;
+		memcpy(mask, blob->mask, sizeof(blob->mask));
+		memcpy(buf, blob->buf, blob->len);
+		*len = blob->len;
+		found = true;
+		break;
+	}
+	pthread_spin_unlock(&blobs->lock);
+
+	if (found)
+		atomic_inc_uint64_t(&cache_inode_attr_blob_stats.hits);
+	else
+		atomic_inc_uint64_t(&cache_inode_attr_blob_stats.misses);
+
+	return found;
+}
+
+/**
+ * @brief Keep an encoding of the current attributes
+ *
+ * The caller must hold the attribute lock and have encoded the
+ * attributes under it.  The slot replaced is, in order of preference,
+ * one with the same key, a free or stale one, or the next in turn.
+ *
+ * @param[in] entry The entry
+ * @param[in] key   CACHE_INODE_ATTR_BLOB_WORDS words naming the request
+ * @param[in] mask  CACHE_INODE_ATTR_BLOB_WORDS words to return with
+ *                  the encoding
+ * @param[in] buf   The encoding
+ * @param[in] len   Its size
+ */
+void
+cache_inode_attr_blob_put(cache_entry_t *entry,
+			  const uint32_t *key,
+			  const uint32_t *mask,
+			  const char *buf,
+			  size_t len)
+{
+	struct cache_inode_attr_blobs *blobs = &entry->attr_blobs;
+	struct cache_inode_attr_blob *blob, *victim = NULL;
+	char *copy, *old;
+	int i;
+
+	if (len == 0 || len > CACHE_INODE_ATTR_BLOB_MAX)
+		return;
+
+	copy = gsh_malloc(len);
+	if (copy == NULL)
+		return;
+	memcpy(copy, buf, len);
+
+	pthread_spin_lock(&blobs->lock);
+	for (i = 0; i < CACHE_INODE_ATTR_BLOBS; i++) {
+		blob = &blobs->b[i];
+		if (blob->buf != NULL &&
+		    memcmp(blob->key, key, sizeof(blob->key)) == 0) {
+			victim = blob;
+			break;
+		}
+		if (victim == NULL &&
+		    (blob->buf == NULL || blob->gen != entry->attr_gen))
+			victim = blob;
+	}
+	if (victim == NULL) {
+		victim = &blobs->b[blobs->next];
+		blobs->next = (blobs->next + 1) % CACHE_INODE_ATTR_BLOBS;
+	}
+
+	old = victim->buf;
+	if (old != NULL)
+		cache_inode_mem_discharge(entry, CACHE_INODE_MEM_ATTR_BLOB,
+					  victim->len);
+	victim->gen = entry->attr_gen;
+	memcpy(victim->key, key, sizeof(victim->key));
+	memcpy(victim->mask, mask, sizeof(victim->mask));
+	victim->len = len;
+	victim->buf = copy;
+	cache_inode_mem_charge(entry, CACHE_INODE_MEM_ATTR_BLOB, len);
+	pthread_spin_unlock(&blobs->lock);
+
+	gsh_free(old);
+	atomic_inc_uint64_t(&cache_inode_attr_blob_stats.stores);
+}
+
 /**
  * @brief Gets the fileid of a cached entry
  *
@@ -43,6 +43,7 @@
 #include "cache_inode_lru.h"
 #include "abstract_atomic.h"
 #include "cache_inode_hash.h"
+#include "pool_slab.h"
 
 #include <unistd.h>
 #include <sys/types.h>
@@ -66,7 +67,7 @@ cache_inode_status_t cache_inode_init(void)
 
   cache_inode_entry_pool = pool_init("Entry Pool",
                                      sizeof(cache_entry_t),
-                                     pool_basic_substrate,
+                                     pool_slab_substrate,
                                      NULL, NULL, NULL);
   if(!(cache_inode_entry_pool))
     {
@@ -76,6 +77,7 @@ cache_inode_status_t cache_inode_init(void)
     }
 
   cih_pkginit();
+  cache_inode_lookup_pkginit();
 
   return status;
 }                               /* cache_inode_init */
@@ -99,6 +99,8 @@ cache_inode_invalidate(cache_entry_t *entry,
                 atomic_clear_uint32_t_bits(&entry->flags,
                                            CACHE_INODE_TRUST_CONTENT |
                                            CACHE_INODE_DIR_POPULATED);
+                if (entry->type == DIRECTORY)
+                        atomic_inc_uint32_t(&entry->object.dir.gen);
         }
 
         if (((flags & CACHE_INODE_INVALIDATE_CLOSE) != 0) &&
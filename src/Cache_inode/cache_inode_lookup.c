@@ -41,6 +41,7 @@
 #include "cache_inode.h"
 #include "cache_inode_avl.h"
 #include "cache_inode_lru.h"
+#include "nlm_list.h"
 
 #include <unistd.h>
 #include <sys/types.h>
@@ -49,6 +50,218 @@
 #include <pthread.h>
 #include <assert.h>
 
+
+/**
+ * @brief A lookup the FSAL is working on
+ *
+ * Concurrent misses on the same name in the same, unchanged
+ * directory wait for the first one instead of asking the FSAL again.
+ */
+
+struct lookup_inflight {
+     struct glist_head q; /*< Partition queue */
+     cache_entry_t *parent; /*< Directory searched */
+     uint32_t gen; /*< Directory generation the lookup started from */
+     uint32_t add_gen; /*< Directory add generation, likewise */
+     uint32_t refcnt; /*< Leader plus waiters */
+     bool done; /*< Result is available */
+     cache_inode_status_t status; /*< Result of the lookup */
+     cache_entry_t *entry; /*< Entry found, one reference per waiter */
+     char name[]; /*< The name looked up */
+};
+
+#define LOOKUP_INFLIGHT_PARTITIONS 31
+
+static struct lookup_inflight_partition {
+     pthread_mutex_t mtx;
+     pthread_cond_t cv;
+     struct glist_head q;
+} lookup_inflight[LOOKUP_INFLIGHT_PARTITIONS];
+
+/**
+ * @brief Initialize the in-flight lookup table
+ */
+
+void cache_inode_lookup_pkginit(void)
+{
+     int i;
+
+     for (i = 0; i < LOOKUP_INFLIGHT_PARTITIONS; i++) {
+          pthread_mutex_init(&lookup_inflight[i].mtx, NULL);
+          pthread_cond_init(&lookup_inflight[i].cv, NULL);
+          init_glist(&lookup_inflight[i].q);
+     }
+}
+
+static inline struct lookup_inflight_partition *
+lookup_inflight_partition(cache_entry_t *parent, const char *name)
+{
+     uint64_t h = (uintptr_t) parent;
+
+     while (*name)
+          h = (h * 31) + (unsigned char) *name++;
+
+     return &lookup_inflight[h % LOOKUP_INFLIGHT_PARTITIONS];
+}
+
+/**
+ * @brief Check the caller may look names up in parent
+ *
+ * @param[in] parent  The directory
+ * @param[in] req_ctx Request context
+ *
+ * @return CACHE_INODE_SUCCESS or error.
+ */
+
+static inline cache_inode_status_t
+lookup_access(cache_entry_t *parent, struct req_op_context *req_ctx)
+{
+     return cache_inode_access(parent,
+                               FSAL_MODE_MASK_SET(FSAL_X_OK) |
+                               FSAL_ACE4_MASK_SET(FSAL_ACE_PERM_LIST_DIR),
+                               req_ctx);
+}
+
+/**
+ * @brief Answer a lookup from the dirent cache
+ *
+ * The content lock on parent must be held for read or write.
+ *
+ * @param[in]  parent  The directory to search
+ * @param[in]  name    The name to be looked up
+ * @param[in]  req_ctx Request context
+ * @param[out] entry   Found entry
+ * @param[out] status  Result, when true is returned
+ *
+ * @return true if the cache settled the lookup.
+ */
+
+static bool
+lookup_cached(cache_entry_t *parent,
+              const char *name,
+              struct req_op_context *req_ctx,
+              cache_entry_t **entry,
+              cache_inode_status_t *status)
+{
+     cache_inode_dir_entry_t *dirent;
+
+     /* If the dirent cache is untrustworthy, don't even ask it */
+     if (!(parent->flags & CACHE_INODE_TRUST_CONTENT))
+          return false;
+
+     dirent = cache_inode_avl_qp_lookup_s(parent, name, 1);
+     if (dirent) {
+          *entry = cache_inode_get_keyed(&dirent->ckey, req_ctx,
+                                         CIG_KEYED_FLAG_NONE);
+          if (*entry) {
+               /* We have our entry and a valid reference.
+                  Declare victory. */
+               *status = CACHE_INODE_SUCCESS;
+               return true;
+          }
+          return false;
+     }
+
+     if (parent->flags & CACHE_INODE_DIR_POPULATED) {
+          /* If the dirent cache is both fully populated and valid,
+             it can serve negative lookups. */
+          *entry = NULL;
+          *status = CACHE_INODE_NOT_FOUND;
+          return true;
+     }
+     if (cache_inode_avl_neg_lookup(parent, name)) {
+          /* The FSAL told us recently. */
+          atomic_inc_uint64_t(&neg_dirent_stats.hits);
+          *entry = NULL;
+          *status = CACHE_INODE_NOT_FOUND;
+          return true;
+     }
+
+     return false;
+}
+
+/**
+ * @brief Ask the FSAL for a name
+ *
+ * No lock on parent is needed.
+ *
+ * @param[in]  parent  The directory to search
+ * @param[in]  name    The name to be looked up
+ * @param[in]  req_ctx Request context
+ * @param[out] entry   Found entry, with a reference
+ *
+ * @return CACHE_INODE_SUCCESS or error.
+ */
+
+static cache_inode_status_t
+lookup_from_fsal(cache_entry_t *parent,
+            const char *name,
+            struct req_op_context *req_ctx,
+            cache_entry_t **entry)
+{
+     struct fsal_obj_handle *object_handle = NULL;
+     struct fsal_obj_handle *dir_handle = parent->obj_handle;
+     fsal_status_t fsal_status;
+
+     *entry = NULL;
+     fsal_status = dir_handle->ops->lookup(dir_handle, req_ctx, name,
+                                           &object_handle);
+     if (FSAL_IS_ERROR(fsal_status)) {
+          if (fsal_status.major == ERR_FSAL_STALE) {
+               LogEvent(COMPONENT_CACHE_INODE,
+                  "FSAL returned STALE from a lookup.");
+               cache_inode_kill_entry(parent);
+          }
+          return cache_inode_error_convert(fsal_status);
+     }
+
+     /* Allocation of a new entry in the cache */
+     return cache_inode_new_entry(object_handle, CACHE_INODE_FLAG_NONE,
+                                  entry);
+}
+
+/**
+ * @brief Record the FSAL's answer in the dirent cache
+ *
+ * The content lock on parent must be held for write and the dirent
+ * cache must be trusted.
+ *
+ * @param[in] parent   The directory searched
+ * @param[in] name     The name looked up
+ * @param[in] status   Result of lookup_from_fsal
+ * @param[in] entry    Entry found
+ * @param[in] negative Whether a NOT_FOUND may be cached: false if a
+ *                     dirent may have been added since the FSAL was
+ *                     asked
+ *
+ * @return Result of adding the dirent.
+ */
+
+static cache_inode_status_t
+lookup_cache_result(cache_entry_t *parent,
+                    const char *name,
+                    cache_inode_status_t status,
+                    cache_entry_t *entry,
+                    bool negative)
+{
+     if (status == CACHE_INODE_NOT_FOUND) {
+          atomic_inc_uint64_t(&neg_dirent_stats.misses);
+          if (negative &&
+              cache_inode_avl_qp_lookup_s(parent, name, 1) == NULL)
+               cache_inode_avl_neg_insert(parent, name);
+          return CACHE_INODE_SUCCESS;
+     }
+     if (status != CACHE_INODE_SUCCESS || entry == NULL)
+          return CACHE_INODE_SUCCESS;
+
+     /* Entry was found in the FSAL, add this entry to the
+	parent directory */
+     status = cache_inode_add_cached_dirent(parent, name, entry, NULL);
+     if (status == CACHE_INODE_ENTRY_EXISTS)
+          status = CACHE_INODE_SUCCESS;
+     return status;
+}
+
 /**
  *
  * @brief Do the work of looking up a name in a directory.
@@ -60,6 +273,10 @@
  * before proceeding.  The caller is responsible for freeing the lock
  * on the directory in any case.
  *
+ * This is for callers that need the directory to stay locked across
+ * the lookup (remove and rename); cache_inode_lookup does not hold
+ * the content lock while the FSAL works.
+ *
  * If a cache entry is returned, its refcount is incremented by 1.
  *
  * @param[in]  parent  The directory to search
@@ -75,10 +292,6 @@ cache_inode_lookup_impl(cache_entry_t *parent,
 			struct req_op_context *req_ctx,
 			cache_entry_t **entry)
 {
-     cache_inode_dir_entry_t *dirent = NULL;
-     fsal_status_t fsal_status = {0, 0};
-     struct fsal_obj_handle *object_handle = NULL;
-     struct fsal_obj_handle *dir_handle;
      cache_inode_status_t status = CACHE_INODE_SUCCESS;
 
      if(parent->type != DIRECTORY) {
@@ -109,30 +322,10 @@ cache_inode_lookup_impl(cache_entry_t *parent,
            * dispatch to the FSAL. */
 	  /* XXX this ++write_locked idiom is not good style */
           for (write_locked = 0; write_locked < 2; ++write_locked) {
-               /* If the dirent cache is untrustworthy, don't even ask it */
-               if (parent->flags & CACHE_INODE_TRUST_CONTENT) {
-                    dirent = cache_inode_avl_qp_lookup_s(parent, name, 1);
-                    if (dirent) {
-                        *entry = cache_inode_get_keyed(
-                            &dirent->ckey, req_ctx, CIG_KEYED_FLAG_NONE);
-			if (*entry) {
-                              /* We have our entry and a valid reference.
-                                 Declare victory. */
-                              status = CACHE_INODE_SUCCESS;
-                              goto out;
-			}
-                    } else { /* ! dirent */
-			    if (parent->flags & CACHE_INODE_DIR_POPULATED) {
-				    /* If the dirent cache is both fully
-				       populated and valid, it can serve
-				       negative lookups. */
-				    *entry = NULL;
-				    status = CACHE_INODE_NOT_FOUND;
-				    goto out;
-			    }
-			    /* XXX keep going? */
-                    }
-               } else if (write_locked) {
+               if (lookup_cached(parent, name, req_ctx, entry, &status))
+                    goto out;
+               if (!(parent->flags & CACHE_INODE_TRUST_CONTENT) &&
+                   write_locked) {
                     /* We have the write lock and the content is
                        still invalid.  Empty it out and mark it valid
                        in preparation for caching the result of this lookup. */
@@ -144,39 +337,158 @@ cache_inode_lookup_impl(cache_entry_t *parent,
                     PTHREAD_RWLOCK_wrlock(&parent->content_lock);
                }
           }
-          assert(*entry == NULL);
+          *entry = NULL;
           LogDebug(COMPONENT_CACHE_INODE, "Cache Miss detected");
      }
 
-     dir_handle = parent->obj_handle;
-     fsal_status = dir_handle->ops->lookup(dir_handle, req_ctx, name,
-                                           &object_handle);
-     if (FSAL_IS_ERROR(fsal_status)) {
-          if (fsal_status.major == ERR_FSAL_STALE) {
-               LogEvent(COMPONENT_CACHE_INODE,
-                  "FSAL returned STALE from a lookup.");
-               cache_inode_kill_entry(parent);
+     status = lookup_from_fsal(parent, name, req_ctx, entry);
+     if ((status == CACHE_INODE_SUCCESS || status == CACHE_INODE_NOT_FOUND)
+         && (parent->flags & CACHE_INODE_TRUST_CONTENT)) {
+          cache_inode_status_t cache_status =
+               lookup_cache_result(parent, name, status, *entry, true);
+
+          if (status == CACHE_INODE_SUCCESS)
+               status = cache_status;
+     }
+
+out:
+     return status;
+}
+
+/**
+ * @brief Look up a name the dirent cache could not answer
+ *
+ * Called with no lock on parent.  The FSAL lookup runs unlocked and
+ * the content lock is taken for write only to record the answer, and
+ * only if no dirent was removed, renamed or invalidated (gen) since
+ * the caller last looked at the cache.  Adds do not bump gen, so
+ * concurrent misses on other names in the directory all get cached.
+ * A NOT_FOUND is only cached if nothing was added either (add_gen),
+ * since the add may have been of this name; an untrusted directory
+ * is then left alone rather than emptied of the new dirent.
+ *
+ * A caller that misses on a name whose lookup is already in flight
+ * from the same generations waits for it and takes the entry found,
+ * after checking its own access to parent.  The leader's failures
+ * may come from the leader's credentials, so on any other result the
+ * waiter asks the FSAL itself.
+ *
+ * @param[in]  parent  The directory to search
+ * @param[in]  name    The name to be looked up
+ * @param[in]  gen     Directory generation seen by the caller
+ * @param[in]  add_gen Directory add generation seen by the caller
+ * @param[in]  req_ctx Request context
+ * @param[out] entry   Found entry
+ *
+ * @return CACHE_INODE_SUCCESS or error.
+ */
+
+static cache_inode_status_t
+lookup_miss(cache_entry_t *parent,
+            const char *name,
+            uint32_t gen,
+            uint32_t add_gen,
+            struct req_op_context *req_ctx,
+            cache_entry_t **entry)
+{
+     struct lookup_inflight_partition *part =
+          lookup_inflight_partition(parent, name);
+     struct lookup_inflight *lif = NULL;
+     struct glist_head *glist;
+     size_t namesize = strlen(name) + 1;
+     cache_inode_status_t status;
+     uint32_t refs;
+
+     pthread_mutex_lock(&part->mtx);
+     glist_for_each(glist, &part->q) {
+          struct lookup_inflight *cand =
+               glist_entry(glist, struct lookup_inflight, q);
+
+          if (cand->parent == parent && cand->gen == gen &&
+              cand->add_gen == add_gen &&
+              strcmp(cand->name, name) == 0) {
+               lif = cand;
+               break;
           }
-          status = cache_inode_error_convert(fsal_status);
-          *entry = NULL;
-          return status;
+     }
+     if (lif) {
+          /* Someone is already asking, share their answer. */
+          lif->refcnt++;
+          while (!lif->done)
+               pthread_cond_wait(&part->cv, &part->mtx);
+          status = lif->status;
+          *entry = lif->entry;
+          refs = --lif->refcnt;
+          pthread_mutex_unlock(&part->mtx);
+          if (refs == 0)
+               gsh_free(lif);
+          if (status == CACHE_INODE_SUCCESS) {
+               LogFullDebug(COMPONENT_CACHE_INODE,
+                            "Shared in-flight lookup of %s", name);
+               status = lookup_access(parent, req_ctx);
+               if (status != CACHE_INODE_SUCCESS) {
+                    cache_inode_put(*entry);
+                    *entry = NULL;
+               }
+               return status;
+          }
+          /* Ask for ourselves, without offering to share */
+          lif = NULL;
+          goto ask;
      }
 
-     /* Allocation of a new entry in the cache */
-     status = cache_inode_new_entry(object_handle,
-				    CACHE_INODE_FLAG_NONE,
-				    entry);
+     lif = gsh_malloc(sizeof(struct lookup_inflight) + namesize);
+     if (lif != NULL) {
+          memset(lif, 0, sizeof(struct lookup_inflight));
+          lif->parent = parent;
+          lif->gen = gen;
+          lif->add_gen = add_gen;
+          lif->refcnt = 1;
+          memcpy(lif->name, name, namesize);
+          glist_add_tail(&part->q, &lif->q);
+     }
+     pthread_mutex_unlock(&part->mtx);
 
-     if (unlikely(! *entry))
-	     return status;
+ask:
+     LogDebug(COMPONENT_CACHE_INODE, "Cache Miss detected");
+     status = lookup_from_fsal(parent, name, req_ctx, entry);
 
-     /* Entry was found in the FSAL, add this entry to the
-	parent directory */
-     status = cache_inode_add_cached_dirent(parent, name, *entry, NULL);
-     if (status == CACHE_INODE_ENTRY_EXISTS)
-	     status = CACHE_INODE_SUCCESS;
+     if (status == CACHE_INODE_SUCCESS || status == CACHE_INODE_NOT_FOUND) {
+          PTHREAD_RWLOCK_wrlock(&parent->content_lock);
+          bool added = parent->object.dir.add_gen != add_gen;
+
+          if (parent->object.dir.gen == gen &&
+              !(added && !(parent->flags & CACHE_INODE_TRUST_CONTENT))) {
+               if (!(parent->flags & CACHE_INODE_TRUST_CONTENT)) {
+                    /* Empty it out and mark it valid in preparation
+                       for caching the result of this lookup. */
+                    cache_inode_invalidate_all_cached_dirent(parent);
+               }
+               (void) lookup_cache_result(parent, name, status, *entry,
+                                          !added);
+          }
+          PTHREAD_RWLOCK_unlock(&parent->content_lock);
+     }
+
+     if (lif == NULL)
+          return status;
+
+     pthread_mutex_lock(&part->mtx);
+     glist_del(&lif->q);
+     lif->done = true;
+     lif->status = status;
+     lif->entry = *entry;
+     if (*entry != NULL) {
+          /* One reference for each waiter to take away. */
+          for (refs = 1; refs < lif->refcnt; refs++)
+               cache_inode_lru_ref(*entry, LRU_FLAG_NONE);
+     }
+     refs = --lif->refcnt;
+     pthread_cond_broadcast(&part->cv);
+     pthread_mutex_unlock(&part->mtx);
+     if (refs == 0)
+          gsh_free(lif);
 
-out:
      return status;
 }
 
@@ -186,6 +498,10 @@ out:
  * Looks up for a name in a directory indicated by a cached entry. The
  * directory should have been cached before.
  *
+ * The content lock on the directory is only held for read while the
+ * dirent cache is consulted; on a miss the FSAL is asked with no
+ * lock held.
+ *
  * If a cache entry is returned, the refcount on entry is +1.
  *
  * @param[in]  parent  Entry for the parent directory to be managed.
@@ -202,27 +518,36 @@ cache_inode_lookup(cache_entry_t *parent,
                    struct req_op_context *req_ctx,
                    cache_entry_t **entry)
 {
-     fsal_accessflags_t access_mask
-          = (FSAL_MODE_MASK_SET(FSAL_X_OK) |
-             FSAL_ACE4_MASK_SET(FSAL_ACE_PERM_LIST_DIR));
      cache_inode_status_t status = CACHE_INODE_SUCCESS;
+     uint32_t gen, add_gen;
 
-     status = cache_inode_access(parent,
-				 access_mask,
-				 req_ctx);
+     status = lookup_access(parent, req_ctx);
 
      if (status != CACHE_INODE_SUCCESS) {
 	  *entry = NULL;
           return status;
      }
 
+     if (parent->type != DIRECTORY ||
+         strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+          PTHREAD_RWLOCK_rdlock(&parent->content_lock);
+          status = cache_inode_lookup_impl(parent,
+                                           name,
+                                           req_ctx,
+                                           entry);
+          PTHREAD_RWLOCK_unlock(&parent->content_lock);
+          return status;
+     }
+
      PTHREAD_RWLOCK_rdlock(&parent->content_lock);
-     status = cache_inode_lookup_impl(parent,
-                                     name,
-                                     req_ctx,
-                                     entry);
+     if (lookup_cached(parent, name, req_ctx, entry, &status)) {
+          PTHREAD_RWLOCK_unlock(&parent->content_lock);
+          return status;
+     }
+     gen = parent->object.dir.gen;
+     add_gen = parent->object.dir.add_gen;
      PTHREAD_RWLOCK_unlock(&parent->content_lock);
 
-     return status;
+     return lookup_miss(parent, name, gen, add_gen, req_ctx, entry);
 }
 /** @} */
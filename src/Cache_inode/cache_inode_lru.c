@@ -51,8 +51,10 @@
 #include "log.h"
 #include "cache_inode.h"
 #include "cache_inode_lru.h"
+#include "cache_inode_avl.h"
 #include "abstract_atomic.h"
 #include "cache_inode_hash.h"
+#include "cache_inode_arc.h"
 #include "gsh_intrinsic.h"
 #include "sal_functions.h"
 
@@ -67,11 +69,14 @@
  * @page LRUOverview LRU Overview
  *
  * This module implements a constant-time cache management strategy
- * based on LRU.  Some ideas are taken from 2Q [Johnson and Shasha 1994]
- * and MQ [Zhou, Chen, Li 2004].  In this system, cache management does
- * interact with cache entry lifecycle, but the lru queue is not a garbage
- * collector. Most imporantly, cache management operations execute in constant
- * time, as expected with LRU (and MQ).
+ * based on ARC [Megiddo and Modha 2003].  L1 holds entries referenced
+ * once recently, L2 entries referenced again after a correlated
+ * reference period, and ghost lists of recently evicted keys (see
+ * cache_inode_arc.h) adapt the share of the cache given to each.  In
+ * this system, cache management does interact with cache entry
+ * lifecycle, but the lru queue is not a garbage collector. Most
+ * imporantly, cache management operations execute in constant time,
+ * as expected with LRU (and ARC).
  *
  * Cache entries in use by a currently-active protocol request (or other
  * operation) have a positive refcount, and threfore should not be present
@@ -89,6 +94,20 @@
 
 struct lru_state lru_state;
 
+/**
+ * Approximate memory held by the cache, see cache_inode_mem_charge().
+ */
+
+struct cache_inode_mem_usage cache_inode_mem_usage;
+
+const char *cache_inode_mem_cat_names[CACHE_INODE_MEM_CATS] = {
+	[CACHE_INODE_MEM_ENTRY] = "entries",
+	[CACHE_INODE_MEM_HANDLE] = "handles",
+	[CACHE_INODE_MEM_DIRENT] = "dirents",
+	[CACHE_INODE_MEM_ACL] = "acls",
+	[CACHE_INODE_MEM_ATTR_BLOB] = "attr blobs"
+};
+
 /**
  * A single queue structure.
  */
@@ -130,25 +149,38 @@ struct lru_q_lane
 
 #define QLOCK(qlane) \
 	do { \
-	        pthread_mutex_lock(&(qlane)->mtx); \
+	        PROF_MUTEX_lock(&(qlane)->mtx); \
 		(qlane)->locktrace.func = (char*) __func__; \
 		(qlane)->locktrace.line = __LINE__; \
 	} while(0)
 
 #define QUNLOCK(qlane) \
-	pthread_mutex_unlock(&(qlane)->mtx)
+	PROF_MUTEX_unlock(&(qlane)->mtx)
 
 /**
- * A multi-level LRU algorithm inspired by MQ [Zhou].  Transition from
- * L1 to L2 implies various checks (open files, etc) have been
- * performed, so ensures they are performed only once.  A
- * correspondence to the "scan resistance" property of 2Q and MQ is
- * accomplished by recycling/clean loads onto the LRU of L1.  Async
- * processing onto L2 constrains oscillation in this algorithm.
+ * The ARC resident lists, split into lanes.  New entries go to the
+ * MRU of L1 and move to the MRU of L2 when referenced again more than
+ * LRU_CORRELATED_REF_PERIOD seconds later, so a burst of operations
+ * on one file (LOOKUP, GETATTR, OPEN...) counts as a single use.
+ * Scans (LRU_REQ_SCAN) never promote.  Victims come from L1 while it
+ * is larger than its adaptive target, otherwise from L2.
  */
 
 static struct lru_q_lane LRU[LRU_N_Q_LANES];
 
+/**
+ * Ghost lists and L1 target size
+ */
+
+static struct lru_arc lru_arc;
+
+/**
+ * References to an L1 entry within this many seconds of its
+ * admission are considered correlated and do not promote it.
+ */
+
+#define LRU_CORRELATED_REF_PERIOD 1
+
 /**
  * This is a global counter of files opened by cache_inode.  This is
  * preliminary expected to go away.  Problems with this method are
@@ -369,6 +401,7 @@ cache_inode_lru_clean(cache_entry_t *entry)
 {
      cache_inode_status_t cache_status = CACHE_INODE_SUCCESS;
      fsal_status_t fsal_status = {0, 0};
+     int cat;
 
      if (is_open(entry)) {
           cache_status = cache_inode_close(entry,
@@ -381,8 +414,14 @@ cache_inode_lru_clean(cache_entry_t *entry)
           }
      }
 
+     cache_inode_attr_blobs_release(entry);
+
      if (entry->type == DIRECTORY) {
              cache_inode_release_dirents(entry, CACHE_INODE_AVL_BOTH);
+             if (entry->object.dir.parent.kv.len != 0)
+                     cache_inode_key_delete(&entry->object.dir.parent);
+     } else if (entry->type == REGULAR_FILE) {
+             pthread_spin_destroy(&entry->object.file.ra.lock);
      }
 
      /* Free FSAL resources */
@@ -397,6 +436,10 @@ cache_inode_lru_clean(cache_entry_t *entry)
 	  entry->obj_handle = NULL;
      }
 
+     /* Nothing left to account for */
+     for (cat = 0; cat < CACHE_INODE_MEM_CATS; cat++)
+          cache_inode_mem_discharge(entry, cat, entry->mem_charged[cat]);
+
      /* Finalize last bits of the cache entry */
      cache_inode_key_delete(&entry->fh_hk.key);
      pthread_rwlock_destroy(&entry->content_lock);
@@ -481,6 +524,11 @@ lru_reap_impl(enum lru_q_id qid)
                             if (LRU_ENTRY_RECLAIMABLE(entry, refcnt)) {
 				    /* it worked */
 				    struct lru_q *q = lru_queue_of(entry);
+
+				    lru_arc_remember(&lru_arc,
+						     entry->fh_hk.key.hk,
+						     (qid == LRU_ENTRY_L1) ?
+						     LRU_ARC_B1 : LRU_ARC_B2);
                                     cih_remove_latched(entry, &latch,
                                                        CIH_REMOVE_QLOCKED);
 				    glist_del(&lru->q);
@@ -512,21 +560,58 @@ out:
      return (lru);
 }
 
+/**
+ * @brief Total number of entries in L1
+ *
+ * Lane sizes are read without the lane locks, this is a heuristic.
+ */
+
+static inline uint64_t
+lru_l1_size(void)
+{
+     uint64_t size = 0;
+     uint32_t lane;
+
+     for (lane = 0; lane < LRU_N_Q_LANES; ++lane)
+          size += LRU[lane].L1.size;
+
+     return (size);
+}
+
+/**
+ * @brief Take a victim where ARC says to
+ *
+ * @return A reclaimed entry, or NULL.
+ */
+
 static inline cache_inode_lru_t *
-lru_try_reap_entry(void)
+lru_reap_victim(void)
 {
      cache_inode_lru_t *lru;
 
-     if (lru_state.entries_used < lru_state.entries_hiwat)
-	     return (NULL);
-
-     lru = lru_reap_impl(LRU_ENTRY_L2);
-     if (! lru)
+     if (lru_arc_reap_l1(&lru_arc, lru_l1_size())) {
           lru = lru_reap_impl(LRU_ENTRY_L1);
+          if (! lru)
+               lru = lru_reap_impl(LRU_ENTRY_L2);
+     } else {
+          lru = lru_reap_impl(LRU_ENTRY_L2);
+          if (! lru)
+               lru = lru_reap_impl(LRU_ENTRY_L1);
+     }
 
      return (lru);
 }
 
+static inline cache_inode_lru_t *
+lru_try_reap_entry(void)
+{
+     if ((lru_state.entries_used < lru_state.entries_hiwat) &&
+         !cache_inode_mem_over_budget())
+	     return (NULL);
+
+     return (lru_reap_victim());
+}
+
 /**
  * @brief Push a cache_inode_killed entry to the cleanup queue
  * for out-of-line cleanup
@@ -617,6 +702,105 @@ cache_inode_lru_cleanup(void)
     return (n_finalized);
 }
 
+/**
+ * @brief Number of directories examined per lane lock hold
+ */
+#define LRU_TRIM_BATCH 16
+
+/**
+ * @brief Bring the cache back under Cache_Memory_Budget
+ *
+ * A directory with a large dirent cache can cost as much as
+ * thousands of files, so the cached dirents of cold directories (L2
+ * before L1) are dropped first.  The directories stay cached and
+ * trusted, they just go back to asking the FSAL and are repopulated
+ * by the next readdir.  If that is not enough, cold entries are
+ * reaped outright.  Either way, no more than biggest_window entries
+ * are touched per run.
+ *
+ * @return Number of entries trimmed or reaped.
+ */
+
+static size_t
+lru_trim_to_budget(void)
+{
+     /* Stop a little below the budget so we don't run every time */
+     uint64_t target = nfs_param.cache_param.mem_budget -
+          nfs_param.cache_param.mem_budget / 10;
+     cache_entry_t *batch[LRU_TRIM_BATCH];
+     cache_inode_lru_t *lru;
+     size_t work = 0;
+     int n, i;
+     uint32_t lane;
+     enum lru_q_id qid;
+
+     if (!cache_inode_mem_over_budget())
+          return 0;
+
+     for (qid = LRU_ENTRY_L2; ; qid = LRU_ENTRY_L1) {
+          for (lane = 0; lane < LRU_N_Q_LANES; ++lane) {
+               struct lru_q_lane *qlane = &LRU[lane];
+               struct lru_q *q = (qid == LRU_ENTRY_L1) ?
+                    &qlane->L1 : &qlane->L2;
+               struct glist_head *glist;
+
+               if (cache_inode_mem_total() <= target)
+                    goto out;
+
+               /* Take references on a batch of directories with
+                  cached dirents, then work on them unlocked. */
+               n = 0;
+               QLOCK(qlane);
+               glist_for_each(glist, &q->q) {
+                    cache_entry_t *entry;
+
+                    lru = glist_entry(glist, cache_inode_lru_t, q);
+                    entry = container_of(lru, cache_entry_t, lru);
+                    if (entry->type != DIRECTORY ||
+                        entry->mem_charged[CACHE_INODE_MEM_DIRENT] == 0)
+                         continue;
+                    atomic_inc_int32_t(&lru->refcnt);
+                    batch[n++] = entry;
+                    if (n == LRU_TRIM_BATCH)
+                         break;
+               }
+               QUNLOCK(qlane);
+
+               for (i = 0; i < n; i++) {
+                    /* Don't wait behind a busy directory */
+                    if (pthread_rwlock_trywrlock(
+                             &batch[i]->content_lock) == 0) {
+                         cache_inode_release_dirents(batch[i],
+                                                     CACHE_INODE_AVL_BOTH);
+                         pthread_rwlock_unlock(&batch[i]->content_lock);
+                         ++work;
+                    }
+                    cache_inode_lru_unref(batch[i], LRU_FLAG_NONE);
+               }
+          }
+          if (qid == LRU_ENTRY_L1)
+               break;
+     }
+
+     /* Still over, give up cold entries */
+     while ((work < lru_state.biggest_window) &&
+            (cache_inode_mem_total() > target)) {
+          cache_entry_t *entry;
+
+          lru = lru_reap_victim();
+          if (!lru)
+               break;
+          entry = container_of(lru, cache_entry_t, lru);
+          cache_inode_lru_clean(entry);
+          pool_free(cache_inode_entry_pool, entry);
+          atomic_dec_int64_t(&lru_state.entries_used);
+          ++work;
+     }
+
+out:
+     return work;
+}
+
 /**
  * @brief Function that executes in the lru thread
  *
@@ -635,13 +819,11 @@ cache_inode_lru_cleanup(void)
  *
  *  - If the number of open FDs is between the low and high water
  *    mark, make one pass through the queues, and exit.  Each pass
- *    consists of taking an entry from L1, examining to see if it is a
- *    regular file not bearing state with an open FD, closing the open
- *    FD if it is, and then moving it to L2.  The advantage of the two
- *    level system is twofold: First, seldom used entries congregate
- *    in L2 and the promotion behaviour provides some scan
- *    resistance.  Second, once an entry is examined, it is moved to
- *    L2, so we won't examine the same cache entry repeatedly.
+ *    walks L1 and then L2 from the LRU end, closing the FD of each
+ *    regular file not bearing state that has one.  Entries are left
+ *    where they are, since their position is the ARC policy's
+ *    business; those without an open FD are skipped without dropping
+ *    the lane lock.
  *
  *  - If the number of open FDs is greater than the high water mark,
  *    we consider ourselves to be in extremis.  In this case we make a
@@ -769,9 +951,10 @@ lru_run(struct fridgethr_context *ctx)
 		    cache_entry_t *entry;
 		    /* Current queue lane */
 		    struct lru_q_lane *qlane = &LRU[lane];
-		    /* safe lane traversal */
+		    /* lane traversal */
 		    struct glist_head  *glist;
-		    struct glist_head  *glistn;
+		    /* queue being traversed */
+		    enum lru_q_id qid;
 
 		    LogDebug(COMPONENT_CACHE_INODE_LRU,
 			     "Reaping up to %d entries from lane %zd",
@@ -785,32 +968,37 @@ lru_run(struct fridgethr_context *ctx)
 				 workpass, closed, totalclosed);
 
 		    QLOCK(qlane);
-		    while ((workdone < lru_state.per_lane_work) &&
-			   (!glist_empty(&LRU[lane].L1.q))) {
-			 /* In hindsight, it's really important to avoid
-			  * restarts. */
-			    glist_for_each_safe(glist, glistn,
-						&LRU[lane].L1.q) {
-				    uint32_t refcnt;
-				    struct lru_q *q;
-
-				    /* recheck per-lane work */
-				    if (workdone >= lru_state.per_lane_work) {
-					    break;
-				    }
-
+		    /* Entries seen only once are the least likely to
+		       need their descriptor again, start with L1. */
+		    for (qid = LRU_ENTRY_L1; ;
+			 qid = LRU_ENTRY_L2) {
+			    struct lru_q *q = (qid == LRU_ENTRY_L1) ?
+				    &qlane->L1 : &qlane->L2;
+			    /* Entries looked at, open or not. */
+			    size_t visited = 0;
+
+			    glist = q->q.next;
+			    while ((glist != &q->q) &&
+				   (workdone < lru_state.per_lane_work) &&
+				   (visited++ < lru_state.biggest_window)) {
 				    lru = glist_entry(glist,
 						      cache_inode_lru_t, q);
+				    entry = container_of(lru, cache_entry_t,
+							 lru);
+
+				    /* Entries stay where ARC put them, so
+				     * skip the ones with nothing to close
+				     * rather than moving them along. */
+				    if (!is_open(entry)) {
+					    glist = glist->next;
+					    continue;
+				    }
 
 				    /* Drop the lane lock while performing
 				     * (slow) operations on entry */
 				    atomic_inc_int32_t(&lru->refcnt);
 				    QUNLOCK(qlane);
 
-				    /* Need the entry */
-				    entry = container_of(lru, cache_entry_t,
-							 lru);
-
 				    /* Acquire the content lock first; we may
 				     * need to look at fds and close it. */
 				    pthread_rwlock_wrlock(&entry->content_lock);
@@ -833,38 +1021,21 @@ lru_run(struct fridgethr_context *ctx)
 				    }
 				    pthread_rwlock_unlock(&entry->content_lock);
 
-				    /* We did the (slow) cache entry ops
-				     * unlocked, recheck lru before moving it
-				     * to L2. */
 				    QLOCK(qlane);
+				    ++workdone;
 
-				    /* Yes, we must recheck this. */
-				    refcnt = atomic_fetch_int32_t(&entry->lru.refcnt);
+				    /* We did the (slow) cache entry ops
+				     * unlocked.  Our reference kept the entry,
+				     * but if it left this queue, so do we. */
+				    glist = (lru->qid == qid) ?
+					    lru->q.next : &q->q;
 
 				    /* Safely decrement refcnt. */
 				    cache_inode_lru_unref(entry, LRU_UNREF_QLOCKED);
-
-				    /* Since we dropped the lane mutex, recheck
-				     * that the entry hasn't moved or been recycled. */
-				    if (unlikely((lru->qid != LRU_ENTRY_L1) ||
-						 (refcnt == 1))) {
-					    workdone++; /* but count it */
-					    /* qlane LOCKED */
-					    continue;
-				    }
-
-				    /* Move entry to MRU of L2 */
-				    q = &qlane->L1;
-				    glist_del(&lru->q);
-				    --(q->size);
-				    lru->qid = LRU_ENTRY_L2;
-				    q = &qlane->L2;
-				    glist_add(&q->q, &lru->q);
-				    ++(q->size);
-
-				    ++workdone;
-			    } /* for_each_safe lru */
-		    } /* while (workdone < per-lane work) */
+			    } /* while (workdone < per-lane work) */
+			    if (qid == LRU_ENTRY_L2)
+				    break;
+		    }
 
 		    QUNLOCK(qlane);
 		    LogDebug(COMPONENT_CACHE_INODE_LRU,
@@ -930,6 +1101,29 @@ lru_run(struct fridgethr_context *ctx)
 	      "threadwait=%"PRIu64"\n",
 	      open_fd_count, lru_state.entries_used, fdratepersec,
 	      threadwait);
+     LogDebug(COMPONENT_CACHE_INODE_LRU,
+	      "ARC: L1 target=%"PRIu64" L1=%"PRIu64" ghosts B1=%"PRIu64
+	      " B2=%"PRIu64" ghost hits B1=%"PRIu64" B2=%"PRIu64,
+	      lru_arc.p, lru_l1_size(),
+	      lru_arc.nghost[LRU_ARC_B1], lru_arc.nghost[LRU_ARC_B2],
+	      lru_arc.hits[LRU_ARC_B1], lru_arc.hits[LRU_ARC_B2]);
+     LogDebug(COMPONENT_CACHE_INODE_LRU,
+	      "Negative dirents: hits=%"PRIu64" misses=%"PRIu64
+	      " inserts=%"PRIu64,
+	      neg_dirent_stats.hits, neg_dirent_stats.misses,
+	      neg_dirent_stats.inserts);
+     LogDebug(COMPONENT_CACHE_INODE_LRU,
+	      "Readahead: streams=%"PRIu64" prefetches=%"PRIu64
+	      " bytes=%"PRIu64" stream reads=%"PRIu64" hits=%"PRIu64,
+	      cache_inode_ra_stats.streams, cache_inode_ra_stats.prefetches,
+	      cache_inode_ra_stats.prefetch_bytes, cache_inode_ra_stats.reads,
+	      cache_inode_ra_stats.hits);
+     LogDebug(COMPONENT_CACHE_INODE_LRU,
+	      "Attribute blobs: hits=%"PRIu64" misses=%"PRIu64
+	      " stores=%"PRIu64,
+	      cache_inode_attr_blob_stats.hits,
+	      cache_inode_attr_blob_stats.misses,
+	      cache_inode_attr_blob_stats.stores);
      LogFullDebug(COMPONENT_CACHE_INODE_LRU,
 		  "currentopen=%zd futility=%d totalwork=%zd "
 		  "biggest_window=%d extremis=%d lanes=%d "
@@ -938,6 +1132,23 @@ lru_run(struct fridgethr_context *ctx)
 		  totalwork, lru_state.biggest_window, extremis,
 		  LRU_N_Q_LANES, lru_state.fds_lowat);
 
+     if (nfs_param.cache_param.mem_budget != 0) {
+	  size_t trimmed = lru_trim_to_budget();
+
+	  if (trimmed != 0)
+	       LogDebug(COMPONENT_CACHE_INODE_LRU,
+			"Over memory budget, trimmed %zu entries",
+			trimmed);
+     }
+     LogDebug(COMPONENT_CACHE_INODE_LRU,
+	      "Memory: entries=%"PRIu64" handles=%"PRIu64
+	      " dirents=%"PRIu64" acls=%"PRIu64" budget=%"PRIu64,
+	      cache_inode_mem_bytes(CACHE_INODE_MEM_ENTRY),
+	      cache_inode_mem_bytes(CACHE_INODE_MEM_HANDLE),
+	      cache_inode_mem_bytes(CACHE_INODE_MEM_DIRENT),
+	      cache_inode_mem_bytes(CACHE_INODE_MEM_ACL),
+	      nfs_param.cache_param.mem_budget);
+
      /* Process LRU cleanup queue */
      n_finalized = cache_inode_lru_cleanup();
 
@@ -1057,6 +1268,15 @@ cache_inode_lru_pkginit(void)
      /* init queue complex */
      lru_init_queues();
 
+     /* ghost lists sized to the cache */
+     code = lru_arc_init(&lru_arc, lru_state.entries_hiwat);
+     if (code != 0) {
+          LogMajor(COMPONENT_CACHE_INODE_LRU,
+                   "Unable to allocate LRU ghost lists, error code %d.",
+                   code);
+	  return code;
+     }
+
      /* spawn LRU background thread */
      code = fridgethr_init(&lru_fridge,
 			   "LRU Thread",
@@ -1181,16 +1401,143 @@ cache_inode_lru_get(cache_entry_t **entry)
      nentry->lru.refcnt = 2;
      nentry->lru.pin_refcnt = 0;
      nentry->lru.cf = 0;
+     nentry->lru.admitted = time(NULL);
 
-     /* Enqueue. */
+     /* Enqueue at the MRU of L1, cache_inode_lru_admit may move it
+	to L2 once the key is known. */
      lane = lru_lane_of_entry(nentry);
-     lru_insert_entry(nentry, &LRU[lane].L1, lane, LRU_HEAD);
+     lru_insert_entry(nentry, &LRU[lane].L1, lane, LRU_TAIL);
 
 out:
      *entry = nentry;
      return (status);
 }
 
+/**
+ * @brief Consult the ghost lists for a newly keyed entry
+ *
+ * An entry whose key was evicted recently is being reloaded, which
+ * ARC takes as proof it is used repeatedly: the L1 target adapts and
+ * the entry goes straight to the MRU of L2.
+ *
+ * @param[in] entry The entry, just returned by cache_inode_lru_get and
+ *                  given its key
+ */
+void
+cache_inode_lru_admit(cache_entry_t *entry)
+{
+     cache_inode_lru_t *lru = &entry->lru;
+     struct lru_q_lane *qlane = &LRU[lru->lane];
+     struct lru_q *q;
+
+     if (lru_arc_admit(&lru_arc, entry->fh_hk.key.hk) == LRU_ARC_MISS)
+          return;
+
+     QLOCK(qlane);
+     if (lru->qid == LRU_ENTRY_L1) {
+          q = &qlane->L1;
+          glist_del(&lru->q);
+          --(q->size);
+          lru->qid = LRU_ENTRY_L2;
+          q = &qlane->L2;
+          glist_add_tail(&q->q, &lru->q);
+          ++(q->size);
+     }
+     QUNLOCK(qlane);
+}
+
+/**
+ * @brief Visit the hottest entries of each lane
+ *
+ * Each lane is visited under its lock, pinned entries first, then L2
+ * and L1, each from MRU to LRU, until max_per_lane entries have been
+ * visited or visit returns false.  Entries not yet (or no longer) in
+ * the hash table are skipped, their keys may not be set.
+ *
+ * The visitor is called with the lane LOCKED, so it must not take a
+ * reference on the entry or block on any of its locks.
+ *
+ * @param[in] max_per_lane Most entries to visit in a lane
+ * @param[in] visit        Called for each entry with the queue it
+ *                         should be restored to (pinned entries
+ *                         count as L2) and its rank in the lane, 0
+ *                         being the hottest.  Returns false to
+ *                         stop the walk.
+ * @param[in] arg          Passed to visit
+ */
+void
+cache_inode_lru_walk_hot(uint32_t max_per_lane,
+                         bool (*visit)(cache_entry_t *entry,
+                                       enum lru_q_id qid,
+                                       uint32_t rank,
+                                       void *arg),
+                         void *arg)
+{
+     uint32_t lane;
+     uint32_t rank;
+     int ix;
+
+     for (lane = 0; lane < LRU_N_Q_LANES; ++lane) {
+          struct lru_q_lane *qlane = &LRU[lane];
+          struct lru_q *qs[] = {&qlane->pinned, &qlane->L2, &qlane->L1};
+          struct glist_head *glist;
+          cache_entry_t *entry;
+          bool more = true;
+
+          rank = 0;
+          QLOCK(qlane);
+          for (ix = 0; ix < 3 && more && rank < max_per_lane; ++ix) {
+               glist_for_each_prev(glist, &qs[ix]->q) {
+                    entry = container_of(glist, cache_entry_t, lru.q);
+                    if (!entry->fh_hk.inavl)
+                         continue;
+                    more = visit(entry,
+                                 (qs[ix]->id == LRU_ENTRY_L1) ?
+                                 LRU_ENTRY_L1 : LRU_ENTRY_L2,
+                                 rank, arg);
+                    if (!more || ++rank == max_per_lane)
+                         break;
+               }
+          }
+          QUNLOCK(qlane);
+          if (!more)
+               return;
+     }
+}
+
+/**
+ * @brief Put an entry back on the queue it was on before a restart
+ *
+ * A reloaded entry starts at the MRU of L1 like any other.  One that
+ * was in L2 is moved to the MRU of L2, so the frequency it earned
+ * before the restart is kept.
+ *
+ * @param[in] entry A referenced entry
+ * @param[in] qid   LRU_ENTRY_L1 or LRU_ENTRY_L2
+ */
+void
+cache_inode_lru_restore(cache_entry_t *entry, enum lru_q_id qid)
+{
+     cache_inode_lru_t *lru = &entry->lru;
+     struct lru_q_lane *qlane = &LRU[lru->lane];
+     struct lru_q *q;
+
+     if (qid != LRU_ENTRY_L2)
+          return;
+
+     QLOCK(qlane);
+     if (lru->qid == LRU_ENTRY_L1) {
+          q = &qlane->L1;
+          glist_del(&lru->q);
+          --(q->size);
+          lru->qid = LRU_ENTRY_L2;
+          q = &qlane->L2;
+          glist_add_tail(&q->q, &lru->q);
+          ++(q->size);
+     }
+     QUNLOCK(qlane);
+}
+
 /**
  * @brief Function to let the state layer pin an entry
  *
@@ -1314,10 +1661,11 @@ bool cache_inode_is_pinned(cache_entry_t *entry)
  * path, hence does not influence LRU, and is lockless.
  *
  * A flags value of LRU_REQ_INITIAL indicates an ordinary initial reference,
- * and strongly influences LRU.  LRU_REQ_SCAN indicates a scan reference
- * (currently, READDIR) and weakly influences LRU.  Ascan reference should not
- * be taken by call paths which may open a file descriptor.  In both cases, the
- * L1->L2 boundary is sticky (scan resistence).
+ * and strongly influences LRU: it promotes an L1 entry to L2 once the
+ * correlated reference period has passed.  LRU_REQ_SCAN indicates a scan
+ * reference (currently, READDIR) and weakly influences LRU.  Ascan reference
+ * should not be taken by call paths which may open a file descriptor.  A scan
+ * never promotes (scan resistence).
  *
  * @retval CACHE_INODE_SUCCESS if the reference was acquired
  */
@@ -1333,6 +1681,26 @@ cache_inode_lru_ref(cache_entry_t *entry, uint32_t flags)
 		struct lru_q_lane *qlane = &LRU[lru->lane];
 		struct lru_q *q;
 
+		/* Promotion out of L1 is what ARC learns from, so it is
+		   not rate limited.  Scans never promote. */
+		if ((lru->qid == LRU_ENTRY_L1) && (flags & LRU_REQ_INITIAL) &&
+		    ((uint32_t) time(NULL) - lru->admitted >
+		     LRU_CORRELATED_REF_PERIOD)) {
+			QLOCK(qlane);
+			if (lru->qid == LRU_ENTRY_L1) {
+				/* move entry to MRU of L2 */
+				q = &qlane->L1;
+				glist_del(&lru->q);
+				--(q->size);
+				lru->qid = LRU_ENTRY_L2;
+				q = &qlane->L2;
+				glist_add_tail(&q->q, &lru->q);
+				++(q->size);
+			}
+			QUNLOCK(qlane);
+			goto out;
+		}
+
 		/* do it less */
                 if ((atomic_inc_int32_t(&entry->lru.cf) % 3) != 0)
 			goto out;
@@ -1344,36 +1712,21 @@ cache_inode_lru_ref(cache_entry_t *entry, uint32_t flags)
 			/* do nothing */
 			break;
 		case LRU_ENTRY_L1:
-			q = lru_queue_of(entry);
-			if (flags & LRU_REQ_INITIAL) {
-				/* advance entry to MRU (of L1) */
-				glist_del(&lru->q);
-				glist_add_tail(&q->q, &lru->q);
-			} else {
-				/* do not advance entry in L1 on LRU_REQ_SCAN
-				 * (scan resistence) */                    
-			}
-			break;
 		case LRU_ENTRY_L2:
 			q = lru_queue_of(entry);
 			if (flags & LRU_REQ_INITIAL) {
-				/* move entry to LRU of L1 */
-				glist_del(&lru->q);
-				--(q->size);
-				lru->qid = LRU_ENTRY_L1;
-				q = &qlane->L1;
-				glist_add(&q->q, &lru->q);
-				++(q->size);
-			} else {
-				/* advance entry to MRU of L2 */
+				/* advance entry to MRU (of its queue) */
 				glist_del(&lru->q);
 				glist_add_tail(&q->q, &lru->q);
+			} else {
+				/* do not advance entry on LRU_REQ_SCAN
+				 * (scan resistence) */
 			}
 			break;
 		default:
 			/* can't happen */
 			abort();
-			break;               
+			break;
 		} /* switch qid */
 		QUNLOCK(qlane);
 	} /* initial ref */
@@ -302,13 +302,23 @@ cache_inode_new_entry(struct fsal_obj_handle *new_obj,
      /* Set cache key */
      cih_hash_entry(nentry, &fh_desc, CIH_HASH_NONE);
 
+     /* Recently evicted keys come back to L2 */
+     cache_inode_lru_admit(nentry);
+
      /* Set export id (unhashed, uncompared key component) */
      nentry->fh_hk.key.exportid = new_obj->export->exp_entry->id;
 
      /* Initialize common fields */
      nentry->type = new_obj->type;
      nentry->flags = 0;
+     memset(nentry->mem_charged, 0, sizeof(nentry->mem_charged));
+     cache_inode_attr_blobs_init(nentry);
+     cache_inode_mem_charge(nentry, CACHE_INODE_MEM_ENTRY,
+                            sizeof(cache_entry_t) + fh_desc.len);
+     cache_inode_mem_charge(nentry, CACHE_INODE_MEM_HANDLE,
+                            sizeof(struct fsal_obj_handle) + fh_desc.len);
      init_glist(&nentry->state_list);
+     state_index_init(nentry);
      init_glist(&nentry->layoutrecall_list);
 
      switch (nentry->type) {
@@ -323,6 +333,7 @@ cache_inode_new_entry(struct fsal_obj_handle *new_obj,
 
           memset(&nentry->object.file.share_state, 0,
 		 sizeof(cache_inode_share_t));
+          cache_inode_readahead_init(nentry);
 	  break;
      
      case DIRECTORY:
@@ -341,7 +352,13 @@ cache_inode_new_entry(struct fsal_obj_handle *new_obj,
           }
 	  
           nentry->object.dir.avl.collisions = 0;
+          nentry->object.dir.avl.nneg = 0;
+          nentry->object.dir.gen = 0;
+          nentry->object.dir.add_gen = 0;
           nentry->object.dir.nbactive = 0;
+          /* Not known until the first lookupp */
+          nentry->object.dir.parent.kv.len = 0;
+          nentry->object.dir.parent.kv.addr = NULL;
           /* init avl tree */
           cache_inode_avl_init(nentry);
           break;
@@ -630,15 +647,22 @@ void cache_inode_release_dirents(cache_entry_t *entry,
     case CACHE_INODE_AVL_BOTH:
         cache_inode_release_dirents(entry, CACHE_INODE_AVL_NAMES);
         cache_inode_release_dirents(entry, CACHE_INODE_AVL_COOKIES);
+        cache_inode_release_dirents(entry, CACHE_INODE_AVL_NEGATIVE);
         /* tree == NULL */
         break;
 
+    case CACHE_INODE_AVL_NEGATIVE:
+        tree = &entry->object.dir.avl.neg;
+        entry->object.dir.avl.nneg = 0;
+        break;
+
     default:
         /* tree == NULL */
         break;
     }
 
     if (tree) {
+          atomic_inc_uint32_t(&entry->object.dir.gen);
           dirent_node = avltree_first(tree);
 
           while( dirent_node )
@@ -648,6 +672,8 @@ void cache_inode_release_dirents(cache_entry_t *entry,
                                            cache_inode_dir_entry_t,
                                            node_hk);
              avltree_remove(dirent_node, tree);
+             cache_inode_mem_discharge(entry, CACHE_INODE_MEM_DIRENT,
+                                       cache_inode_dirent_footprint(dirent));
              gsh_free(dirent);
              dirent_node = next_dirent_node;
            }
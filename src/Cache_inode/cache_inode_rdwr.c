@@ -50,6 +50,191 @@
 #include <time.h>
 #include <pthread.h>
 #include <assert.h>
+#include "abstract_atomic.h"
+
+struct cache_inode_ra_stats cache_inode_ra_stats;
+
+/** Reads further apart than this are never taken for a stride */
+#define RA_MAX_STRIDE (16 * 1024 * 1024)
+
+/** Reads that must continue a stream before we read ahead */
+#define RA_MIN_HITS 2
+
+/** Smallest window read ahead of a new stream */
+#define RA_MIN_WINDOW (128 * 1024)
+
+/** Most records of a strided stream read ahead at once */
+#define RA_MAX_RECORDS 8
+
+/**
+ * @brief Set up readahead state for a new regular file
+ *
+ * @param[in] entry The file
+ */
+
+void
+cache_inode_readahead_init(cache_entry_t *entry)
+{
+    struct cache_inode_readahead *ra = &entry->object.file.ra;
+
+    pthread_spin_init(&ra->lock, PTHREAD_PROCESS_PRIVATE);
+    ra->clock = 0;
+    memset(ra->s, 0, sizeof(ra->s));
+}
+
+/**
+ * @brief Find the stream a read belongs to
+ *
+ * A read continues a stream if it starts where the stream's next read
+ * is expected: right after the last one for a sequential stream, one
+ * stride after it for a strided one.  A young stream that has not
+ * continued yet becomes strided if the read lands a little way past
+ * it.  Otherwise the read starts a new stream in the least recently
+ * used slot.
+ *
+ * @param[in,out] ra     Readahead state, locked
+ * @param[in]     offset Start of the read
+ * @param[in]     len    Length of the read
+ *
+ * @return The continued stream, or NULL if the read started a new one.
+ */
+
+static struct cache_inode_ra_stream *
+ra_match(struct cache_inode_readahead *ra, uint64_t offset, size_t len)
+{
+    struct cache_inode_ra_stream *s, *cand = NULL, *victim = NULL;
+    uint64_t next;
+    int i;
+
+    for (i = 0; i < CACHE_INODE_RA_STREAMS; i++) {
+        s = &ra->s[i];
+        if (s->len == 0) {
+            if (victim == NULL || victim->len != 0)
+                victim = s;
+            continue;
+        }
+        next = s->last + (s->stride ? s->stride : s->len);
+        if (offset == next)
+            return s;
+        if (s->hits == 0 && offset > s->last + s->len &&
+            offset - s->last <= RA_MAX_STRIDE &&
+            (cand == NULL || s->used > cand->used))
+            cand = s;
+        if (victim == NULL ||
+            (victim->len != 0 && s->used < victim->used))
+            victim = s;
+    }
+
+    if (cand != NULL) {
+        cand->stride = offset - cand->last;
+        return cand;
+    }
+
+    memset(victim, 0, sizeof(*victim));
+    victim->last = offset;
+    victim->len = len;
+    victim->used = ra->clock;
+    return NULL;
+}
+
+/**
+ * @brief Feed a completed READ to the stream detector
+ *
+ * Once a stream has continued RA_MIN_HITS times, the FSAL is asked to
+ * prefetch ahead of it.  A sequential stream keeps a window of data
+ * read ahead, topped up when the client has consumed half of it and
+ * doubled each time up to Readahead_Max.  A strided stream gets its
+ * next few records read ahead instead.
+ *
+ * Called with the content lock held for read and the file open.
+ *
+ * @param[in] entry  The file
+ * @param[in] offset Start of the read
+ * @param[in] len    Bytes read
+ * @param[in] eof    Whether the read hit end of file
+ */
+
+static void
+cache_inode_readahead(cache_entry_t *entry, uint64_t offset, size_t len,
+                      bool eof)
+{
+    struct cache_inode_readahead *ra = &entry->object.file.ra;
+    struct fsal_obj_handle *obj_hdl = entry->obj_handle;
+    struct cache_inode_ra_stream *s;
+    uint64_t ra_max = nfs_param.cache_param.readahead_max;
+    uint64_t from[RA_MAX_RECORDS], rec, end = offset + len;
+    size_t rlen[RA_MAX_RECORDS];
+    uint32_t nrec, n = 0, i;
+
+    if (ra_max == 0 || len == 0 || len > ra_max)
+        return;
+    if (ra_max > UINT32_MAX)
+        ra_max = UINT32_MAX;
+
+    pthread_spin_lock(&ra->lock);
+    ra->clock++;
+    s = ra_match(ra, offset, len);
+    if (s == NULL) {
+        pthread_spin_unlock(&ra->lock);
+        return;
+    }
+
+    s->hits++;
+    if (s->hits == RA_MIN_HITS) {
+        atomic_inc_uint64_t(&cache_inode_ra_stats.streams);
+        s->window = MAX(4 * len, RA_MIN_WINDOW);
+        s->window = MIN(s->window, ra_max);
+    }
+    if (s->hits > RA_MIN_HITS) {
+        atomic_inc_uint64_t(&cache_inode_ra_stats.reads);
+        if (end <= s->ra_end)
+            atomic_inc_uint64_t(&cache_inode_ra_stats.hits);
+    }
+    s->last = offset;
+    s->len = len;
+    s->used = ra->clock;
+
+    if (s->hits >= RA_MIN_HITS && !eof) {
+        if (s->stride == 0) {
+            if (s->ra_end < end)
+                s->ra_end = end;
+            if (s->ra_end - end <= s->window / 2) {
+                from[0] = s->ra_end;
+                rlen[0] = end + s->window - s->ra_end;
+                s->ra_end = end + s->window;
+                n = 1;
+                s->window = MIN(2 * (uint64_t)s->window, ra_max);
+            }
+        } else {
+            nrec = MAX(s->window / s->stride, 1);
+            nrec = MIN(nrec, RA_MAX_RECORDS);
+            if (s->ra_end <=
+                offset + (uint64_t)s->stride * ((nrec + 1) / 2)) {
+                for (i = 1; i <= nrec; i++) {
+                    rec = offset + (uint64_t)s->stride * i;
+                    if (rec + len <= s->ra_end)
+                        continue;
+                    from[n] = rec;
+                    rlen[n] = len;
+                    n++;
+                }
+                s->ra_end = offset + (uint64_t)s->stride * nrec + len;
+                s->window = MIN(2 * (uint64_t)s->window, ra_max);
+            }
+        }
+    }
+    pthread_spin_unlock(&ra->lock);
+
+    for (i = 0; i < n; i++) {
+        fsal_status_t fsal_status =
+            obj_hdl->ops->prefetch(obj_hdl, from[i], rlen[i]);
+
+        if (fsal_status.major == ERR_FSAL_NOTSUPP)
+            break;
+        atomic_inc_uint64_t(&cache_inode_ra_stats.prefetches);
+        atomic_add_uint64_t(&cache_inode_ra_stats.prefetch_bytes, rlen[i]);
+    }
+}
 
 /**
  * @brief Reads/Writes through the cache layer
@@ -63,7 +248,9 @@
  * @param[in]     offset       Absolute file position for I/O
  * @param[in]     io_size      Amount of data to be read or written
  * @param[out]    bytes_moved  The length of data successfuly read or written
- * @param[in,out] buffer       Where in memory to read or write data
+ * @param[in,out] buffer       Where in memory to read or write data, or
+ *                             for CACHE_INODE_READ_FD the int that
+ *                             receives the descriptor to send from
  * @param[out]    eof          Whether a READ encountered the end of file.  May
  *                             be NULL for writes.
  * @param[in]     req_ctx      FSAL credentials
@@ -99,12 +286,12 @@ cache_inode_rdwr(cache_entry_t *entry,
     cache_inode_status_t status = CACHE_INODE_SUCCESS;
 
     /* Set flags for a read or write, as appropriate */
-    if (io_direction == CACHE_INODE_READ) {
-        openflags = FSAL_O_READ;
-    } else {
+    if (io_direction == CACHE_INODE_WRITE) {
         openflags = FSAL_O_WRITE;
         if (*sync)
             openflags |= FSAL_O_SYNC;
+    } else {
+        openflags = FSAL_O_READ;
     }
 
     assert(obj_hdl != NULL);
@@ -151,6 +338,11 @@ cache_inode_rdwr(cache_entry_t *entry,
 					 buffer,
 					 bytes_moved,
 					 eof);
+    } else if (io_direction == CACHE_INODE_READ_FD) {
+	fsal_status = obj_hdl->ops->read_fd(obj_hdl, offset, io_size,
+					    (int *)buffer,
+					    bytes_moved,
+					    eof);
     } else {
 	bool fsal_sync = *sync;
 	fsal_status = obj_hdl->ops->write(obj_hdl, req_ctx,
@@ -199,7 +391,10 @@ cache_inode_rdwr(cache_entry_t *entry,
 	    goto out;
 	}
 
+	/* An FSAL without read_fd says so without anything wrong
+	   with the descriptor it has open. */
 	if ((fsal_status.major != ERR_FSAL_NOT_OPENED)
+	    && (fsal_status.major != ERR_FSAL_NOTSUPP)
 	    && (obj_hdl->ops->status(obj_hdl) != FSAL_O_CLOSED)) {
 	    cache_inode_status_t cstatus;
 
@@ -229,6 +424,9 @@ cache_inode_rdwr(cache_entry_t *entry,
 		 "bytes_moved=%zu, offset=%"PRIu64,
 		 io_size, *bytes_moved, offset);
 
+    if (io_direction != CACHE_INODE_WRITE)
+        cache_inode_readahead(entry, offset, *bytes_moved, *eof);
+
     if (opened) {
 	PTHREAD_RWLOCK_unlock(&entry->content_lock);
 	PTHREAD_RWLOCK_wrlock(&entry->content_lock);
@@ -257,6 +455,7 @@ cache_inode_rdwr(cache_entry_t *entry,
         }
     } else {
         cache_inode_set_time_current(&obj_hdl->attributes.atime);
+        entry->attr_gen++;
     }
     PTHREAD_RWLOCK_unlock(&entry->attr_lock);
     attributes_locked = false;
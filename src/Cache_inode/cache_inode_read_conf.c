@@ -77,6 +77,35 @@ int parse_cache_expire(cache_inode_expire_type_t *type, time_t *value, char *key
   return CACHE_INODE_SUCCESS;
 }
 
+/* Parse a byte count with an optional K, M or G suffix */
+static int parse_size(const char *key_name, const char *key_value,
+                      uint64_t *value)
+{
+  char *end;
+
+  *value = strtoull(key_value, &end, 10);
+  switch (*end)
+    {
+    case 'g': case 'G':
+      *value <<= 10;
+      /* fall through */
+    case 'm': case 'M':
+      *value <<= 10;
+      /* fall through */
+    case 'k': case 'K':
+      *value <<= 10;
+      end++;
+      break;
+    }
+  if(*end != '\0')
+    {
+      LogCrit(COMPONENT_CONFIG,
+              "Invalid %s \"%s\"", key_name, key_value);
+      return CACHE_INODE_INVALID_ARGUMENT;
+    }
+  return CACHE_INODE_SUCCESS;
+}
+
 /**
  * @brief Read the configuration for the Cache inode layer
  *
@@ -172,10 +201,30 @@ cache_inode_read_conf_parameter(config_file_t config,
         {
           param->getattr_dir_invalidation = StrToBoolean(key_value);
         }
+      else if(!strcasecmp(key_name, "Negative_Dirent_Expiration_Time"))
+        {
+          param->neg_dirent_ttl = atoi(key_value);
+        }
+      else if(!strcasecmp(key_name, "Negative_Dirents_Max"))
+        {
+          param->neg_dirent_max = atoi(key_value);
+        }
       else if(!strcasecmp(key_name, "Entries_HWMark"))
         {
           param->entries_hwmark = atoi(key_value);
         }
+      else if(!strcasecmp(key_name, "Readahead_Max"))
+        {
+          if(parse_size(key_name, key_value, &param->readahead_max)
+             != CACHE_INODE_SUCCESS)
+            return CACHE_INODE_INVALID_ARGUMENT;
+        }
+      else if(!strcasecmp(key_name, "Cache_Memory_Budget"))
+        {
+          if(parse_size(key_name, key_value, &param->mem_budget)
+             != CACHE_INODE_SUCCESS)
+            return CACHE_INODE_INVALID_ARGUMENT;
+        }
       else if(!strcasecmp(key_name, "LRU_Run_Interval"))
         {
           param->lru_run_interval = atoi(key_value);
@@ -212,6 +261,19 @@ cache_inode_read_conf_parameter(config_file_t config,
         {
           param->futility_count = atoi(key_value);
         }
+      else if(!strcasecmp(key_name, "Snapshot_File"))
+        {
+          gsh_free(param->snapshot_file);
+          param->snapshot_file = gsh_strdup(key_value);
+        }
+      else if(!strcasecmp(key_name, "Snapshot_Entries"))
+        {
+          param->snapshot_entries = atoi(key_value);
+        }
+      else if(!strcasecmp(key_name, "Snapshot_Interval"))
+        {
+          param->snapshot_interval = atoi(key_value);
+        }
      else if(!strcasecmp(key_name, "DebugLevel"))
         {
           DebugLevel = ReturnLevelAscii(key_value);
@@ -130,6 +130,9 @@ cache_inode_operate_cached_dirent(cache_entry_t *directory,
          goto out;
      }
 
+     if (dirent_op != CACHE_INODE_DIRENT_OP_LOOKUP)
+          atomic_inc_uint32_t(&directory->object.dir.gen);
+
      /* If no active entry, do nothing */
      if (directory->object.dir.nbactive == 0) {
        if (!((directory->flags & CACHE_INODE_TRUST_CONTENT) &&
@@ -168,6 +171,7 @@ cache_inode_operate_cached_dirent(cache_entry_t *directory,
          break;
 
      case CACHE_INODE_DIRENT_OP_RENAME:
+         cache_inode_avl_neg_remove(directory, newname);
          dirent2 = cache_inode_avl_qp_lookup_s(directory,
                                                newname, 1);
          if (dirent2) {
@@ -176,7 +180,13 @@ cache_inode_operate_cached_dirent(cache_entry_t *directory,
                  /* overwrite, replace entry and expire the old */
                  cache_entry_t *oldentry;
 		 avl_dirent_set_deleted(directory, dirent);
+                 cache_inode_mem_discharge(
+                      directory, CACHE_INODE_MEM_DIRENT,
+                      cache_inode_dirent_footprint(dirent2));
                  cache_inode_key_dup(&dirent2->ckey, &dirent->ckey);
+                 cache_inode_mem_charge(
+                      directory, CACHE_INODE_MEM_DIRENT,
+                      cache_inode_dirent_footprint(dirent2));
                  oldentry =
                      cache_inode_get_keyed(&dirent2->ckey, req_ctx,
                                            CIG_KEYED_FLAG_CACHED_ONLY);
@@ -207,6 +217,10 @@ cache_inode_operate_cached_dirent(cache_entry_t *directory,
                  avl_dirent_clear_deleted(directory, dirent);
                  /* dirent3 was never inserted */
                  gsh_free(dirent3);
+             } else {
+                 cache_inode_mem_charge(
+                      directory, CACHE_INODE_MEM_DIRENT,
+                      cache_inode_dirent_footprint(dirent3));
              }
          } /* !found */
          break;
@@ -258,6 +272,12 @@ cache_inode_add_cached_dirent(cache_entry_t *parent,
           return status;
      }
 
+     /* The name exists now.  dir.gen is left alone: an add makes no
+        cached answer stale.  dir.add_gen tells lookups that asked the
+        FSAL before this not to cache a negative answer. */
+     parent->object.dir.add_gen++;
+     cache_inode_avl_neg_remove(parent, name);
+
      /* in cache inode avl, we always insert on pentry_parent */
      new_dir_entry = gsh_malloc(sizeof(cache_inode_dir_entry_t) +
                                 namesize);
@@ -288,6 +308,8 @@ cache_inode_add_cached_dirent(cache_entry_t *parent,
 
      /* we're going to succeed */
      parent->object.dir.nbactive++;
+     cache_inode_mem_charge(parent, CACHE_INODE_MEM_DIRENT,
+                            cache_inode_dirent_footprint(new_dir_entry));
 
      return status;
 }
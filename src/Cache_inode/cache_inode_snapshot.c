@@ -0,0 +1,602 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/**
+ * @addtogroup Cache_inode
+ * @{
+ */
+
+/**
+ * @file cache_inode_snapshot.c
+ * @brief Warm the inode cache across a restart
+ *
+ * With Snapshot_File set, the keys of the hottest entries (the FSAL
+ * handle key and export id, the parent key of a directory, and the
+ * queue and position in the LRU) are written to a file at shutdown
+ * and, with Snapshot_Interval, every so often while running.  At
+ * startup a background thread reads the file back and looks every
+ * key up with cache_inode_get_keyed(), which calls create_handle() on
+ * the FSAL, coldest first so the hottest end at the MRU.  Entries
+ * that were in L2 are put back in L2.
+ *
+ * Nothing more is trusted from the snapshot than a handle would be
+ * from a client: a key the FSAL no longer knows is skipped, and the
+ * entries loaded are validated by the usual attribute expiry.  The
+ * reload stops once the cache reaches Entries_HWMark, so it never
+ * pushes out entries clients are already using.
+ *
+ * The file is in host byte order, and written to a temporary file
+ * renamed over the old one, so a crash while writing leaves the last
+ * snapshot in place.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "log.h"
+#include "abstract_mem.h"
+#include "fridgethr.h"
+#include "nfs_core.h"
+#include "cache_inode.h"
+#include "cache_inode_hash.h"
+#include "cache_inode_lru.h"
+
+/** "GSCS" */
+#define SNAP_MAGIC 0x47534353
+#define SNAP_VERSION 1
+
+/**
+ * @brief Snapshot file header
+ */
+
+struct snap_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t written; /*< Time the snapshot was taken */
+	uint32_t count; /*< Records following */
+	uint32_t reserved;
+};
+
+/**
+ * @brief A snapshot record, followed by the key and the parent key
+ */
+
+struct snap_record {
+	uint32_t exportid;
+	uint32_t parent_exportid;
+	uint32_t rank; /*< Position in its lane, 0 is the MRU */
+	uint16_t key_len;
+	uint16_t parent_len; /*< 0 if no parent is known */
+	uint8_t qid; /*< LRU_ENTRY_L1 or LRU_ENTRY_L2 */
+	uint8_t pad[3];
+};
+
+/**
+ * @brief Records being collected from the LRU
+ */
+
+struct snap_buf {
+	char *data;
+	size_t len;
+	size_t size;
+	size_t missed; /*< Bytes of records that did not fit */
+	uint32_t count;
+};
+
+static struct fridgethr *snap_fridge;
+
+/** Set once the snapshot has been reloaded */
+static bool snap_reloaded;
+
+/** Serializes writers of the snapshot file */
+static pthread_mutex_t snap_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t snap_max_entries(void)
+{
+	if (nfs_param.cache_param.snapshot_entries != 0)
+		return nfs_param.cache_param.snapshot_entries;
+	return nfs_param.cache_param.entries_hwmark;
+}
+
+/**
+ * @brief Grow the buffer to hold at least n bytes
+ *
+ * Never called with a lane locked.
+ */
+
+static bool snap_reserve(struct snap_buf *b, size_t n)
+{
+	size_t size = b->size ? b->size : 64 * 1024;
+	char *data;
+
+	if (n <= b->size)
+		return true;
+	while (size < n)
+		size *= 2;
+	data = gsh_realloc(b->data, size);
+	if (data == NULL)
+		return false;
+	b->data = data;
+	b->size = size;
+	return true;
+}
+
+/**
+ * @brief Copy an entry's keys into the snapshot
+ *
+ * Called with the entry's lane locked.  The parent key is changed
+ * under the content lock, which other paths take before a lane lock,
+ * so it is only tried for.  The buffer is not grown here; a record
+ * that does not fit is skipped and its size added to missed.
+ */
+
+static bool snap_visit(cache_entry_t *entry, enum lru_q_id qid,
+		       uint32_t rank, void *arg)
+{
+	struct snap_buf *b = arg;
+	cache_inode_key_t *key = &entry->fh_hk.key;
+	cache_inode_key_t *parent = NULL;
+	struct snap_record rec;
+	size_t n;
+	bool locked = false;
+
+	if (key->kv.len == 0 || key->kv.len > UINT16_MAX)
+		return true;
+
+	if (entry->type == DIRECTORY &&
+	    pthread_rwlock_tryrdlock(&entry->content_lock) == 0) {
+		locked = true;
+		if (entry->object.dir.parent.kv.len != 0 &&
+		    entry->object.dir.parent.kv.len <= UINT16_MAX)
+			parent = &entry->object.dir.parent;
+	}
+
+	memset(&rec, 0, sizeof(rec));
+	rec.exportid = key->exportid;
+	rec.rank = rank;
+	rec.key_len = key->kv.len;
+	rec.qid = qid;
+	if (parent != NULL) {
+		rec.parent_exportid = parent->exportid;
+		rec.parent_len = parent->kv.len;
+	}
+
+	n = sizeof(rec) + rec.key_len + rec.parent_len;
+	if (b->len + n > b->size) {
+		if (locked)
+			pthread_rwlock_unlock(&entry->content_lock);
+		b->missed += n;
+		return true;
+	}
+
+	memcpy(b->data + b->len, &rec, sizeof(rec));
+	b->len += sizeof(rec);
+	memcpy(b->data + b->len, key->kv.addr, rec.key_len);
+	b->len += rec.key_len;
+	if (parent != NULL) {
+		memcpy(b->data + b->len, parent->kv.addr, rec.parent_len);
+		b->len += rec.parent_len;
+	}
+	b->count++;
+
+	if (locked)
+		pthread_rwlock_unlock(&entry->content_lock);
+	return true;
+}
+
+static int snap_write_all(int fd, const void *data, size_t len)
+{
+	const char *p = data;
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * @brief Write a snapshot of the hottest cache entries
+ *
+ * @return 0 on success, POSIX errors on failure.
+ */
+
+int cache_inode_snapshot_write(void)
+{
+	const char *path = nfs_param.cache_param.snapshot_file;
+	uint32_t max = snap_max_entries();
+	struct snap_buf b = { NULL, 0, 0, 0, 0 };
+	struct snap_header hdr;
+	char *tmp;
+	int fd, rc, tries;
+
+	if (path == NULL)
+		return 0;
+
+	tmp = gsh_malloc(strlen(path) + sizeof(".tmp"));
+	if (tmp == NULL)
+		return ENOMEM;
+	sprintf(tmp, "%s.tmp", path);
+
+	pthread_mutex_lock(&snap_mtx);
+
+	/* Most handles are small, so one walk usually fits.  If records
+	   were skipped, grow the buffer with no lane locked and walk
+	   again; after a few tries write what fitted. */
+	snap_reserve(&b, (size_t) max * (sizeof(struct snap_record) + 64));
+	for (tries = 0; tries < 3; tries++) {
+		b.len = 0;
+		b.count = 0;
+		b.missed = 0;
+		cache_inode_lru_walk_hot((max + LRU_N_Q_LANES - 1) /
+					 LRU_N_Q_LANES, snap_visit, &b);
+		if (b.missed == 0 || !snap_reserve(&b, b.len + b.missed))
+			break;
+	}
+	if (b.missed != 0)
+		LogDebug(COMPONENT_CACHE_INODE,
+			 "Cache snapshot left out %zu bytes of records",
+			 b.missed);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = SNAP_MAGIC;
+	hdr.version = SNAP_VERSION;
+	hdr.written = time(NULL);
+	hdr.count = b.count;
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		rc = errno;
+		goto out;
+	}
+	rc = snap_write_all(fd, &hdr, sizeof(hdr));
+	if (rc == 0)
+		rc = snap_write_all(fd, b.data, b.len);
+	if (rc == 0 && fsync(fd) != 0)
+		rc = errno;
+	if (close(fd) != 0 && rc == 0)
+		rc = errno;
+	if (rc == 0 && rename(tmp, path) != 0)
+		rc = errno;
+	if (rc != 0)
+		unlink(tmp);
+
+out:
+	pthread_mutex_unlock(&snap_mtx);
+
+	if (rc == 0)
+		LogEvent(COMPONENT_CACHE_INODE,
+			 "Wrote %"PRIu32" cache entries to %s", b.count, path);
+	else
+		LogCrit(COMPONENT_CACHE_INODE,
+			"Could not write cache snapshot %s: %s",
+			path, strerror(rc));
+
+	gsh_free(b.data);
+	gsh_free(tmp);
+	return rc;
+}
+
+/**
+ * @brief Where a record is in the file, for sorting
+ */
+
+struct snap_index {
+	uint32_t rank;
+	size_t off;
+};
+
+/**
+ * @brief Read a snapshot file and check its records
+ *
+ * @param[in]  path  File to read
+ * @param[out] data  The file, to be freed by the caller
+ * @param[out] index The records in it, to be freed by the caller
+ *
+ * @return The number of records, or -1.
+ */
+
+static int snap_read(const char *path, char **data,
+		     struct snap_index **index)
+{
+	struct snap_header hdr;
+	struct snap_record rec;
+	struct stat st;
+	size_t off, size;
+	uint32_t i;
+	int fd;
+
+	*data = NULL;
+	*index = NULL;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			LogCrit(COMPONENT_CACHE_INODE,
+				"Could not open cache snapshot %s: %s",
+				path, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(hdr))
+		goto bad;
+	size = st.st_size;
+
+	*data = gsh_malloc(size);
+	if (*data == NULL || read(fd, *data, size) != (ssize_t) size)
+		goto bad;
+
+	memcpy(&hdr, *data, sizeof(hdr));
+	if (hdr.magic != SNAP_MAGIC || hdr.version != SNAP_VERSION ||
+	    hdr.count > (size - sizeof(hdr)) / sizeof(rec))
+		goto bad;
+
+	*index = gsh_calloc(hdr.count + 1, sizeof(struct snap_index));
+	if (*index == NULL)
+		goto bad;
+
+	off = sizeof(hdr);
+	for (i = 0; i < hdr.count; i++) {
+		if (size - off < sizeof(rec))
+			goto bad;
+		memcpy(&rec, *data + off, sizeof(rec));
+		if (rec.key_len == 0 ||
+		    size - off - sizeof(rec) <
+		    (size_t) rec.key_len + rec.parent_len)
+			goto bad;
+		(*index)[i].rank = rec.rank;
+		(*index)[i].off = off;
+		off += sizeof(rec) + rec.key_len + rec.parent_len;
+	}
+
+	close(fd);
+	return hdr.count;
+
+bad:
+	LogCrit(COMPONENT_CACHE_INODE,
+		"Cache snapshot %s is unreadable, ignoring it", path);
+	close(fd);
+	gsh_free(*index);
+	gsh_free(*data);
+	*index = NULL;
+	*data = NULL;
+	return -1;
+}
+
+/* Coldest first */
+static int snap_index_cmpf(const void *a, const void *b)
+{
+	const struct snap_index *l = a, *r = b;
+
+	if (l->rank != r->rank)
+		return (l->rank > r->rank) ? -1 : 1;
+	return (l->off < r->off) ? -1 : (l->off > r->off);
+}
+
+/**
+ * @brief Bring one snapshot record back into the cache
+ *
+ * @return true if the entry is now cached.
+ */
+
+static bool snap_load(char *data, size_t off, struct req_op_context *req_ctx)
+{
+	struct snap_record rec;
+	cache_inode_key_t key;
+	cache_inode_key_t parent;
+	cache_entry_t *entry;
+
+	memcpy(&rec, data + off, sizeof(rec));
+	key.exportid = rec.exportid;
+	key.kv.addr = data + off + sizeof(rec);
+	key.kv.len = rec.key_len;
+	cih_hash_key(&key);
+
+	entry = cache_inode_get_keyed(&key, req_ctx, CIG_KEYED_FLAG_NONE);
+	if (entry == NULL)
+		return false;
+
+	cache_inode_lru_restore(entry, rec.qid);
+
+	if (entry->type == DIRECTORY && rec.parent_len != 0) {
+		parent.exportid = rec.parent_exportid;
+		parent.kv.addr = data + off + sizeof(rec) + rec.key_len;
+		parent.kv.len = rec.parent_len;
+		cih_hash_key(&parent);
+		PTHREAD_RWLOCK_wrlock(&entry->content_lock);
+		if (entry->object.dir.parent.kv.len == 0)
+			cache_inode_key_dup(&entry->object.dir.parent, &parent);
+		PTHREAD_RWLOCK_unlock(&entry->content_lock);
+	}
+
+	cache_inode_put(entry);
+	return true;
+}
+
+/**
+ * @brief Reload the snapshot into the cache
+ *
+ * @return false if cut short by shutdown.
+ */
+
+static bool snap_reload(struct fridgethr_context *ctx)
+{
+	const char *path = nfs_param.cache_param.snapshot_file;
+	struct user_cred creds = {
+		.caller_uid = 0,
+		.caller_gid = 0,
+		.caller_glen = 0,
+		.caller_garray = NULL
+	};
+	struct req_op_context req_ctx = {
+		.creds = &creds,
+		.caller_addr = NULL,
+		.clientid = NULL
+	};
+	struct snap_index *index;
+	char *data;
+	int count, i;
+	uint32_t loaded = 0, stale = 0;
+	time_t start = time(NULL);
+	bool done = true;
+
+	count = snap_read(path, &data, &index);
+	if (count <= 0)
+		goto out;
+
+	qsort(index, count, sizeof(struct snap_index), snap_index_cmpf);
+
+	for (i = 0; i < count; i++) {
+		if (fridgethr_you_should_break(ctx)) {
+			done = false;
+			break;
+		}
+		if (lru_state.entries_used >= lru_state.entries_hiwat)
+			break;
+		if (snap_load(data, index[i].off, &req_ctx))
+			loaded++;
+		else
+			stale++;
+	}
+
+	LogEvent(COMPONENT_CACHE_INODE,
+		 "Reloaded %"PRIu32" of %d cache entries from %s in %ld s, "
+		 "%"PRIu32" no longer valid",
+		 loaded, count, path, (long) (time(NULL) - start), stale);
+
+out:
+	gsh_free(index);
+	gsh_free(data);
+	return done;
+}
+
+/**
+ * @brief Snapshot thread
+ *
+ * Reloads the snapshot on its first run, then writes one every
+ * Snapshot_Interval seconds, if set.
+ */
+
+static void snap_run(struct fridgethr_context *ctx)
+{
+	if (!snap_reloaded) {
+		snap_reloaded = snap_reload(ctx);
+		return;
+	}
+	if (nfs_param.cache_param.snapshot_interval != 0)
+		cache_inode_snapshot_write();
+}
+
+/**
+ * @brief Start reloading the snapshot, if there is one
+ *
+ * Must be called once exports are set up.
+ *
+ * @return 0 on success, POSIX errors on failure.
+ */
+
+int cache_inode_snapshot_pkginit(void)
+{
+	struct fridgethr_params frp;
+	int rc;
+
+	if (nfs_param.cache_param.snapshot_file == NULL)
+		return 0;
+
+	memset(&frp, 0, sizeof(struct fridgethr_params));
+	frp.thr_max = 1;
+	frp.thr_min = 1;
+	/* Without an interval, the thread only sleeps after the reload */
+	frp.thread_delay = nfs_param.cache_param.snapshot_interval ?
+		nfs_param.cache_param.snapshot_interval : 3600;
+	frp.flavor = fridgethr_flavor_looper;
+
+	rc = fridgethr_init(&snap_fridge, "Cache Snapshot", &frp);
+	if (rc != 0) {
+		LogMajor(COMPONENT_CACHE_INODE,
+			 "Unable to initialize cache snapshot fridge, "
+			 "error code %d.", rc);
+		return rc;
+	}
+
+	rc = fridgethr_submit(snap_fridge, snap_run, NULL);
+	if (rc != 0) {
+		LogMajor(COMPONENT_CACHE_INODE,
+			 "Unable to start cache snapshot thread, "
+			 "error code %d.", rc);
+		return rc;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Stop the snapshot thread and write a last snapshot
+ *
+ * Call once requests are no longer served and before the cache is
+ * destroyed.
+ *
+ * @return 0 on success, POSIX errors on failure.
+ */
+
+int cache_inode_snapshot_pkgshutdown(void)
+{
+	int rc;
+
+	if (snap_fridge == NULL)
+		return 0;
+
+	rc = fridgethr_sync_command(snap_fridge, fridgethr_comm_stop, 120);
+	if (rc == ETIMEDOUT) {
+		LogMajor(COMPONENT_CACHE_INODE,
+			 "Shutdown timed out, cancelling threads.");
+		fridgethr_cancel(snap_fridge);
+	} else if (rc != 0) {
+		LogMajor(COMPONENT_CACHE_INODE,
+			 "Failed shutting down cache snapshot thread: %d",
+			 rc);
+	}
+
+	/* A reload cut short leaves the old snapshot the better one */
+	if (!snap_reloaded)
+		return rc;
+
+	return cache_inode_snapshot_write();
+}
+
+/** @} */
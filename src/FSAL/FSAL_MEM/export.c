@@ -0,0 +1,515 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file   FSAL_MEM/export.c
+ * @brief Export operations of the in-memory FSAL
+ */
+
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "abstract_mem.h"
+#include "abstract_atomic.h"
+#include "fsal.h"
+#include "fsal_types.h"
+#include "fsal_api.h"
+#include "FSAL/fsal_commonlib.h"
+#include "internal.h"
+
+/**
+ * @brief Clean up an export
+ *
+ * Every object of the export goes with it.
+ *
+ * @param[in,out] export_pub The export to be released
+ *
+ * @retval ERR_FSAL_NO_ERROR on success.
+ * @retval ERR_FSAL_DELAY if the export is in use.
+ */
+
+static fsal_status_t release(struct fsal_export *export_pub)
+{
+	struct mem_export *export =
+		container_of(export_pub, struct mem_export, export);
+
+	pthread_mutex_lock(&export->export.lock);
+	if ((export->export.refs > 0) ||
+	    (!glist_empty(&export->export.handles))) {
+		pthread_mutex_unlock(&export->export.lock);
+		LogMajor(COMPONENT_FSAL, "MEM release: export (0x%p) busy",
+			 export_pub);
+		return mem2fsal_error(EBUSY);
+	}
+	fsal_detach_export(export->export.fsal, &export->export.exports);
+	free_export_ops(&export->export);
+	pthread_mutex_unlock(&export->export.lock);
+
+	export->export.ops = NULL;
+	mem_export_destroy(export);
+	gsh_free(export->path);
+	pthread_mutex_destroy(&export->export.lock);
+	gsh_free(export);
+
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
+/**
+ * @brief Return a handle corresponding to a path
+ *
+ * The exported path is the root of the tree; anything below it is
+ * looked up a component at a time.
+ *
+ * @param[in]  export_pub The export in which to look up the file
+ * @param[in]  opctx      Request context
+ * @param[in]  path       The path to look up
+ * @param[out] pub_handle The created public FSAL handle
+ *
+ * @return FSAL status.
+ */
+
+static fsal_status_t lookup_path(struct fsal_export *export_pub,
+				 const struct req_op_context *opctx,
+				 const char *path,
+				 struct fsal_obj_handle **pub_handle)
+{
+	struct mem_export *export =
+		container_of(export_pub, struct mem_export, export);
+	size_t len = strlen(export->path);
+	struct mem_node *node, *next;
+	struct mem_dirent *dirent;
+	char name[MEM_MAXNAMLEN + 1];
+	struct mem_handle *handle;
+	const char *end;
+	int rc;
+
+	*pub_handle = NULL;
+
+	if (strncmp(path, export->path, len) != 0 ||
+	    (path[len] != '\0' && path[len] != '/'))
+		return fsalstat(ERR_FSAL_INVAL, 0);
+	path += len;
+
+	node = export->root;
+	mem_node_get(node);
+	for (;;) {
+		while (*path == '/')
+			path++;
+		if (*path == '\0')
+			break;
+		end = strchrnul(path, '/');
+		if (end - path > MEM_MAXNAMLEN) {
+			mem_node_put(export, node);
+			return fsalstat(ERR_FSAL_NAMETOOLONG, 0);
+		}
+		memcpy(name, path, end - path);
+		name[end - path] = '\0';
+		path = end;
+
+		if (node->mn_attrs.type != DIRECTORY) {
+			mem_node_put(export, node);
+			return fsalstat(ERR_FSAL_NOTDIR, 0);
+		}
+		pthread_rwlock_rdlock(&node->mn_lock);
+		dirent = mem_dirent_lookup(node, name);
+		next = dirent == NULL ? NULL : dirent->md_node;
+		if (next != NULL)
+			mem_node_get(next);
+		pthread_rwlock_unlock(&node->mn_lock);
+		mem_node_put(export, node);
+		if (next == NULL)
+			return fsalstat(ERR_FSAL_NOENT, 0);
+		node = next;
+	}
+
+	rc = mem_handle_new(export, node, &handle);
+	if (rc < 0) {
+		mem_node_put(export, node);
+		return mem2fsal_error(-rc);
+	}
+
+	*pub_handle = &handle->handle;
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
+/**
+ * @brief Decode a digested handle
+ *
+ * @param[in]     exp_hdl Handle of the relevant fs export
+ * @param[in]     in_type The type of digest being decoded
+ * @param[in,out] fh_desc Address and length of key
+ */
+
+static fsal_status_t extract_handle(struct fsal_export *exp_hdl,
+				    fsal_digesttype_t in_type,
+				    struct gsh_buffdesc *fh_desc)
+{
+	switch (in_type) {
+		/* Digested Handles */
+	case FSAL_DIGEST_NFSV2:
+	case FSAL_DIGEST_NFSV3:
+	case FSAL_DIGEST_NFSV4:
+		if (fh_desc->len < sizeof(struct mem_wire))
+			return fsalstat(ERR_FSAL_INVAL, 0);
+		fh_desc->len = sizeof(struct mem_wire);
+		break;
+	default:
+		return fsalstat(ERR_FSAL_SERVERFAULT, 0);
+	}
+
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
+/**
+ * @brief Create a handle object from a wire handle
+ *
+ * @param[in]  export_pub Public export
+ * @param[in]  opctx      Request context
+ * @param[in]  desc       Handle buffer descriptor
+ * @param[out] pub_handle The created handle
+ *
+ * @return FSAL status, ERR_FSAL_STALE if the object is gone.
+ */
+
+static fsal_status_t create_handle(struct fsal_export *export_pub,
+				   const struct req_op_context *opctx,
+				   struct gsh_buffdesc *desc,
+				   struct fsal_obj_handle **pub_handle)
+{
+	struct mem_export *export =
+		container_of(export_pub, struct mem_export, export);
+	struct mem_wire wire;
+	struct mem_handle *handle;
+	struct mem_node *node;
+	int rc;
+
+	*pub_handle = NULL;
+
+	if (desc->len != sizeof(struct mem_wire))
+		return fsalstat(ERR_FSAL_INVAL, 0);
+	memcpy(&wire, desc->addr, sizeof(wire));
+
+	node = mem_node_find(export, wire.fileid);
+	if (node == NULL)
+		return fsalstat(ERR_FSAL_STALE, 0);
+
+	rc = mem_handle_new(export, node, &handle);
+	if (rc < 0) {
+		mem_node_put(export, node);
+		return mem2fsal_error(-rc);
+	}
+
+	*pub_handle = &handle->handle;
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
+/**
+ * @brief Get dynamic filesystem info
+ *
+ * Space is what the export holds plus the memory still free in the
+ * machine.  There is no limit on the number of files.
+ *
+ * @param[in]  export_pub The public export handle
+ * @param[in]  opctx      Request context
+ * @param[out] info       The dynamic FS information
+ *
+ * @return FSAL status.
+ */
+
+static fsal_status_t get_fs_dynamic_info(struct fsal_export *export_pub,
+					 const struct req_op_context *opctx,
+					 fsal_dynamicfsinfo_t *info)
+{
+	struct mem_export *export =
+		container_of(export_pub, struct mem_export, export);
+	long pages = sysconf(_SC_AVPHYS_PAGES);
+	long pagesize = sysconf(_SC_PAGESIZE);
+	uint64_t avail = 0;
+
+	if (pages > 0 && pagesize > 0)
+		avail = (uint64_t)pages * pagesize;
+
+	memset(info, 0, sizeof(fsal_dynamicfsinfo_t));
+	info->total_bytes = atomic_fetch_uint64_t(&export->bytes) + avail;
+	info->free_bytes = avail;
+	info->avail_bytes = avail;
+	info->total_files = atomic_fetch_uint64_t(&export->files) + UINT32_MAX;
+	info->free_files = UINT32_MAX;
+	info->avail_files = UINT32_MAX;
+	info->time_delta.tv_sec = 0;
+	info->time_delta.tv_nsec = 1;
+
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
+/**
+ * @brief Query the FSAL's capabilities
+ *
+ * @param[in] export_pub The public export handle
+ * @param[in] option     The option to check
+ *
+ * @retval true if the option is supported.
+ * @retval false if the option is unsupported (or unknown).
+ */
+
+static bool fs_supports(struct fsal_export *export_pub,
+			fsal_fsinfo_options_t option)
+{
+	switch (option) {
+	case fso_no_trunc:
+		return true;
+
+	case fso_chown_restricted:
+		return true;
+
+	case fso_case_insensitive:
+		return false;
+
+	case fso_case_preserving:
+		return true;
+
+	case fso_link_support:
+		return true;
+
+	case fso_symlink_support:
+		return true;
+
+	case fso_lock_support:
+		return true;
+
+	case fso_lock_support_owner:
+		return true;
+
+	case fso_lock_support_async_block:
+		return false;
+
+	case fso_named_attr:
+		return false;
+
+	case fso_unique_handles:
+		return true;
+
+	case fso_cansettime:
+		return true;
+
+	case fso_homogenous:
+		return true;
+
+	case fso_auth_exportpath_xdev:
+		return false;
+
+	case fso_dirs_have_sticky_bit:
+		return true;
+
+	case fso_accesscheck_support:
+		return false;
+
+	case fso_share_support:
+		return false;
+
+	case fso_share_support_owner:
+		return false;
+
+	case fso_pnfs_ds_supported:
+		return false;
+
+	case fso_delegations:
+		return false;
+	}
+
+	return false;
+}
+
+/**
+ * @brief Return the longest file supported
+ *
+ * @param[in] export_pub The public export
+ *
+ * @return INT64_MAX.
+ */
+
+static uint64_t fs_maxfilesize(struct fsal_export *export_pub)
+{
+	return INT64_MAX;
+}
+
+/**
+ * @brief Return the longest read supported
+ *
+ * @param[in] export_pub The public export
+ *
+ * @return 4 mebibytes.
+ */
+
+static uint32_t fs_maxread(struct fsal_export *export_pub)
+{
+	return 0x400000;
+}
+
+/**
+ * @brief Return the longest write supported
+ *
+ * @param[in] export_pub The public export
+ *
+ * @return 4 mebibytes.
+ */
+
+static uint32_t fs_maxwrite(struct fsal_export *export_pub)
+{
+	return 0x400000;
+}
+
+/**
+ * @brief Return the maximum number of hard links to a file
+ *
+ * @param[in] export_pub The public export
+ *
+ * @return UINT32_MAX.
+ */
+
+static uint32_t fs_maxlink(struct fsal_export *export_pub)
+{
+	return UINT32_MAX;
+}
+
+/**
+ * @brief Return the maximum size of a filename
+ *
+ * @param[in] export_pub The public export
+ *
+ * @return MEM_MAXNAMLEN.
+ */
+
+static uint32_t fs_maxnamelen(struct fsal_export *export_pub)
+{
+	return MEM_MAXNAMLEN;
+}
+
+/**
+ * @brief Return the maximum length of a path
+ *
+ * @param[in] export_pub The public export
+ *
+ * @return PATH_MAX.
+ */
+
+static uint32_t fs_maxpathlen(struct fsal_export *export_pub)
+{
+	return PATH_MAX;
+}
+
+/**
+ * @brief Return the lease time
+ *
+ * @param[in] export_pub The public export
+ *
+ * @return five minutes.
+ */
+
+static struct timespec fs_lease_time(struct fsal_export *export_pub)
+{
+	struct timespec lease = {300, 0};
+
+	return lease;
+}
+
+/**
+ * @brief Return ACL support
+ *
+ * @param[in] export_pub The public export
+ *
+ * @return FSAL_ACLSUPPORT_DENY.
+ */
+
+static fsal_aclsupp_t fs_acl_support(struct fsal_export *export_pub)
+{
+	return FSAL_ACLSUPPORT_DENY;
+}
+
+/**
+ * @brief Return the attributes supported by this FSAL
+ *
+ * @param[in] export_pub The public export
+ *
+ * @return MEM_SUPPORTED_ATTRIBUTES.
+ */
+
+static attrmask_t fs_supported_attrs(struct fsal_export *export_pub)
+{
+	return MEM_SUPPORTED_ATTRIBUTES;
+}
+
+/**
+ * @brief Return the mode under which the FSAL will create files
+ *
+ * @param[in] export_pub The public export
+ *
+ * @return 0, the mode asked for is the mode given.
+ */
+
+static uint32_t fs_umask(struct fsal_export *export_pub)
+{
+	return 0;
+}
+
+/**
+ * @brief Return the mode for extended attributes
+ *
+ * @param[in] export_pub The public export
+ *
+ * @return 0644.
+ */
+
+static uint32_t fs_xattr_access_rights(struct fsal_export *export_pub)
+{
+	return 0644;
+}
+
+/**
+ * @brief Set operations for exports
+ *
+ * @param[in,out] ops Operations vector
+ */
+
+void export_ops_init(struct export_ops *ops)
+{
+	ops->release = release;
+	ops->lookup_path = lookup_path;
+	ops->extract_handle = extract_handle;
+	ops->create_handle = create_handle;
+	ops->get_fs_dynamic_info = get_fs_dynamic_info;
+	ops->fs_supports = fs_supports;
+	ops->fs_maxfilesize = fs_maxfilesize;
+	ops->fs_maxread = fs_maxread;
+	ops->fs_maxwrite = fs_maxwrite;
+	ops->fs_maxlink = fs_maxlink;
+	ops->fs_maxnamelen = fs_maxnamelen;
+	ops->fs_maxpathlen = fs_maxpathlen;
+	ops->fs_lease_time = fs_lease_time;
+	ops->fs_acl_support = fs_acl_support;
+	ops->fs_supported_attrs = fs_supported_attrs;
+	ops->fs_umask = fs_umask;
+	ops->fs_xattr_access_rights = fs_xattr_access_rights;
+}
@@ -0,0 +1,1287 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file   FSAL_MEM/handle.c
+ * @brief Object operations of the in-memory FSAL
+ */
+
+#include <string.h>
+#include <errno.h>
+#include "abstract_mem.h"
+#include "abstract_atomic.h"
+#include "fsal.h"
+#include "fsal_types.h"
+#include "fsal_api.h"
+#include "FSAL/fsal_commonlib.h"
+#include "internal.h"
+
+#define mem_export_of(pub) \
+	container_of((pub)->export, struct mem_export, export)
+#define mem_handle_of(pub) \
+	container_of((pub), struct mem_handle, handle)
+
+/**
+ * @brief Release an object
+ *
+ * @param[in] obj_pub The object to release
+ *
+ * @return FSAL status codes.
+ */
+
+static fsal_status_t release(struct fsal_obj_handle *obj_pub)
+{
+	struct mem_handle *obj = mem_handle_of(obj_pub);
+	struct mem_export *export = mem_export_of(obj_pub);
+	int retval;
+
+	retval = fsal_obj_handle_uninit(obj_pub);
+	if (retval != 0) {
+		LogCrit(COMPONENT_FSAL,
+			"Tried to release busy handle, hdl = 0x%p->refs = %d",
+			obj_pub, obj_pub->refs);
+		return mem2fsal_error(retval);
+	}
+
+	mem_node_put(export, obj->node);
+	gsh_free(obj);
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
+/**
+ * @brief Make a handle for a referenced node
+ *
+ * Consumes the reference whether or not it succeeds.
+ */
+
+static fsal_status_t mem_make_handle(struct mem_export *export,
+				     struct mem_node *node,
+				     struct fsal_obj_handle **obj_pub)
+{
+	struct mem_handle *obj;
+	int rc;
+
+	rc = mem_handle_new(export, node, &obj);
+	if (rc < 0) {
+		mem_node_put(export, node);
+		return mem2fsal_error(-rc);
+	}
+
+	*obj_pub = &obj->handle;
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
+/**
+ * @brief Look up an object by name
+ *
+ * "." and ".." are understood; the parent of the root is the root.
+ *
+ * @param[in]  dir_pub The directory in which to look up the object.
+ * @param[in]  opctx   Request context (user creds, client address)
+ * @param[in]  path    The name to look up.
+ * @param[out] obj_pub The looked up object.
+ *
+ * @return FSAL status codes.
+ */
+
+static fsal_status_t lookup(struct fsal_obj_handle *dir_pub,
+			    const struct req_op_context *opctx,
+			    const char *path,
+			    struct fsal_obj_handle **obj_pub)
+{
+	struct mem_export *export = mem_export_of(dir_pub);
+	struct mem_node *dir = mem_handle_of(dir_pub)->node;
+	struct mem_node *node = NULL;
+	struct mem_dirent *dirent;
+	uint64_t parent;
+
+	*obj_pub = NULL;
+
+	if (dir->mn_attrs.type != DIRECTORY)
+		return fsalstat(ERR_FSAL_NOTDIR, 0);
+
+	if (strcmp(path, ".") == 0) {
+		node = dir;
+		mem_node_get(node);
+	} else if (strcmp(path, "..") == 0) {
+		pthread_rwlock_rdlock(&dir->mn_lock);
+		parent = dir->mn_u.dir.parent;
+		pthread_rwlock_unlock(&dir->mn_lock);
+		node = mem_node_find(export, parent);
+	} else {
+		pthread_rwlock_rdlock(&dir->mn_lock);
+		dirent = mem_dirent_lookup(dir, path);
+		if (dirent != NULL) {
+			node = dirent->md_node;
+			mem_node_get(node);
+		}
+		pthread_rwlock_unlock(&dir->mn_lock);
+	}
+
+	if (node == NULL)
+		return fsalstat(ERR_FSAL_NOENT, 0);
+
+	return mem_make_handle(export, node, obj_pub);
+}
+
+/**
+ * @brief Read a directory
+ *
+ * Entries are passed to the callback in cookie order, without the
+ * directory locked since the callback may look them up.  Each step
+ * looks for the first entry after the cookie of the last one, so
+ * entries added or removed meanwhile are simply seen or not.
+ *
+ * @param[in]  dir_pub   The directory to read
+ * @param[in]  opctx     Request context (user creds, client address etc)
+ * @param[in]  whence    The cookie indicating resumption, NULL to start
+ * @param[in]  dir_state Opaque, passed to cb
+ * @param[in]  cb        Callback that receives directory entries
+ * @param[out] eof       True if there are no more entries
+ *
+ * @return FSAL status.
+ */
+
+static fsal_status_t fsal_readdir(struct fsal_obj_handle *dir_pub,
+				  const struct req_op_context *opctx,
+				  fsal_cookie_t *whence,
+				  void *dir_state,
+				  fsal_readdir_cb cb,
+				  bool *eof)
+{
+	struct mem_node *dir = mem_handle_of(dir_pub)->node;
+	struct mem_dirent *dirent;
+	char name[MEM_MAXNAMLEN + 1];
+	uint64_t cookie = 0;
+
+	if (dir->mn_attrs.type != DIRECTORY)
+		return fsalstat(ERR_FSAL_NOTDIR, 0);
+
+	if (whence != NULL)
+		cookie = *whence;
+
+	*eof = false;
+	while (!*eof) {
+		pthread_rwlock_rdlock(&dir->mn_lock);
+		dirent = mem_dirent_after(dir, cookie);
+		if (dirent != NULL) {
+			strcpy(name, dirent->md_name);
+			cookie = dirent->md_cookie;
+		} else {
+			*eof = true;
+		}
+		pthread_rwlock_unlock(&dir->mn_lock);
+
+		if (dirent != NULL && !cb(opctx, name, dir_state, cookie))
+			break;
+	}
+
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
+/**
+ * @brief Create an object of any type in a directory
+ *
+ * @param[in]     dir_pub   Directory in which to create the object
+ * @param[in]     name      Name of the object
+ * @param[in]     type      Its type
+ * @param[in]     link_path Target if it is a symbolic link
+ * @param[in,out] attrib    Mode, owner, group and device in, all
+ *                          attributes of the new object out
+ * @param[out]    obj_pub   Handle for the new object
+ *
+ * @return FSAL status.
+ */
+
+static fsal_status_t mem_create_obj(struct fsal_obj_handle *dir_pub,
+				    const char *name,
+				    object_file_type_t type,
+				    const char *link_path,
+				    struct attrlist *attrib,
+				    struct fsal_obj_handle **obj_pub)
+{
+	struct mem_export *export = mem_export_of(dir_pub);
+	struct mem_node *dir = mem_handle_of(dir_pub)->node;
+	struct mem_handle *obj;
+	struct mem_node *node;
+	struct attrlist init = *attrib;
+	fsal_status_t status;
+	int rc;
+
+	*obj_pub = NULL;
+
+	if (dir->mn_attrs.type != DIRECTORY)
+		return fsalstat(ERR_FSAL_NOTDIR, 0);
+	if (strlen(name) > MEM_MAXNAMLEN)
+		return fsalstat(ERR_FSAL_NAMETOOLONG, 0);
+	if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+		return fsalstat(ERR_FSAL_EXIST, 0);
+
+	init.mode &= ~dir_pub->export->ops->fs_umask(dir_pub->export);
+	node = mem_node_new(export, type, &init);
+	if (node == NULL)
+		return fsalstat(ERR_FSAL_NOMEM, 0);
+	if (type == SYMBOLIC_LINK) {
+		node->mn_u.link = gsh_strdup(link_path);
+		if (node->mn_u.link == NULL) {
+			mem_node_put(export, node);
+			return fsalstat(ERR_FSAL_NOMEM, 0);
+		}
+		node->mn_attrs.filesize = strlen(link_path);
+		node->mn_attrs.spaceused = node->mn_attrs.filesize;
+	} else if (type == DIRECTORY) {
+		node->mn_u.dir.parent = dir->mn_fileid;
+	}
+
+	pthread_rwlock_wrlock(&dir->mn_lock);
+	if (dir->mn_attrs.numlinks == 0) {
+		/* Removed while we held a handle */
+		rc = -ESTALE;
+	} else {
+		rc = mem_dirent_add(dir, name, node);
+	}
+	if (rc == 0) {
+		if (type == DIRECTORY)
+			dir->mn_attrs.numlinks++;
+		mem_node_changed(dir, true);
+	}
+	pthread_rwlock_unlock(&dir->mn_lock);
+
+	if (rc < 0) {
+		mem_node_put(export, node);
+		return mem2fsal_error(-rc);
+	}
+
+	status = mem_make_handle(export, node, obj_pub);
+	if (FSAL_IS_ERROR(status))
+		return status;
+
+	obj = mem_handle_of(*obj_pub);
+	*attrib = obj->handle.attributes;
+	return status;
+}
+
+/**
+ * @brief Create a regular file
+ *
+ * @param[in]     dir_pub Directory in which to create the file
+ * @param[in]     opctx   Request context (user creds, client address etc)
+ * @param[in]     name    Name of file to create
+ * @param[in,out] attrib  Attributes of newly created file
+ * @param[out]    obj_pub Handle for newly created file
+ *
+ * @return FSAL status.
+ */
+
+static fsal_status_t fsal_create(struct fsal_obj_handle *dir_pub,
+				 const struct req_op_context *opctx,
+				 const char *name,
+				 struct attrlist *attrib,
+				 struct fsal_obj_handle **obj_pub)
+{
+	return mem_create_obj(dir_pub, name, REGULAR_FILE, NULL, attrib,
+			      obj_pub);
+}
+
+/**
+ * @brief Create a directory
+ *
+ * @param[in]     dir_pub Directory in which to create the directory
+ * @param[in]     opctx   Request context (user creds, client address etc)
+ * @param[in]     name    Name of directory to create
+ * @param[in,out] attrib  Attributes of newly created directory
+ * @param[out]    obj_pub Handle for newly created directory
+ *
+ * @return FSAL status.
+ */
+
+static fsal_status_t fsal_mkdir(struct fsal_obj_handle *dir_pub,
+				const struct req_op_context *opctx,
+				const char *name,
+				struct attrlist *attrib,
+				struct fsal_obj_handle **obj_pub)
+{
+	return mem_create_obj(dir_pub, name, DIRECTORY, NULL, attrib,
+			      obj_pub);
+}
+
+/**
+ * @brief Create a special file
+ *
+ * @param[in]     dir_pub  Directory in which to create the object
+ * @param[in]     opctx    Request context (user creds, client address etc)
+ * @param[in]     name     Name of object to create
+ * @param[in]     nodetype Type of special file to create
+ * @param[in]     dev      Major and minor device numbers for block or
+ *                         character special
+ * @param[in,out] attrib   Attributes of newly created object
+ * @param[out]    obj_pub  Handle for newly created object
+ *
+ * @return FSAL status.
+ */
+
+static fsal_status_t fsal_mknode(struct fsal_obj_handle *dir_pub,
+				 const struct req_op_context *opctx,
+				 const char *name,
+				 object_file_type_t nodetype,
+				 fsal_dev_t *dev,
+				 struct attrlist *attrib,
+				 struct fsal_obj_handle **obj_pub)
+{
+	switch (nodetype) {
+	case CHARACTER_FILE:
+	case BLOCK_FILE:
+		if (dev == NULL)
+			return fsalstat(ERR_FSAL_FAULT, 0);
+		attrib->rawdev = *dev;
+		break;
+	case SOCKET_FILE:
+	case FIFO_FILE:
+		break;
+	default:
+		return fsalstat(ERR_FSAL_INVAL, 0);
+	}
+
+	return mem_create_obj(dir_pub, name, nodetype, NULL, attrib,
+			      obj_pub);
+}
+
+/**
+ * @brief Create a symbolic link
+ *
+ * @param[in]     dir_pub   Directory in which to create the link
+ * @param[in]     opctx     Request context (user creds, client address etc)
+ * @param[in]     name      Name of link to create
+ * @param[in]     link_path Content of the link
+ * @param[in,out] attrib    Attributes of newly created link
+ * @param[out]    obj_pub   Handle for newly created link
+ *
+ * @return FSAL status.
+ */
+
+static fsal_status_t fsal_symlink(struct fsal_obj_handle *dir_pub,
+				  const struct req_op_context *opctx,
+				  const char *name,
+				  const char *link_path,
+				  struct attrlist *attrib,
+				  struct fsal_obj_handle **obj_pub)
+{
+	return mem_create_obj(dir_pub, name, SYMBOLIC_LINK, link_path,
+			      attrib, obj_pub);
+}
+
+/**
+ * @brief Return the content of a symbolic link
+ *
+ * @param[in]  link_pub    The handle for the link
+ * @param[in]  opctx       Request context (user creds, client address etc)
+ * @param[out] content_buf Buffdesc for symbolic link
+ * @param[in]  refresh     Ignored, the content is always current
+ *
+ * @return FSAL status.
+ */
+
+static fsal_status_t fsal_readlink(struct fsal_obj_handle *link_pub,
+				   const struct req_op_context *opctx,
+				   struct gsh_buffdesc *content_buf,
+				   bool refresh)
+{
+	struct mem_node *node = mem_handle_of(link_pub)->node;
+
+	if (node->mn_attrs.type != SYMBOLIC_LINK)
+		return fsalstat(ERR_FSAL_INVAL, 0);
+
+	/* The target never changes, so needs no lock */
+	content_buf->len = strlen(node->mn_u.link) + 1;
+	content_buf->addr = gsh_malloc(content_buf->len);
+	if (content_buf->addr == NULL)
+		return fsalstat(ERR_FSAL_NOMEM, 0);
+	memcpy(content_buf->addr, node->mn_u.link, content_buf->len);
+
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
+/**
+ * @brief Freshen and return attributes
+ *
+ * @param[in] handle_pub Object to interrogate
+ * @param[in] opctx      Request context (user creds, client address etc)
+ *
+ * @return FSAL status.
+ */
+
+static fsal_status_t getattrs(struct fsal_obj_handle *handle_pub,
+			      const struct req_op_context *opctx)
+{
+	struct mem_node *node = mem_handle_of(handle_pub)->node;
+
+	pthread_rwlock_rdlock(&node->mn_lock);
+	handle_pub->attributes = node->mn_attrs;
+	pthread_rwlock_unlock(&node->mn_lock);
+
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
+/**
+ * @brief Change the size of a file
+ *
+ * Pages wholly past the new end are freed and the rest of the last
+ * page is cleared, so that bytes past the end of a file always read
+ * as zero when it grows again.  Called with the node write locked.
+ */
+
+static void mem_truncate(struct mem_export *export, struct mem_node *node,
+			 uint64_t size)
+{
+	uint64_t first = (size + MEM_PAGE_SIZE - 1) / MEM_PAGE_SIZE;
+	uint64_t freed = 0;
+	uint64_t i;
+
+	if (size < node->mn_attrs.filesize) {
+		for (i = first; i < node->mn_u.file.npages; i++) {
+			if (node->mn_u.file.pages[i] == NULL)
+				continue;
+			gsh_free(node->mn_u.file.pages[i]);
+			node->mn_u.file.pages[i] = NULL;
+			freed++;
+		}
+		if (size % MEM_PAGE_SIZE != 0 &&
+		    first - 1 < node->mn_u.file.npages &&
+		    node->mn_u.file.pages[first - 1] != NULL)
+			memset(node->mn_u.file.pages[first - 1] +
+			       size % MEM_PAGE_SIZE, 0,
+			       MEM_PAGE_SIZE - size % MEM_PAGE_SIZE);
+		node->mn_u.file.allocated -= freed;
+		atomic_sub_uint64_t(&export->bytes, freed * MEM_PAGE_SIZE);
+	}
+	node->mn_attrs.filesize = size;
+	node->mn_attrs.spaceused = node->mn_u.file.allocated * MEM_PAGE_SIZE;
+}
+
+/**
+ * @brief Set attributes on a file
+ *
+ * @param[in] handle_pub File to modify.
+ * @param[in] opctx      Request context, includes credentials
+ * @param[in] attrs      Attributes to set.
+ *
+ * @return FSAL status.
+ */
+
+static fsal_status_t setattrs(struct fsal_obj_handle *handle_pub,
+			      const struct req_op_context *opctx,
+			      struct attrlist *attrs)
+{
+	struct mem_export *export = mem_export_of(handle_pub);
+	struct mem_node *node = mem_handle_of(handle_pub)->node;
+	struct attrlist *cur = &node->mn_attrs;
+	struct timespec now;
+	bool data = false;
+
+	if (attrs->mask & ~MEM_SETTABLE_ATTRIBUTES)
+		return fsalstat(ERR_FSAL_INVAL, 0);
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_SIZE) &&
+	    cur->type != REGULAR_FILE)
+		return fsalstat(ERR_FSAL_INVAL, 0);
+
+	mem_now(&now);
+	pthread_rwlock_wrlock(&node->mn_lock);
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_SIZE)) {
+		mem_truncate(export, node, attrs->filesize);
+		data = true;
+	}
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_MODE))
+		cur->mode = attrs->mode & MEM_MODE_BITS;
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_OWNER))
+		cur->owner = attrs->owner;
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_GROUP))
+		cur->group = attrs->group;
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_ATIME))
+		cur->atime = attrs->atime;
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_ATIME_SERVER))
+		cur->atime = now;
+	mem_node_changed(node, data);
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_MTIME))
+		cur->mtime = attrs->mtime;
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_MTIME_SERVER))
+		cur->mtime = now;
+	if (FSAL_TEST_MASK(attrs->mask, ATTR_CTIME))
+		cur->ctime = attrs->ctime;
+	handle_pub->attributes = *cur;
+	pthread_rwlock_unlock(&node->mn_lock);
+
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
+/**
+ * @brief Create a hard link
+ *
+ * @param[in] handle_pub  File to link
+ * @param[in] opctx       Request context, includes credentials
+ * @param[in] destdir_pub Directory in which to create link
+ * @param[in] name        Name of link
+ *
+ * @return FSAL status.
+ */
+
+static fsal_status_t fsal_link(struct fsal_obj_handle *handle_pub,
+			       const struct req_op_context *opctx,
+			       struct fsal_obj_handle *destdir_pub,
+			       const char *name)
+{
+	struct mem_node *node = mem_handle_of(handle_pub)->node;
+	struct mem_node *dir = mem_handle_of(destdir_pub)->node;
+	int rc = 0;
+
+	if (node->mn_attrs.type == DIRECTORY)
+		return fsalstat(ERR_FSAL_ISDIR, 0);
+	if (dir->mn_attrs.type != DIRECTORY)
+		return fsalstat(ERR_FSAL_NOTDIR, 0);
+
+	pthread_rwlock_wrlock(&dir->mn_lock);
+	pthread_rwlock_wrlock(&node->mn_lock);
+	if (node->mn_attrs.numlinks == 0 || dir->mn_attrs.numlinks == 0)
+		rc = -ESTALE;
+	else
+		rc = mem_dirent_add(dir, name, node);
+	if (rc == 0) {
+		node->mn_attrs.numlinks++;
+		mem_node_changed(node, false);
+		handle_pub->attributes = node->mn_attrs;
+		mem_node_changed(dir, true);
+	}
+	pthread_rwlock_unlock(&node->mn_lock);
+	pthread_rwlock_unlock(&dir->mn_lock);
+
+	return mem2fsal_error(-rc);
+}
+
+/**
+ * @brief Account for a name of node having gone
+ *
+ * Called with the parent directory and the node write locked.
+ */
+
+static void mem_unlinked(struct mem_node *dir, struct mem_node *node)
+{
+	if (node->mn_attrs.type == DIRECTORY) {
+		node->mn_attrs.numlinks = 0;
+		dir->mn_attrs.numlinks--;
+	} else {
+		node->mn_attrs.numlinks--;
+	}
+	mem_node_changed(node, false);
+}
+
+/**
+ * @brief Lock two directories for a rename
+ *
+ * An ancestor is locked before its descendants, otherwise the one
+ * with the lower fileid goes first.  The rename lock is held.
+ */
+
+static void mem_lock_dirs(struct mem_export *export, struct mem_node *a,
+			  struct mem_node *b)
+{
+	struct mem_node *tmp;
+
+	if (mem_is_ancestor(export, a, b) ||
+	    (!mem_is_ancestor(export, b, a) &&
+	     b->mn_fileid < a->mn_fileid)) {
+		tmp = a;
+		a = b;
+		b = tmp;
+	}
+	pthread_rwlock_wrlock(&a->mn_lock);
+	pthread_rwlock_wrlock(&b->mn_lock);
+}
+
+/**
+ * @brief Rename a file
+ *
+ * An existing target is replaced if it is of a compatible type, and
+ * if it is a directory, empty.  A directory cannot be moved into
+ * itself or anything below it.
+ *
+ * @param[in] olddir_pub Source directory
+ * @param[in] opctx      Request context, includes credentials
+ * @param[in] old_name   Original name
+ * @param[in] newdir_pub Destination directory
+ * @param[in] new_name   New name
+ *
+ * @return FSAL status.
+ */
+
+static fsal_status_t fsal_rename(struct fsal_obj_handle *olddir_pub,
+				 const struct req_op_context *opctx,
+				 const char *old_name,
+				 struct fsal_obj_handle *newdir_pub,
+				 const char *new_name)
+{
+	struct mem_export *export = mem_export_of(olddir_pub);
+	struct mem_node *olddir = mem_handle_of(olddir_pub)->node;
+	struct mem_node *newdir = mem_handle_of(newdir_pub)->node;
+	struct mem_dirent *src, *dst;
+	struct mem_node *node, *victim = NULL;
+	bool cross = olddir != newdir;
+	int rc = 0;
+
+	if (olddir->mn_attrs.type != DIRECTORY ||
+	    newdir->mn_attrs.type != DIRECTORY)
+		return fsalstat(ERR_FSAL_NOTDIR, 0);
+	if (strcmp(new_name, ".") == 0 || strcmp(new_name, "..") == 0 ||
+	    strcmp(old_name, ".") == 0 || strcmp(old_name, "..") == 0)
+		return fsalstat(ERR_FSAL_INVAL, 0);
+	if (strlen(new_name) > MEM_MAXNAMLEN)
+		return fsalstat(ERR_FSAL_NAMETOOLONG, 0);
+
+	if (cross) {
+		pthread_mutex_lock(&export->rename_lock);
+		mem_lock_dirs(export, olddir, newdir);
+	} else {
+		pthread_rwlock_wrlock(&olddir->mn_lock);
+	}
+
+	src = mem_dirent_lookup(olddir, old_name);
+	if (src == NULL) {
+		rc = -ENOENT;
+		goto out;
+	}
+	node = src->md_node;
+	if (olddir->mn_attrs.numlinks == 0 || newdir->mn_attrs.numlinks == 0) {
+		rc = -ESTALE;
+		goto out;
+	}
+	if (cross && node->mn_attrs.type == DIRECTORY &&
+	    mem_is_ancestor(export, newdir, node)) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	dst = mem_dirent_lookup(newdir, new_name);
+	if (dst != NULL) {
+		victim = dst->md_node;
+		if (victim == node)
+			goto out;
+		if (node->mn_attrs.type == DIRECTORY &&
+		    victim->mn_attrs.type != DIRECTORY) {
+			rc = -ENOTDIR;
+			goto out;
+		}
+		if (node->mn_attrs.type != DIRECTORY &&
+		    victim->mn_attrs.type == DIRECTORY) {
+			rc = -EISDIR;
+			goto out;
+		}
+		/* A directory holding olddir is not empty and must not
+		   be locked after it */
+		if (victim->mn_attrs.type == DIRECTORY && cross &&
+		    mem_is_ancestor(export, olddir, victim)) {
+			rc = -ENOTEMPTY;
+			goto out;
+		}
+		pthread_rwlock_wrlock(&victim->mn_lock);
+		if (victim->mn_attrs.type == DIRECTORY &&
+		    !mem_dir_empty(victim)) {
+			pthread_rwlock_unlock(&victim->mn_lock);
+			rc = -ENOTEMPTY;
+			goto out;
+		}
+		mem_dirent_del(newdir, dst);
+		mem_unlinked(newdir, victim);
+		pthread_rwlock_unlock(&victim->mn_lock);
+	} else if (!cross && strcmp(old_name, new_name) == 0) {
+		goto out;
+	}
+
+	rc = mem_dirent_add(newdir, new_name, node);
+	if (rc < 0) {
+		/* The victim is gone; the source stays */
+		goto changed;
+	}
+	mem_dirent_del(olddir, src);
+	/* The reference of the old entry */
+	mem_node_put(export, node);
+
+	pthread_rwlock_wrlock(&node->mn_lock);
+	if (cross && node->mn_attrs.type == DIRECTORY) {
+		node->mn_u.dir.parent = newdir->mn_fileid;
+		olddir->mn_attrs.numlinks--;
+		newdir->mn_attrs.numlinks++;
+	}
+	mem_node_changed(node, false);
+	pthread_rwlock_unlock(&node->mn_lock);
+
+changed:
+	mem_node_changed(olddir, true);
+	if (cross)
+		mem_node_changed(newdir, true);
+
+out:
+	if (cross) {
+		pthread_rwlock_unlock(&newdir->mn_lock);
+		pthread_rwlock_unlock(&olddir->mn_lock);
+		pthread_mutex_unlock(&export->rename_lock);
+	} else {
+		pthread_rwlock_unlock(&olddir->mn_lock);
+	}
+
+	/* The reference of the replaced entry */
+	if (victim != NULL && victim != node)
+		mem_node_put(export, victim);
+
+	return mem2fsal_error(-rc);
+}
+
+/**
+ * @brief Remove a name
+ *
+ * Directories must be empty to be removed.
+ *
+ * @param[in] dir_pub Parent directory
+ * @param[in] opctx   Request context, includes credentials
+ * @param[in] name    Name to remove
+ *
+ * @return FSAL status.
+ */
+
+static fsal_status_t fsal_unlink(struct fsal_obj_handle *dir_pub,
+				 const struct req_op_context *opctx,
+				 const char *name)
+{
+	struct mem_export *export = mem_export_of(dir_pub);
+	struct mem_node *dir = mem_handle_of(dir_pub)->node;
+	struct mem_dirent *dirent;
+	struct mem_node *node = NULL;
+	int rc = 0;
+
+	if (dir->mn_attrs.type != DIRECTORY)
+		return fsalstat(ERR_FSAL_NOTDIR, 0);
+
+	pthread_rwlock_wrlock(&dir->mn_lock);
+	dirent = mem_dirent_lookup(dir, name);
+	if (dirent == NULL) {
+		rc = -ENOENT;
+		goto out;
+	}
+	node = dirent->md_node;
+	pthread_rwlock_wrlock(&node->mn_lock);
+	if (node->mn_attrs.type == DIRECTORY && !mem_dir_empty(node)) {
+		pthread_rwlock_unlock(&node->mn_lock);
+		node = NULL;
+		rc = -ENOTEMPTY;
+		goto out;
+	}
+	mem_dirent_del(dir, dirent);
+	mem_unlinked(dir, node);
+	pthread_rwlock_unlock(&node->mn_lock);
+	mem_node_changed(dir, true);
+
+out:
+	pthread_rwlock_unlock(&dir->mn_lock);
+
+	/* The reference of the entry */
+	if (node != NULL)
+		mem_node_put(export, node);
+
+	return mem2fsal_error(-rc);
+}
+
+/**
+ * @brief Open a file for read or write
+ *
+ * There is nothing to open; the mode is only remembered.
+ *
+ * @param[in] handle_pub File to open
+ * @param[in] opctx      Request context, includes credentials
+ * @param[in] openflags  Mode to open in
+ *
+ * @return FSAL status.
+ */
+
+static fsal_status_t fsal_open(struct fsal_obj_handle *handle_pub,
+			       const struct req_op_context *opctx,
+			       fsal_openflags_t openflags)
+{
+	struct mem_handle *handle = mem_handle_of(handle_pub);
+
+	if (handle->openflags != FSAL_O_CLOSED)
+		return fsalstat(ERR_FSAL_SERVERFAULT, 0);
+
+	handle->openflags = openflags;
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
+/**
+ * @brief Return the open status of a file
+ *
+ * @param[in] handle_pub File to interrogate.
+ *
+ * @return Open mode.
+ */
+
+static fsal_openflags_t status(struct fsal_obj_handle *handle_pub)
+{
+	return mem_handle_of(handle_pub)->openflags;
+}
+
+/**
+ * @brief Read data from a file
+ *
+ * Holes read as zeros.  The access time is not updated, reads
+ * leaving the node unchanged so they can share its lock.
+ *
+ * @param[in]  handle_pub  File to read
+ * @param[in]  opctx       Request context, includes credentials
+ * @param[in]  offset      Point at which to begin read
+ * @param[in]  buffer_size Maximum number of bytes to read
+ * @param[out] buffer      Buffer to store data read
+ * @param[out] read_amount Count of bytes read
+ * @param[out] end_of_file true if the end of file is reached
+ *
+ * @return FSAL status.
+ */
+
+static fsal_status_t fsal_read(struct fsal_obj_handle *handle_pub,
+			       const struct req_op_context *opctx,
+			       uint64_t offset,
+			       size_t buffer_size,
+			       void *buffer,
+			       size_t *read_amount,
+			       bool *end_of_file)
+{
+	struct mem_node *node = mem_handle_of(handle_pub)->node;
+	uint64_t size, pos, idx, skip, chunk;
+	char *out = buffer;
+
+	if (node->mn_attrs.type != REGULAR_FILE)
+		return fsalstat(ERR_FSAL_INVAL, 0);
+
+	pthread_rwlock_rdlock(&node->mn_lock);
+	size = node->mn_attrs.filesize;
+	if (offset >= size) {
+		pthread_rwlock_unlock(&node->mn_lock);
+		*read_amount = 0;
+		*end_of_file = true;
+		return fsalstat(ERR_FSAL_NO_ERROR, 0);
+	}
+	if (buffer_size > size - offset)
+		buffer_size = size - offset;
+
+	for (pos = offset; pos < offset + buffer_size; pos += chunk) {
+		idx = pos / MEM_PAGE_SIZE;
+		skip = pos % MEM_PAGE_SIZE;
+		chunk = MEM_PAGE_SIZE - skip;
+		if (chunk > offset + buffer_size - pos)
+			chunk = offset + buffer_size - pos;
+		if (idx < node->mn_u.file.npages &&
+		    node->mn_u.file.pages[idx] != NULL)
+			memcpy(out, node->mn_u.file.pages[idx] + skip, chunk);
+		else
+			memset(out, 0, chunk);
+		out += chunk;
+	}
+	pthread_rwlock_unlock(&node->mn_lock);
+
+	*read_amount = buffer_size;
+	*end_of_file = offset + buffer_size >= size;
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
+/**
+ * @brief Write data to file
+ *
+ * Written data is as stable as it will ever be.
+ *
+ * @param[in]  handle_pub   File to write
+ * @param[in]  opctx        Request context, includes credentials
+ * @param[in]  offset       Position at which to write
+ * @param[in]  buffer_size  Number of bytes to write
+ * @param[in]  buffer       Data to write
+ * @param[out] write_amount Number of bytes written
+ * @param[out] fsal_stable  Set to true
+ *
+ * @return FSAL status.
+ */
+
+static fsal_status_t fsal_write(struct fsal_obj_handle *handle_pub,
+				const struct req_op_context *opctx,
+				uint64_t offset,
+				size_t buffer_size,
+				void *buffer,
+				size_t *write_amount,
+				bool *fsal_stable)
+{
+	struct mem_export *export = mem_export_of(handle_pub);
+	struct mem_node *node = mem_handle_of(handle_pub)->node;
+	uint64_t end = offset + buffer_size;
+	uint64_t npages, pos, idx, skip, chunk, added = 0;
+	const char *in = buffer;
+	char **pages;
+	fsal_status_t status = {ERR_FSAL_NO_ERROR, 0};
+
+	*write_amount = 0;
+	if (node->mn_attrs.type != REGULAR_FILE)
+		return fsalstat(ERR_FSAL_INVAL, 0);
+	if (end < offset || end > INT64_MAX)
+		return fsalstat(ERR_FSAL_FBIG, 0);
+	if (buffer_size == 0)
+		return fsalstat(ERR_FSAL_NO_ERROR, 0);
+
+	pthread_rwlock_wrlock(&node->mn_lock);
+	npages = (end + MEM_PAGE_SIZE - 1) / MEM_PAGE_SIZE;
+	if (npages > node->mn_u.file.npages) {
+		pages = gsh_realloc(node->mn_u.file.pages,
+				    npages * sizeof(char *));
+		if (pages == NULL) {
+			status.major = ERR_FSAL_NOSPC;
+			goto out;
+		}
+		memset(pages + node->mn_u.file.npages, 0,
+		       (npages - node->mn_u.file.npages) * sizeof(char *));
+		node->mn_u.file.pages = pages;
+		node->mn_u.file.npages = npages;
+	}
+
+	for (pos = offset; pos < end; pos += chunk) {
+		idx = pos / MEM_PAGE_SIZE;
+		skip = pos % MEM_PAGE_SIZE;
+		chunk = MEM_PAGE_SIZE - skip;
+		if (chunk > end - pos)
+			chunk = end - pos;
+		if (node->mn_u.file.pages[idx] == NULL) {
+			node->mn_u.file.pages[idx] = chunk == MEM_PAGE_SIZE ?
+				gsh_malloc(MEM_PAGE_SIZE) :
+				gsh_calloc(1, MEM_PAGE_SIZE);
+			if (node->mn_u.file.pages[idx] == NULL) {
+				status.major = ERR_FSAL_NOSPC;
+				break;
+			}
+			added++;
+		}
+		memcpy(node->mn_u.file.pages[idx] + skip, in, chunk);
+		in += chunk;
+		*write_amount += chunk;
+	}
+
+	if (*write_amount != 0) {
+		if (offset + *write_amount > node->mn_attrs.filesize)
+			node->mn_attrs.filesize = offset + *write_amount;
+		/* A short write is still a write */
+		status.major = ERR_FSAL_NO_ERROR;
+	}
+	node->mn_u.file.allocated += added;
+	node->mn_attrs.spaceused = node->mn_u.file.allocated * MEM_PAGE_SIZE;
+	atomic_add_uint64_t(&export->bytes, added * MEM_PAGE_SIZE);
+	mem_node_changed(node, true);
+	handle_pub->attributes = node->mn_attrs;
+
+out:
+	pthread_rwlock_unlock(&node->mn_lock);
+
+	*fsal_stable = true;
+	return status;
+}
+
+/**
+ * @brief Commit written data
+ *
+ * Nothing to do, every write is stable.
+ *
+ * @param[in] handle_pub File to commit
+ * @param[in] offset     Start of range to commit
+ * @param[in] len        Size of range to commit
+ *
+ * @return FSAL status.
+ */
+
+static fsal_status_t commit(struct fsal_obj_handle *handle_pub,
+			    off_t offset,
+			    size_t len)
+{
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
+/**
+ * @brief Return true if a held lock stands in the way of a request
+ */
+
+static bool mem_lock_conflicts(const struct mem_lock *held, void *owner,
+			       fsal_lock_t type, uint64_t start, uint64_t end)
+{
+	return held->ml_owner != owner &&
+		(type == FSAL_LOCK_W || held->ml_type == FSAL_LOCK_W) &&
+		held->ml_start <= end && start <= held->ml_end;
+}
+
+/**
+ * @brief Release the locks an owner holds on a range
+ *
+ * A lock reaching past both ends of the range is split, using spare,
+ * which is consumed only then.  Called with the node write locked.
+ *
+ * @return true if spare was used.
+ */
+
+static bool mem_unlock_range(struct mem_node *node, void *owner,
+			     uint64_t start, uint64_t end,
+			     struct mem_lock *spare)
+{
+	struct glist_head *glist, *glistn;
+	struct mem_lock *held;
+	bool used = false;
+
+	glist_for_each_safe(glist, glistn, &node->mn_u.file.locks) {
+		held = glist_entry(glist, struct mem_lock, ml_list);
+		if (held->ml_owner != owner || held->ml_start > end ||
+		    start > held->ml_end)
+			continue;
+		if (held->ml_start < start && held->ml_end > end) {
+			*spare = *held;
+			spare->ml_start = end + 1;
+			glist_add(&held->ml_list, &spare->ml_list);
+			held->ml_end = start - 1;
+			used = true;
+		} else if (held->ml_start < start) {
+			held->ml_end = start - 1;
+		} else if (held->ml_end > end) {
+			held->ml_start = end + 1;
+		} else {
+			glist_del(&held->ml_list);
+			gsh_free(held);
+		}
+	}
+
+	return used;
+}
+
+/**
+ * @brief Lock or unlock a byte range
+ *
+ * Locks belong to the owner SAL passes; a NULL owner is one more
+ * owner.  A lock replaces whatever its owner held on the range, as
+ * fcntl does, and a request that would conflict with another owner
+ * fails with ERR_FSAL_DELAY.  Blocking locks are not offered.
+ *
+ * @param[in]  handle_pub       File to lock
+ * @param[in]  opctx            Request context, includes credentials
+ * @param[in]  owner            Lock owner
+ * @param[in]  lock_op          Operation to perform
+ * @param[in]  request_lock     Range and type requested
+ * @param[out] conflicting_lock The lock in the way, if any
+ *
+ * @return FSAL status.
+ */
+
+static fsal_status_t lock_op(struct fsal_obj_handle *handle_pub,
+			     const struct req_op_context *opctx,
+			     void *owner,
+			     fsal_lock_op_t lock_op,
+			     fsal_lock_param_t *request_lock,
+			     fsal_lock_param_t *conflicting_lock)
+{
+	struct mem_node *node = mem_handle_of(handle_pub)->node;
+	uint64_t start = request_lock->lock_start;
+	uint64_t end = UINT64_MAX;
+	struct mem_lock *lock = NULL, *spare = NULL, *held = NULL;
+	struct glist_head *glist;
+	fsal_status_t status = {ERR_FSAL_NO_ERROR, 0};
+
+	if (node->mn_attrs.type != REGULAR_FILE)
+		return fsalstat(ERR_FSAL_INVAL, 0);
+	if (lock_op == FSAL_OP_LOCKB || lock_op == FSAL_OP_CANCEL)
+		return fsalstat(ERR_FSAL_NOTSUPP, 0);
+	if (lock_op != FSAL_OP_UNLOCK &&
+	    request_lock->lock_type != FSAL_LOCK_R &&
+	    request_lock->lock_type != FSAL_LOCK_W)
+		return fsalstat(ERR_FSAL_NOTSUPP, 0);
+	if (lock_op == FSAL_OP_LOCKT && conflicting_lock == NULL)
+		return fsalstat(ERR_FSAL_FAULT, 0);
+
+	if (request_lock->lock_length != 0 &&
+	    request_lock->lock_length - 1 <= UINT64_MAX - start)
+		end = start + request_lock->lock_length - 1;
+
+	/* Allocate before changing anything */
+	if (lock_op != FSAL_OP_LOCKT) {
+		spare = gsh_malloc(sizeof(struct mem_lock));
+		if (lock_op == FSAL_OP_LOCK)
+			lock = gsh_malloc(sizeof(struct mem_lock));
+		if (spare == NULL ||
+		    (lock_op == FSAL_OP_LOCK && lock == NULL)) {
+			gsh_free(spare);
+			gsh_free(lock);
+			return fsalstat(ERR_FSAL_NOMEM, 0);
+		}
+	}
+
+	pthread_rwlock_wrlock(&node->mn_lock);
+	if (lock_op != FSAL_OP_UNLOCK) {
+		glist_for_each(glist, &node->mn_u.file.locks) {
+			held = glist_entry(glist, struct mem_lock, ml_list);
+			if (mem_lock_conflicts(held, owner,
+					       request_lock->lock_type,
+					       start, end))
+				break;
+			held = NULL;
+		}
+	}
+
+	if (held != NULL) {
+		if (conflicting_lock != NULL) {
+			conflicting_lock->lock_sle_type = FSAL_POSIX_LOCK;
+			conflicting_lock->lock_type = held->ml_type;
+			conflicting_lock->lock_start = held->ml_start;
+			conflicting_lock->lock_length =
+				held->ml_end == UINT64_MAX ? 0 :
+				held->ml_end - held->ml_start + 1;
+		}
+		if (lock_op == FSAL_OP_LOCK)
+			status.major = ERR_FSAL_DELAY;
+	} else {
+		if (conflicting_lock != NULL) {
+			conflicting_lock->lock_type = FSAL_NO_LOCK;
+			conflicting_lock->lock_start = 0;
+			conflicting_lock->lock_length = 0;
+		}
+		if (lock_op != FSAL_OP_LOCKT &&
+		    mem_unlock_range(node, owner, start, end, spare))
+			spare = NULL;
+		if (lock_op == FSAL_OP_LOCK) {
+			lock->ml_owner = owner;
+			lock->ml_type = request_lock->lock_type;
+			lock->ml_start = start;
+			lock->ml_end = end;
+			glist_add_tail(&node->mn_u.file.locks, &lock->ml_list);
+			lock = NULL;
+		}
+	}
+	pthread_rwlock_unlock(&node->mn_lock);
+
+	gsh_free(spare);
+	gsh_free(lock);
+	return status;
+}
+
+/**
+ * @brief Close a file
+ *
+ * @param[in] handle_pub File to close
+ *
+ * @return FSAL status.
+ */
+
+static fsal_status_t fsal_close(struct fsal_obj_handle *handle_pub)
+{
+	mem_handle_of(handle_pub)->openflags = FSAL_O_CLOSED;
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
+/**
+ * @brief Write wire handle
+ *
+ * @param[in]     handle_pub  Handle to digest
+ * @param[in]     output_type Type of digest requested
+ * @param[in,out] fh_desc     Location/size of buffer for
+ *                            digest/Length modified to digest length
+ *
+ * @return FSAL status.
+ */
+
+static fsal_status_t handle_digest(const struct fsal_obj_handle *handle_pub,
+				   uint32_t output_type,
+				   struct gsh_buffdesc *fh_desc)
+{
+	const struct mem_handle *handle =
+		container_of(handle_pub, const struct mem_handle, handle);
+
+	switch (output_type) {
+	/* Digested Handles */
+	case FSAL_DIGEST_NFSV2:
+	case FSAL_DIGEST_NFSV3:
+	case FSAL_DIGEST_NFSV4:
+		if (fh_desc->len < sizeof(handle->wire)) {
+			LogMajor(COMPONENT_FSAL,
+				 "digest_handle: space too small for "
+				 "handle.  Need %zu, have %zu",
+				 sizeof(handle->wire), fh_desc->len);
+			return fsalstat(ERR_FSAL_TOOSMALL, 0);
+		}
+		memcpy(fh_desc->addr, &handle->wire, sizeof(handle->wire));
+		fh_desc->len = sizeof(handle->wire);
+		break;
+
+	default:
+		return fsalstat(ERR_FSAL_SERVERFAULT, 0);
+	}
+
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
+/**
+ * @brief Give a hash key for file handle
+ *
+ * @param[in]  handle_pub The file whose key is to be found
+ * @param[out] fh_desc    Address and length of key
+ */
+
+static void handle_to_key(struct fsal_obj_handle *handle_pub,
+			  struct gsh_buffdesc *fh_desc)
+{
+	struct mem_handle *handle = mem_handle_of(handle_pub);
+
+	fh_desc->addr = &handle->wire;
+	fh_desc->len = sizeof(handle->wire);
+}
+
+/**
+ * @brief Override functions in ops vector
+ *
+ * @param[in] ops Handle operations vector
+ */
+
+void handle_ops_init(struct fsal_obj_ops *ops)
+{
+	ops->release = release;
+	ops->lookup = lookup;
+	ops->create = fsal_create;
+	ops->mkdir = fsal_mkdir;
+	ops->mknode = fsal_mknode;
+	ops->readdir = fsal_readdir;
+	ops->symlink = fsal_symlink;
+	ops->readlink = fsal_readlink;
+	ops->getattrs = getattrs;
+	ops->setattrs = setattrs;
+	ops->link = fsal_link;
+	ops->rename = fsal_rename;
+	ops->unlink = fsal_unlink;
+	ops->open = fsal_open;
+	ops->status = status;
+	ops->read = fsal_read;
+	ops->write = fsal_write;
+	ops->commit = commit;
+	ops->lock_op = lock_op;
+	ops->close = fsal_close;
+	ops->handle_digest = handle_digest;
+	ops->handle_to_key = handle_to_key;
+}
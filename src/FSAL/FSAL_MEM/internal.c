@@ -0,0 +1,585 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file   FSAL_MEM/internal.c
+ * @brief Nodes and directory entries of the in-memory FSAL
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "abstract_mem.h"
+#include "abstract_atomic.h"
+#include "fsal.h"
+#include "FSAL/fsal_commonlib.h"
+#include "internal.h"
+
+/**
+ * @brief Get the time for timestamps
+ *
+ * @param[out] ts The time
+ */
+
+void mem_now(struct timespec *ts)
+{
+	if (clock_gettime(CLOCK_REALTIME, ts) != 0)
+		memset(ts, 0, sizeof(*ts));
+}
+
+/**
+ * @brief FSAL status from a POSIX error
+ *
+ * @param[in] errorcode POSIX error, 0 for success
+ *
+ * @return FSAL status.
+ */
+
+fsal_status_t mem2fsal_error(int errorcode)
+{
+	fsal_status_t status;
+
+	status.minor = errorcode;
+
+	switch (errorcode) {
+	case 0:
+		status.major = ERR_FSAL_NO_ERROR;
+		break;
+	case ENOENT:
+		status.major = ERR_FSAL_NOENT;
+		break;
+	case ENOMEM:
+		status.major = ERR_FSAL_NOMEM;
+		break;
+	case EEXIST:
+		status.major = ERR_FSAL_EXIST;
+		break;
+	case ENOTDIR:
+		status.major = ERR_FSAL_NOTDIR;
+		break;
+	case EISDIR:
+		status.major = ERR_FSAL_ISDIR;
+		break;
+	case EINVAL:
+		status.major = ERR_FSAL_INVAL;
+		break;
+	case ENOSPC:
+		status.major = ERR_FSAL_NOSPC;
+		break;
+	case ENAMETOOLONG:
+		status.major = ERR_FSAL_NAMETOOLONG;
+		break;
+	case ENOTEMPTY:
+		status.major = ERR_FSAL_NOTEMPTY;
+		break;
+	case ESTALE:
+		status.major = ERR_FSAL_STALE;
+		break;
+	case EBUSY:
+		status.major = ERR_FSAL_DELAY;
+		break;
+	default:
+		status.major = ERR_FSAL_SERVERFAULT;
+		break;
+	}
+
+	return status;
+}
+
+static int mem_node_cmpf(const struct avltree_node *lhs,
+			 const struct avltree_node *rhs)
+{
+	const struct mem_node *lk =
+		avltree_container_of(lhs, struct mem_node, mn_fileid_node);
+	const struct mem_node *rk =
+		avltree_container_of(rhs, struct mem_node, mn_fileid_node);
+
+	if (lk->mn_fileid < rk->mn_fileid)
+		return -1;
+	return lk->mn_fileid > rk->mn_fileid;
+}
+
+static int mem_name_cmpf(const struct avltree_node *lhs,
+			 const struct avltree_node *rhs)
+{
+	const struct mem_dirent *lk =
+		avltree_container_of(lhs, struct mem_dirent, md_name_node);
+	const struct mem_dirent *rk =
+		avltree_container_of(rhs, struct mem_dirent, md_name_node);
+
+	return strcmp(lk->md_name, rk->md_name);
+}
+
+static int mem_cookie_cmpf(const struct avltree_node *lhs,
+			   const struct avltree_node *rhs)
+{
+	const struct mem_dirent *lk =
+		avltree_container_of(lhs, struct mem_dirent, md_cookie_node);
+	const struct mem_dirent *rk =
+		avltree_container_of(rhs, struct mem_dirent, md_cookie_node);
+
+	if (lk->md_cookie < rk->md_cookie)
+		return -1;
+	return lk->md_cookie > rk->md_cookie;
+}
+
+/**
+ * @brief Set up the node tree of a new export
+ *
+ * @param[in,out] export The export
+ */
+
+void mem_export_init(struct mem_export *export)
+{
+	pthread_rwlock_init(&export->nodes_lock, NULL);
+	pthread_mutex_init(&export->rename_lock, NULL);
+	avltree_init(&export->nodes, mem_node_cmpf, 0);
+	export->next_fileid = 1;
+}
+
+/**
+ * @brief Create a node
+ *
+ * The node is entered in the export but in no directory; the caller
+ * gets the only reference.  Its mode, owner, group and, for special
+ * files, device are taken from attrib.  The parent of a directory and
+ * the target of a link are left for the caller.
+ *
+ * @param[in] export The export
+ * @param[in] type   Type of the object
+ * @param[in] attrib Initial attributes
+ *
+ * @return The node or NULL if out of memory.
+ */
+
+struct mem_node *mem_node_new(struct mem_export *export,
+			      object_file_type_t type,
+			      const struct attrlist *attrib)
+{
+	struct mem_node *node = gsh_calloc(1, sizeof(struct mem_node));
+	struct attrlist *attrs;
+
+	if (node == NULL)
+		return NULL;
+
+	node->mn_refs = 1;
+	pthread_rwlock_init(&node->mn_lock, NULL);
+	node->mn_fileid = atomic_postinc_uint64_t(&export->next_fileid);
+
+	attrs = &node->mn_attrs;
+	attrs->mask = MEM_SUPPORTED_ATTRIBUTES;
+	attrs->type = type;
+	attrs->fsid = export->fsid;
+	attrs->fileid = node->mn_fileid;
+	attrs->mode = attrib->mode & MEM_MODE_BITS;
+	attrs->owner = attrib->owner;
+	attrs->group = attrib->group;
+	attrs->numlinks = type == DIRECTORY ? 2 : 1;
+	if (type == CHARACTER_FILE || type == BLOCK_FILE)
+		attrs->rawdev = attrib->rawdev;
+	mem_now(&attrs->ctime);
+	attrs->atime = attrs->ctime;
+	attrs->mtime = attrs->ctime;
+	attrs->creation = attrs->ctime;
+	attrs->chgtime = attrs->ctime;
+	attrs->change = 1;
+
+	switch (type) {
+	case DIRECTORY:
+		avltree_init(&node->mn_u.dir.by_name, mem_name_cmpf, 0);
+		avltree_init(&node->mn_u.dir.by_cookie, mem_cookie_cmpf, 0);
+		node->mn_u.dir.next_cookie = MEM_FIRST_COOKIE;
+		node->mn_u.dir.parent = node->mn_fileid;
+		break;
+	case REGULAR_FILE:
+		init_glist(&node->mn_u.file.locks);
+		break;
+	default:
+		break;
+	}
+
+	pthread_rwlock_wrlock(&export->nodes_lock);
+	avltree_insert(&node->mn_fileid_node, &export->nodes);
+	export->files++;
+	pthread_rwlock_unlock(&export->nodes_lock);
+
+	return node;
+}
+
+/**
+ * @brief Free a node, which must be out of the export
+ *
+ * The entries of a directory are freed without touching the nodes
+ * they name, which is only right when the whole export goes.
+ */
+
+static void mem_node_free(struct mem_node *node)
+{
+	struct avltree_node *n;
+	struct glist_head *glist, *glistn;
+	uint64_t i;
+
+	switch (node->mn_attrs.type) {
+	case DIRECTORY:
+		while ((n = avltree_first(&node->mn_u.dir.by_name)) != NULL) {
+			struct mem_dirent *dirent =
+				avltree_container_of(n, struct mem_dirent,
+						     md_name_node);
+
+			avltree_remove(n, &node->mn_u.dir.by_name);
+			avltree_remove(&dirent->md_cookie_node,
+				       &node->mn_u.dir.by_cookie);
+			gsh_free(dirent);
+		}
+		break;
+	case REGULAR_FILE:
+		for (i = 0; i < node->mn_u.file.npages; i++)
+			gsh_free(node->mn_u.file.pages[i]);
+		gsh_free(node->mn_u.file.pages);
+		glist_for_each_safe(glist, glistn, &node->mn_u.file.locks) {
+			glist_del(glist);
+			gsh_free(glist_entry(glist, struct mem_lock, ml_list));
+		}
+		break;
+	case SYMBOLIC_LINK:
+		gsh_free(node->mn_u.link);
+		break;
+	default:
+		break;
+	}
+	pthread_rwlock_destroy(&node->mn_lock);
+	gsh_free(node);
+}
+
+/**
+ * @brief Take a reference on a node
+ *
+ * The caller must already hold one, directly or through the entry
+ * it found the node by while holding the directory lock.
+ */
+
+void mem_node_get(struct mem_node *node)
+{
+	atomic_inc_int32_t(&node->mn_refs);
+}
+
+/**
+ * @brief Drop a reference on a node, freeing it if it was the last
+ *
+ * The last reference is only dropped under the export's node lock,
+ * so mem_node_find never returns a node on its way out.
+ *
+ * @param[in] export The export
+ * @param[in] node   The node
+ */
+
+void mem_node_put(struct mem_export *export, struct mem_node *node)
+{
+	int32_t refs;
+
+	for (;;) {
+		refs = atomic_fetch_int32_t(&node->mn_refs);
+		if (refs <= 1)
+			break;
+		if (__sync_bool_compare_and_swap(&node->mn_refs, refs,
+						 refs - 1))
+			return;
+	}
+
+	pthread_rwlock_wrlock(&export->nodes_lock);
+	if (atomic_dec_int32_t(&node->mn_refs) != 0) {
+		pthread_rwlock_unlock(&export->nodes_lock);
+		return;
+	}
+	avltree_remove(&node->mn_fileid_node, &export->nodes);
+	export->files--;
+	pthread_rwlock_unlock(&export->nodes_lock);
+
+	if (node->mn_attrs.type == REGULAR_FILE)
+		atomic_sub_uint64_t(&export->bytes,
+				    node->mn_u.file.allocated *
+				    MEM_PAGE_SIZE);
+	mem_node_free(node);
+}
+
+/**
+ * @brief Find a node by fileid
+ *
+ * @param[in] export The export
+ * @param[in] fileid Its fileid
+ *
+ * @return The node, referenced, or NULL if there is none.
+ */
+
+struct mem_node *mem_node_find(struct mem_export *export, uint64_t fileid)
+{
+	struct mem_node key, *node = NULL;
+	struct avltree_node *n;
+
+	key.mn_fileid = fileid;
+	pthread_rwlock_rdlock(&export->nodes_lock);
+	n = avltree_lookup(&key.mn_fileid_node, &export->nodes);
+	if (n != NULL) {
+		node = avltree_container_of(n, struct mem_node,
+					    mn_fileid_node);
+		mem_node_get(node);
+	}
+	pthread_rwlock_unlock(&export->nodes_lock);
+
+	return node;
+}
+
+/**
+ * @brief Record a change to a node
+ *
+ * Called with the node write locked.
+ *
+ * @param[in,out] node The node
+ * @param[in]     data True if its contents changed as well
+ */
+
+void mem_node_changed(struct mem_node *node, bool data)
+{
+	struct attrlist *attrs = &node->mn_attrs;
+
+	mem_now(&attrs->ctime);
+	attrs->chgtime = attrs->ctime;
+	if (data)
+		attrs->mtime = attrs->ctime;
+	attrs->change++;
+	if (attrs->type == DIRECTORY)
+		attrs->filesize =
+			avltree_size(&node->mn_u.dir.by_name);
+}
+
+/**
+ * @brief Return true if a directory has no entries
+ *
+ * Called with the directory locked.
+ */
+
+bool mem_dir_empty(struct mem_node *dir)
+{
+	return avltree_size(&dir->mn_u.dir.by_name) == 0;
+}
+
+/**
+ * @brief Find an entry by name
+ *
+ * Called with the directory locked.
+ *
+ * @return The entry or NULL.
+ */
+
+struct mem_dirent *mem_dirent_lookup(struct mem_node *dir, const char *name)
+{
+	struct avltree_node *n;
+	struct mem_dirent *key;
+	size_t len = strlen(name);
+	char buf[sizeof(struct mem_dirent) + MEM_MAXNAMLEN + 1]
+		__attribute__((aligned(sizeof(void *))));
+
+	if (len > MEM_MAXNAMLEN)
+		return NULL;
+	key = (struct mem_dirent *)buf;
+	memcpy(key->md_name, name, len + 1);
+	n = avltree_lookup(&key->md_name_node, &dir->mn_u.dir.by_name);
+
+	return n == NULL ? NULL :
+		avltree_container_of(n, struct mem_dirent, md_name_node);
+}
+
+/**
+ * @brief Find the first entry after a cookie
+ *
+ * Entries get increasing cookies, so a readdir resumed from the
+ * cookie of an entry since removed still picks up where it left off.
+ * Called with the directory locked.
+ *
+ * @return The entry with the least cookie above the one given, or
+ *         NULL if there is none.
+ */
+
+struct mem_dirent *mem_dirent_after(struct mem_node *dir, uint64_t cookie)
+{
+	struct avltree_node *n = dir->mn_u.dir.by_cookie.root;
+	struct mem_dirent *dirent, *best = NULL;
+
+	while (n != NULL) {
+		dirent = avltree_container_of(n, struct mem_dirent,
+					      md_cookie_node);
+		if (dirent->md_cookie > cookie) {
+			best = dirent;
+			n = n->left;
+		} else {
+			n = n->right;
+		}
+	}
+
+	return best;
+}
+
+/**
+ * @brief Add an entry to a directory
+ *
+ * The entry takes a reference on the node.  Called with the directory
+ * write locked.
+ *
+ * @param[in,out] dir  The directory
+ * @param[in]     name Name of the new entry
+ * @param[in]     node Object it names
+ *
+ * @return 0, -EEXIST, -ENAMETOOLONG or -ENOMEM.
+ */
+
+int mem_dirent_add(struct mem_node *dir, const char *name,
+		   struct mem_node *node)
+{
+	size_t len = strlen(name);
+	struct mem_dirent *dirent;
+
+	if (len > MEM_MAXNAMLEN)
+		return -ENAMETOOLONG;
+	dirent = gsh_malloc(sizeof(struct mem_dirent) + len + 1);
+	if (dirent == NULL)
+		return -ENOMEM;
+	memcpy(dirent->md_name, name, len + 1);
+	if (avltree_insert(&dirent->md_name_node,
+			   &dir->mn_u.dir.by_name) != NULL) {
+		gsh_free(dirent);
+		return -EEXIST;
+	}
+	dirent->md_cookie = dir->mn_u.dir.next_cookie++;
+	avltree_insert(&dirent->md_cookie_node, &dir->mn_u.dir.by_cookie);
+	dirent->md_node = node;
+	mem_node_get(node);
+
+	return 0;
+}
+
+/**
+ * @brief Remove an entry from a directory
+ *
+ * The caller inherits the entry's reference on its node, and drops
+ * it once done with the node.  Called with the directory write
+ * locked.
+ */
+
+void mem_dirent_del(struct mem_node *dir, struct mem_dirent *dirent)
+{
+	avltree_remove(&dirent->md_name_node, &dir->mn_u.dir.by_name);
+	avltree_remove(&dirent->md_cookie_node, &dir->mn_u.dir.by_cookie);
+	gsh_free(dirent);
+}
+
+/**
+ * @brief Return true if node is dir or a directory above it
+ *
+ * Parents only change under the rename lock, which the caller holds.
+ *
+ * @param[in] export The export
+ * @param[in] dir    The directory to start from
+ * @param[in] node   The node looked for
+ */
+
+bool mem_is_ancestor(struct mem_export *export, struct mem_node *dir,
+		     struct mem_node *node)
+{
+	uint64_t fileid = dir->mn_fileid;
+	struct mem_node *cur;
+
+	for (;;) {
+		if (fileid == node->mn_fileid)
+			return true;
+		if (fileid == export->root->mn_fileid)
+			return false;
+		cur = mem_node_find(export, fileid);
+		if (cur == NULL)
+			return false;
+		fileid = cur->mn_u.dir.parent;
+		mem_node_put(export, cur);
+	}
+}
+
+/**
+ * @brief Free every node of an export
+ *
+ * Called once no handle is left.
+ *
+ * @param[in,out] export The export
+ */
+
+void mem_export_destroy(struct mem_export *export)
+{
+	struct avltree_node *n;
+
+	while ((n = avltree_first(&export->nodes)) != NULL) {
+		avltree_remove(n, &export->nodes);
+		mem_node_free(avltree_container_of(n, struct mem_node,
+						   mn_fileid_node));
+	}
+	export->root = NULL;
+	pthread_rwlock_destroy(&export->nodes_lock);
+	pthread_mutex_destroy(&export->rename_lock);
+}
+
+/**
+ * @brief Construct a new handle
+ *
+ * The handle takes over the caller's reference on the node and
+ * starts with its current attributes.
+ *
+ * @param[in]  export The export
+ * @param[in]  node   Object the handle is for
+ * @param[out] obj    The handle
+ *
+ * @return 0 on success, negative error codes on failure.
+ */
+
+int mem_handle_new(struct mem_export *export, struct mem_node *node,
+		   struct mem_handle **obj)
+{
+	struct mem_handle *constructing;
+	int rc;
+
+	*obj = NULL;
+	constructing = gsh_calloc(1, sizeof(struct mem_handle));
+	if (constructing == NULL)
+		return -ENOMEM;
+
+	constructing->node = node;
+	constructing->wire.fileid = node->mn_fileid;
+	pthread_rwlock_rdlock(&node->mn_lock);
+	constructing->handle.attributes = node->mn_attrs;
+	pthread_rwlock_unlock(&node->mn_lock);
+
+	rc = -fsal_obj_handle_init(&constructing->handle, &export->export,
+				   node->mn_attrs.type);
+	if (rc < 0) {
+		gsh_free(constructing);
+		return rc;
+	}
+
+	*obj = constructing;
+	return 0;
+}
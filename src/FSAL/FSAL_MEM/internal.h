@@ -0,0 +1,199 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file   FSAL_MEM/internal.h
+ * @brief Internal declarations for the in-memory FSAL
+ *
+ * The in-memory FSAL keeps a tree of objects, with the contents of
+ * regular files, entirely in memory.  It exists so the protocol
+ * layers, cache_inode and SAL can be measured without a filesystem
+ * underneath them: every operation costs a lock and a few tree
+ * walks, and nothing ever waits on a disk or a network.  Nothing
+ * survives the export.
+ *
+ * A node is the object itself and a handle is a reference to it.
+ * Each lookup makes a new handle, each directory entry and each
+ * handle holds a reference on its node, and a node goes away when it
+ * has neither.  Nodes are found by fileid in a tree kept by the
+ * export; the fileid is the whole of the wire handle.
+ *
+ * Each node has a read-write lock protecting its attributes and, for
+ * a directory, its entries or, for a file, its data and byte-range
+ * locks.  A directory is locked before the objects in it.  Renames
+ * between directories also take the export's rename lock, so that
+ * whether one directory is inside the other cannot change while the
+ * two are being locked, ancestor first.  The export's node tree lock
+ * is never held while taking a node lock.
+ */
+
+#ifndef FSAL_MEM_INTERNAL_H
+#define FSAL_MEM_INTERNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "fsal.h"
+#include "fsal_types.h"
+#include "fsal_api.h"
+#include "avltree.h"
+#include "nlm_list.h"
+
+/** Data of regular files is kept in pages of this many bytes */
+#define MEM_PAGE_SIZE (64 * 1024)
+
+/** Longest name in a directory */
+#define MEM_MAXNAMLEN 255
+
+/** First cookie given out in a directory, 0 to 2 being reserved */
+#define MEM_FIRST_COOKIE 3
+
+/** Permission bits kept in the mode */
+#define MEM_MODE_BITS 07777
+
+/** Major part of the fsid of every export, "MEM" */
+#define MEM_FSID_MAJOR 0x4d454dULL
+
+/** Attributes this FSAL supplies */
+#define MEM_SUPPORTED_ATTRIBUTES (ATTRS_POSIX | ATTR_CHGTIME)
+
+/** Attributes this FSAL can set */
+#define MEM_SETTABLE_ATTRIBUTES (ATTR_MODE | ATTR_OWNER | ATTR_GROUP | \
+				 ATTR_ATIME | ATTR_CTIME | ATTR_MTIME | \
+				 ATTR_SIZE | ATTR_MTIME_SERVER |	\
+				 ATTR_ATIME_SERVER)
+
+/**
+ * @brief A byte-range lock held on a file
+ */
+
+struct mem_lock {
+	struct glist_head ml_list; /*< Link in the file's locks */
+	void *ml_owner; /*< Owner as given by SAL, NULL if none */
+	fsal_lock_t ml_type; /*< FSAL_LOCK_R or FSAL_LOCK_W */
+	uint64_t ml_start; /*< First byte */
+	uint64_t ml_end; /*< Last byte, UINT64_MAX to end of file */
+};
+
+/**
+ * @brief An object of the filesystem
+ */
+
+struct mem_node {
+	struct avltree_node mn_fileid_node; /*< Link in the export's nodes */
+	uint64_t mn_fileid; /*< Fileid, also the wire handle */
+	int32_t mn_refs; /*< Entries and handles pointing here */
+	pthread_rwlock_t mn_lock; /*< Protects everything below */
+	struct attrlist mn_attrs; /*< Attributes, without the ACL */
+	union {
+		struct {
+			struct avltree by_name; /*< Entries by name */
+			struct avltree by_cookie; /*< Entries by cookie */
+			uint64_t next_cookie; /*< Cookie of the next entry */
+			uint64_t parent; /*< Fileid of the parent */
+		} dir;
+		struct {
+			char **pages; /*< Data, NULL for a hole */
+			uint64_t npages; /*< Length of pages */
+			uint64_t allocated; /*< Pages not NULL */
+			struct glist_head locks; /*< Byte-range locks */
+		} file;
+		char *link; /*< Target of a symbolic link */
+	} mn_u;
+};
+
+/**
+ * @brief A name in a directory
+ */
+
+struct mem_dirent {
+	struct avltree_node md_name_node; /*< Link in by_name */
+	struct avltree_node md_cookie_node; /*< Link in by_cookie */
+	uint64_t md_cookie; /*< Readdir cookie */
+	struct mem_node *md_node; /*< Object named, referenced */
+	char md_name[]; /*< The name */
+};
+
+/**
+ * @brief In-memory private export object
+ */
+
+struct mem_export {
+	struct fsal_export export; /*< The public export object */
+	char *path; /*< The path exported, resolved to the root */
+	struct mem_node *root; /*< Root directory, referenced */
+	fsal_fsid_t fsid; /*< Filesystem id of every object */
+	pthread_rwlock_t nodes_lock; /*< Protects nodes */
+	struct avltree nodes; /*< Every node by fileid */
+	uint64_t next_fileid; /*< Fileid of the next node */
+	uint64_t bytes; /*< Memory held in file pages */
+	uint64_t files; /*< Nodes in existence */
+	pthread_mutex_t rename_lock; /*< Serializes cross-directory renames */
+};
+
+/**
+ * The portion of a handle that is sent over the wire
+ */
+
+struct __attribute__((packed)) mem_wire {
+	uint64_t fileid;
+};
+
+/**
+ * @brief In-memory private object handle
+ */
+
+struct mem_handle {
+	struct fsal_obj_handle handle; /*< The public handle */
+	struct mem_wire wire; /*< The wire handle */
+	struct mem_node *node; /*< The object, referenced */
+	fsal_openflags_t openflags; /*< Mode the file was opened in */
+};
+
+/* Prototypes */
+
+void mem_now(struct timespec *ts);
+fsal_status_t mem2fsal_error(int errorcode);
+void mem_export_init(struct mem_export *export);
+struct mem_node *mem_node_new(struct mem_export *export,
+			      object_file_type_t type,
+			      const struct attrlist *attrib);
+void mem_node_get(struct mem_node *node);
+void mem_node_put(struct mem_export *export, struct mem_node *node);
+struct mem_node *mem_node_find(struct mem_export *export, uint64_t fileid);
+void mem_node_changed(struct mem_node *node, bool data);
+bool mem_dir_empty(struct mem_node *dir);
+struct mem_dirent *mem_dirent_lookup(struct mem_node *dir, const char *name);
+struct mem_dirent *mem_dirent_after(struct mem_node *dir, uint64_t cookie);
+int mem_dirent_add(struct mem_node *dir, const char *name,
+		   struct mem_node *node);
+void mem_dirent_del(struct mem_node *dir, struct mem_dirent *dirent);
+bool mem_is_ancestor(struct mem_export *export, struct mem_node *dir,
+		     struct mem_node *node);
+void mem_export_destroy(struct mem_export *export);
+int mem_handle_new(struct mem_export *export, struct mem_node *node,
+		   struct mem_handle **obj);
+void export_ops_init(struct export_ops *ops);
+void handle_ops_init(struct fsal_obj_ops *ops);
+
+#endif /* !FSAL_MEM_INTERNAL_H */
@@ -0,0 +1,207 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file   FSAL_MEM/main.c
+ * @brief Module functions of the in-memory FSAL
+ *
+ * Each export gets a tree of its own, starting out as an empty root
+ * directory owned by root with mode 0777.  The export options are
+ * not used.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "fsal.h"
+#include "fsal_types.h"
+#include "FSAL/fsal_init.h"
+#include "FSAL/fsal_commonlib.h"
+#include "fsal_api.h"
+#include "abstract_mem.h"
+#include "abstract_atomic.h"
+#include "internal.h"
+
+/**
+ * A local copy of the handle for this module, so it can be disposed
+ * of.
+ */
+static struct fsal_module *module = NULL;
+
+/**
+ * The name of this module.
+ */
+static const char *module_name = "MEM";
+
+/**
+ * Exports created so far, the minor part of the next fsid
+ */
+static uint64_t mem_exports;
+
+/**
+ * @brief Create a new export under this FSAL
+ *
+ * @param[in]     module_in  The supplied module handle
+ * @param[in]     path       The path to export
+ * @param[in]     options    Export specific options for the FSAL
+ * @param[in,out] list_entry Our entry in the export list
+ * @param[in]     next_fsal  Next stacked FSAL
+ * @param[in]     up_ops     Upcall operations
+ * @param[out]    pub_export Newly created FSAL export object
+ *
+ * @return FSAL status.
+ */
+
+static fsal_status_t create_export(struct fsal_module *module_in,
+				   const char *path,
+				   const char *options,
+				   struct exportlist *list_entry,
+				   struct fsal_module *next_fsal,
+				   const struct fsal_up_vector *up_ops,
+				   struct fsal_export **pub_export)
+{
+	fsal_status_t status = {ERR_FSAL_NO_ERROR, 0};
+	struct mem_export *export = NULL;
+	struct attrlist root_attrs;
+	size_t len;
+
+	if ((path == NULL) || (strlen(path) == 0)) {
+		status.major = ERR_FSAL_INVAL;
+		LogCrit(COMPONENT_FSAL, "No path to export.");
+		return status;
+	}
+
+	if (next_fsal != NULL) {
+		status.major = ERR_FSAL_INVAL;
+		LogCrit(COMPONENT_FSAL, "Stacked FSALs unsupported.");
+		return status;
+	}
+
+	export = gsh_calloc(1, sizeof(struct mem_export));
+	if (export == NULL) {
+		status.major = ERR_FSAL_NOMEM;
+		LogCrit(COMPONENT_FSAL,
+			"Unable to allocate export object for %s.", path);
+		return status;
+	}
+
+	if (fsal_export_init(&export->export, list_entry) != 0) {
+		status.major = ERR_FSAL_NOMEM;
+		LogCrit(COMPONENT_FSAL,
+			"Unable to allocate export ops vectors for %s.", path);
+		gsh_free(export);
+		return status;
+	}
+	export_ops_init(export->export.ops);
+	handle_ops_init(export->export.obj_ops);
+	export->export.up_ops = up_ops;
+
+	mem_export_init(export);
+	export->fsid.major = MEM_FSID_MAJOR;
+	export->fsid.minor = atomic_postinc_uint64_t(&mem_exports);
+
+	/* The root is the path without its trailing slashes */
+	export->path = gsh_strdup(path);
+	if (export->path == NULL) {
+		status.major = ERR_FSAL_NOMEM;
+		goto error;
+	}
+	for (len = strlen(export->path);
+	     len > 1 && export->path[len - 1] == '/'; len--)
+		export->path[len - 1] = '\0';
+
+	memset(&root_attrs, 0, sizeof(root_attrs));
+	root_attrs.mode = 0777;
+	export->root = mem_node_new(export, DIRECTORY, &root_attrs);
+	if (export->root == NULL) {
+		status.major = ERR_FSAL_NOMEM;
+		goto error;
+	}
+
+	if (fsal_attach_export(module_in, &export->export.exports) != 0) {
+		status.major = ERR_FSAL_SERVERFAULT;
+		LogCrit(COMPONENT_FSAL, "Unable to attach export.");
+		goto error;
+	}
+	export->export.fsal = module_in;
+
+	*pub_export = &export->export;
+	return status;
+
+error:
+	mem_export_destroy(export);
+	gsh_free(export->path);
+	free_export_ops(&export->export);
+	pthread_mutex_destroy(&export->export.lock);
+	gsh_free(export);
+	return status;
+}
+
+/**
+ * @brief Initialize and register the FSAL
+ *
+ * This function initializes the FSAL module handle.  There is no
+ * per-module data beyond it.
+ */
+
+MODULE_INIT void init(void)
+{
+	/* register_fsal seems to expect zeroed memory. */
+	module = gsh_calloc(1, sizeof(struct fsal_module));
+	if (module == NULL) {
+		LogCrit(COMPONENT_FSAL,
+			"Unable to allocate memory for MEM FSAL module.");
+		return;
+	}
+
+	if (register_fsal(module, module_name, FSAL_MAJOR_VERSION,
+			  FSAL_MINOR_VERSION) != 0) {
+		/* The register_fsal function prints its own log
+		   message if it fails */
+		gsh_free(module);
+		module = NULL;
+		LogCrit(COMPONENT_FSAL, "MEM module failed to register.");
+		return;
+	}
+
+	/* Set up module operations */
+	module->ops->create_export = create_export;
+}
+
+/**
+ * @brief Release FSAL resources
+ *
+ * This function unregisters the FSAL and frees its module handle.
+ */
+
+MODULE_FINI void finish(void)
+{
+	if (unregister_fsal(module) != 0) {
+		LogCrit(COMPONENT_FSAL,
+			"Unable to unload FSAL.  Dying with extreme "
+			"prejudice.");
+		abort();
+	}
+
+	gsh_free(module);
+	module = NULL;
+}
@@ -118,6 +118,8 @@ static fsal_status_t release(struct fsal_export *exp_hdl)
 	}
 	fsal_detach_export(exp_hdl->fsal, &exp_hdl->exports);
 	free_export_ops(exp_hdl);
+	vfs_sync_report(myself);
+	vfs_sync_group_destroy(&myself->fs_sync);
 	if(myself->root_fd >= 0)
 		close(myself->root_fd);
 	if(myself->root_handle != NULL)
@@ -555,6 +557,7 @@ fsal_status_t vfs_create_export(struct fsal_module *fsal_hdl,
 #endif
         struct vfs_exp_handle_ops *hops = &defops;
 	char type[MAXNAMLEN + 1];
+	char group_commit[8] = "";
 	int retval = 0;
 	fsal_errors_t fsal_error = ERR_FSAL_NO_ERROR;
 
@@ -591,6 +594,18 @@ fsal_status_t vfs_create_export(struct fsal_module *fsal_hdl,
 	vfs_handle_ops_init(myself->export.obj_ops);
         myself->export.up_ops = up_ops;
 
+	vfs_sync_group_init(&myself->fs_sync);
+	if(fs_specific_has(fs_specific, "group_commit",
+			   group_commit, sizeof(group_commit) - 1)) {
+		if(strcmp(group_commit, "fs") == 0) {
+			myself->sync_fs = true;
+		} else if(strcmp(group_commit, "file") != 0) {
+			LogCrit(COMPONENT_FSAL,
+				"Unknown group_commit=%s for [%s], "
+				"using file", group_commit, export_path);
+		}
+	}
+
 	myself->pnfs_panfs_enabled = fs_specific_has(fs_specific, "pnfs_panfs",
 						     NULL, 0);
 	if (myself->pnfs_panfs_enabled) {
@@ -769,6 +784,7 @@ errout:
 	if(myself->fs_spec != NULL)
 		gsh_free(myself->fs_spec);
 	free_export_ops(&myself->export);
+	vfs_sync_group_destroy(&myself->fs_sync);
 	pthread_mutex_unlock(&myself->export.lock);
 	pthread_mutex_destroy(&myself->export.lock);
 	gsh_free(myself);  /* elvis has left the building */
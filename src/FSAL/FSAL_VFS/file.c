@@ -162,7 +162,7 @@ out:
 
 /* vfs_commit
  * Commit a file range to storage.
- * for right now, fsync will have to do.
+ * Concurrent commits to the same file share one flush, see vfs_sync.c.
  */
 
 fsal_status_t vfs_commit(struct fsal_obj_handle *obj_hdl, /* sync */
@@ -170,22 +170,93 @@ fsal_status_t vfs_commit(struct fsal_obj_handle *obj_hdl, /* sync */
 			 size_t len)
 {
 	struct vfs_fsal_obj_handle *myself;
+	struct vfs_fsal_export *exp;
 	fsal_errors_t fsal_error = ERR_FSAL_NO_ERROR;
 	int retval = 0;
 
 	myself = container_of(obj_hdl, struct vfs_fsal_obj_handle, obj_handle);
+	exp = container_of(obj_hdl->export, struct vfs_fsal_export, export);
 
 	assert(myself->u.file.fd >= 0 &&
 	       myself->u.file.openflags != FSAL_O_CLOSED);
 
-	retval = fsync(myself->u.file.fd);
-	if(retval == -1) {
-		retval = errno;
+	retval = vfs_sync_commit(exp,
+				 exp->sync_fs ? &exp->fs_sync
+					      : &myself->u.file.sync,
+				 myself->u.file.fd, offset, len);
+	if(retval != 0)
 		fsal_error = posix2fsal_error(retval);
-	}
 	return fsalstat(fsal_error, retval);	
 }
 
+/* vfs_prefetch
+ * Start reading a range into the page cache without waiting for it.
+ */
+
+fsal_status_t vfs_prefetch(struct fsal_obj_handle *obj_hdl,
+			   uint64_t offset,
+			   size_t len)
+{
+	struct vfs_fsal_obj_handle *myself;
+	fsal_errors_t fsal_error = ERR_FSAL_NO_ERROR;
+	int retval = 0;
+
+	myself = container_of(obj_hdl, struct vfs_fsal_obj_handle, obj_handle);
+
+	assert(myself->u.file.fd >= 0 &&
+	       myself->u.file.openflags != FSAL_O_CLOSED);
+
+	retval = posix_fadvise(myself->u.file.fd, offset, len,
+			       POSIX_FADV_WILLNEED);
+	if(retval != 0)
+		fsal_error = posix2fsal_error(retval);
+	return fsalstat(fsal_error, retval);
+}
+
+/* vfs_read_fd
+ * Work out how much of the range there is to read and hand back a
+ * duplicate of our descriptor to send it from.  The duplicate stays
+ * valid after cache inode closes or reaps the file.
+ */
+
+fsal_status_t vfs_read_fd(struct fsal_obj_handle *obj_hdl,
+			  uint64_t offset,
+			  size_t buffer_size,
+			  int *fd,
+			  size_t *read_amount,
+			  bool *end_of_file)
+{
+	struct vfs_fsal_obj_handle *myself;
+	struct stat st;
+	int retval = 0;
+
+	myself = container_of(obj_hdl, struct vfs_fsal_obj_handle, obj_handle);
+
+	assert(myself->u.file.fd >= 0 &&
+	       myself->u.file.openflags != FSAL_O_CLOSED);
+
+	if(fstat(myself->u.file.fd, &st) < 0) {
+		retval = errno;
+		return fsalstat(posix2fsal_error(retval), retval);
+	}
+	*fd = -1;
+	if(offset >= st.st_size) {
+		*read_amount = 0;
+		*end_of_file = true;
+		return fsalstat(ERR_FSAL_NO_ERROR, 0);
+	}
+	*read_amount = MIN(buffer_size, st.st_size - offset);
+	*end_of_file = (offset + *read_amount >= st.st_size);
+
+	*fd = fcntl(myself->u.file.fd, F_DUPFD_CLOEXEC, 0);
+	if(*fd < 0) {
+		retval = errno;
+		*read_amount = 0;
+		return fsalstat(posix2fsal_error(retval), retval);
+	}
+	return fsalstat(ERR_FSAL_NO_ERROR, 0);
+}
+
 /* vfs_lock_op
  * lock a region of the file
  * throw an error if the fd is not open.  The old fsal didn't
@@ -342,6 +413,8 @@ fsal_status_t vfs_lru_cleanup(struct fsal_obj_handle *obj_hdl,
 	int retval = 0;
 
 	myself = container_of(obj_hdl, struct vfs_fsal_obj_handle, obj_handle);
+	if(obj_hdl->type == DIRECTORY && (requests & LRU_CLOSE_FILES))
+		vfs_fdcache_drop(myself);
 	if(obj_hdl->type == REGULAR_FILE && myself->u.file.fd >= 0) {
 		retval = close(myself->u.file.fd);
 		myself->u.file.fd = -1;
@@ -102,9 +102,12 @@ static struct vfs_fsal_obj_handle *alloc_handle(int dirfd,
 	hdl->handle = (vfs_file_handle_t *)&hdl[1];
 	memcpy(hdl->handle, fh, sizeof(vfs_file_handle_t));
 	hdl->obj_handle.type = posix2fsal_type(stat->st_mode);
+	hdl->fdc.path_fd = -1;
+	hdl->fdc.dir_fd = -1;
 	if(hdl->obj_handle.type == REGULAR_FILE) {
 		hdl->u.file.fd = -1;  /* no open on this yet */
 		hdl->u.file.openflags = FSAL_O_CLOSED;
+		vfs_sync_group_init(&hdl->u.file.sync);
 	} else if(hdl->obj_handle.type == SYMBOLIC_LINK) {
                 ssize_t retlink;
 		size_t len = stat->st_size + 1;
@@ -157,7 +160,9 @@ static struct vfs_fsal_obj_handle *alloc_handle(int dirfd,
 	pthread_mutex_unlock(&hdl->obj_handle.lock);
 	pthread_mutex_destroy(&hdl->obj_handle.lock);
 spcerr:
-	if(hdl->obj_handle.type == SYMBOLIC_LINK) {
+	if(hdl->obj_handle.type == REGULAR_FILE) {
+		vfs_sync_group_destroy(&hdl->u.file.sync);
+	} else if(hdl->obj_handle.type == SYMBOLIC_LINK) {
 		if(hdl->u.symlink.link_content != NULL)
 			gsh_free(hdl->u.symlink.link_content);
         } else if(vfs_unopenable_type(hdl->obj_handle.type)) {
@@ -199,7 +204,7 @@ static fsal_status_t lookup(struct fsal_obj_handle *parent,
 			parent);
 		return fsalstat(ERR_FSAL_NOTDIR, 0);
 	}
-	dirfd = vfs_fsal_open(parent_hdl, O_PATH|O_NOACCESS, &fsal_error);
+	dirfd = vfs_fdcache_get(parent_hdl, O_PATH|O_NOACCESS, &fsal_error);
 	if(dirfd < 0) {
 		return fsalstat(fsal_error, -dirfd);
 	}
@@ -217,7 +222,7 @@ static fsal_status_t lookup(struct fsal_obj_handle *parent,
 	/* allocate an obj_handle and fill it up */
 	hdl = alloc_handle(dirfd, fh, &stat, parent_hdl->handle, path,
 			   parent->export);
-	close(dirfd);
+	vfs_fdcache_put(parent_hdl, O_PATH|O_NOACCESS, dirfd);
 	if(hdl == NULL) {
 		retval = ENOMEM;
 		goto hdlerr;
@@ -226,7 +231,7 @@ static fsal_status_t lookup(struct fsal_obj_handle *parent,
 	return fsalstat(ERR_FSAL_NO_ERROR, 0);
 
 direrr:
-	close(dirfd);
+	vfs_fdcache_put(parent_hdl, O_PATH|O_NOACCESS, dirfd);
 hdlerr:
 	fsal_error = posix2fsal_error(retval);
 	return fsalstat(fsal_error, retval);	
@@ -326,7 +331,7 @@ static fsal_status_t create(struct fsal_obj_handle *dir_hdl,
 	group = attrib->group;
 	unix_mode = fsal2unix_mode(attrib->mode)
 		& ~dir_hdl->export->ops->fs_umask(dir_hdl->export);
-	dir_fd = vfs_fsal_open(myself, flags, &fsal_error);
+	dir_fd = vfs_fdcache_get(myself, flags, &fsal_error);
 	if(dir_fd < 0) 
 		return fsalstat(fsal_error, -dir_fd);
 
@@ -349,7 +354,7 @@ static fsal_status_t create(struct fsal_obj_handle *dir_hdl,
 
 	retval = make_file_safe(myself, dir_fd, name, unix_mode, user, group, &hdl);
 	if(!retval) {
-                close(dir_fd); /* done with parent */
+                vfs_fdcache_put(myself, flags, dir_fd); /* done with parent */
                 close(fd);  /* don't need it anymore. */
                 *handle = &hdl->obj_handle;
                 return fsalstat(ERR_FSAL_NO_ERROR, 0);
@@ -359,7 +364,7 @@ static fsal_status_t create(struct fsal_obj_handle *dir_hdl,
 
 direrr:
 	fsal_error = posix2fsal_error(retval);
-	close(dir_fd);
+	vfs_fdcache_put(myself, flags, dir_fd);
 	return fsalstat(fsal_error, retval);	
 }
 
@@ -393,7 +398,7 @@ static fsal_status_t makedir(struct fsal_obj_handle *dir_hdl,
 	group = attrib->group;
 	unix_mode = fsal2unix_mode(attrib->mode)
 		& ~dir_hdl->export->ops->fs_umask(dir_hdl->export);
-	dir_fd = vfs_fsal_open(myself, flags, &fsal_error);
+	dir_fd = vfs_fdcache_get(myself, flags, &fsal_error);
 	if(dir_fd < 0) {
 		return fsalstat(fsal_error, -dir_fd);	
 	}
@@ -413,7 +418,7 @@ static fsal_status_t makedir(struct fsal_obj_handle *dir_hdl,
 	}
 	retval = make_file_safe(myself, dir_fd, name, unix_mode, user, group, &hdl);
 	if(!retval) {
-                close(dir_fd);
+                vfs_fdcache_put(myself, flags, dir_fd);
                 *handle = &hdl->obj_handle;
                 return fsalstat(ERR_FSAL_NO_ERROR, 0);
         }
@@ -422,7 +427,7 @@ static fsal_status_t makedir(struct fsal_obj_handle *dir_hdl,
 
 direrr:
 	fsal_error = posix2fsal_error(retval);
-	close(dir_fd);
+	vfs_fdcache_put(myself, flags, dir_fd);
 	return fsalstat(fsal_error, retval);	
 }
 
@@ -491,7 +496,7 @@ static fsal_status_t makenode(struct fsal_obj_handle *dir_hdl,
                 fsal_error = ERR_FSAL_INVAL;
                 goto errout;
         }
-	dir_fd = vfs_fsal_open(myself, flags, &fsal_error);
+	dir_fd = vfs_fdcache_get(myself, flags, &fsal_error);
 	if(dir_fd < 0) {
 		goto errout;
 	}
@@ -511,7 +516,7 @@ static fsal_status_t makenode(struct fsal_obj_handle *dir_hdl,
 	}
 	retval = make_file_safe(myself, dir_fd, name, unix_mode, user, group, &hdl);
 	if(!retval) {
-                close(dir_fd); /* done with parent */
+                vfs_fdcache_put(myself, flags, dir_fd); /* done with parent */
                 *handle = &hdl->obj_handle;
                 return fsalstat(ERR_FSAL_NO_ERROR, 0);
         }
@@ -520,7 +525,7 @@ static fsal_status_t makenode(struct fsal_obj_handle *dir_hdl,
 	
 direrr:
 	fsal_error = posix2fsal_error(retval);
-	close(dir_fd); /* done with parent */
+	vfs_fdcache_put(myself, flags, dir_fd); /* done with parent */
 
 errout:
 	return fsalstat(fsal_error, retval);	
@@ -560,7 +565,7 @@ static fsal_status_t makesymlink(struct fsal_obj_handle *dir_hdl,
 	myself = container_of(dir_hdl, struct vfs_fsal_obj_handle, obj_handle);
 	user = attrib->owner;
 	group = attrib->group;
-	dir_fd = vfs_fsal_open(myself, flags, &fsal_error);
+	dir_fd = vfs_fdcache_get(myself, flags, &fsal_error);
 	if(dir_fd < 0) {
 		return fsalstat(fsal_error, -dir_fd);
 	}
@@ -597,7 +602,7 @@ static fsal_status_t makesymlink(struct fsal_obj_handle *dir_hdl,
 
 	/* allocate an obj_handle and fill it up */
 	hdl = alloc_handle(dir_fd, fh, &stat, NULL, name, dir_hdl->export);
-	close(dir_fd);
+	vfs_fdcache_put(myself, O_PATH|O_NOACCESS, dir_fd);
 	if(hdl == NULL) {
 		retval = ENOMEM;
 		goto errout;
@@ -608,12 +613,12 @@ static fsal_status_t makesymlink(struct fsal_obj_handle *dir_hdl,
 linkerr:
 	retval = errno;
 	unlinkat(dir_fd, name, 0);
-	close(dir_fd);
+	vfs_fdcache_put(myself, O_PATH|O_NOACCESS, dir_fd);
 	goto errout;
 
 direrr:
 	retval = errno;
-	close(dir_fd);
+	vfs_fdcache_put(myself, O_PATH|O_NOACCESS, dir_fd);
 errout:
 	if(retval == ENOENT)
 		fsal_error = ERR_FSAL_STALE;
@@ -803,7 +808,7 @@ static fsal_status_t read_dirents(struct fsal_obj_handle *dir_hdl,
                 seekloc = (off_t)*whence;
         }
 	myself = container_of(dir_hdl, struct vfs_fsal_obj_handle, obj_handle);
-	dirfd = vfs_fsal_open(myself, O_RDONLY|O_DIRECTORY, &fsal_error);
+	dirfd = vfs_fdcache_get(myself, O_RDONLY|O_DIRECTORY, &fsal_error);
 	if(dirfd < 0) {
 		retval = -dirfd;
 		goto out;
@@ -845,7 +850,7 @@ static fsal_status_t read_dirents(struct fsal_obj_handle *dir_hdl,
 
 	*eof = nread == 0 ? true : false;
 done:
-	close(dirfd);
+	vfs_fdcache_put(myself, O_RDONLY|O_DIRECTORY, dirfd);
 	
 out:
 	return fsalstat(fsal_error, retval);	
@@ -864,16 +869,16 @@ static fsal_status_t renamefile(struct fsal_obj_handle *olddir_hdl,
 	int retval = 0;
 
 	olddir = container_of(olddir_hdl, struct vfs_fsal_obj_handle, obj_handle);
-	oldfd = vfs_fsal_open(olddir, O_PATH|O_NOACCESS, &fsal_error);
+	oldfd = vfs_fdcache_get(olddir, O_PATH|O_NOACCESS, &fsal_error);
 	if(oldfd < 0) {
 		retval = -oldfd;
 		goto out;
 	}
 	newdir = container_of(newdir_hdl, struct vfs_fsal_obj_handle, obj_handle);
-	newfd = vfs_fsal_open(newdir, O_PATH|O_NOACCESS, &fsal_error);
+	newfd = vfs_fdcache_get(newdir, O_PATH|O_NOACCESS, &fsal_error);
 	if(newfd < 0) {
 		retval = -newfd;
-		close(oldfd);
+		vfs_fdcache_put(olddir, O_PATH|O_NOACCESS, oldfd);
 		goto out;
 	}
 	retval = renameat(oldfd, old_name, newfd, new_name);
@@ -881,8 +886,8 @@ static fsal_status_t renamefile(struct fsal_obj_handle *olddir_hdl,
 		retval = errno;
 		fsal_error = posix2fsal_error(retval);
 	}
-	close(oldfd);
-	close(newfd);
+	vfs_fdcache_put(olddir, O_PATH|O_NOACCESS, oldfd);
+	vfs_fdcache_put(newdir, O_PATH|O_NOACCESS, newfd);
 out:
 	return fsalstat(fsal_error, retval);	
 }
@@ -931,7 +936,8 @@ vfs_fsal_open_and_stat(struct vfs_fsal_obj_handle *myself,
                 retval = fstat(fd, stat);
                 break;
         case DIRECTORY:
-                fd = vfs_fsal_open(myself, open_flags, fsal_error);
+                fd = vfs_fdcache_get(myself, open_flags|O_DIRECTORY,
+                                     fsal_error);
                 if(fd < 0) {
                         return fd;
                 }
@@ -984,7 +990,9 @@ static fsal_status_t getattrs(struct fsal_obj_handle *obj_hdl,
 	myself = container_of(obj_hdl, struct vfs_fsal_obj_handle, obj_handle);
 	fd = vfs_fsal_open_and_stat(myself, &stat, O_RDONLY, &fsal_error);
 	if(fd >= 0) {
-	   	if(obj_hdl->type != REGULAR_FILE || myself->u.file.fd < 0)
+		if(obj_hdl->type == DIRECTORY)
+			vfs_fdcache_put(myself, O_RDONLY|O_DIRECTORY, fd);
+		else if(obj_hdl->type != REGULAR_FILE || myself->u.file.fd < 0)
 			close(fd);
 		st = posix2fsal_attributes(&stat, &obj_hdl->attributes);
 		if(FSAL_IS_ERROR(st)) {
@@ -1142,7 +1150,9 @@ fileerr:
         retval = errno;
         fsal_error = posix2fsal_error(retval);
 out:
-	if(obj_hdl->type != REGULAR_FILE
+	if(obj_hdl->type == DIRECTORY)
+		vfs_fdcache_put(myself, open_flags|O_DIRECTORY, fd);
+	else if(obj_hdl->type != REGULAR_FILE
 	      || myself->u.file.openflags == FSAL_O_CLOSED)
 		close(fd);
 	return fsalstat(fsal_error, retval);
@@ -1164,7 +1174,7 @@ static fsal_status_t file_unlink(struct fsal_obj_handle *dir_hdl,
 	int retval = 0;
 
 	myself = container_of(dir_hdl, struct vfs_fsal_obj_handle, obj_handle);
-	fd = vfs_fsal_open(myself, O_PATH|O_NOACCESS, &fsal_error);
+	fd = vfs_fdcache_get(myself, O_PATH|O_NOACCESS, &fsal_error);
 	if(fd < 0) {
 		retval = -fd;
 		goto out;
@@ -1189,7 +1199,7 @@ static fsal_status_t file_unlink(struct fsal_obj_handle *dir_hdl,
 	}
 	
 errout:
-	close(fd);
+	vfs_fdcache_put(myself, O_PATH|O_NOACCESS, fd);
 out:
 	return fsalstat(fsal_error, retval);	
 }
@@ -1293,7 +1303,11 @@ static fsal_status_t release(struct fsal_obj_handle *obj_hdl)
 		return fsalstat(posix2fsal_error(retval), retval);
 	}
 
-	if(type == SYMBOLIC_LINK) {
+	if(type == REGULAR_FILE) {
+		vfs_sync_group_destroy(&myself->u.file.sync);
+	} else if(type == DIRECTORY) {
+		vfs_fdcache_drop(myself);
+	} else if(type == SYMBOLIC_LINK) {
 		if(myself->u.symlink.link_content != NULL)
 			gsh_free(myself->u.symlink.link_content);
 	} else if(vfs_unopenable_type(type)) {
@@ -1328,6 +1342,8 @@ void vfs_handle_ops_init(struct fsal_obj_ops *ops)
 	ops->read = vfs_read;
 	ops->write = vfs_write;
 	ops->commit = vfs_commit;
+	ops->prefetch = vfs_prefetch;
+	ops->read_fd = vfs_read_fd;
 	ops->lock_op = vfs_lock_op;
 	ops->close = vfs_close;
 	ops->lru_cleanup = vfs_lru_cleanup;
@@ -39,6 +39,7 @@
 #include <sys/types.h>
 #include "nlm_list.h"
 #include "FSAL/fsal_init.h"
+#include "vfs_methods.h"
 
 /* VFS FSAL module private storage
  */
@@ -131,6 +132,7 @@ static fsal_status_t init_config(struct fsal_module *fsal_hdl,
 	 * params.
 	 */
 
+	vfs_fdcache_init();
 	display_fsinfo(&vfs_me->fs_info);
 	LogFullDebug(COMPONENT_FSAL,
 		     "Supported attributes constant = 0x%"PRIx64,
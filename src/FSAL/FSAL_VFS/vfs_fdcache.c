@@ -0,0 +1,236 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * -------------
+ */
+
+/* vfs_fdcache.c
+ * Directory descriptor cache for the VFS module
+ *
+ * LOOKUP, CREATE, REMOVE, RENAME, READDIR and GETATTR on a directory
+ * each used to open_by_handle_at() the directory and close it again.
+ * Instead, a directory handle keeps the last O_PATH descriptor and the
+ * last O_RDONLY|O_DIRECTORY descriptor it was given back.
+ *
+ * A caller takes the cached descriptor out of the handle, so it owns
+ * it until it hands it back; a second caller on the same directory
+ * meanwhile opens one of its own and whichever comes back second is
+ * closed.  Descriptors of other types are never cached: an O_PATH
+ * descriptor pins its inode, which for a removed file would hold on
+ * to its blocks.
+ *
+ * All directories with cached descriptors sit on one LRU.  Past
+ * vfs_fdcache_max descriptors the least recently returned ones are
+ * closed.  The bound comes out of the headroom cache_inode leaves
+ * between its FD high water mark and the process limit, and a handle
+ * reaped by the cache_inode LRU closes its descriptors on release.
+ */
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "fsal.h"
+#include "abstract_atomic.h"
+#include "nlm_list.h"
+#include "vfs_methods.h"
+
+/* Share of the process descriptor limit we may keep cached */
+#define VFS_FDCACHE_SHARE 16
+
+/* Log the counters at debug level every this many lookups */
+#define VFS_FDCACHE_REPORT_PERIOD 65536
+
+static pthread_mutex_t fdcache_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct glist_head fdcache_lru = {&fdcache_lru, &fdcache_lru};
+static uint32_t fdcache_count;
+static uint32_t vfs_fdcache_max;
+static struct vfs_fdcache_stats fdcache_stats;
+
+/* vfs_fdcache_init
+ * Size the cache from the descriptor limit.  Called once the module
+ * has its configuration.
+ */
+
+void vfs_fdcache_init(void)
+{
+	struct rlimit rlim;
+	rlim_t max;
+
+	if(getrlimit(RLIMIT_NOFILE, &rlim) != 0) {
+		LogMajor(COMPONENT_FSAL,
+			 "getrlimit failed with error %d, "
+			 "VFS directory descriptor cache disabled",
+			 errno);
+		return;
+	}
+	max = rlim.rlim_cur;
+	if(max == RLIM_INFINITY || max > UINT32_MAX)
+		max = UINT32_MAX;
+	pthread_mutex_lock(&fdcache_mtx);
+	vfs_fdcache_max = max / VFS_FDCACHE_SHARE;
+	pthread_mutex_unlock(&fdcache_mtx);
+	LogInfo(COMPONENT_FSAL,
+		"VFS directory descriptor cache holds up to %"PRIu32
+		" descriptors", vfs_fdcache_max);
+}
+
+/* fdcache_slot
+ * The slot of a handle caching descriptors opened with openflags,
+ * or NULL if such descriptors are not cached.
+ */
+
+static int *fdcache_slot(struct vfs_fsal_obj_handle *myself, int openflags)
+{
+	if(myself->obj_handle.type != DIRECTORY)
+		return NULL;
+	if(openflags == (O_PATH|O_NOACCESS))
+		return &myself->fdc.path_fd;
+	if(openflags == (O_RDONLY|O_DIRECTORY))
+		return &myself->fdc.dir_fd;
+	return NULL;
+}
+
+/* fdcache_unlink
+ * Close the descriptors of a handle and take it off the LRU.
+ * Called with the cache lock held.
+ */
+
+static void fdcache_unlink(struct vfs_fsal_obj_handle *myself)
+{
+	if(myself->fdc.path_fd >= 0) {
+		close(myself->fdc.path_fd);
+		myself->fdc.path_fd = -1;
+		fdcache_count--;
+	}
+	if(myself->fdc.dir_fd >= 0) {
+		close(myself->fdc.dir_fd);
+		myself->fdc.dir_fd = -1;
+		fdcache_count--;
+	}
+	glist_del(&myself->fdc.lru);
+}
+
+/* vfs_fdcache_get
+ * Get a descriptor on the object opened with openflags, from the
+ * cache if it has one.  Same return convention as vfs_fsal_open.
+ * Give it back with vfs_fdcache_put.
+ */
+
+int vfs_fdcache_get(struct vfs_fsal_obj_handle *myself,
+		    int openflags,
+		    fsal_errors_t *fsal_error)
+{
+	int *slot = fdcache_slot(myself, openflags);
+	int fd = -1;
+	uint64_t lookups;
+
+	if(slot == NULL)
+		return vfs_fsal_open(myself, openflags, fsal_error);
+
+	/* Peek first, most misses are handles with nothing cached */
+	if(*slot >= 0) {
+		pthread_mutex_lock(&fdcache_mtx);
+		fd = *slot;
+		if(fd >= 0) {
+			*slot = -1;
+			fdcache_count--;
+			if(myself->fdc.path_fd < 0 && myself->fdc.dir_fd < 0)
+				glist_del(&myself->fdc.lru);
+		}
+		pthread_mutex_unlock(&fdcache_mtx);
+	}
+	if(fd >= 0) {
+		lookups = atomic_inc_uint64_t(&fdcache_stats.hits);
+	} else {
+		atomic_inc_uint64_t(&fdcache_stats.misses);
+		lookups = 0;
+		fd = vfs_fsal_open(myself, openflags, fsal_error);
+	}
+	if(lookups != 0 && lookups % VFS_FDCACHE_REPORT_PERIOD == 0)
+		vfs_fdcache_report();
+	return fd;
+}
+
+/* vfs_fdcache_put
+ * Give back a descriptor from vfs_fdcache_get, with the same openflags.
+ * It is cached if the handle has room for it, closed otherwise.
+ */
+
+void vfs_fdcache_put(struct vfs_fsal_obj_handle *myself,
+		     int openflags,
+		     int fd)
+{
+	int *slot = fdcache_slot(myself, openflags);
+	struct vfs_fsal_obj_handle *victim;
+
+	if(slot == NULL || vfs_fdcache_max == 0) {
+		close(fd);
+		return;
+	}
+	pthread_mutex_lock(&fdcache_mtx);
+	if(*slot >= 0) {
+		pthread_mutex_unlock(&fdcache_mtx);
+		close(fd);
+		return;
+	}
+	*slot = fd;
+	fdcache_count++;
+	/* Most recently returned at the tail */
+	glist_del(&myself->fdc.lru);
+	glist_add_tail(&fdcache_lru, &myself->fdc.lru);
+	while(fdcache_count > vfs_fdcache_max) {
+		victim = glist_first_entry(&fdcache_lru,
+					   struct vfs_fsal_obj_handle,
+					   fdc.lru);
+		fdcache_unlink(victim);
+		atomic_inc_uint64_t(&fdcache_stats.evictions);
+	}
+	pthread_mutex_unlock(&fdcache_mtx);
+}
+
+/* vfs_fdcache_drop
+ * Close whatever descriptors a handle has cached.  Called from release
+ * and lru_cleanup.
+ */
+
+void vfs_fdcache_drop(struct vfs_fsal_obj_handle *myself)
+{
+	if(myself->obj_handle.type != DIRECTORY)
+		return;
+	pthread_mutex_lock(&fdcache_mtx);
+	fdcache_unlink(myself);
+	pthread_mutex_unlock(&fdcache_mtx);
+}
+
+/* vfs_fdcache_report
+ * Log how many opens the cache saved.
+ */
+
+void vfs_fdcache_report(void)
+{
+	LogDebug(COMPONENT_FSAL,
+		 "VFS directory descriptors: %"PRIu32" cached of %"PRIu32
+		 ", %"PRIu64" hits, %"PRIu64" misses, %"PRIu64" evictions",
+		 fdcache_count, vfs_fdcache_max,
+		 atomic_fetch_uint64_t(&fdcache_stats.hits),
+		 atomic_fetch_uint64_t(&fdcache_stats.misses),
+		 atomic_fetch_uint64_t(&fdcache_stats.evictions));
+}
@@ -4,6 +4,32 @@
 #include "fsal_handle_syscalls.h"
 struct vfs_fsal_obj_handle;
 
+/*
+ * Group commit
+ * Threads that want the same file (or, with fs_specific "group_commit=fs",
+ * the same filesystem) flushed at the same time share one flush.  A
+ * flush that starts after a thread arrived covers every write that
+ * thread completed, so it waits for the first such flush and returns
+ * its result.  See vfs_sync.c.
+ */
+
+struct vfs_sync_group {
+	pthread_mutex_t mtx;
+	pthread_cond_t cv;
+	uint64_t started;	/* sequence of the last flush started */
+	uint64_t done;		/* sequence of the last flush finished */
+	uint64_t err_seq;	/* sequence of the last flush that failed */
+	int error;		/* errno of that flush */
+	bool busy;		/* a flush is running */
+	bool whole;		/* next flush must cover the whole file */
+};
+
+struct vfs_sync_stats {
+	uint64_t requests;	/* commits asked for */
+	uint64_t flushes;	/* fsync, fdatasync or syncfs issued */
+	uint64_t data_flushes;	/* of which fdatasync */
+};
+
 struct vfs_exp_handle_ops {
 	int (*vex_open_by_handle)(struct fsal_export *exp,
 				  vfs_file_handle_t *fh,
@@ -27,6 +53,9 @@ struct vfs_fsal_export {
 	dev_t root_dev;
 	vfs_file_handle_t *root_handle;
 	bool pnfs_panfs_enabled;
+	bool sync_fs;		/* group commits per filesystem (syncfs) */
+	struct vfs_sync_group fs_sync;
+	struct vfs_sync_stats sync_stats;
 	struct vfs_exp_handle_ops vex_ops;
 	void *pnfs_data;
 };
@@ -36,6 +65,35 @@ struct vfs_fsal_export {
 
 int vfs_get_root_fd(struct fsal_export *exp_hdl);
 
+/* group commit, vfs_sync.c
+ */
+
+void vfs_sync_group_init(struct vfs_sync_group *group);
+void vfs_sync_group_destroy(struct vfs_sync_group *group);
+int vfs_sync_commit(struct vfs_fsal_export *exp,
+		    struct vfs_sync_group *group,
+		    int fd, off_t offset, size_t len);
+void vfs_sync_report(struct vfs_fsal_export *exp);
+
+/* directory descriptor cache, vfs_fdcache.c
+ */
+
+struct vfs_fdcache_stats {
+	uint64_t hits;		/* descriptors handed out from the cache */
+	uint64_t misses;	/* opened because none was cached */
+	uint64_t evictions;	/* closed to stay under the bound */
+};
+
+void vfs_fdcache_init(void);
+int vfs_fdcache_get(struct vfs_fsal_obj_handle *myself,
+		    int openflags,
+		    fsal_errors_t *fsal_error);
+void vfs_fdcache_put(struct vfs_fsal_obj_handle *myself,
+		     int openflags,
+		     int fd);
+void vfs_fdcache_drop(struct vfs_fsal_obj_handle *myself);
+void vfs_fdcache_report(void);
+
 /* method proto linkage to handle.c for export
  */
 
@@ -66,10 +124,16 @@ fsal_status_t vfs_create_handle(struct fsal_export *exp_hdl,
 struct vfs_fsal_obj_handle {
 	struct fsal_obj_handle obj_handle;
 	vfs_file_handle_t *handle;
+	struct {
+		struct glist_head lru;	/* on the cache LRU while caching */
+		int path_fd;		/* O_PATH descriptor or -1 */
+		int dir_fd;		/* O_RDONLY|O_DIRECTORY one or -1 */
+	} fdc;			/* directories only, see vfs_fdcache.c */
 	union {
 		struct {
 			int fd;
 			fsal_openflags_t openflags;
+			struct vfs_sync_group sync;
 		} file;
 		struct {
 			unsigned char *link_content;
@@ -119,6 +183,15 @@ fsal_status_t vfs_write(struct fsal_obj_handle *obj_hdl,
 fsal_status_t vfs_commit(struct fsal_obj_handle *obj_hdl, /* sync */
 			 off_t offset,
 			 size_t len);
+fsal_status_t vfs_prefetch(struct fsal_obj_handle *obj_hdl,
+			   uint64_t offset,
+			   size_t len);
+fsal_status_t vfs_read_fd(struct fsal_obj_handle *obj_hdl,
+			  uint64_t offset,
+			  size_t buffer_size,
+			  int *fd,
+			  size_t *read_amount,
+			  bool *end_of_file);
 fsal_status_t vfs_lock_op(struct fsal_obj_handle *obj_hdl,
 			  const struct req_op_context *opctx,
 			  void * p_owner,
@@ -0,0 +1,163 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * -------------
+ */
+
+/* vfs_sync.c
+ * Group commit for the VFS module
+ *
+ * Every COMMIT and every stable WRITE ends in a flush of the file.
+ * When several of them arrive for the same file while a flush is
+ * running, they all wait for that flush to finish and then share the
+ * next one, so N concurrent committers cost at most two flushes.
+ *
+ * A flush covering only byte ranges is an fdatasync(), which writes
+ * the file's dirty pages, the metadata needed to read them back and
+ * the device cache.  Linux has no ranged equivalent: sync_file_range()
+ * neither writes metadata nor flushes the device cache, and ahead of
+ * an fdatasync() it only repeats part of its work.  A flush for the
+ * whole file (COMMIT with count 0) is an fsync(), as before.
+ * With group_commit=fs every file of the export shares one group and
+ * a flush is a syncfs() of the export's filesystem.
+ */
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include "fsal.h"
+#include "abstract_atomic.h"
+#include "vfs_methods.h"
+
+/* Log the counters at debug level every this many flushes */
+#define VFS_SYNC_REPORT_PERIOD 4096
+
+void vfs_sync_group_init(struct vfs_sync_group *group)
+{
+	memset(group, 0, sizeof(*group));
+	pthread_mutex_init(&group->mtx, NULL);
+	pthread_cond_init(&group->cv, NULL);
+}
+
+void vfs_sync_group_destroy(struct vfs_sync_group *group)
+{
+	pthread_mutex_destroy(&group->mtx);
+	pthread_cond_destroy(&group->cv);
+}
+
+/* flush_one
+ * Do one flush for a group.  Called without the group lock.
+ */
+
+static int flush_one(struct vfs_fsal_export *exp, int fd, bool whole)
+{
+	int retval;
+
+	if(exp->sync_fs) {
+		retval = syncfs(exp->root_fd);
+	} else if(whole) {
+		retval = fsync(fd);
+	} else {
+		retval = fdatasync(fd);
+		atomic_inc_uint64_t(&exp->sync_stats.data_flushes);
+	}
+	return (retval == -1) ? errno : 0;
+}
+
+/* vfs_sync_commit
+ * Make everything written to fd before the call stable, sharing the
+ * flush with any other thread committing to the same group.
+ * A len of 0 means the whole file.  fd must stay open until we return,
+ * which the cache_inode content lock held by the caller guarantees.
+ * Returns 0 or an errno.
+ */
+
+int vfs_sync_commit(struct vfs_fsal_export *exp,
+		    struct vfs_sync_group *group,
+		    int fd, off_t offset, size_t len)
+{
+	uint64_t need, seq, flushes;
+	bool whole;
+	int retval = 0;
+
+	atomic_inc_uint64_t(&exp->sync_stats.requests);
+
+	pthread_mutex_lock(&group->mtx);
+
+	/* The flush running now may have started before our writes, the
+	   next one to start cannot have. */
+	need = group->started + 1;
+
+	if(len == 0)
+		group->whole = true;
+
+	while(group->done < need) {
+		if(group->busy) {
+			pthread_cond_wait(&group->cv, &group->mtx);
+			continue;
+		}
+		/* Lead the next flush, taking over what everyone queued
+		   behind us asked for. */
+		seq = ++group->started;
+		group->busy = true;
+		whole = group->whole;
+		group->whole = false;
+		pthread_mutex_unlock(&group->mtx);
+
+		retval = flush_one(exp, fd, whole);
+		flushes = atomic_inc_uint64_t(&exp->sync_stats.flushes);
+		if(flushes % VFS_SYNC_REPORT_PERIOD == 0)
+			vfs_sync_report(exp);
+
+		pthread_mutex_lock(&group->mtx);
+		group->busy = false;
+		group->done = seq;
+		if(retval != 0) {
+			group->err_seq = seq;
+			group->error = retval;
+		}
+		pthread_cond_broadcast(&group->cv);
+	}
+
+	/* Any flush from ours on failing may have lost our data */
+	retval = (group->err_seq >= need) ? group->error : 0;
+	pthread_mutex_unlock(&group->mtx);
+
+	return retval;
+}
+
+/* vfs_sync_report
+ * Log how many flushes group commit saved on this export.
+ */
+
+void vfs_sync_report(struct vfs_fsal_export *exp)
+{
+	uint64_t requests = atomic_fetch_uint64_t(&exp->sync_stats.requests);
+	uint64_t flushes = atomic_fetch_uint64_t(&exp->sync_stats.flushes);
+	uint64_t data =
+		atomic_fetch_uint64_t(&exp->sync_stats.data_flushes);
+
+	LogDebug(COMPONENT_FSAL,
+		 "VFS commit on %s: %"PRIu64" requests, %"PRIu64
+		 " flushes (%"PRIu64" fdatasync), %"PRIu64" saved",
+		 exp->mntdir ? exp->mntdir : "(null)",
+		 requests, flushes, data,
+		 (requests > flushes) ? requests - flushes : 0);
+}
@@ -868,6 +868,31 @@ static fsal_status_t commit(struct fsal_obj_handle *obj_hdl, /* sync */
 	return fsalstat(ERR_FSAL_NOTSUPP, 0);
 }
 
+/* prefetch
+ * default case not supported
+ */
+
+static fsal_status_t prefetch(struct fsal_obj_handle *obj_hdl,
+			      uint64_t offset,
+			      size_t len)
+{
+	return fsalstat(ERR_FSAL_NOTSUPP, 0);
+}
+
+/* read_fd
+ * default case not supported
+ */
+
+static fsal_status_t read_fd(struct fsal_obj_handle *obj_hdl,
+			     uint64_t offset,
+			     size_t buffer_size,
+			     int *fd,
+			     size_t *read_amount,
+			     bool *end_of_file)
+{
+	return fsalstat(ERR_FSAL_NOTSUPP, 0);
+}
+
 /* lock_op
  * default case not supported
  */
@@ -1166,7 +1191,9 @@ struct fsal_obj_ops def_handle_ops = {
         .handle_to_key = handle_to_key,
         .layoutget = layoutget,
         .layoutreturn = layoutreturn,
-        .layoutcommit = layoutcommit
+        .layoutcommit = layoutcommit,
+        .prefetch = prefetch,
+        .read_fd = read_fd
 };
 
 /* fsal_ds_handle common methods */
@@ -32,6 +32,8 @@
 #include "config.h"
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
+#include <inttypes.h>
 #include <pthread.h>
 #include "nfs_core.h"
 #include "nfs_tools.h"
@@ -42,14 +44,16 @@
 #include "cache_inode_lru.h"
 #include "idmapper.h"
 #include "delayed_exec.h"
+#include "export_mgr.h"
+#include "nfs_proto_functions.h"
+#include "nsm.h"
+#include "lock_profile.h"
 #ifdef USE_DBUS
 #include "ganesha_dbus.h"
 #endif
 
 extern struct fridgethr *req_fridge; /*< Decoder thread pool */
 
-struct glist_head temp_exportlist;
-
 /**
  * @brief Mutex protecting command and status
  */
@@ -213,10 +217,341 @@ static struct gsh_dbus_method method_shutdown = {
 	}
 };
 
+/**
+ * @brief Dbus method reporting inode cache memory use
+ *
+ * Replies with the status, the configured Cache_Memory_Budget and an
+ * array of (category, bytes).
+ *
+ * @param[in]  args  Unused
+ * @param[out] reply The usage
+ */
+
+static bool admin_dbus_cache_memory(DBusMessageIter *args,
+				    DBusMessage *reply)
+{
+	DBusMessageIter iter, array_iter, struct_iter;
+	uint64_t bytes;
+	int cat;
+
+	dbus_message_iter_init_append(reply, &iter);
+	if (args != NULL) {
+		dbus_status_reply(&iter, false,
+				  "Cache memory takes no arguments.");
+		return false;
+	}
+	dbus_status_reply(&iter, true, "OK");
+	bytes = nfs_param.cache_param.mem_budget;
+	dbus_message_iter_append_basic(&iter, DBUS_TYPE_UINT64, &bytes);
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "(st)",
+					 &array_iter);
+	for (cat = 0; cat < CACHE_INODE_MEM_CATS; cat++) {
+		const char *name = cache_inode_mem_cat_names[cat];
+
+		bytes = cache_inode_mem_bytes(cat);
+		dbus_message_iter_open_container(&array_iter,
+						 DBUS_TYPE_STRUCT, NULL,
+						 &struct_iter);
+		dbus_message_iter_append_basic(&struct_iter,
+					       DBUS_TYPE_STRING, &name);
+		dbus_message_iter_append_basic(&struct_iter,
+					       DBUS_TYPE_UINT64, &bytes);
+		dbus_message_iter_close_container(&array_iter, &struct_iter);
+	}
+	dbus_message_iter_close_container(&iter, &array_iter);
+	return true;
+}
+
+static struct gsh_dbus_method method_cache_memory = {
+	.name = "cache_memory",
+	.method = admin_dbus_cache_memory,
+	.args = { STATUS_REPLY,
+		  {
+			  .name = "budget",
+			  .type = "t",
+			  .direction = "out"
+		  },
+		  {
+			  .name = "usage",
+			  .type = "a(st)",
+			  .direction = "out"
+		  },
+		  END_ARG_LIST
+	}
+};
+
+static void admin_dbus_grace_client(const char *name, void *arg)
+{
+	DBusMessageIter *array_iter = arg;
+
+	dbus_message_iter_append_basic(array_iter, DBUS_TYPE_STRING, &name);
+}
+
+/**
+ * @brief Dbus method reporting on the grace period
+ *
+ * Replies with the status, whether the server is in grace, the
+ * seconds left, how many clients may reclaim and the names of those
+ * that have not finished reclaiming.
+ *
+ * @param[in]  args  Unused
+ * @param[out] reply The report
+ */
+
+static bool admin_dbus_grace_status(DBusMessageIter *args,
+				    DBusMessage *reply)
+{
+	DBusMessageIter iter, array_iter;
+	dbus_bool_t in_grace;
+	uint64_t remaining;
+	uint32_t recorded;
+	time_t left;
+
+	dbus_message_iter_init_append(reply, &iter);
+	if (args != NULL) {
+		dbus_status_reply(&iter, false,
+				  "Grace status takes no arguments.");
+		return false;
+	}
+	dbus_status_reply(&iter, true, "OK");
+
+	/* The count and times are known only once the names are out */
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "s",
+					 &array_iter);
+	in_grace = nfs4_grace_status(&left, &recorded,
+				     admin_dbus_grace_client, &array_iter);
+	dbus_message_iter_close_container(&iter, &array_iter);
+
+	remaining = left;
+	dbus_message_iter_append_basic(&iter, DBUS_TYPE_BOOLEAN, &in_grace);
+	dbus_message_iter_append_basic(&iter, DBUS_TYPE_UINT64, &remaining);
+	dbus_message_iter_append_basic(&iter, DBUS_TYPE_UINT32, &recorded);
+	return true;
+}
+
+static struct gsh_dbus_method method_grace_status = {
+	.name = "grace_status",
+	.method = admin_dbus_grace_status,
+	.args = { STATUS_REPLY,
+		  {
+			  .name = "outstanding",
+			  .type = "as",
+			  .direction = "out"
+		  },
+		  {
+			  .name = "in_grace",
+			  .type = "b",
+			  .direction = "out"
+		  },
+		  {
+			  .name = "remaining",
+			  .type = "t",
+			  .direction = "out"
+		  },
+		  {
+			  .name = "recorded",
+			  .type = "u",
+			  .direction = "out"
+		  },
+		  END_ARG_LIST
+	}
+};
+
+#ifdef USE_LOCK_PROFILE
+
+/** Sites reported when lock_profile is given no count */
+#define ADMIN_LOCK_PROFILE_TOP 20
+
+/**
+ * @brief Dbus method reporting the most contended lock sites
+ *
+ * Takes the number of sites to report, or nothing for
+ * ADMIN_LOCK_PROFILE_TOP.  Replies with the status, whether
+ * profiling is on and, for each site, where it is, the kind of lock,
+ * the lock and its counters.
+ *
+ * @param[in]  args  Number of sites
+ * @param[out] reply The report
+ */
+
+static bool admin_dbus_lock_profile(DBusMessageIter *args,
+				    DBusMessage *reply)
+{
+	DBusMessageIter iter, array_iter, struct_iter;
+	struct lock_prof_report *report;
+	uint32_t max = ADMIN_LOCK_PROFILE_TOP;
+	dbus_bool_t enabled = lock_prof_enabled;
+	char where[PATH_MAX];
+	const char *str;
+	int n, i;
+
+	dbus_message_iter_init_append(reply, &iter);
+	if (args != NULL) {
+		if (dbus_message_iter_get_arg_type(args) != DBUS_TYPE_UINT32) {
+			dbus_status_reply(&iter, false,
+					  "Lock profile takes a site count.");
+			return false;
+		}
+		dbus_message_iter_get_basic(args, &max);
+	}
+
+	report = gsh_calloc(max, sizeof(*report));
+	n = report == NULL && max != 0 ? -1 : lock_prof_top(report, max);
+	if (n < 0) {
+		gsh_free(report);
+		dbus_status_reply(&iter, false, "Out of memory.");
+		return false;
+	}
+	dbus_status_reply(&iter, true, "OK");
+	dbus_message_iter_append_basic(&iter, DBUS_TYPE_BOOLEAN, &enabled);
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+					 "(ssstttttt)", &array_iter);
+	for (i = 0; i < n; i++) {
+		const struct lock_prof_site *site = report[i].site;
+		const struct lock_prof_counts *counts = &report[i].counts;
+
+		dbus_message_iter_open_container(&array_iter,
+						 DBUS_TYPE_STRUCT, NULL,
+						 &struct_iter);
+		snprintf(where, sizeof(where), "%s (%s:%d)", site->func,
+			 site->file, site->line);
+		str = where;
+		dbus_message_iter_append_basic(&struct_iter,
+					       DBUS_TYPE_STRING, &str);
+		str = lock_prof_kind_name(site->kind);
+		dbus_message_iter_append_basic(&struct_iter,
+					       DBUS_TYPE_STRING, &str);
+		dbus_message_iter_append_basic(&struct_iter,
+					       DBUS_TYPE_STRING, &site->what);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &counts->acquired);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &counts->contended);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &counts->wait_ns);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &counts->wait_max);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &counts->hold_ns);
+		dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+					       &counts->hold_max);
+		dbus_message_iter_close_container(&array_iter, &struct_iter);
+	}
+	dbus_message_iter_close_container(&iter, &array_iter);
+	gsh_free(report);
+	return true;
+}
+
+static struct gsh_dbus_method method_lock_profile = {
+	.name = "lock_profile",
+	.method = admin_dbus_lock_profile,
+	.args = { {
+			  .name = "count",
+			  .type = "u",
+			  .direction = "in"
+		  },
+		  STATUS_REPLY,
+		  {
+			  .name = "enabled",
+			  .type = "b",
+			  .direction = "out"
+		  },
+		  {
+			  .name = "sites",
+			  .type = "a(ssstttttt)",
+			  .direction = "out"
+		  },
+		  END_ARG_LIST
+	}
+};
+
+/**
+ * @brief Dbus method turning lock profiling on or off
+ *
+ * Counters are kept; a lock held across the change has no hold time.
+ *
+ * @param[in]  args  Whether to profile
+ * @param[out] reply The status
+ */
+
+static bool admin_dbus_lock_profile_enable(DBusMessageIter *args,
+					   DBusMessage *reply)
+{
+	DBusMessageIter iter;
+	dbus_bool_t enable;
+
+	dbus_message_iter_init_append(reply, &iter);
+	if (args == NULL ||
+	    dbus_message_iter_get_arg_type(args) != DBUS_TYPE_BOOLEAN) {
+		dbus_status_reply(&iter, false,
+				  "Lock profile enable takes a boolean.");
+		return false;
+	}
+	dbus_message_iter_get_basic(args, &enable);
+	lock_prof_enable(enable);
+	LogEvent(COMPONENT_RW_LOCK, "Lock profiling %s",
+		 enable ? "enabled" : "disabled");
+	dbus_status_reply(&iter, true, "OK");
+	return true;
+}
+
+static struct gsh_dbus_method method_lock_profile_enable = {
+	.name = "lock_profile_enable",
+	.method = admin_dbus_lock_profile_enable,
+	.args = { {
+			  .name = "enable",
+			  .type = "b",
+			  .direction = "in"
+		  },
+		  STATUS_REPLY,
+		  END_ARG_LIST
+	}
+};
+
+/**
+ * @brief Dbus method zeroing the lock profile counters
+ *
+ * @param[in]  args  Unused
+ * @param[out] reply The status
+ */
+
+static bool admin_dbus_lock_profile_reset(DBusMessageIter *args,
+					  DBusMessage *reply)
+{
+	DBusMessageIter iter;
+
+	dbus_message_iter_init_append(reply, &iter);
+	if (args != NULL) {
+		dbus_status_reply(&iter, false,
+				  "Lock profile reset takes no arguments.");
+		return false;
+	}
+	lock_prof_reset();
+	dbus_status_reply(&iter, true, "OK");
+	return true;
+}
+
+static struct gsh_dbus_method method_lock_profile_reset = {
+	.name = "lock_profile_reset",
+	.method = admin_dbus_lock_profile_reset,
+	.args = { STATUS_REPLY,
+		  END_ARG_LIST
+	}
+};
+
+#endif /* USE_LOCK_PROFILE */
+
 static struct gsh_dbus_method *admin_methods[] = {
 	&method_shutdown,
 	&method_reload,
 	&method_grace_period,
+	&method_grace_status,
+	&method_cache_memory,
+#ifdef USE_LOCK_PROFILE
+	&method_lock_profile,
+	&method_lock_profile_enable,
+	&method_lock_profile_reset,
+#endif
 	NULL
 };
 
@@ -273,7 +608,7 @@ static void admin_issue_command(admin_command_t command)
 
 void admin_replace_exports(void)
 {
-  admin_issue_command(admin_command);
+  admin_issue_command(admin_reload_exports);
 }
 
 /**
@@ -286,14 +621,15 @@ void admin_halt(void)
 }
 
 /**
- * @TODO commented out because it doesn't work.
- * return to this when export manager and pseudo fs fsal is in place
+ * @brief Parse the configuration file into the export staging tree
+ *
+ * @param[out] staged List the staged entries are linked on
+ *
+ * @return The number of staged exports, 0 or less on failure.
  */
 
-/* Skips deleting first entry of export list. */
-int rebuild_export_list(void)
+static int rebuild_export_list(struct glist_head *staged)
 {
-#if 0
   int status = 0;
   config_file_t config_struct;
 
@@ -317,7 +653,8 @@ int rebuild_export_list(void)
     }
 
   /* Create the new exports list */
-  status = ReadExports(config_struct, &temp_exportlist);
+  status = ReadStagedExports(config_struct, staged);
+  config_Free(config_struct);
   if(status < 0)
     {
       LogCrit(COMPONENT_CONFIG,
@@ -331,84 +668,75 @@ int rebuild_export_list(void)
       return 0;
     }
 
-  return 1;
-#else
-  return 0;
-#endif
+  return status;
 }
 
-static int ChangeoverExports()
-{
-
-#if 0
-  exportlist_t *pcurrent = NULL;
-
-  /**
-   * @@TODO@@ This is all totally bogus code now that exports are under the
-   * control of the export manager. Left as unfinished business.
-   */
-  if (nfs_param.pexportlist)
-    pcurrent = nfs_param.pexportlist->next;
+/**
+ * @brief Publish the staged exports and rewire what hangs off them
+ *
+ * On failure nothing has been published and the staged exports are
+ * left for the caller to abort.
+ *
+ * @param[in] staged List the staged entries are linked on
+ *
+ * @return 0 on success, an errno otherwise.
+ */
 
-  while(pcurrent != NULL)
-    {
-      /* Leave the head so that the list may be replaced later without
-       * changing the reference pointer in worker threads. */
+static int ChangeoverExports(struct glist_head *staged)
+{
+  pseudofs_t *pseudofs;
+  uint64_t generation;
 
-      if (pcurrent == nfs_param.pexportlist)
-        break;
+  /* The new pseudo fs is built aside first, it is all that may fail */
+  pseudofs = nfs4_PreparePseudoFS(staged);
+  if(pseudofs == NULL)
+    return ENOMEM;
 
-      nfs_param.pexportlist->next = RemoveExportEntry(pcurrent);
-      pcurrent = nfs_param.pexportlist->next;
-    }
+  generation = publish_staged_exports();
 
-  /* Allocate memory if needed, could have started with NULL exports */
-  if (nfs_param.pexportlist == NULL)
-    nfs_param.pexportlist = gsh_malloc(sizeof(exportlist_t));
+  /* Swap the pseudo fs pointing at the new generation in.  Compounds
+   * keep the one they started with, so once the requests running now
+   * are done nothing walks the old one any more.
+   */
+  pseudofs = nfs4_InstallPseudoFS(pseudofs, nfs_param.pexportlist);
+  worker_synchronize();
+  nfs4_FreePseudoFS(pseudofs);
 
-  if (nfs_param.pexportlist == NULL)
-    return ENOMEM;
+  /* Retired exports are no longer junctions and may be reaped */
+  export_pseudofs_rebuilt(generation);
 
-  /* Changed the old export list head to the new export list head.
-   * All references to the exports list should be up-to-date now. */
-  memcpy(nfs_param.pexportlist, temp_pexportlist, sizeof(exportlist_t));
+  /* Get the root entries of new exports, unchanged ones already
+   * have theirs cached.
+   */
+  exports_pkginit();
 
-  /* We no longer need the head that was created for
-   * the new list since the export list is built as a linked list. */
-  gsh_free(temp_pexportlist);
-  temp_pexportlist = NULL;
+  /* Anything retired that was idle can go now, the rest is picked
+   * up by the reaper.
+   */
+  (void) reap_retired_exports();
   return 0;
-#else
-  return ENOTSUP;
-#endif
 }
 
+/**
+ * @brief Reload the exports without stopping the server
+ *
+ * The new export set is parsed and its FSAL exports created off to
+ * the side, then published in one step.  Workers keep running:
+ * in-flight requests complete against the export and pseudo fs they
+ * already hold and new requests see the new generation.
+ */
+
 static void redo_exports(void)
 {
-  /**
-   * @todo If we make this accessible by DBUS we should have a good
-   * way of indicating error.
-   */
-  int rc = 0;
-
-  if (rebuild_export_list() <= 0)
-    {
-      return;
-    }
+  struct glist_head staged;
 
-  rc = state_async_pause();
-  if (rc != STATE_SUCCESS)
-    {
-      LogMajor(COMPONENT_THREAD,
-	       "Error pausing async state thread: %d",
-	       rc);
-      return;
-    }
+  init_glist(&staged);
 
-  if (worker_pause() != 0)
+  if (rebuild_export_list(&staged) <= 0)
     {
-      LogMajor(COMPONENT_MAIN,
-	       "Unable to pause workers.");
+      abort_staged_exports();
+      LogCrit(COMPONENT_MAIN,
+	      "Export reload failed, keeping current exports.");
       return;
     }
 
@@ -421,34 +749,58 @@ static void redo_exports(void)
 #endif /* USE_NFSIDMAP */
 #endif /* _HAVE_GSSAPI */
 
-  if (ChangeoverExports())
+  if (ChangeoverExports(&staged))
     {
-      LogCrit(COMPONENT_MAIN, "ChangeoverExports failed.");
+      abort_staged_exports();
+      LogCrit(COMPONENT_MAIN,
+	      "ChangeoverExports failed, keeping current exports.");
       return;
     }
 
-  if (worker_resume() != 0)
-    {
-      /* It's not as if there's anything you can do if this
-	 happens... */
-      LogFatal(COMPONENT_MAIN,
-	       "Unable to resume workers.");
-      return;
-    }
-
-  rc = state_async_resume();
-  if (rc != STATE_SUCCESS)
-    {
-      LogFatal(COMPONENT_THREAD,
-	       "Error resumeing down upcall system: %d",
-	       rc);
-    }
-
   LogEvent(COMPONENT_MAIN,
 	   "Exports reloaded and active");
 
 }
 
+#ifdef USE_LOCK_PROFILE
+
+/** Sites logged at shutdown */
+#define SHUTDOWN_LOCK_PROFILE_TOP 20
+
+/**
+ * @brief Log the most contended lock sites
+ */
+
+static void log_lock_profile(void)
+{
+	struct lock_prof_report report[SHUTDOWN_LOCK_PROFILE_TOP];
+	int n, i;
+
+	n = lock_prof_top(report, SHUTDOWN_LOCK_PROFILE_TOP);
+	if (n < 0) {
+		LogMajor(COMPONENT_RW_LOCK,
+			 "Unable to gather the lock profile");
+		return;
+	}
+	LogEvent(COMPONENT_RW_LOCK,
+		 "Most contended lock sites (times in ns):");
+	for (i = 0; i < n; i++) {
+		const struct lock_prof_site *site = report[i].site;
+		const struct lock_prof_counts *c = &report[i].counts;
+
+		LogEvent(COMPONENT_RW_LOCK,
+			 "%s %s at %s (%s:%d): acquired %"PRIu64
+			 " contended %"PRIu64" wait %"PRIu64" (max %"PRIu64
+			 ") hold %"PRIu64" (max %"PRIu64")",
+			 lock_prof_kind_name(site->kind), site->what,
+			 site->func, site->file, site->line, c->acquired,
+			 c->contended, c->wait_ns, c->wait_max, c->hold_ns,
+			 c->hold_max);
+	}
+}
+
+#endif /* USE_LOCK_PROFILE */
+
 static void do_shutdown(void)
 {
   int rc = 0;
@@ -476,6 +828,17 @@ static void do_shutdown(void)
 	       "State asynchronous request system shut down.");
     }
 
+  if (nfs_param.core_param.enable_NLM)
+    {
+      LogEvent(COMPONENT_MAIN,
+               "Stopping NSM thread");
+      nsm_async_shutdown();
+    }
+
+  LogEvent(COMPONENT_MAIN,
+           "Stopping recovery store thread");
+  nfs4_recovery_async_shutdown();
+
   LogEvent(COMPONENT_MAIN, "Stopping request listener threads.");
   nfs_rpc_dispatch_stop();
 
@@ -540,6 +903,16 @@ static void do_shutdown(void)
 	       "Reaper thread shut down.");
     }
 
+  LogEvent(COMPONENT_MAIN,
+	   "Writing the inode cache snapshot.");
+  rc = cache_inode_snapshot_pkgshutdown();
+  if (rc != 0)
+    {
+      LogMajor(COMPONENT_THREAD,
+	       "Error writing the inode cache snapshot: %d",
+	       rc);
+    }
+
   LogEvent(COMPONENT_MAIN,
 	   "Stopping LRU thread.");
   rc = cache_inode_lru_pkgshutdown();
@@ -555,6 +928,11 @@ static void do_shutdown(void)
 	       "LRU thread system shut down.");
     }
 
+#ifdef USE_LOCK_PROFILE
+  /* The threads serving requests have all stopped */
+  log_lock_profile();
+#endif
+
   LogEvent(COMPONENT_MAIN,
 	   "Destroying the inode cache.");
   cache_inode_destroyer();
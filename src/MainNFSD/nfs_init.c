@@ -70,6 +70,7 @@
 #include "delayed_exec.h"
 #include "client_mgr.h"
 #include "export_mgr.h"
+#include "pool_slab.h"
 
 extern struct fridgethr *req_fridge;
 
@@ -119,6 +120,10 @@ nfs_parameter_t nfs_param =
   .core_param.rpc.max_recv_buffer_size = NFS_DEFAULT_RECV_BUFFER_SIZE,
   .core_param.enable_NLM = true,
   .core_param.enable_RQUOTA = true,
+  .core_param.zero_copy_read = false,
+  .core_param.numa_local_pools = false,
+  .core_param.qos_client_ops = 0,
+  .core_param.qos_client_bytes = 0,
 
 
   /* Workers parameters : IP/Name values pool prealloc */
@@ -139,6 +144,8 @@ nfs_parameter_t nfs_param =
   .nfsv4_param.domainname = DOMAINNAME_DEFAULT,
   .nfsv4_param.idmapconf = IDMAPCONF_DEFAULT,
   .nfsv4_param.allow_numeric_owners = true,
+  .nfsv4_param.recovery_backend = RECOVERY_BACKEND_FS,
+  .nfsv4_param.lift_grace_early = true,
 #ifdef USE_NFSIDMAP
   .nfsv4_param.use_getpwnam = false,
 #else
@@ -270,9 +277,13 @@ nfs_parameter_t nfs_param =
   .cache_param.expire_type_link = CACHE_INODE_EXPIRE_NEVER,
   .cache_param.expire_type_dirent = CACHE_INODE_EXPIRE_NEVER,
   .cache_param.getattr_dir_invalidation = false,
+  .cache_param.neg_dirent_ttl = 10,
+  .cache_param.neg_dirent_max = 1024,
+  .cache_param.readahead_max = 4 * 1024 * 1024,
 
   /* Cache inode parameters : Garbage collection policy */
   .cache_param.entries_hwmark = 100000,
+  .cache_param.mem_budget = 0,
   .cache_param.use_fd_cache = true,
   .cache_param.lru_run_interval = 600,
   .cache_param.fd_limit_percent = 99,
@@ -282,6 +293,9 @@ nfs_parameter_t nfs_param =
   .cache_param.biggest_window = 40,
   .cache_param.required_progress = 5,
   .cache_param.futility_count = 8,
+  .cache_param.snapshot_file = NULL,
+  .cache_param.snapshot_entries = 0,
+  .cache_param.snapshot_interval = 0,
 
 };
 
@@ -482,6 +496,12 @@ int nfs_set_param_from_conf(config_file_t config_struct,
                  "core configuration read from config file");
     }
 
+  /* Clients are limited from their first request, before any of
+   * them is in the client manager */
+  if(nfs_param.core_param.qos_client_ops != 0 ||
+     nfs_param.core_param.qos_client_bytes != 0)
+    nfs_qos_enabled = true;
+
 
   /* Worker paramters: ip/name hash table and expiration for each entry */
   if((rc = nfs_read_ip_name_conf(config_struct, &nfs_param.ip_name_param)) < 0)
@@ -812,6 +832,9 @@ static void nfs_Init(const nfs_start_info_t *p_start_info)
   char GssError[MAXNAMLEN + 1];
 #endif
 
+  /* Before any slab pool is created */
+  pool_slab_defaults.numa_local = nfs_param.core_param.numa_local_pools;
+
 #ifdef USE_DBUS
   /* DBUS init */
   gsh_dbus_pkginit();
@@ -852,6 +875,13 @@ static void nfs_Init(const nfs_start_info_t *p_start_info)
    */
   exports_pkginit();
 
+  /* Warm the cache from the last snapshot, in the background */
+  rc = cache_inode_snapshot_pkginit();
+  if (rc != 0)
+    LogCrit(COMPONENT_INIT,
+            "Unable to start reloading the cache snapshot: %d.",
+            rc);
+
   nfs41_session_pool = pool_init("NFSv4.1 session pool",
                                  sizeof(nfs41_session_t),
                                  pool_basic_substrate,
@@ -885,18 +915,6 @@ static void nfs_Init(const nfs_start_info_t *p_start_info)
       Fatal();
     }
 
-  dupreq_pool = pool_init("Duplicate Request Pool",
-                          sizeof(dupreq_entry_t),
-                          pool_basic_substrate,
-                          NULL, NULL, NULL);
-  if(!(dupreq_pool))
-    {
-      LogCrit(COMPONENT_INIT,
-              "Error while allocating duplicate request pool");
-      LogError(COMPONENT_INIT, ERR_SYS, ERR_MALLOC, errno);
-      Fatal();
-    }
-
 #ifdef _USE_ASYNC_CACHE_INODE
   /* Start the TAD and synclets for writeback cache inode */
   cache_inode_async_init(nfs_param.cache_layers_param.cache_inode_client_param);
@@ -1110,6 +1128,9 @@ static void nfs_Init(const nfs_start_info_t *p_start_info)
   /* Start grace period */
   nfs4_start_grace(NULL);
 
+  /* From now on the recovery store is updated asynchronously */
+  nfs4_recovery_async_init();
+
 
      /* callback dispatch */
      nfs_rpc_cb_pkginit();
@@ -34,6 +34,8 @@
 #include "nfs_core.h"
 #include "log.h"
 #include "fridgethr.h"
+#include "export_mgr.h"
+#include "pool_slab.h"
 
 #define REAPER_DELAY 10
 
@@ -130,6 +132,39 @@ static int reap_hash_table(hash_table_t * ht_reap)
   return count;
 }
 
+/**
+ * @brief Log the occupancy of a slab pool
+ */
+static void reap_log_slab_pool(pool_t *pool,
+                               void *arg __attribute__((unused)))
+{
+  struct pool_slab_stats st;
+
+  pool_slab_stats(pool, &st);
+  LogDebug(COMPONENT_MEMALLOC,
+           "Pool %s: %"PRIu64" slabs (%"PRIu64" bytes) on %u node(s), "
+           "%"PRIu64" of %"PRIu64" objects in use, %"PRIu64" cached, "
+           "%"PRIu64" slabs made, %"PRIu64" released, %"PRIu64
+           " depot misses",
+           pool->name ? pool->name : "(unnamed)",
+           st.slabs, st.bytes, st.nodes, st.in_use, st.capacity,
+           st.cached, st.slab_allocs, st.slab_frees, st.depot_misses);
+}
+
+/**
+ * @brief Return a slab pool's idle magazines to its slabs
+ */
+static void reap_trim_slab_pool(pool_t *pool,
+                                void *arg __attribute__((unused)))
+{
+  uint64_t objs = pool_slab_trim(pool);
+
+  if(objs != 0)
+    LogFullDebug(COMPONENT_MEMALLOC,
+                 "Pool %s: %"PRIu64" idle objects returned to slabs",
+                 pool->name ? pool->name : "(unnamed)", objs);
+}
+
 struct reaper_state {
 	bool old_state_cleaned;
 	size_t count;
@@ -178,6 +213,14 @@ static void reaper_run(struct fridgethr_context *ctx)
 
   rst->count = (reap_hash_table(ht_confirmed_client_id) +
 		reap_hash_table(ht_unconfirmed_client_id));
+
+  /* Free exports retired by a reload once they are idle */
+  (void) reap_retired_exports();
+
+  pool_slab_foreach(reap_trim_slab_pool, NULL);
+
+  if(isDebug(COMPONENT_MEMALLOC))
+    pool_slab_foreach(reap_log_slab_pool, NULL);
 }
 
 int reaper_init(void)
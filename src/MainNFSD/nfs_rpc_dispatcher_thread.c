@@ -1258,6 +1258,7 @@ alloc_nfs_request(SVCXPRT *xprt)
 
     /* set the request as NFS already-read */
     nfsreq->rtype = NFS_REQUEST;
+    nfsreq->qos_charged = false;
 
     nfsreq->r_u.nfs = pool_alloc(request_data_pool, NULL);
     if (! nfsreq->r_u.nfs) {
@@ -42,6 +42,7 @@
 #include <sys/file.h> /* for having FNDELAY */
 #include <sys/signal.h>
 #include <poll.h>
+#include <unistd.h>
 #include "HashTable.h"
 #include "abstract_atomic.h"
 #include "log.h"
@@ -63,6 +64,9 @@
 #include "client_mgr.h"
 #include "export_mgr.h"
 #include "server_stats.h"
+#include "nfs_zcopy.h"
+#include "nfs_qos.h"
+#include "delayed_exec.h"
 
 pool_t *request_pool;
 pool_t *request_data_pool;
@@ -709,6 +713,8 @@ static void nfs_rpc_execute(request_data_t *preq,
   int port, rc = NFS_REQ_OK;
   enum auth_stat auth_rc;
   bool slocked = false;
+  bool sent;
+  struct nfs_zcopy zcopy = { .fd = -1 };
   const char *progname = "unknown";
 
   /* Initialize permissions to allow nothing */
@@ -789,6 +795,17 @@ static void nfs_rpc_execute(request_data_t *preq,
    * path is short, lockless, and does no hash/search). */
   dpq_status = nfs_dupreq_start(preqnfs, req);
   res_nfs = preqnfs->res_nfs;
+
+  /* A result that is freed with the request may be built in the
+   * worker's arena; one that is kept in the DRC may not. */
+  if(nfs_dupreq_nocache(req))
+    req_ctx.arena = &worker_data->arena;
+
+  /* Likewise, a READ whose reply is not kept may leave its payload in
+   * the file for us to send from. */
+  if(nfs_zcopy_eligible(req))
+    req_ctx.zcopy = &zcopy;
+
   if(dpq_status == DUPREQ_SUCCESS) {
       /* A new request, continue processing it. */
       LogFullDebug(COMPONENT_DISPATCH, "Current request is not duplicate or "
@@ -1229,8 +1246,12 @@ static void nfs_rpc_execute(request_data_t *preq,
       DISP_SLOCK(xprt);
 
       /* encoding the result on xdr output */
-      if(svc_sendreply(xprt, req, preqnfs->funcdesc->xdr_encode_func,
-                       (caddr_t) res_nfs) == false)
+      if(zcopy.fd >= 0)
+        sent = nfs_zcopy_sendreply(xprt, req, &res_nfs->res_read3, &zcopy);
+      else
+        sent = svc_sendreply(xprt, req, preqnfs->funcdesc->xdr_encode_func,
+                             (caddr_t) res_nfs);
+      if(sent == false)
         {
           LogDebug(COMPONENT_DISPATCH,
                   "NFS DISPATCHER: FAILURE: Error while calling "
@@ -1314,6 +1335,10 @@ freeargs:
   if (res_nfs)
 	  nfs_dupreq_rele(req, preqnfs->funcdesc);
 
+  /* Everything built in the arena went out with the reply */
+  gsh_arena_reset(&worker_data->arena);
+  nfs_zcopy_release(&zcopy);
+
   if(req_ctx.client != NULL)
 	  put_gsh_client(req_ctx.client);
   if(req_ctx.export != NULL)
@@ -1362,8 +1387,191 @@ static void _9p_free_reqdata(_9p_request_data_t * preq9p)
 /* XXX include dependency issue prevented declaring in nfs_req_queue.h */
 request_data_t *nfs_rpc_dequeue_req(nfs_worker_data_t *worker);
 
+/**
+ * @brief Bytes a request reads or writes, for rate limits
+ *
+ * @param[in] preqnfs Request
+ *
+ * @return The byte count of an NFS READ or WRITE, or of all the reads
+ *         and writes in an NFSv4 compound; 0 for anything else.
+ */
+
+static uint64_t nfs_rpc_qos_bytes(nfs_request_data_t *preqnfs)
+{
+  struct svc_req *req = &preqnfs->req;
+  nfs_arg_t *arg_nfs = &preqnfs->arg_nfs;
+  nfs_argop4 *op;
+  uint64_t bytes = 0;
+  u_int i;
+
+  if(req->rq_prog != nfs_param.core_param.program[P_NFS])
+    return 0;
+
+  if(req->rq_vers == NFS_V3)
+    {
+      if(req->rq_proc == NFSPROC3_READ)
+        bytes = arg_nfs->arg_read3.count;
+      else if(req->rq_proc == NFSPROC3_WRITE)
+        bytes = arg_nfs->arg_write3.data.data_len;
+    }
+  else if(req->rq_vers == NFS_V4 && req->rq_proc == NFSPROC4_COMPOUND)
+    {
+      for(i = 0; i < arg_nfs->arg_compound4.argarray.argarray_len; i++)
+        {
+          op = &arg_nfs->arg_compound4.argarray.argarray_val[i];
+          if(op->argop == NFS4_OP_READ)
+            bytes += op->nfs_argop4_u.opread.count;
+          else if(op->argop == NFS4_OP_WRITE)
+            bytes += op->nfs_argop4_u.opwrite.data.data_len;
+        }
+    }
+
+  return bytes;
+}
+
+/**
+ * @brief Export a request is for, for rate limits
+ *
+ * An NFSv3 request is for the export of its file handle, as in
+ * nfs_rpc_execute().  An NFSv4 compound may cross exports; it is
+ * charged to the export of its first PUTFH.
+ *
+ * @param[in] preqnfs Request
+ *
+ * @return The export id, or -1 if the request is for no export or
+ *         its handle is too short to name one.
+ */
+
+static int nfs_rpc_qos_exportid(nfs_request_data_t *preqnfs)
+{
+  struct svc_req *req = &preqnfs->req;
+  nfs_arg_t *arg_nfs = &preqnfs->arg_nfs;
+  nfs_fh3 *fh3;
+  nfs_fh4 *fh4;
+  nfs_argop4 *op;
+  u_int i;
+
+  if(preqnfs->funcdesc == &invalid_funcdesc ||
+     req->rq_proc == NFSPROC_NULL ||
+     req->rq_prog != nfs_param.core_param.program[P_NFS])
+    return -1;
+
+  /* The handles are not validated until the request runs, so one too
+   * short to hold an export id is charged to the client alone. */
+  if(req->rq_vers == NFS_V3)
+    {
+      fh3 = (nfs_fh3 *) arg_nfs;
+      if(fh3->data.data_len < sizeof(file_handle_v3_t))
+        return -1;
+      return nfs3_FhandleToExportId(fh3);
+    }
+
+  for(i = 0; i < arg_nfs->arg_compound4.argarray.argarray_len; i++)
+    {
+      op = &arg_nfs->arg_compound4.argarray.argarray_val[i];
+      if(op->argop == NFS4_OP_PUTFH)
+        {
+          fh4 = &op->nfs_argop4_u.opputfh.object;
+          if(fh4->nfs_fh4_len < sizeof(file_handle_v4_t))
+            return -1;
+          return nfs4_FhandleToExportId(fh4);
+        }
+    }
+
+  return -1;
+}
+
+/**
+ * @brief Queue a deferred request again
+ *
+ * @param[in] arg The request
+ */
+
+static void nfs_rpc_qos_resume(void *arg)
+{
+  nfs_rpc_enqueue_req(arg);
+}
+
+/**
+ * @brief Charge a request against the limits of its client and export
+ *
+ * A request is charged once, when a worker first picks it up.  If
+ * either its client or its export is over its limit, the request is
+ * handed to the delayed executor to be queued again once the debt
+ * is paid, and the worker moves on.
+ *
+ * @param[in] nfsreq Request
+ *
+ * @retval true if the request was deferred.
+ * @retval false if it should be executed now.
+ */
+
+static bool nfs_rpc_qos_defer(request_data_t *nfsreq)
+{
+  nfs_request_data_t *preqnfs = nfsreq->r_u.nfs;
+  struct gsh_client *client;
+  struct gsh_export *export;
+  sockaddr_t addr;
+  struct timespec ts;
+  nsecs_elapsed_t now_ns, delay = 0, d;
+  uint64_t bytes;
+  int exportid;
+
+  if(!nfs_qos_enabled || nfsreq->qos_charged)
+    return false;
+  nfsreq->qos_charged = true;
+
+  now(&ts);
+  /* 0 is "never charged" to the buckets */
+  now_ns = timespec_diff(&ServerBootTime, &ts) + 1;
+  bytes = nfs_rpc_qos_bytes(preqnfs);
+
+  if(copy_xprt_addr(&addr, preqnfs->xprt) == 1)
+    {
+      client = get_gsh_client(&addr, false);
+      if(client != NULL)
+        {
+          delay = nfs_qos_charge(&client->qos, bytes, now_ns);
+          put_gsh_client(client);
+        }
+    }
+
+  exportid = nfs_rpc_qos_exportid(preqnfs);
+  if(exportid >= 0)
+    {
+      export = get_gsh_export(exportid, true);
+      if(export != NULL)
+        {
+          d = nfs_qos_charge(&export->qos, bytes, now_ns);
+          if(d > delay)
+            delay = d;
+          put_gsh_export(export);
+        }
+    }
+
+  if(delay == 0)
+    return false;
+
+  LogFullDebug(COMPONENT_DISPATCH,
+               "Deferring request %p xid=%u for %llu ns",
+               nfsreq, preqnfs->req.rq_xid, (unsigned long long) delay);
+
+  if(delayed_submit(nfs_rpc_qos_resume, nfsreq, delay) != 0)
+    {
+      LogMajor(COMPONENT_DISPATCH,
+               "Unable to defer request, executing it now");
+      return false;
+    }
+
+  return true;
+}
+
 static uint32_t worker_indexer = 0;
 
+/* Running workers, for worker_synchronize() */
+static struct glist_head worker_list = { &worker_list, &worker_list };
+static pthread_mutex_t worker_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 /**
  * @brief Initialize a worker thread
  *
@@ -1383,6 +1591,14 @@ static void worker_thread_initializer(struct fridgethr_context *ctx)
   init_wait_q_entry(&wd->wqe);
   wd->ctx = ctx;
   ctx->thread_info = wd;
+
+  /* Result storage for the requests this worker runs */
+  gsh_arena_init(&wd->arena, GSH_ARENA_CHUNK_SIZE, GSH_ARENA_RETAIN_MAX);
+  gsh_arena_set_current(&wd->arena);
+
+  pthread_mutex_lock(&worker_list_mutex);
+  glist_add_tail(&worker_list, &wd->wd_list);
+  pthread_mutex_unlock(&worker_list_mutex);
 }
 
 /**
@@ -1393,6 +1609,14 @@ static void worker_thread_initializer(struct fridgethr_context *ctx)
 
 static void worker_thread_finalizer(struct fridgethr_context *ctx)
 {
+  struct nfs_worker_data *wd = ctx->thread_info;
+
+  pthread_mutex_lock(&worker_list_mutex);
+  glist_del(&wd->wd_list);
+  pthread_mutex_unlock(&worker_list_mutex);
+
+  gsh_arena_set_current(NULL);
+  gsh_arena_destroy(&wd->arena);
   gsh_free(ctx->thread_info);
   ctx->thread_info = NULL;
 }
@@ -1441,13 +1665,19 @@ static void worker_run(struct fridgethr_context *ctx)
            }
            reqcnt = xu->req_cnt;
            pthread_mutex_unlock(&nfsreq->r_u.nfs->xprt->xp_lock);
+           /* over its rate limits, the request is queued again later,
+            * still holding its xprt ref */
+           if(nfs_rpc_qos_defer(nfsreq))
+             continue;
            /* execute */
            LogDebug(COMPONENT_DISPATCH,
                     "NFS protocol request, nfsreq=%p xprt=%p req_cnt=%d",
                     nfsreq,
                     nfsreq->r_u.nfs->xprt,
                     reqcnt);
+           atomic_inc_uint64_t(&worker_data->req_seq);
            nfs_rpc_execute(nfsreq, worker_data);
+           atomic_inc_uint64_t(&worker_data->req_seq);
            break;
 
        case NFS_CALL:
@@ -1571,6 +1801,33 @@ int worker_pause(void)
   return rc;
 }
 
+/**
+ * @brief Wait for the NFS requests running now to finish
+ *
+ * Workers are not paused: each is waited on only until the request it
+ * is running, if any, is done.  Whatever was unpublished before the
+ * call is then no longer used by any request.
+ */
+
+void worker_synchronize(void)
+{
+  struct glist_head *glist;
+  struct nfs_worker_data *wd;
+  uint64_t seq;
+
+  pthread_mutex_lock(&worker_list_mutex);
+  glist_for_each(glist, &worker_list)
+    {
+      wd = glist_entry(glist, struct nfs_worker_data, wd_list);
+      seq = atomic_fetch_uint64_t(&wd->req_seq);
+      if((seq & 1) == 0)
+        continue;
+      while(atomic_fetch_uint64_t(&wd->req_seq) == seq)
+        usleep(1000);
+    }
+  pthread_mutex_unlock(&worker_list_mutex);
+}
+
 int worker_resume(void)
 {
   int rc = fridgethr_sync_command(worker_fridge,
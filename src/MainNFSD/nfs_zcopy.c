@@ -0,0 +1,263 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file nfs_zcopy.c
+ * @brief Send NFSv3 READ replies straight from the file
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include "log.h"
+#include "abstract_atomic.h"
+#include "ganesha_rpc.h"
+#include "nfs23.h"
+#include "nfs_core.h"
+#include "nfs_dupreq.h"
+#include "nfs_zcopy.h"
+
+/** Room for the record mark, reply header and READ3resok header */
+#define ZCOPY_HDR_MAX 512
+
+/** How long a send may wait for the client to drain the socket */
+#define ZCOPY_SEND_TIMEOUT_MS 60000
+
+/** Log the counters at debug level every this many replies */
+#define ZCOPY_REPORT_PERIOD 65536
+
+/** The last fragment bit of an RPC record mark */
+#define ZCOPY_LAST_FRAG 0x80000000
+
+static struct nfs_zcopy_stats zcopy_stats;
+
+/** XDR padding after the payload */
+static const char zcopy_pad[BYTES_PER_XDR_UNIT];
+
+/**
+ * @brief Decide whether a request may leave its READ payload in a file
+ *
+ * @param[in] req The request, after nfs_dupreq_start
+ *
+ * @return true if the reply can be sent with nfs_zcopy_sendreply.
+ */
+
+bool nfs_zcopy_eligible(struct svc_req *req)
+{
+  return nfs_param.core_param.zero_copy_read &&
+         req->rq_prog == nfs_param.core_param.program[P_NFS] &&
+         req->rq_vers == NFS_V3 &&
+         req->rq_proc == NFSPROC3_READ &&
+         req->rq_xprt->xp_type == XPRT_TCP &&
+         req->rq_cred.oa_flavor != RPCSEC_GSS &&
+         nfs_dupreq_nocache(req);
+}
+
+/**
+ * @brief Wait for the socket to take more data
+ *
+ * The transport socket may be non-blocking.
+ */
+
+static bool zcopy_wait(int sock)
+{
+  struct pollfd pfd = { .fd = sock, .events = POLLOUT };
+  int rc;
+
+  do
+    rc = poll(&pfd, 1, ZCOPY_SEND_TIMEOUT_MS);
+  while(rc < 0 && errno == EINTR);
+
+  return rc > 0 && !(pfd.revents & (POLLERR | POLLHUP | POLLNVAL));
+}
+
+static bool zcopy_send(int sock, const char *buf, size_t len, int flags)
+{
+  ssize_t n;
+
+  while(len > 0)
+    {
+      n = send(sock, buf, len, flags | MSG_NOSIGNAL);
+      if(n < 0)
+        {
+          if(errno == EINTR)
+            continue;
+          if((errno == EAGAIN || errno == EWOULDBLOCK) && zcopy_wait(sock))
+            continue;
+          return false;
+        }
+      buf += n;
+      len -= n;
+    }
+  return true;
+}
+
+/**
+ * @brief Send the payload with sendfile
+ *
+ * The length is already on the wire, so if the file shrank since
+ * read_fd looked at it the rest is sent as zeros to keep the record
+ * intact.
+ */
+
+static bool zcopy_sendfile(int sock, struct nfs_zcopy *zc, bool more)
+{
+  static const char zeros[1024];
+  off_t off = zc->offset;
+  size_t left = zc->len;
+  ssize_t n;
+
+  while(left > 0)
+    {
+      n = sendfile(sock, zc->fd, &off, left);
+      if(n < 0)
+        {
+          if(errno == EINTR)
+            continue;
+          if((errno == EAGAIN || errno == EWOULDBLOCK) && zcopy_wait(sock))
+            continue;
+          return false;
+        }
+      if(n == 0)
+        break;
+      left -= n;
+    }
+
+  if(left > 0)
+    {
+      atomic_inc_uint64_t(&zcopy_stats.short_files);
+      LogInfo(COMPONENT_DISPATCH,
+              "File shrank during zero-copy READ, padding %zu bytes",
+              left);
+    }
+  while(left > 0)
+    {
+      n = MIN(left, sizeof(zeros));
+      if(!zcopy_send(sock, zeros, n, (left > n || more) ? MSG_MORE : 0))
+        return false;
+      left -= n;
+    }
+  return true;
+}
+
+/**
+ * @brief Send a READ reply whose payload is in a file
+ *
+ * Does what svc_sendreply does for an AUTH_NONE or AUTH_SYS reply on
+ * a TCP stream, as one record: record mark, accepted reply header and
+ * READ3res encoded up to the data length, then the data from zc->fd,
+ * then XDR padding.  Called with the transport's send lock held.
+ *
+ * @param[in] xprt Transport the request came on
+ * @param[in] req  The request
+ * @param[in] res  READ result, status NFS3_OK
+ * @param[in] zc   The payload
+ *
+ * @return false if the reply could not be sent; the stream is then
+ *         unusable.
+ */
+
+bool nfs_zcopy_sendreply(SVCXPRT *xprt, struct svc_req *req,
+                         READ3res *res, struct nfs_zcopy *zc)
+{
+  READ3resok *resok = &res->READ3res_u.resok;
+  char hdr[ZCOPY_HDR_MAX];
+  struct rpc_msg reply;
+  XDR xdrs;
+  u_int data_len = zc->len;
+  uint32_t pad = (BYTES_PER_XDR_UNIT - (zc->len % BYTES_PER_XDR_UNIT)) %
+                 BYTES_PER_XDR_UNIT;
+  uint32_t hlen, mark;
+  uint64_t replies;
+  bool ok;
+
+  memset(&reply, 0, sizeof(reply));
+  reply.rm_xid = req->rq_xid;
+  reply.rm_direction = REPLY;
+  reply.rm_reply.rp_stat = MSG_ACCEPTED;
+  reply.acpted_rply.ar_verf = req->rq_verf;
+  reply.acpted_rply.ar_stat = SUCCESS;
+  reply.acpted_rply.ar_results.where = NULL;
+  reply.acpted_rply.ar_results.proc = (xdrproc_t) xdr_void;
+
+  xdrmem_create(&xdrs, hdr + BYTES_PER_XDR_UNIT,
+                sizeof(hdr) - BYTES_PER_XDR_UNIT, XDR_ENCODE);
+  ok = xdr_replymsg(&xdrs, &reply) &&
+       xdr_nfsstat3(&xdrs, &res->status) &&
+       xdr_post_op_attr(&xdrs, &resok->file_attributes) &&
+       xdr_count3(&xdrs, &resok->count) &&
+       xdr_bool(&xdrs, &resok->eof) &&
+       xdr_u_int(&xdrs, &data_len);
+  hlen = xdr_getpos(&xdrs);
+  xdr_destroy(&xdrs);
+  if(!ok)
+    {
+      LogCrit(COMPONENT_DISPATCH,
+              "Could not encode zero-copy READ reply header, xid=%u",
+              req->rq_xid);
+      return false;
+    }
+
+  mark = htonl(ZCOPY_LAST_FRAG | (hlen + zc->len + pad));
+  memcpy(hdr, &mark, BYTES_PER_XDR_UNIT);
+
+  if(!zcopy_send(xprt->xp_fd, hdr, BYTES_PER_XDR_UNIT + hlen,
+                 zc->len ? MSG_MORE : 0) ||
+     !zcopy_sendfile(xprt->xp_fd, zc, pad != 0) ||
+     !zcopy_send(xprt->xp_fd, zcopy_pad, pad, 0))
+    {
+      LogDebug(COMPONENT_DISPATCH,
+               "Zero-copy READ reply failed on socket %d, xid=%u: %d",
+               xprt->xp_fd, req->rq_xid, errno);
+      return false;
+    }
+
+  replies = atomic_inc_uint64_t(&zcopy_stats.replies);
+  atomic_add_uint64_t(&zcopy_stats.bytes, zc->len);
+  if(replies % ZCOPY_REPORT_PERIOD == 0)
+    LogDebug(COMPONENT_DISPATCH,
+             "Zero-copy READ: %"PRIu64" replies, %"PRIu64" bytes, "
+             "%"PRIu64" short files",
+             replies, atomic_fetch_uint64_t(&zcopy_stats.bytes),
+             atomic_fetch_uint64_t(&zcopy_stats.short_files));
+  return true;
+}
+
+/**
+ * @brief Close the payload descriptor, sent or not
+ */
+
+void nfs_zcopy_release(struct nfs_zcopy *zc)
+{
+  if(zc->fd >= 0)
+    {
+      close(zc->fd);
+      zc->fd = -1;
+    }
+  zc->len = 0;
+}
@@ -47,6 +47,7 @@
 #include "nfs_proto_tools.h"
 #include "nfs_tools.h"
 #include "server_stats.h"
+#include "nfs_zcopy.h"
 
 static void
 nfs_read_ok(exportlist_t *export,
@@ -61,7 +62,7 @@ nfs_read_ok(exportlist_t *export,
    if ((read_size == 0) &&
        (data != NULL))
        {
-          gsh_free(data);
+          gsh_arena_res_free(data);
           data = NULL;
        }
 
@@ -232,7 +233,31 @@ nfs_Read(nfs_arg_t *arg,
          } 
         else 
          {
-                data = gsh_malloc(size);
+                if (req_ctx->zcopy != NULL) {
+                        /* Leave the data in the file for the worker to
+                           send with sendfile, if the FSAL can */
+                        cache_status = cache_inode_rdwr(entry,
+                                                        CACHE_INODE_READ_FD,
+                                                        offset,
+                                                        size,
+                                                        &read_size,
+                                                        &req_ctx->zcopy->fd,
+                                                        &eof_met,
+                                                        req_ctx,
+                                                        &sync);
+                        if (cache_status == CACHE_INODE_SUCCESS) {
+                                req_ctx->zcopy->offset = offset;
+                                req_ctx->zcopy->len = read_size;
+                                nfs_read_ok(export, req, req_ctx, res, NULL,
+                                            read_size, entry, eof_met);
+                                rc = NFS_REQ_OK;
+                                goto out;
+                        }
+                        if (cache_status != CACHE_INODE_NOT_SUPPORTED)
+                                goto err;
+                }
+
+                data = gsh_arena_res_alloc(req_ctx->arena, size);
                 if (data == NULL) {
                         rc = NFS_REQ_DROP;
                         goto out;
@@ -254,9 +279,10 @@ nfs_Read(nfs_arg_t *arg,
                         rc = NFS_REQ_OK;
                         goto out;
                 }
-                gsh_free(data);
+                gsh_arena_res_free(data);
         }
 
+err:
         /* If we are here, there was an error */
         if (nfs_RetryableError(cache_status)) {
                 rc = NFS_REQ_DROP;
@@ -293,8 +319,10 @@ out:
  */
 void nfs3_Read_Free(nfs_res_t *res)
 {
+        /* A zero-copy READ has the length but no data */
         if ((res->res_read3.status == NFS3_OK) &&
-            (res->res_read3.READ3res_u.resok.data.data_len != 0)) {
-                gsh_free(res->res_read3.READ3res_u.resok.data.data_val);
+            (res->res_read3.READ3res_u.resok.data.data_len != 0) &&
+            (res->res_read3.READ3res_u.resok.data.data_val != NULL)) {
+                gsh_arena_res_free(res->res_read3.READ3res_u.resok.data.data_val);
         }
 } /* nfs3_Read_Free */
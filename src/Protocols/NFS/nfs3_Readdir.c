@@ -79,6 +79,7 @@ struct nfs3_readdir_cb_data
                               array */
      nfsstat3 error; /*< Set to a value other than NFS_OK if the
                          callback function finds a fatal error. */
+     struct gsh_arena *arena; /*< Result storage, may be NULL */
 };
 
 
@@ -217,8 +218,10 @@ nfs_Readdir(nfs_arg_t *arg,
           }
      }
 
-     cb3.entries = gsh_calloc(estimated_num_entries,
-                              sizeof(entry3));
+     cb3.arena = req_ctx->arena;
+     cb3.entries = gsh_arena_res_calloc(cb3.arena,
+                                        estimated_num_entries,
+                                        sizeof(entry3));
      if (cb3.entries == NULL) {
           rc = NFS_REQ_DROP;
           goto out;
@@ -394,7 +397,7 @@ nfs3_readdir_callback(void* opaque,
      }
 
      e3->fileid = obj_hdl->attributes.fileid;
-     e3->name = gsh_strdup(name);
+     e3->name = gsh_arena_res_strdup(tracker->arena, name);
      if (e3->name == NULL) {
           tracker->error = NFS3ERR_IO;
           return false;
@@ -426,9 +429,9 @@ free_entry3s(entry3 *entry3s)
      for (entry = entry3s;
           entry != NULL;
           entry = entry->nextentry) {
-          gsh_free(entry->name);
+          gsh_arena_res_free(entry->name);
      }
-     gsh_free(entry3s);
+     gsh_arena_res_free(entry3s);
 
      return;
 } /* free_entry3s */
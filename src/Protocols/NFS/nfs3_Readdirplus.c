@@ -61,17 +61,19 @@ static void free_entryplus3s(entryplus3 *entryplus3s);
  *
  * This structure keeps track of the process of writing out an NFSv3
  * READDIRPLUS response between calls to nfs3_readdirplus_callback.
+ * Entries are XDR encoded as they arrive, into a buffer that is later
+ * copied as-is into the reply.
  */
 
 struct nfs3_readdirplus_cb_data
 {
-     entryplus3 *entries; /*< The array holding individual entries */
-     size_t mem_left; /*< The amount of memory remaining before we
-                          hit maxcount */
+     XDR xdr; /*< Memory stream over the entry buffer, its size
+                  is what maxcount leaves for entries */
+     size_t dircount; /*< Client's limit on fileid, name and cookie
+                          bytes */
+     size_t dir_used; /*< Directory bytes encoded so far */
      size_t count; /*< The count of complete entries stored in the
                        buffer */
-     size_t total_entries; /*< The number of entires we allocated for
-                               the array. */
      nfsstat3 error; /*< Set to a value other than NFS_OK if the
                          callback function finds a fatal error. */
 };
@@ -106,14 +108,15 @@ nfs3_Readdirplus(nfs_arg_t *arg,
      uint64_t cache_inode_cookie = 0;
      cookieverf3 cookie_verifier;
      unsigned int num_entries = 0;
-     unsigned long estimated_num_entries = 0;
      object_file_type_t dir_filetype = 0;
      bool eod_met = false;
      cache_inode_status_t cache_status = 0;
      cache_inode_status_t cache_status_gethandle = 0;
      int rc = NFS_REQ_OK;
-     struct nfs3_readdirplus_cb_data cb_opaque = {.entries = NULL,
-                                                  .mem_left = 0,
+     size_t entries_len = 0;
+     char *entries_xdr = NULL;
+     struct nfs3_readdirplus_cb_data cb_opaque = {.dircount = 0,
+                                                  .dir_used = 0,
                                                   .count = 0,
                                                   .error = NFS3_OK};
 
@@ -136,26 +139,27 @@ nfs3_Readdirplus(nfs_arg_t *arg,
      res->res_readdir3.READDIR3res_u.resfail
           .dir_attributes.attributes_follow = FALSE;
 
-     cb_opaque.mem_left = (arg->arg_readdirplus3.maxcount * 9) / 10;
+     /* Room for entries is what maxcount leaves after the rest of
+        the reply (counted generously, at in-memory size).  The buffer
+        is sized from it, so a client must not choose it beyond what
+        the export would send for a READ. */
+     entries_len = MIN(arg->arg_readdirplus3.maxcount, export->MaxRead);
+     entries_len = (entries_len * 9) / 10;
+     if (entries_len > sizeof(READDIRPLUS3resok)) {
+          entries_len -= sizeof(READDIRPLUS3resok);
+     } else {
+          entries_len = 0;
+     }
      begin_cookie = arg->arg_readdirplus3.cookie;
+     cb_opaque.dircount = arg->arg_readdirplus3.dircount;
 
-     cb_opaque.mem_left -= sizeof(READDIRPLUS3resok);
-
-     /* Estimate assuming that we're going to send no names and no handles.
-      * Don't count space for pointers for nextentry or 
-      * name_handle.data.data_val in entryplus3 */
-     estimated_num_entries =
-          MIN((cb_opaque.mem_left + sizeof(entryplus3 *))
-              / (sizeof(entryplus3) - sizeof(char *)*2), 50);
-
-     cb_opaque.total_entries = estimated_num_entries;
      LogFullDebug(COMPONENT_NFS_READDIR,
                   "nfs3_Readdirplus: dircount=%u "
                   "begin_cookie=%"PRIu64" "
-                  "estimated_num_entries=%lu, mem_left=%zd",
+                  "entries_len=%zu",
                   arg->arg_readdirplus3.dircount,
                   begin_cookie,
-                  estimated_num_entries, cb_opaque.mem_left);
+                  entries_len);
 
      /* Is this a xattr FH ? */
      if (nfs3_Is_Fh_Xattr(&(arg->arg_readdirplus3.dir))) {
@@ -224,12 +228,13 @@ nfs3_Readdirplus(nfs_arg_t *arg,
 #define RES_READDIRPLUS_REPLY pres->res_readdirplus3.READDIRPLUS3res_u  \
           .resok.reply
 
-     /* Allocate space for entries */
-     cb_opaque.entries = gsh_calloc(estimated_num_entries, sizeof(entryplus3));
-     if (cb_opaque.entries == NULL) {
+     /* Allocate the buffer entries are encoded into */
+     entries_xdr = gsh_arena_res_alloc(req_ctx->arena, entries_len);
+     if (entries_xdr == NULL) {
           rc = NFS_REQ_DROP;
           goto out;
      }
+     xdrmem_create(&cb_opaque.xdr, entries_xdr, entries_len, XDR_ENCODE);
 
      if (begin_cookie == 0) {
           /* Fill in "." */
@@ -313,10 +318,24 @@ nfs3_Readdirplus(nfs_arg_t *arg,
           memcpy(res->res_readdirplus3.READDIRPLUS3res_u.resok.cookieverf,
                  cookie_verifier, sizeof(cookieverf3));
      } else {
+          entries_len = xdr_getpos(&cb_opaque.xdr);
+          if (req_ctx->arena == NULL) {
+               /* The reply may be kept, don't keep it at maxcount */
+               char *shrunk = gsh_realloc(entries_xdr, entries_len);
+
+               if (shrunk != NULL) {
+                    entries_xdr = shrunk;
+               }
+          }
+          res->res_readdirplus3.READDIRPLUS3res_u
+               .resok.reply.entries = NULL;
           res->res_readdirplus3.READDIRPLUS3res_u
-               .resok.reply.entries = cb_opaque.entries;
+               .resok.reply.entries_xdr = entries_xdr;
+          res->res_readdirplus3.READDIRPLUS3res_u
+               .resok.reply.entries_xdr_len = entries_len;
           res->res_readdirplus3.READDIRPLUS3res_u.resok.reply.eof
                = eod_met;
+          entries_xdr = NULL;
      }
 
      nfs_SetPostOpAttr(dir_entry,
@@ -338,10 +357,9 @@ out:
      if (dir_entry)
           cache_inode_put(dir_entry);
 
-     if (((res->res_readdir3.status != NFS3_OK) ||
-          (rc != NFS_REQ_OK)) &&
-         (cb_opaque.entries != NULL)) {
-          free_entryplus3s(cb_opaque.entries);
+     /* Not handed to the reply */
+     if (entries_xdr != NULL) {
+          gsh_arena_res_free(entries_xdr);
      }
 
      return rc;
@@ -362,21 +380,24 @@ void nfs3_Readdirplus_Free(nfs_res_t *resp)
          (RESREADDIRPLUSREPLY.entries != NULL)) {
           free_entryplus3s(RESREADDIRPLUSREPLY.entries);
      }
+     if (resp->res_readdirplus3.status == NFS3_OK) {
+          gsh_arena_res_free(RESREADDIRPLUSREPLY.entries_xdr);
+     }
 } /*  nfs3_Readdirplus_Free */
 
 /**
- * @brief Populate entryplus3s when called from cache_inode_readdir
+ * @brief Encode an entryplus3 when called from cache_inode_readdir
  *
  * This function is a callback passed to cache_inode_readdir.  It
- * fills in a pre-allocated array of entryplys3 structures and allocates
- * space for the name and attributes.  This space must be freed.
+ * appends the entry, as it will appear on the wire, to the buffer
+ * set up in the tracker.  An entry that does not fit is rolled back
+ * and ends the listing.
  *
- * @param opaque [in] Pointer to a struct nfs3_readdirplus_cb_data that is
- *                    gives the location of the array and other
- *                    bookeeping information
+ * @param opaque [in] Pointer to a struct nfs3_readdirplus_cb_data that
+ *                    holds the encoding stream and other bookeeping
+ *                    information
  * @param name [in] The filename for the current entry
- * @param handle [in] The current entry's filehandle
- * @param attrs [in] The current entry's attributes
+ * @param obj_hdl [in] The current entry's handle
  * @param cookie [in] The readdir cookie for the current entry
  */
 
@@ -391,67 +412,54 @@ nfs3_readdirplus_callback(void* opaque,
           (struct nfs3_readdirplus_cb_data *) opaque;
      /* Length of the current filename */
      size_t namelen = strlen(name);
-     entryplus3 *ep3 = tracker->entries + tracker->count;
-
-     if (tracker->count == tracker->total_entries) {
-          return false;
-     }
-     /* This is a pessimistic check, which assumes that we're going
-      * to send attributes and full size handle - if it fails then
-      * we're close enough to the buffer size limit and t's time to
-      * stop anyway */
-     if ((tracker->mem_left < (sizeof(entryplus3) + namelen + NFS3_FHSIZE))) {
-          if (tracker->count == 0) {
-               tracker->error = NFS3ERR_TOOSMALL;
-          }
+     /* Fileid, name and cookie, as counted against dircount */
+     size_t dirbytes = sizeof(fileid3) + BYTES_PER_XDR_UNIT
+          + RNDUP(namelen) + sizeof(cookie3);
+     u_int start = xdr_getpos(&tracker->xdr);
+     bool_t follows = TRUE;
+     char fh_buf[NFS3_FHSIZE];
+     entryplus3 ep3;
+
+     if ((tracker->dircount != 0) && (tracker->count != 0) &&
+         (tracker->dir_used + dirbytes > tracker->dircount)) {
           return false;
      }
 
-     ep3->fileid = obj_hdl->attributes.fileid;
-     ep3->name = gsh_strdup(name);
-     if (ep3->name == NULL) {
-          tracker->error = NFS3ERR_IO;
-          return false;
-     }
-     ep3->cookie = cookie;
-
-     /* Account for file name + length + cookie */
-     tracker->mem_left -= sizeof(ep3->cookie) + ((namelen + 3) & ~3) + 4;
-
-     ep3->name_handle.handle_follows = TRUE;
-     ep3->name_handle.post_op_fh3_u.handle.data.data_val
-          = gsh_malloc(NFS3_FHSIZE);
-     if (ep3->name_handle.post_op_fh3_u .handle.data.data_val == NULL) {
-          LogEvent(COMPONENT_NFS_READDIR, "FAILED to allocate FH");
-          tracker->error = NFS3ERR_SERVERFAULT;
-          gsh_free(ep3->name);
-          return false;
-     }
+     memset(&ep3, 0, sizeof(ep3));
+     ep3.fileid = obj_hdl->attributes.fileid;
+     ep3.name = (char *) name;
+     ep3.cookie = cookie;
 
-     if (!nfs3_FSALToFhandle(&ep3->name_handle.post_op_fh3_u.handle,
+     ep3.name_handle.handle_follows = TRUE;
+     ep3.name_handle.post_op_fh3_u.handle.data.data_val = fh_buf;
+     if (!nfs3_FSALToFhandle(&ep3.name_handle.post_op_fh3_u.handle,
 			     obj_hdl)) {
           tracker->error = NFS3ERR_BADHANDLE;
-          gsh_free(ep3->name);
-          gsh_free(ep3->name_handle.post_op_fh3_u.handle.data.data_val);
           return false;
      }
 
-     /* Account for filehande + length + follows + nextentry */
-     tracker->mem_left -= ep3->name_handle.post_op_fh3_u.handle.data.data_len + 12;
-     if (tracker->count > 0) {
-          tracker->entries[tracker->count - 1].nextentry = ep3;
-     }
-
-     ep3->name_attributes.attributes_follow
+     ep3.name_attributes.attributes_follow
           = nfs3_FSALattr_To_Fattr(
                obj_hdl->export->exp_entry,
                &obj_hdl->attributes,
-               &(ep3->name_attributes.post_op_attr_u.attributes));
-     if (ep3->name_attributes.attributes_follow) {
-          tracker->mem_left -= sizeof(ep3->name_attributes);
-     } else {
-          tracker->mem_left -= sizeof(ep3->name_attributes.attributes_follow);
+               &(ep3.name_attributes.post_op_attr_u.attributes));
+
+     /* The value_follows of the list pointer, then the entry without
+        its own nextentry pointer */
+     if (!xdr_bool(&tracker->xdr, &follows) ||
+         !xdr_fileid3(&tracker->xdr, &ep3.fileid) ||
+         !xdr_filename3(&tracker->xdr, &ep3.name) ||
+         !xdr_cookie3(&tracker->xdr, &ep3.cookie) ||
+         !xdr_post_op_attr(&tracker->xdr, &ep3.name_attributes) ||
+         !xdr_post_op_fh3(&tracker->xdr, &ep3.name_handle)) {
+          xdr_setpos(&tracker->xdr, start);
+          if (tracker->count == 0) {
+               tracker->error = NFS3ERR_TOOSMALL;
+          }
+          return false;
      }
+
+     tracker->dir_used += dirbytes;
      ++(tracker->count);
      return true;
 } /* nfs3_readdirplus_callback */
@@ -473,10 +481,10 @@ free_entryplus3s(entryplus3 *entryplus3s)
      for (entry = entryplus3s;
           entry != NULL;
           entry = entry->nextentry) {
-          gsh_free(entry->name);
-          gsh_free(entry->name_handle.post_op_fh3_u.handle.data.data_val);
+          gsh_arena_res_free(entry->name);
+          gsh_arena_res_free(entry->name_handle.post_op_fh3_u.handle.data.data_val);
      }
-     gsh_free(entryplus3s);
+     gsh_arena_res_free(entryplus3s);
 
      return;
 } /* free_entryplus3s */
@@ -225,27 +225,20 @@ int nfs4_op_close(struct nfs_argop4 *op,
                    layouts of only one layout type) each marked
                    return_on_close. */
 
-                glist_for_each(glist, &data->current_entry->state_list) {
-                        state_t *state = glist_entry(glist, state_t,
-                                                     state_list);
-
-                        if ((state->state_type == STATE_TYPE_SHARE) &&
-                            (state->state_owner->so_type
-                             == STATE_OPEN_OWNER_NFSV4) &&
-                            (state->state_owner->so_owner.so_nfs4_owner
-                             .so_clientid ==
-                             data->psession->clientid)) {
-                                last_close = false;
-                                break;
-                        }
+                if (state_index_first(data->current_entry,
+                                      STATE_TYPE_SHARE,
+                                      data->psession->clientid,
+                                      NULL) != NULL) {
+                        last_close = false;
                 }
 
                 if (last_close) {
-                        glist_for_each_safe(
-                                glist, glistn,
-                                &data->current_entry->state_list) {
-                                state_t *state = glist_entry(glist, state_t,
-                                                             state_list);
+                        state_t *next = state_index_first(
+                                data->current_entry, STATE_TYPE_LAYOUT,
+                                data->psession->clientid, NULL);
+
+                        while (next != NULL) {
+                                state_t *state = next;
                                 bool deleted = false;
                                 struct pnfs_segment entire = {
                                         .io_mode = LAYOUTIOMODE4_ANY,
@@ -253,8 +246,12 @@ int nfs4_op_close(struct nfs_argop4 *op,
                                         .length = NFS4_UINT64_MAX
                                 };
 
-                                if ((state->state_type == STATE_TYPE_LAYOUT) &&
-                                    (state->state_owner
+                                /* Step past it before it is returned */
+                                next = state_index_next(
+                                        state, STATE_TYPE_LAYOUT,
+                                        data->psession->clientid, NULL);
+
+                                if ((state->state_owner
                                      ->so_owner.so_nfs4_owner
                                      .so_clientrec ==
                                      data->psession->clientid_record) &&
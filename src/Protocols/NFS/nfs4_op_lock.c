@@ -387,7 +387,13 @@ check_seqid:
                 goto out;
         }
 
-        /* Do grace period checking */
+        /* Do grace period checking.  A v4.0 client locks anew only
+           once it has reclaimed everything. */
+        if (data->minorversion == 0 && !arg_LOCK4->reclaim &&
+            clientid->cid_allow_reclaim && nfs_in_grace()) {
+                nfs4_reclaim_done(clientid);
+        }
+
         if (nfs_in_grace() && !arg_LOCK4->reclaim) {
                 LogLock(COMPONENT_NFS_V4_LOCK, NIV_DEBUG,
                         "LOCK failed, non-reclaim while in grace",
@@ -91,8 +91,6 @@ open4_do_open(struct nfs_argop4  * op,
         state_status_t         state_status = STATE_SUCCESS;
         /* Return value of Cache inode operations */
         cache_inode_status_t   cache_status = CACHE_INODE_SUCCESS;
-        /* Iterator for state list */
-        struct glist_head    * glist = NULL;
         /* Current state being investigated */
         state_t              * state_iterate = NULL;
         /* The open state for the file */
@@ -147,28 +145,15 @@ open4_do_open(struct nfs_argop4  * op,
         }
 
         /* Try to find if the same open_owner already has acquired a
-           stateid for this file */
-        glist_for_each(glist, &data->current_entry->state_list) {
-                state_iterate = glist_entry(glist, state_t, state_list);
-
-                /**
-                 * @todo This will need to be updated when we get
-                 * delegations.
-                 */
-                if (state_iterate->state_type != STATE_TYPE_SHARE)
-                        continue;
-
-                /* Check if open_owner is the same.  Since owners are
-                   created/looked up we should be able to just
-                   compare pointers.  */
-                if (state_iterate->state_owner == owner) {
-                        /* We'll be re-using the found state */
-                        file_state = state_iterate;
-                        *new_state = false;
-                        /* If we are re-using stateid, then release
-                           extra reference to open owner */
-                        break;
-                }
+           stateid for this file.  Since owners are created/looked up
+           the index can compare pointers. */
+        state_iterate = state_index_first(
+                data->current_entry, STATE_TYPE_SHARE,
+                owner->so_owner.so_nfs4_owner.so_clientid, owner);
+        if (state_iterate != NULL) {
+                /* We'll be re-using the found state */
+                file_state = state_iterate;
+                *new_state = false;
         }
 
         if (*new_state) {
@@ -343,6 +328,13 @@ open4_validate_claim(compound_data_t   * data,
 
         switch (claim) {
         case CLAIM_NULL:
+                /* A v4.0 client opens anew only once it has
+                   reclaimed everything */
+                if (data->minorversion == 0 &&
+                    clientid->cid_allow_reclaim &&
+                    nfs_in_grace()) {
+                        nfs4_reclaim_done(clientid);
+                }
                 if (nfs_in_grace()) {
                         status = NFS4ERR_GRACE;
                 }
@@ -296,7 +296,9 @@ nfs4_op_read(struct nfs_argop4 *op,
         }
 
         /* Some work is to be done */
-        if ((bufferdata = gsh_malloc_aligned(4096, size)) == NULL) {
+        bufferdata = gsh_arena_res_alloc_aligned(data->req_ctx->arena,
+                                                 4096, size);
+        if (bufferdata == NULL) {
                 LogEvent(COMPONENT_NFS_V4,
                         "FAILED to allocate bufferdata");
                 res_READ4.status = NFS4ERR_SERVERFAULT;
@@ -321,7 +323,7 @@ nfs4_op_read(struct nfs_argop4 *op,
 					&sync);
 	if (cache_status != CACHE_INODE_SUCCESS) {
                 res_READ4.status = nfs4_Errno(cache_status);
-                gsh_free(bufferdata);
+                gsh_arena_res_free(bufferdata);
                 res_READ4.READ4res_u.resok4.data.data_val = NULL;
                 goto done;
         }
@@ -330,7 +332,7 @@ nfs4_op_read(struct nfs_argop4 *op,
                              data->req_ctx,
                              &file_size) != CACHE_INODE_SUCCESS) {
                 res_READ4.status = nfs4_Errno(cache_status);
-                gsh_free(bufferdata);
+                gsh_arena_res_free(bufferdata);
                 res_READ4.READ4res_u.resok4.data.data_val = NULL;
                 goto done;
         }
@@ -384,7 +386,8 @@ nfs4_op_read_Free(READ4res *resp)
 {
         if (resp->status == NFS4_OK) {
                 if (resp->READ4res_u.resok4.data.data_val != NULL) {
-                        gsh_free(resp->READ4res_u.resok4.data.data_val);
+                        gsh_arena_res_free(resp->READ4res_u.resok4
+                                           .data.data_val);
                 }
         }
         return;
@@ -427,7 +430,8 @@ static int op_dsread(struct nfs_argop4 *op,
 
         /* Construct the FSAL file handle */
 
-        buffer = gsh_malloc_aligned(4096, arg_READ4.count);
+        buffer = gsh_arena_res_alloc_aligned(data->req_ctx->arena,
+                                             4096, arg_READ4.count);
         if (buffer == NULL) {
                 LogEvent(COMPONENT_NFS_V4,
                         "FAILED to allocate read buffer");
@@ -448,7 +452,7 @@ static int op_dsread(struct nfs_argop4 *op,
                                            &res_READ4.READ4res_u
                                            .resok4.data.data_len,
                                            &eof)) != NFS4_OK) {
-                gsh_free(buffer);
+                gsh_arena_res_free(buffer);
                 res_READ4.READ4res_u.resok4.data.data_val = NULL;
         }
 
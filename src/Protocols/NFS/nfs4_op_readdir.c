@@ -49,18 +49,20 @@ static const attrlist4 RdAttrErrorVals = {0, NULL};
  * @brief Opaque bookkeeping structure for NFSv4 readdir
  *
  * This structure keeps track of the process of writing out an NFSv4
- * READDIR response between calls to nfs4_readdir_callback.
+ * READDIR response between calls to nfs4_readdir_callback.  Entries
+ * are XDR encoded as they arrive, into a buffer that is later copied
+ * as-is into the reply.
  */
 
 struct nfs4_readdir_cb_data
 {
-     entry4 *entries; /*< The array holding individual entries */
-     size_t mem_left; /*< The amount of memory remaining before we
-                          hit maxcount */
+     XDR xdr; /*< Memory stream over the entry buffer, its size
+                  is what maxcount leaves for entries */
+     size_t dircount; /*< Client's limit on cookie and name bytes,
+                          0 for none */
+     size_t dir_used; /*< Cookie and name bytes encoded so far */
      size_t count; /*< The count of complete entries stored in the
                        buffer */
-     size_t total_entries; /*< The total number of entries available
-                               in the array*/
      nfsstat4 error; /*< Set to a value other than NFS4_OK if the
                          callback function finds a fatal error. */
      struct bitmap4 req_attr; /*< The requested attributes */
@@ -69,18 +71,18 @@ struct nfs4_readdir_cb_data
 };
 
 /**
- * @brief Populate entry4s when called from cache_inode_readdir
+ * @brief Encode an entry4 when called from cache_inode_readdir
  *
  * This function is a callback passed to cache_inode_readdir.  It
- * fills in a pre-allocated array of entry4 structures and allocates
- * space for the name and attributes.  This space must be freed.
+ * appends the entry, as it will appear on the wire, to the buffer
+ * set up in the tracker.  An entry that does not fit is rolled back
+ * and ends the listing.
  *
  * @param[in,out] opaque A struct nfs4_readdir_cb_data that stores the
- *                       location of the array and other bookeeping
+ *                       encoding stream and other bookeeping
  *                       information
  * @param[in]     name   The filename for the current entry
  * @param[in]     handle The current entry's filehandle
- * @param[in]     attrs  The current entry's attributes
  * @param[in]     cookie The readdir cookie for the current entry
  */
 
@@ -92,91 +94,63 @@ nfs4_readdir_callback(void* opaque,
 {
      struct nfs4_readdir_cb_data *tracker =
           (struct nfs4_readdir_cb_data *) opaque;
-     size_t namelen = 0;
+     size_t namelen = strlen(name);
+     /* Cookie and name, as counted against dircount */
+     size_t dirbytes = sizeof(nfs_cookie4) + BYTES_PER_XDR_UNIT
+          + RNDUP(namelen);
+     u_int start = xdr_getpos(&tracker->xdr);
+     bool_t follows = TRUE;
      char val_fh[NFS4_FHSIZE];
      nfs_fh4 entryFH = {
           .nfs_fh4_len = 0,
           .nfs_fh4_val = val_fh
      };
+     char attrvals[NFS4_ATTRVALS_BUFFLEN];
+     fattr4 attrs;
+     component4 entryname = {
+          .utf8string_len = namelen,
+          .utf8string_val = (char *) name
+     };
 
-     if (tracker->total_entries == tracker->count) {
+     if ((tracker->dircount != 0) && (tracker->count != 0) &&
+         (tracker->dir_used + dirbytes > tracker->dircount)) {
           return false;
      }
      memset(val_fh, 0, NFS4_FHSIZE);
-     /* Bits that don't require allocation */
-     if (tracker->mem_left < sizeof(entry4)) {
-          if (tracker->count == 0) {
-               tracker->error = NFS4ERR_TOOSMALL;
-          }
-          return false;
-     }
-     tracker->mem_left -= sizeof(entry4);
-     tracker->entries[tracker->count].cookie = cookie;
-     tracker->entries[tracker->count].nextentry = NULL;
-
-     /* The filename.  We don't use str2utf8 because that has an
-        additional copy into a buffer before copying into the
-        destination. */
-
-     namelen = strlen(name);
-     if (tracker->mem_left < (namelen + 1)) {
-          if (tracker->count == 0) {
-               tracker->error = NFS4ERR_TOOSMALL;
-          }
-          return false;
-     }
-     tracker->mem_left -= (namelen);
-     tracker->entries[tracker->count].name.utf8string_len = namelen;
-     tracker->entries[tracker->count].name.utf8string_val
-          = gsh_malloc(namelen);
-     memcpy(tracker->entries[tracker->count].name.utf8string_val,
-	    name, namelen);
 
      if(attribute_is_set(&tracker->req_attr, FATTR4_FILEHANDLE)) {
           if (!nfs4_FSALToFhandle(&entryFH, handle)) {
                tracker->error = NFS4ERR_SERVERFAULT;
-               gsh_free(tracker->entries[tracker->count].name.utf8string_val);
                return false;
           }
      }
 
-     if (nfs4_FSALattr_To_Fattr(&handle->attributes,
-                                &tracker->entries[tracker->count].attrs,
-                                tracker->data,
-                                &entryFH,
-                                &tracker->req_attr) != 0) {
+     if (nfs4_FSALattr_To_Fattr_buf(&handle->attributes,
+                                    &attrs,
+                                    tracker->data,
+                                    &entryFH,
+                                    &tracker->req_attr,
+                                    attrvals,
+                                    sizeof(attrvals)) != 0) {
           /* Return the fattr4_rdattr_error, see RFC 3530, p. 192/RFC
              5661 p. 112. */
-          tracker->entries[tracker->count]
-               .attrs.attrmask = RdAttrErrorBitmap;
-          tracker->entries[tracker->count]
-               .attrs.attr_vals = RdAttrErrorVals;
+          attrs.attrmask = RdAttrErrorBitmap;
+          attrs.attr_vals = RdAttrErrorVals;
      }
 
-     if (tracker->mem_left <
-         ((tracker->entries[tracker->count].attrs.attrmask.bitmap4_len *
-           sizeof(uint32_t)) +
-          (tracker->entries[tracker->count]
-           .attrs.attr_vals.attrlist4_len))) {
-          gsh_free(tracker->entries[tracker->count]
-                   .attrs.attr_vals.attrlist4_val);
-          gsh_free(tracker->entries[tracker->count].name.utf8string_val);
+     /* The value_follows of the list pointer, then the entry4 */
+     if (!xdr_bool(&tracker->xdr, &follows) ||
+         !xdr_nfs_cookie4(&tracker->xdr, &cookie) ||
+         !xdr_component4(&tracker->xdr, &entryname) ||
+         !xdr_fattr4(&tracker->xdr, &attrs)) {
+          xdr_setpos(&tracker->xdr, start);
           if (tracker->count == 0) {
                tracker->error = NFS4ERR_TOOSMALL;
           }
           return false;
      }
-     tracker->mem_left -=
-          (tracker->entries[tracker->count].attrs.attrmask.bitmap4_len *
-           sizeof(uint32_t));
-     tracker->mem_left -=
-          (tracker->entries[tracker->count].attrs.attr_vals.attrlist4_len);
-
-     if (tracker->count != 0) {
-          tracker->entries[tracker->count - 1].nextentry =
-               &tracker->entries[tracker->count];
-     }
 
+     tracker->dir_used += dirbytes;
      ++(tracker->count);
      return true;
 }
@@ -200,9 +174,9 @@ free_entries(entry4 *entries)
           if (entry->attrs.attr_vals.attrlist4_val != NULL) {
                gsh_free(entry->attrs.attr_vals.attrlist4_val);
           }
-          gsh_free(entry->name.utf8string_val);
+          gsh_arena_res_free(entry->name.utf8string_val);
      }
-     gsh_free(entries);
+     gsh_arena_res_free(entries);
 
      return;
 } /* free_entries */
@@ -229,10 +203,10 @@ nfs4_op_readdir(struct nfs_argop4 *op,
      bool eod_met = false;
      unsigned long dircount = 0;
      unsigned long maxcount = 0;
-     entry4 *entries = NULL;
+     char *entries_xdr = NULL;
+     size_t entries_len = 0;
      verifier4 cookie_verifier;
      uint64_t cookie = 0;
-     unsigned int estimated_num_entries = 0;
      unsigned int num_entries = 0;
      struct nfs4_readdir_cb_data cb_data;
      cache_inode_status_t cache_status = CACHE_INODE_SUCCESS;
@@ -261,22 +235,21 @@ nfs4_op_readdir(struct nfs_argop4 *op,
 
      /* get the characteristic value for readdir operation */
      dircount = arg_READDIR4.dircount;
-     maxcount = (arg_READDIR4.maxcount * 9) / 10;
+     /* The entry buffer is sized from maxcount, so a client must not
+        choose it beyond what the export would send for a READ */
+     maxcount = MIN(arg_READDIR4.maxcount, data->pexport->MaxRead);
+     maxcount = (maxcount * 9) / 10;
      cookie = arg_READDIR4.cookie;
 
-     /* Dircount is considered meaningless by many nfsv4 client (like the CITI
-        one).  we use maxcount instead. */
-
-     /* The Linux 3.0, 3.1.0 clients vs. TCP Ganesha comes out 10x slower
-        with 500 max entries */
-
-     estimated_num_entries = 50;
-     cb_data.total_entries = estimated_num_entries;
+     /* Entries are encoded as they are read, so the reply holds as
+        many as maxcount allows.  Dircount is considered meaningless
+        by many nfsv4 clients (like the CITI one), it only limits the
+        reply when set. */
 
      LogFullDebug(COMPONENT_NFS_V4,
                   "--- nfs4_op_readdir ---> dircount=%lu maxcount=%lu "
-                  "cookie=%"PRIu64" estimated_num_entries=%u",
-                  dircount, maxcount, cookie, estimated_num_entries);
+                  "cookie=%"PRIu64,
+                  dircount, maxcount, cookie);
 
      /* Since we never send a cookie of 1 or 2, we shouldn't ever get
         them back. */
@@ -294,7 +267,7 @@ nfs4_op_readdir(struct nfs_argop4 *op,
 
      /* If maxcount is too short (14 should be enough for an empty directory)
           return NFS4ERR_TOOSMALL */
-     if (maxcount < 14 || estimated_num_entries == 0) {
+     if (maxcount < 14) {
           res_READDIR4.status = NFS4ERR_TOOSMALL;
           goto out;
      }
@@ -324,13 +297,21 @@ nfs4_op_readdir(struct nfs_argop4 *op,
           }
      }
 
-     /* Prepare to read the entries */
+     /* Prepare to read the entries.  What maxcount leaves after
+        the verifier, the list terminator and eof is for entries. */
 
-     entries = gsh_calloc(estimated_num_entries,
-                          sizeof(entry4));
-     cb_data.entries = entries;
-     cb_data.mem_left = maxcount - sizeof(READDIR4resok);
-     cb_data.count = 0;
+     if (maxcount > NFS4_VERIFIER_SIZE + 2 * BYTES_PER_XDR_UNIT) {
+          entries_len = maxcount - NFS4_VERIFIER_SIZE
+               - 2 * BYTES_PER_XDR_UNIT;
+     }
+     entries_xdr = gsh_arena_res_alloc(data->req_ctx->arena, entries_len);
+     if (entries_xdr == NULL) {
+          res_READDIR4.status = NFS4ERR_SERVERFAULT;
+          goto out;
+     }
+     memset(&cb_data, 0, sizeof(cb_data));
+     xdrmem_create(&cb_data.xdr, entries_xdr, entries_len, XDR_ENCODE);
+     cb_data.dircount = dircount;
      cb_data.error = NFS4_OK;
      cb_data.req_attr = arg_READDIR4.attr_request;
      cb_data.data = data;
@@ -343,6 +324,9 @@ nfs4_op_readdir(struct nfs_argop4 *op,
 					data->req_ctx,
 					nfs4_readdir_callback,
 					&cb_data);
+     entries_len = xdr_getpos(&cb_data.xdr);
+     xdr_destroy(&cb_data.xdr);
+
      if (cache_status != CACHE_INODE_SUCCESS) {
           res_READDIR4.status = nfs4_Errno(cache_status);
           goto out;
@@ -352,14 +336,28 @@ nfs4_op_readdir(struct nfs_argop4 *op,
           goto out;
      }
 
+     res_READDIR4.READDIR4res_u.resok4.reply.entries = NULL;
      if (cb_data.count != 0) {
-          /* Put the entry's list in the READDIR reply if there were any. */
-          res_READDIR4.READDIR4res_u.resok4.reply.entries = entries;
+          /* Put the encoded entries in the READDIR reply if there
+             were any. */
+          if (data->req_ctx->arena == NULL) {
+               /* The reply may be kept, don't keep it at maxcount */
+               char *shrunk = gsh_realloc(entries_xdr, entries_len);
+
+               if (shrunk != NULL) {
+                    entries_xdr = shrunk;
+               }
+          }
+          res_READDIR4.READDIR4res_u.resok4.reply.entries_xdr
+               = entries_xdr;
+          res_READDIR4.READDIR4res_u.resok4.reply.entries_xdr_len
+               = entries_len;
      } else {
-          gsh_free(entries);
-          res_READDIR4.READDIR4res_u.resok4.reply.entries
-               = entries = NULL;
+          gsh_arena_res_free(entries_xdr);
+          res_READDIR4.READDIR4res_u.resok4.reply.entries_xdr = NULL;
+          res_READDIR4.READDIR4res_u.resok4.reply.entries_xdr_len = 0;
      }
+     entries_xdr = NULL;
 
      /* This slight bit of oddness is caused by most booleans
         throughout Ganesha being of C99's bool type (taking the values
@@ -380,10 +378,8 @@ nfs4_op_readdir(struct nfs_argop4 *op,
      res_READDIR4.status = NFS4_OK;
 
 out:
-     if (res_READDIR4.status != NFS4_OK) {
-          if (entries) {
-               free_entries(entries);
-          }
+     if (entries_xdr != NULL) {
+          gsh_arena_res_free(entries_xdr);
      }
 
   return res_READDIR4.status;
@@ -400,4 +396,5 @@ out:
 void nfs4_op_readdir_Free(READDIR4res *resp)
 {
      free_entries(resp->READDIR4res_u.resok4.reply.entries);
+     gsh_arena_res_free(resp->READDIR4res_u.resok4.reply.entries_xdr);
 } /* nfs4_op_readdir_Free */
@@ -51,6 +51,7 @@
 #include "nfs_proto_functions.h"
 #include "nfs_file_handle.h"
 #include "nfs_tools.h"
+#include "sal_functions.h"
 
 /**
  *
@@ -75,6 +76,8 @@ int nfs4_op_reclaim_complete(struct nfs_argop4 *op,
                              compound_data_t *data,
                              struct nfs_resop4 *resp)
 {
+  nfs_client_id_t *clientid;
+
   resp->resop = NFS4_OP_RECLAIM_COMPLETE;
 
   res_RECLAIM_COMPLETE4.rcr_status = NFS4_OK;
@@ -82,6 +85,32 @@ int nfs4_op_reclaim_complete(struct nfs_argop4 *op,
     {
       return (res_RECLAIM_COMPLETE4.rcr_status = NFS4ERR_INVAL);
     }
+
+  if (data->psession == NULL)
+    {
+      return (res_RECLAIM_COMPLETE4.rcr_status = NFS4ERR_OP_NOT_IN_SESSION);
+    }
+
+  /* Reclaim is not tracked per file system */
+  if (arg_RECLAIM_COMPLETE4.rca_one_fs)
+    {
+      return res_RECLAIM_COMPLETE4.rcr_status;
+    }
+
+  clientid = data->psession->clientid_record;
+
+  P(clientid->cid_mutex);
+  if (clientid->cid_reclaim_complete)
+    {
+      V(clientid->cid_mutex);
+      return (res_RECLAIM_COMPLETE4.rcr_status = NFS4ERR_COMPLETE_ALREADY);
+    }
+  clientid->cid_reclaim_complete = true;
+  clientid->cid_allow_reclaim = 0;
+  V(clientid->cid_mutex);
+
+  nfs4_reclaim_done(clientid);
+
   return res_RECLAIM_COMPLETE4.rcr_status;
 } /* nfs41_op_reclaim_complete */
 
@@ -177,6 +177,9 @@ int nfs4_op_sequence(struct nfs_argop4 *op,
       data->pcached_res = &session->slots[arg_SEQUENCE4.sa_slotid].cached_result;
       session->slots[arg_SEQUENCE4.sa_slotid].cache_used = true;
 
+      /* The reply outlives this request, keep it out of the arena */
+      data->req_ctx->arena = NULL;
+
       LogFullDebug(COMPONENT_SESSIONS,
                    "Use sesson slot %"PRIu32"=%p for DRC",
                    arg_SEQUENCE4.sa_slotid, data->pcached_res);
@@ -54,7 +54,7 @@
 #define NB_OPT_TOK 10
 #define NB_TOK_PATH 20
 
-static pseudofs_t gPseudoFs;
+static pseudofs_t *gPseudoFs;
 
 /**
  * @brief Convert a file handle to the id of an object in the pseudofs
@@ -85,29 +85,156 @@ uint64_t nfs4_PseudoToId(nfs_fh4 * fh4p)
 /**
  * @brief Get the root of the pseudo file system
  *
- * Gets the root of the pseudo file system. This is only a wrapper to
- * static variable gPseudoFs.
+ * Gets the pseudo file system currently in use.  A compound takes it
+ * once and walks it to the end, an export reload swaps in a new one
+ * (see nfs4_InstallPseudoFS).
  *
  * @return The pseudo fs root
  */
 
 pseudofs_t *nfs4_GetPseudoFs(void)
 {
-  return &gPseudoFs;
+  return atomic_fetch_voidptr((void **) &gPseudoFs);
 }
 
 /**
- * @brief Build a pseudo fs from an exportlist
+ * @brief Free a pseudo fs nobody walks any more
  *
- * This export list itself is obtained by reading the configuration
- * file.
+ * @param[in] PseudoFs The pseudo fs, may be NULL
+ */
+
+void nfs4_FreePseudoFS(pseudofs_t *PseudoFs)
+{
+  unsigned int i;
+
+  if(PseudoFs == NULL)
+    return;
+
+  for(i = 1; i <= PseudoFs->last_pseudo_id; i++)
+    gsh_free(PseudoFs->reverse_tab[i]);
+  gsh_free(PseudoFs);
+}
+
+/**
+ * @brief Append a node to the sons of another
+ */
+
+static void pseudofs_link(pseudofs_entry_t *parent, pseudofs_entry_t *node)
+{
+  if(parent->sons == NULL)
+    parent->sons = node;
+  else
+    {
+      parent->sons->last->next = node;
+      parent->sons->last = node;
+    }
+  node->parent = parent;
+}
+
+/**
+ * @brief Allocate a new node and give it the next pseudo_id
+ *
+ * @return The node, or NULL if there is no room or memory for it.
+ */
+
+static pseudofs_entry_t *pseudofs_new_entry(pseudofs_t *PseudoFs,
+                                            const char *name,
+                                            const char *parent_name)
+{
+  pseudofs_entry_t *newPseudoFsEntry;
+
+  if(PseudoFs->last_pseudo_id == (MAX_PSEUDO_ENTRY - 1))
+    return NULL;
+
+  newPseudoFsEntry = gsh_malloc(sizeof(pseudofs_entry_t));
+  if(newPseudoFsEntry == NULL)
+    return NULL;
+
+  /* Copy component name, no need to check buffer because size
+   * was checked by nfs_ParseConfLine.
+   */
+  strcpy(newPseudoFsEntry->name, name);
+  snprintf(newPseudoFsEntry->fullname, MAXPATHLEN, "%s/%s",
+           parent_name, name);
+  newPseudoFsEntry->pseudo_id = PseudoFs->last_pseudo_id + 1;
+  newPseudoFsEntry->junction_export = NULL;
+  newPseudoFsEntry->last = newPseudoFsEntry;
+  newPseudoFsEntry->next = NULL;
+  newPseudoFsEntry->sons = NULL;
+  newPseudoFsEntry->parent = NULL;
+
+  PseudoFs->last_pseudo_id = newPseudoFsEntry->pseudo_id;
+  PseudoFs->reverse_tab[PseudoFs->last_pseudo_id] = newPseudoFsEntry;
+  return newPseudoFsEntry;
+}
+
+/**
+ * @brief Copy the nodes of a pseudo fs, without their junctions
+ *
+ * Every node keeps its pseudo_id, so pseudo file handles handed out
+ * from the old tree stay valid in the new one.
  *
- * @parma[in] pexportlist The export list
+ * @param[in] old The pseudo fs to copy, NULL for just a root
  *
- * @return the pseudo fs root.
+ * @return The copy, or NULL if out of memory.
  */
 
-int nfs4_ExportToPseudoFS(struct glist_head *pexportlist)
+static pseudofs_t *pseudofs_copy(const pseudofs_t *old)
+{
+  pseudofs_t *PseudoFs;
+  pseudofs_entry_t *node, *parent;
+  unsigned int i;
+
+  PseudoFs = gsh_calloc(1, sizeof(pseudofs_t));
+  if(PseudoFs == NULL)
+    return NULL;
+
+  /* Init Root of the Pseudo FS tree */
+  strcpy(PseudoFs->root.name, "/");
+  PseudoFs->root.pseudo_id = 0;
+  PseudoFs->root.parent = &(PseudoFs->root);    /* root is its own parent */
+  PseudoFs->reverse_tab[0] = &(PseudoFs->root);
+
+  if(old == NULL)
+    return PseudoFs;
+
+  /* Nodes were numbered as they were created, so a parent is copied
+   * before its sons and sons are appended in their old order.
+   */
+  for(i = 1; i <= old->last_pseudo_id; i++)
+    {
+      parent = PseudoFs->reverse_tab[old->reverse_tab[i]->parent->pseudo_id];
+      node = pseudofs_new_entry(PseudoFs, old->reverse_tab[i]->name,
+                                parent->fullname);
+      if(node == NULL)
+        {
+          nfs4_FreePseudoFS(PseudoFs);
+          return NULL;
+        }
+      pseudofs_link(parent, node);
+    }
+
+  return PseudoFs;
+}
+
+/**
+ * @brief Walk the pseudo path of each NFSv4 export of a list
+ *
+ * In the first pass the nodes missing from the tree are created and
+ * the exports learn the pseudo_id they are mounted on.  In the
+ * second pass, which cannot fail, the nodes are found again and made
+ * junctions to the exports.
+ *
+ * @param[in,out] PseudoFs    The pseudo fs
+ * @param[in]     pexportlist The export list
+ * @param[in]     junctions   Which pass this is
+ *
+ * @return 0 or ENOMEM.
+ */
+
+static int pseudofs_walk_exports(pseudofs_t *PseudoFs,
+                                 struct glist_head *pexportlist,
+                                 bool junctions)
 {
   exportlist_t *entry;
   struct glist_head * glist;
@@ -115,26 +242,10 @@ int nfs4_ExportToPseudoFS(struct glist_head *pexportlist)
   int found = 0;
   char *PathTok[NB_TOK_PATH];
   int NbTokPath;
-  pseudofs_t *PseudoFs = NULL;
-  pseudofs_entry_t *PseudoFsRoot = NULL;
   pseudofs_entry_t *PseudoFsCurrent = NULL;
   pseudofs_entry_t *newPseudoFsEntry = NULL;
   pseudofs_entry_t *iterPseudoFs = NULL;
 
-  PseudoFs = &gPseudoFs;
-
-  /* Init Root of the Pseudo FS tree */
-  strcpy(PseudoFs->root.name, "/");
-  PseudoFs->root.pseudo_id = 0;
-  PseudoFs->root.junction_export = NULL;
-  PseudoFs->root.next = NULL;
-  PseudoFs->root.last = PseudoFsRoot;
-  PseudoFs->root.sons = NULL;
-  PseudoFs->root.parent = &(PseudoFs->root);    /* root is its own parent */
-
-  /* To not forget to init "/" entry */
-  PseudoFs->reverse_tab[0] = &(PseudoFs->root);
-
   glist_for_each(glist, pexportlist)
     {
       entry = glist_entry(glist, exportlist_t, exp_list);
@@ -213,64 +324,114 @@ int nfs4_ExportToPseudoFS(struct glist_head *pexportlist)
                 {
                   /* a matching entry was found in the tree */
                   PseudoFsCurrent = iterPseudoFs;
+                  continue;
                 }
-              else
+
+              if(junctions)
                 {
-                  /* a new entry is to be created */
-                  if(PseudoFs->last_pseudo_id == (MAX_PSEUDO_ENTRY - 1))
-                    {
-                      LogMajor(COMPONENT_NFS_V4_PSEUDO,
-                               "Too many nodes in Export_Id %d Path=\"%s\" Pseudo=\"%s\"",
-                               entry->id, entry->fullpath, entry->pseudopath);
-                      return ENOMEM;
-                    }
-                  newPseudoFsEntry = gsh_malloc(sizeof(pseudofs_entry_t));
-                  if(newPseudoFsEntry == NULL)
-                    {
-                      LogMajor(COMPONENT_NFS_V4_PSEUDO,
-                               "Insufficient memory to create pseudo fs node");
-                      return ENOMEM;
-                    }
+                  /* The first pass saw a different export list */
+                  LogCrit(COMPONENT_NFS_V4_PSEUDO,
+                          "No pseudo fs node for Export_Id %d Pseudo=\"%s\"",
+                          entry->id, entry->pseudopath);
+                  PseudoFsCurrent = NULL;
+                  break;
+                }
 
-                  /* Copy component name, no need to check buffer because size
-		   * was checked by nfs_ParseConfLine.
-		   */ 
-                  strcpy(newPseudoFsEntry->name, PathTok[j]);
-                  newPseudoFsEntry->pseudo_id = PseudoFs->last_pseudo_id + 1;
-                  PseudoFs->last_pseudo_id = newPseudoFsEntry->pseudo_id;
-                  PseudoFs->reverse_tab[PseudoFs->last_pseudo_id] = newPseudoFsEntry;
-                  newPseudoFsEntry->junction_export = NULL;
-                  newPseudoFsEntry->last = newPseudoFsEntry;
-                  newPseudoFsEntry->next = NULL;
-                  newPseudoFsEntry->sons = NULL;
-                  snprintf(newPseudoFsEntry->fullname, MAXPATHLEN, "%s/%s",
-                           PseudoFsCurrent->fullname, PathTok[j]);
-
-                  /* Step into the new entry and attach it to the tree */
-                  if(PseudoFsCurrent->sons == NULL)
-                    PseudoFsCurrent->sons = newPseudoFsEntry;
-                  else
-                    {
-                      PseudoFsCurrent->sons->last->next = newPseudoFsEntry;
-                      PseudoFsCurrent->sons->last = newPseudoFsEntry;
-                    }
-                  newPseudoFsEntry->parent = PseudoFsCurrent;
-                  PseudoFsCurrent = newPseudoFsEntry;
+              /* a new entry is to be created */
+              newPseudoFsEntry = pseudofs_new_entry(PseudoFs, PathTok[j],
+                                                    PseudoFsCurrent->fullname);
+              if(newPseudoFsEntry == NULL)
+                {
+                  LogMajor(COMPONENT_NFS_V4_PSEUDO,
+                           "Unable to create pseudo fs node for Export_Id %d Path=\"%s\" Pseudo=\"%s\"",
+                           entry->id, entry->fullpath, entry->pseudopath);
+                  return ENOMEM;
                 }
 
+              /* Step into the new entry and attach it to the tree */
+              pseudofs_link(PseudoFsCurrent, newPseudoFsEntry);
+              PseudoFsCurrent = newPseudoFsEntry;
             }                   /* for j */
 
-          /* Now that all entries are added to pseudofs tree,
-	   * add the junction to the pseudofs */
-          PseudoFsCurrent->junction_export = entry;
-
-          /* And fill in our part of the export root data */
-          entry->exp_mounted_on_file_id = PseudoFsCurrent->pseudo_id;
+          if(PseudoFsCurrent == NULL)
+            continue;
 
+          if(junctions)
+            {
+              /* Now that all entries are added to pseudofs tree,
+               * add the junction to the pseudofs */
+              PseudoFsCurrent->junction_export = entry;
+            }
+          else
+            {
+              /* And fill in our part of the export root data */
+              entry->exp_mounted_on_file_id = PseudoFsCurrent->pseudo_id;
+            }
         }
       /* if( entry->options & EXPORT_OPTION_PSEUDO ) */
     }                           /* glist_for_each */
 
+  return 0;
+}
+
+/**
+ * @brief Build the nodes of the next pseudo fs
+ *
+ * The current pseudo fs is copied and the nodes the exports of the
+ * list need are added to the copy.  Nothing in use is changed, and
+ * this is the only step of an export reload's pseudo fs rebuild that
+ * may fail, so it is done before the new exports are published.  The
+ * list may be the staged exports: they have the same pseudo paths as
+ * the set that will be live.
+ *
+ * @param[in] pexportlist The export list
+ *
+ * @return The new pseudo fs, or NULL on failure.
+ */
+
+pseudofs_t *nfs4_PreparePseudoFS(struct glist_head *pexportlist)
+{
+  pseudofs_t *PseudoFs;
+
+  PseudoFs = pseudofs_copy(nfs4_GetPseudoFs());
+  if(PseudoFs == NULL)
+    {
+      LogMajor(COMPONENT_NFS_V4_PSEUDO,
+               "Insufficient memory to create pseudo fs");
+      return NULL;
+    }
+
+  if(pseudofs_walk_exports(PseudoFs, pexportlist, false) != 0)
+    {
+      nfs4_FreePseudoFS(PseudoFs);
+      return NULL;
+    }
+
+  return PseudoFs;
+}
+
+/**
+ * @brief Make a prepared pseudo fs the one in use
+ *
+ * The nodes of the exports of the list become junctions to them, then
+ * the new tree is swapped in.  Compounds already running keep walking
+ * the old tree, which the caller frees with nfs4_FreePseudoFS() once
+ * they are done (see worker_synchronize()).  Until then the exports
+ * its junctions point to must not be freed either.
+ *
+ * @param[in] PseudoFs    From nfs4_PreparePseudoFS()
+ * @param[in] pexportlist The live export list
+ *
+ * @return The old pseudo fs.
+ */
+
+pseudofs_t *nfs4_InstallPseudoFS(pseudofs_t *PseudoFs,
+                                 struct glist_head *pexportlist)
+{
+  pseudofs_t *old;
+
+  (void) pseudofs_walk_exports(PseudoFs, pexportlist, true);
+
   if(isMidDebug(COMPONENT_NFS_V4_PSEUDO))
     {
       int i;
@@ -294,7 +455,34 @@ int nfs4_ExportToPseudoFS(struct glist_head *pexportlist)
         }
     }
 
-  return (0);
+  old = nfs4_GetPseudoFs();
+  atomic_store_voidptr((void **) &gPseudoFs, PseudoFs);
+  return old;
+}
+
+/**
+ * @brief Build the pseudo fs from an exportlist
+ *
+ * This export list itself is obtained by reading the configuration
+ * file.  Only used at startup, before any compound may walk the
+ * pseudo fs; an export reload uses nfs4_PreparePseudoFS() and
+ * nfs4_InstallPseudoFS().
+ *
+ * @param[in] pexportlist The export list
+ *
+ * @return 0 or an errno.
+ */
+
+int nfs4_ExportToPseudoFS(struct glist_head *pexportlist)
+{
+  pseudofs_t *PseudoFs;
+
+  PseudoFs = nfs4_PreparePseudoFS(pexportlist);
+  if(PseudoFs == NULL)
+    return ENOMEM;
+
+  nfs4_FreePseudoFS(nfs4_InstallPseudoFS(PseudoFs, pexportlist));
+  return 0;
 }
 
 /**
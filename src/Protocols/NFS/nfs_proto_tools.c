@@ -3016,16 +3016,80 @@ void nfs4_Fattr_Free(fattr4 *fattr)
 
 struct Fattr_filler_opaque
 {
+        cache_entry_t *entry; /*< Entry whose attributes these are */
         fattr4 *Fattr; /*< Fattr to fill */
         compound_data_t *data; /*< Compound data */
         nfs_fh4 *objFH; /*< Object file handle */
         struct bitmap4 *Bitmap; /*< Bitmap of entries to fill */
 };
 
+/**
+ * @brief Attributes whose encoding is not a function of the entry
+ *
+ * The file handle is the caller's, the others are fetched from the
+ * filesystem for every request.
+ */
+
+static const int Fattr_volatile_attrs[] = {
+        FATTR4_FILEHANDLE,
+        FATTR4_FILES_AVAIL,
+        FATTR4_FILES_FREE,
+        FATTR4_FILES_TOTAL,
+        FATTR4_SPACE_AVAIL,
+        FATTR4_SPACE_FREE,
+        FATTR4_SPACE_TOTAL
+};
+
+/**
+ * @brief Key an encoding of the attributes by what shapes it
+ *
+ * Apart from the entry's attributes, the encoding depends on the
+ * bitmap asked for and the export it is seen through (fsid, anonymous
+ * owner, maxread and the like, and the fileid of an export root).
+ * An export reloaded with a new configuration keeps its id but gets a
+ * new config_epoch, so both are in the key.
+ *
+ * @param[in]  data   NFSv4 compound request's data
+ * @param[in]  Bitmap Bitmap of attributes being requested
+ * @param[out] key    CACHE_INODE_ATTR_BLOB_WORDS words
+ *
+ * @return false if the encoding must not be kept.
+ */
+
+static bool
+Fattr_blob_key(compound_data_t *data,
+               struct bitmap4 *Bitmap,
+               uint32_t *key)
+{
+        int i;
+
+        if (Bitmap->bitmap4_len == 0 || data->pexport == NULL) {
+                return false;
+        }
+        for (i = 0;
+             i < sizeof(Fattr_volatile_attrs) / sizeof(int);
+             i++) {
+                if (attribute_is_set(Bitmap, Fattr_volatile_attrs[i])) {
+                        return false;
+                }
+        }
+
+        key[0] = data->pexport->id;
+        key[1] = Bitmap->bitmap4_len;
+        key[2] = Bitmap->map[0];
+        key[3] = Bitmap->bitmap4_len > 1 ? Bitmap->map[1] : 0;
+        key[4] = Bitmap->bitmap4_len > 2 ? Bitmap->map[2] : 0;
+        key[5] = data->pexport->config_epoch;
+        return true;
+}
+
 /**
  * @brief Callback to fill a fattr
  *
- * This function is the callback for cache_entry_To_Fattr.
+ * This function is the callback for cache_entry_To_Fattr.  Unless the
+ * bitmap asks for attributes that are not a function of the entry,
+ * an encoding kept with the entry since its attributes last changed
+ * is copied out instead of encoding them again.
  *
  * @param[in] opaque Opaque structure
  * @param[in] attr   Attribute list
@@ -3040,14 +3104,59 @@ Fattr_filler(void *opaque,
 {
         struct Fattr_filler_opaque *f =
                 (struct Fattr_filler_opaque *)opaque;
+        fattr4 *Fattr = f->Fattr;
+        uint32_t key[CACHE_INODE_ATTR_BLOB_WORDS];
+        uint32_t mask[CACHE_INODE_ATTR_BLOB_WORDS];
+        size_t len;
+        char *buf;
+
+        if (!Fattr_blob_key(f->data, f->Bitmap, key)) {
+                if (nfs4_FSALattr_To_Fattr(attr,
+                                           Fattr,
+                                           f->data,
+                                           f->objFH,
+                                           f->Bitmap) != 0) {
+                        return CACHE_INODE_IO_ERROR;
+                }
+                return CACHE_INODE_SUCCESS;
+        }
 
-        if (nfs4_FSALattr_To_Fattr(attr,
-                                   f->Fattr,
-                                   f->data,
-                                   f->objFH,
-                                   f->Bitmap) != 0) {
+        buf = gsh_malloc(NFS4_ATTRVALS_BUFFLEN);
+        if (buf == NULL) {
                 return CACHE_INODE_IO_ERROR;
         }
+
+        if (cache_inode_attr_blob_get(f->entry, key, mask, buf,
+                                      NFS4_ATTRVALS_BUFFLEN, &len)) {
+                Fattr->attrmask.bitmap4_len = mask[0];
+                Fattr->attrmask.map[0] = mask[1];
+                Fattr->attrmask.map[1] = mask[2];
+                Fattr->attrmask.map[2] = mask[3];
+                Fattr->attr_vals.attrlist4_val = buf;
+                Fattr->attr_vals.attrlist4_len = len;
+        } else {
+                if (nfs4_FSALattr_To_Fattr_buf(attr, Fattr, f->data,
+                                               f->objFH, f->Bitmap, buf,
+                                               NFS4_ATTRVALS_BUFFLEN) != 0) {
+                        gsh_free(buf);
+                        Fattr->attr_vals.attrlist4_val = NULL;
+                        return CACHE_INODE_IO_ERROR;
+                }
+                mask[0] = Fattr->attrmask.bitmap4_len;
+                mask[1] = Fattr->attrmask.map[0];
+                mask[2] = Fattr->attrmask.map[1];
+                mask[3] = Fattr->attrmask.map[2];
+                mask[4] = 0;
+                mask[5] = 0;
+                cache_inode_attr_blob_put(f->entry, key, mask, buf,
+                                          Fattr->attr_vals.attrlist4_len);
+        }
+
+        if (Fattr->attr_vals.attrlist4_len == 0) {
+                /* no supported attrs so we can free */
+                gsh_free(buf);
+                Fattr->attr_vals.attrlist4_val = NULL;
+        }
         return CACHE_INODE_SUCCESS;
 }
 
@@ -3079,6 +3188,7 @@ cache_entry_To_Fattr(cache_entry_t *entry,
 {
         cache_inode_status_t cache_status = CACHE_INODE_SUCCESS;
         struct Fattr_filler_opaque f = {
+                .entry = entry,
                 .Fattr = Fattr,
                 .data = data,
                 .objFH = objFH,
@@ -3099,32 +3209,34 @@ cache_entry_To_Fattr(cache_entry_t *entry,
 
 
 /**
- * @brief Converts FSAL Attributes to NFSv4 Fattr buffer.
+ * @brief Converts FSAL Attributes to NFSv4 Fattr in a caller buffer
  *
- * Converts FSAL Attributes to NFSv4 Fattr buffer.
+ * Like nfs4_FSALattr_To_Fattr(), but the attribute values are
+ * encoded into buf, which the caller owns.  Used where the fattr4 is
+ * serialized right away, as by the streaming READDIR encoder.
  *
  * @param[in]  attrs   FSAL attributes.
- * @param[out] Fattr   NFSv4 Fattr buffer
- *		       Memory for bitmap_val and attr_val is
- *                     dynamically allocated,
- *		       caller is responsible for freeing it.
+ * @param[out] Fattr   NFSv4 Fattr, attr_vals points into buf
  * @param[in]  data    NFSv4 compoud request's data.
  * @param[in]  objFH   The NFSv4 filehandle of the object whose
  *                     attributes are requested
  * @param[in]  Bitmap  Bitmap of attributes being requested
+ * @param[in]  buf     Buffer for the attribute values
+ * @param[in]  buflen  Size of buf
  *
  * @return -1 if failed, 0 if successful.
  *
  */
 
-int nfs4_FSALattr_To_Fattr(const struct attrlist *attrs,
-                           fattr4 *Fattr,
-                           compound_data_t *data,
-                           nfs_fh4 *objFH,
-                           struct bitmap4 *Bitmap)
+int nfs4_FSALattr_To_Fattr_buf(const struct attrlist *attrs,
+                               fattr4 *Fattr,
+                               compound_data_t *data,
+                               nfs_fh4 *objFH,
+                               struct bitmap4 *Bitmap,
+                               char *buf,
+                               u_int buflen)
 {
 	int attribute_to_set = 0;
-	u_int LastOffset;
 	fsal_dynamicfsinfo_t dynamicinfo;
 	XDR attr_body;
 	struct xdr_attrs_args args;
@@ -3132,20 +3244,14 @@ int nfs4_FSALattr_To_Fattr(const struct attrlist *attrs,
 
 	/* basic init */
 	memset(&Fattr->attrmask, 0, sizeof(Fattr->attrmask));
+	Fattr->attr_vals.attrlist4_val = buf;
+	Fattr->attr_vals.attrlist4_len = 0;
 	if(Bitmap->bitmap4_len == 0) {
 		return 0;  /* they ask for nothing, they get nothing */
 	}
-	Fattr->attr_vals.attrlist4_val = gsh_malloc(NFS4_ATTRVALS_BUFFLEN);
-	if(Fattr->attr_vals.attrlist4_val == NULL) {
-		return -1;
-	}
 
-	LastOffset = 0;
 	memset(&attr_body, 0, sizeof(attr_body));
-	xdrmem_create(&attr_body,
-		      Fattr->attr_vals.attrlist4_val,
-		      NFS4_ATTRVALS_BUFFLEN,
-		      XDR_ENCODE);
+	xdrmem_create(&attr_body, buf, buflen, XDR_ENCODE);
 	memset(&args, 0, sizeof(args));
 	args.attrs = (struct attrlist *)attrs; /* overriding const */
 	args.hdl4 = objFH;
@@ -3179,25 +3285,66 @@ int nfs4_FSALattr_To_Fattr(const struct attrlist *attrs,
 				     "Encode FAILED for attribute %d, name = %s",
 				     attribute_to_set,
 				     fattr4tab[attribute_to_set].name);
-			goto err;  /* signal fail so if(LastOffset > 0) works right */
+			xdr_destroy(&attr_body);
+			return -1;
 		}
 		/* mark the attribute in the bitmap should be new bitmap btw */
 	}
-	LastOffset = xdr_getpos(&attr_body);  /* dumb but for now */
+	Fattr->attr_vals.attrlist4_len = xdr_getpos(&attr_body);
 	xdr_destroy(&attr_body);
+	return 0;
+}
+
+/**
+ * @brief Converts FSAL Attributes to NFSv4 Fattr buffer.
+ *
+ * Converts FSAL Attributes to NFSv4 Fattr buffer.
+ *
+ * @param[in]  attrs   FSAL attributes.
+ * @param[out] Fattr   NFSv4 Fattr buffer
+ *		       Memory for bitmap_val and attr_val is
+ *                     dynamically allocated,
+ *		       caller is responsible for freeing it.
+ * @param[in]  data    NFSv4 compoud request's data.
+ * @param[in]  objFH   The NFSv4 filehandle of the object whose
+ *                     attributes are requested
+ * @param[in]  Bitmap  Bitmap of attributes being requested
+ *
+ * @return -1 if failed, 0 if successful.
+ *
+ */
 
-	if(LastOffset == 0) {  /* no supported attrs so we can free */
+int nfs4_FSALattr_To_Fattr(const struct attrlist *attrs,
+                           fattr4 *Fattr,
+                           compound_data_t *data,
+                           nfs_fh4 *objFH,
+                           struct bitmap4 *Bitmap)
+{
+	char *buf;
+
+	if(Bitmap->bitmap4_len == 0) {
+		memset(&Fattr->attrmask, 0, sizeof(Fattr->attrmask));
+		return 0;  /* they ask for nothing, they get nothing */
+	}
+	buf = gsh_malloc(NFS4_ATTRVALS_BUFFLEN);
+	if(buf == NULL) {
+		return -1;
+	}
+
+	if(nfs4_FSALattr_To_Fattr_buf(attrs, Fattr, data, objFH, Bitmap,
+				      buf, NFS4_ATTRVALS_BUFFLEN) != 0) {
+		gsh_free(buf);
+		Fattr->attr_vals.attrlist4_val = NULL;
+		return -1;
+	}
+
+	if(Fattr->attr_vals.attrlist4_len == 0) {
+		/* no supported attrs so we can free */
 		assert(Fattr->attrmask.bitmap4_len == 0);
-		gsh_free(Fattr->attr_vals.attrlist4_val);
+		gsh_free(buf);
 		Fattr->attr_vals.attrlist4_val = NULL;
 	}
-	Fattr->attr_vals.attrlist4_len = LastOffset;
 	return 0;
-
-err:
-	gsh_free(Fattr->attr_vals.attrlist4_val);
-	Fattr->attr_vals.attrlist4_val = NULL;
-	return -1;
 }
 
 /**
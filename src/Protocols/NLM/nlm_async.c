@@ -30,9 +30,320 @@
 #include "nlm4.h"
 #include "nlm_util.h"
 #include "nlm_async.h"
+#include "abstract_atomic.h"
+#include "common_utils.h"
 
 pthread_mutex_t nlm_async_resp_mutex  = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t  nlm_async_resp_cond   = PTHREAD_COND_INITIALIZER;
+
+/* Callback channels
+ *
+ * One per client host and transport, holding the CLIENT used to send
+ * it NLM messages and the messages waiting to be sent.  Channels
+ * outlive the NLM client structures, which come and go with the
+ * client's locks, so a host keeps its connection across lock storms.
+ * A channel left unused for NLM_CB_IDLE seconds is reaped the next
+ * time its hash bucket is searched.
+ *
+ * A host that cannot be reached is not tried again for a while,
+ * doubling up to NLM_CB_MAX_BACKOFF seconds, so messages to it fail
+ * at once instead of holding up the async thread on connects.
+ *
+ * No channel lock is held across a connect or a send.  The connection
+ * belongs to whichever sender has marked the channel busy; the queue
+ * has its own lock, held only to link and unlink messages, so
+ * scheduling a message (from under a state_lock, for GRANTED) never
+ * waits on a slow client.
+ */
+
+#define NLM_CB_BUCKETS 64
+#define NLM_CB_IDLE 600
+#define NLM_CB_MAX_BACKOFF 60
+
+struct nlm_cb_chan
+{
+  struct glist_head ncc_hash;       /* Hash chain, under nlm_cb_mutex */
+  int32_t           ncc_refcount;   /* Under nlm_cb_mutex */
+  time_t            ncc_last_used;  /* Under nlm_cb_mutex */
+  xprt_type_t       ncc_type;
+  char            * ncc_name;
+  pthread_mutex_t   ncc_mutex;      /* Protects ncc_busy */
+  pthread_cond_t    ncc_cv;         /* Signalled when ncc_busy clears */
+  bool              ncc_busy;       /* A sender owns the connection */
+  /* The connection, used only by the sender that set ncc_busy */
+  CLIENT          * ncc_clnt;
+  AUTH            * ncc_auth;
+  uint32_t          ncc_failures;   /* Consecutive failed sends */
+  time_t            ncc_retry;      /* No connect attempt before */
+  pthread_mutex_t   ncc_queue_mutex; /* Protects the queue */
+  struct glist_head ncc_queue;      /* Messages waiting */
+  bool              ncc_flushing;   /* A flush is scheduled */
+};
+
+static pthread_mutex_t nlm_cb_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct glist_head nlm_cb_hash[NLM_CB_BUCKETS];
+static bool nlm_cb_hash_inited;
+
+/* Outstanding GRANTED_MSGs, by key, waiting for the GRANTED_RES.
+ * Under nlm_async_resp_mutex.  Nothing waits on them, they only
+ * measure how quickly clients answer.
+ */
+
+#define NLM_RESP_BUCKETS 64
+#define NLM_RESP_EXPIRE 5
+
+struct nlm_resp_pending
+{
+  struct glist_head nrp_list;
+  void            * nrp_key;
+  struct timespec   nrp_sent;
+};
+
+static struct glist_head nlm_resp_hash[NLM_RESP_BUCKETS];
+static bool nlm_resp_hash_inited;
+
+struct nlm_async_stats nlm_async_stats;
+
+static uint32_t nlm_cb_hash_name(char *name, xprt_type_t type)
+{
+  uint32_t h = type;
+
+  while(*name != '\0')
+    h = h * 31 + (unsigned char) *name++;
+
+  return h % NLM_CB_BUCKETS;
+}
+
+static void nlm_cb_chan_free(struct nlm_cb_chan *chan)
+{
+  if(chan->ncc_clnt != NULL)
+    gsh_clnt_destroy(chan->ncc_clnt);
+  if(chan->ncc_auth != NULL)
+    AUTH_DESTROY(chan->ncc_auth);
+  pthread_mutex_destroy(&chan->ncc_mutex);
+  pthread_cond_destroy(&chan->ncc_cv);
+  pthread_mutex_destroy(&chan->ncc_queue_mutex);
+  gsh_free(chan->ncc_name);
+  gsh_free(chan);
+}
+
+/* nlm_cb_get
+ *
+ * Find or make the channel to a host, and reference it.
+ */
+static struct nlm_cb_chan *nlm_cb_get(state_nlm_client_t *host)
+{
+  char *name = host->slc_nsm_client->ssc_nlm_caller_name;
+  uint32_t bucket = nlm_cb_hash_name(name, host->slc_client_type);
+  struct glist_head *glist, *glistn;
+  struct nlm_cb_chan *chan, *found = NULL;
+  time_t now = time(NULL);
+  int i;
+
+  P(nlm_cb_mutex);
+
+  if(!nlm_cb_hash_inited)
+    {
+      for(i = 0; i < NLM_CB_BUCKETS; i++)
+        init_glist(&nlm_cb_hash[i]);
+      nlm_cb_hash_inited = true;
+    }
+
+  glist_for_each_safe(glist, glistn, &nlm_cb_hash[bucket])
+    {
+      chan = glist_entry(glist, struct nlm_cb_chan, ncc_hash);
+
+      if(found == NULL &&
+         chan->ncc_type == host->slc_client_type &&
+         strcmp(chan->ncc_name, name) == 0)
+        {
+          found = chan;
+          continue;
+        }
+
+      if(chan->ncc_refcount == 0 &&
+         now - chan->ncc_last_used > NLM_CB_IDLE)
+        {
+          glist_del(&chan->ncc_hash);
+          nlm_cb_chan_free(chan);
+        }
+    }
+
+  if(found == NULL)
+    {
+      found = gsh_calloc(1, sizeof(*found));
+      if(found != NULL)
+        found->ncc_name = gsh_strdup(name);
+      if(found == NULL || found->ncc_name == NULL)
+        {
+          LogCrit(COMPONENT_NLM,
+                  "No memory for NLM callback channel to %s",
+                  name);
+          gsh_free(found);
+          V(nlm_cb_mutex);
+          return NULL;
+        }
+      found->ncc_type = host->slc_client_type;
+      pthread_mutex_init(&found->ncc_mutex, NULL);
+      pthread_cond_init(&found->ncc_cv, NULL);
+      pthread_mutex_init(&found->ncc_queue_mutex, NULL);
+      init_glist(&found->ncc_queue);
+      glist_add_tail(&nlm_cb_hash[bucket], &found->ncc_hash);
+    }
+
+  found->ncc_refcount++;
+  found->ncc_last_used = now;
+
+  V(nlm_cb_mutex);
+
+  return found;
+}
+
+static void nlm_cb_put(struct nlm_cb_chan *chan)
+{
+  P(nlm_cb_mutex);
+  chan->ncc_refcount--;
+  chan->ncc_last_used = time(NULL);
+  V(nlm_cb_mutex);
+}
+
+/* nlm_cb_claim
+ *
+ * Take ownership of a channel's connection, waiting for another
+ * sender to the same host to finish.  The mutex is only held to
+ * test and set ncc_busy.
+ */
+static void nlm_cb_claim(struct nlm_cb_chan *chan)
+{
+  pthread_mutex_lock(&chan->ncc_mutex);
+  while(chan->ncc_busy)
+    pthread_cond_wait(&chan->ncc_cv, &chan->ncc_mutex);
+  chan->ncc_busy = true;
+  pthread_mutex_unlock(&chan->ncc_mutex);
+}
+
+static void nlm_cb_release(struct nlm_cb_chan *chan)
+{
+  pthread_mutex_lock(&chan->ncc_mutex);
+  chan->ncc_busy = false;
+  pthread_cond_signal(&chan->ncc_cv);
+  pthread_mutex_unlock(&chan->ncc_mutex);
+}
+
+/* nlm_cb_failed
+ *
+ * Drop the connection of a channel after a failure and back off.
+ * Called by the owner of the connection, see nlm_cb_claim.
+ */
+static void nlm_cb_failed(struct nlm_cb_chan *chan)
+{
+  time_t backoff;
+
+  if(chan->ncc_clnt != NULL)
+    {
+      gsh_clnt_destroy(chan->ncc_clnt);
+      chan->ncc_clnt = NULL;
+    }
+  if(chan->ncc_auth != NULL)
+    {
+      AUTH_DESTROY(chan->ncc_auth);
+      chan->ncc_auth = NULL;
+    }
+
+  chan->ncc_failures++;
+  backoff = chan->ncc_failures < 7 ? 1 << (chan->ncc_failures - 1)
+                                   : NLM_CB_MAX_BACKOFF;
+  if(backoff > NLM_CB_MAX_BACKOFF)
+    backoff = NLM_CB_MAX_BACKOFF;
+  chan->ncc_retry = time(NULL) + backoff;
+}
+
+/* nlm_cb_connect
+ *
+ * Make sure a channel has a client.  Called by the owner of the
+ * connection, with no lock held.
+ */
+static bool nlm_cb_connect(struct nlm_cb_chan *chan)
+{
+  if(chan->ncc_clnt != NULL)
+    return true;
+
+  if(chan->ncc_failures != 0 && time(NULL) < chan->ncc_retry)
+    {
+      atomic_inc_uint64_t(&nlm_async_stats.fast_fails);
+      return false;
+    }
+
+  LogFullDebug(COMPONENT_NLM,
+               "gsh_clnt_create %s",
+               chan->ncc_name);
+
+  chan->ncc_clnt = gsh_clnt_create(chan->ncc_name,
+                                   NLMPROG,
+                                   NLM4_VERS,
+                                   (char *)xprt_type_to_str(chan->ncc_type));
+
+  if(chan->ncc_clnt == NULL)
+    {
+      LogMajor(COMPONENT_NLM,
+               "Cannot create NLM async %s connection to client %s",
+               xprt_type_to_str(chan->ncc_type),
+               chan->ncc_name);
+      nlm_cb_failed(chan);
+      return false;
+    }
+
+  /* split auth (for authnone, idempotent) */
+  chan->ncc_auth = authnone_create();
+  atomic_inc_uint64_t(&nlm_async_stats.connects);
+
+  return true;
+}
+
+/* nlm_resp_expect
+ *
+ * Note that a response is due for key.
+ */
+static void nlm_resp_expect(void *key)
+{
+  uint32_t bucket = ((uintptr_t) key >> 4) % NLM_RESP_BUCKETS;
+  struct nlm_resp_pending *pend = gsh_malloc(sizeof(*pend));
+  struct glist_head *glist, *glistn;
+  struct nlm_resp_pending *old;
+  int i;
+
+  if(pend == NULL)
+    return;
+
+  pend->nrp_key = key;
+  now(&pend->nrp_sent);
+
+  pthread_mutex_lock(&nlm_async_resp_mutex);
+
+  if(!nlm_resp_hash_inited)
+    {
+      for(i = 0; i < NLM_RESP_BUCKETS; i++)
+        init_glist(&nlm_resp_hash[i]);
+      nlm_resp_hash_inited = true;
+    }
+
+  /* Forget the ones that will never be answered */
+  glist_for_each_safe(glist, glistn, &nlm_resp_hash[bucket])
+    {
+      old = glist_entry(glist, struct nlm_resp_pending, nrp_list);
+      if(old->nrp_key == key ||
+         pend->nrp_sent.tv_sec - old->nrp_sent.tv_sec > NLM_RESP_EXPIRE)
+        {
+          glist_del(&old->nrp_list);
+          gsh_free(old);
+          atomic_inc_uint64_t(&nlm_async_stats.unanswered);
+        }
+    }
+
+  glist_add_tail(&nlm_resp_hash[bucket], &pend->nrp_list);
+
+  pthread_mutex_unlock(&nlm_async_resp_mutex);
+}
+
 
 int nlm_send_async_res_nlm4(state_nlm_client_t * host,
                             state_async_func_t   func,
@@ -65,10 +376,11 @@ int nlm_send_async_res_nlm4(state_nlm_client_t * host,
       return NFS_REQ_DROP;
    }
 
-  status = state_async_schedule(arg);
+  status = nlm_async_schedule(arg);
 
   if(status != STATE_SUCCESS)
     {
+      netobj_free(&nlm_arg->nlm_async_args.nlm_async_res.res_nlm4.cookie);
       gsh_free(arg);
       return NFS_REQ_DROP;
     }
@@ -120,7 +432,7 @@ int nlm_send_async_res_nlm4test(state_nlm_client_t * host,
    }
 
 
-  status = state_async_schedule(arg);
+  status = nlm_async_schedule(arg);
 
   if(status != STATE_SUCCESS)
     {
@@ -143,55 +455,39 @@ xdrproc_t nlm_reply_proc[] =
   [NLMPROC4_UNLOCK_RES]  = (xdrproc_t) xdr_nlm4_res,
 };
 
-static void *resp_key;
-
 #define MAX_ASYNC_RETRY 2
 
-/* Client routine  to send the asynchrnous response, key is used to wait for a response */
+/* Client routine to send the asynchronous response.  The send does
+ * not wait for the reply message; if key is given, the reply is
+ * expected to be signalled with it through nlm_signal_async_resp.
+ */
 int nlm_send_async(int                  proc,
                    state_nlm_client_t * host,
                    void               * inarg,
                    void               * key)
 {
-  struct timeval  tout = { 0, 10 };
-  int             retval, retry;
-  struct timeval  start, now;
-  struct timespec timeout;
+  struct timeval       tout = { 0, 10 };
+  int                  retval = RPC_CANTSEND;
+  int                  retry;
+  struct nlm_cb_chan * chan;
+
+  chan = nlm_cb_get(host);
+  if(chan == NULL)
+    return RPC_SYSTEMERROR;
+
+  nlm_cb_claim(chan);
 
   for(retry = 1; retry <= MAX_ASYNC_RETRY; retry++)
     {
-      if(host->slc_callback_clnt == NULL)
+      if(!nlm_cb_connect(chan))
         {
-          LogFullDebug(COMPONENT_NLM,
-                       "gsh_clnt_create %s",
-                       host->slc_nsm_client->ssc_nlm_caller_name);
-
-          host->slc_callback_clnt =
-              gsh_clnt_create(host->slc_nsm_client->ssc_nlm_caller_name,
-                              NLMPROG,
-                              NLM4_VERS,
-                              (char *)xprt_type_to_str(host->slc_client_type));
-
-          if(host->slc_callback_clnt == NULL)
-            {
-              LogMajor(COMPONENT_NLM,
-                       "Cannot create NLM async %s connection to client %s",
-                       xprt_type_to_str(host->slc_client_type),
-                       host->slc_nsm_client->ssc_nlm_caller_name);
-              return -1;
-            }
-
-            /* split auth (for authnone, idempotent) */
-            host->slc_callback_auth = authnone_create();
+          retval = RPC_CANTSEND;
+          break;
         }
 
-      pthread_mutex_lock(&nlm_async_resp_mutex);
-      resp_key = key;
-      pthread_mutex_unlock(&nlm_async_resp_mutex);
-
       LogFullDebug(COMPONENT_NLM, "About to make clnt_call");
-      retval = clnt_call(host->slc_callback_clnt,
-                         host->slc_callback_auth,
+      retval = clnt_call(chan->ncc_clnt,
+                         chan->ncc_auth,
                          proc,
                          nlm_reply_proc[proc],
                          inarg,
@@ -203,67 +499,218 @@ int nlm_send_async(int                  proc,
       if(retval == RPC_TIMEDOUT || retval == RPC_SUCCESS)
         {
           retval = RPC_SUCCESS;
+          chan->ncc_failures = 0;
           break;
         }
 
       LogCrit(COMPONENT_NLM,
               "NLM async Client procedure call %d failed with return code %d %s",
-              proc, retval, clnt_sperror(host->slc_callback_clnt, ""));
+              proc, retval, clnt_sperror(chan->ncc_clnt, ""));
 
-      gsh_clnt_destroy(host->slc_callback_clnt);
-      host->slc_callback_clnt = NULL;
+      nlm_cb_failed(chan);
 
       if(retry == MAX_ASYNC_RETRY)
         {
           LogMajor(COMPONENT_NLM,
                    "NLM async Client exceeded retry count %d",
                    MAX_ASYNC_RETRY);
-          pthread_mutex_lock(&nlm_async_resp_mutex);
-          resp_key = NULL;
-          pthread_mutex_unlock(&nlm_async_resp_mutex);
-          return retval;
+        }
+      else
+        {
+          /* Reconnect at once for the retry */
+          chan->ncc_retry = 0;
         }
     }
 
-  pthread_mutex_lock(&nlm_async_resp_mutex);
-  if(resp_key != NULL)
+  nlm_cb_release(chan);
+  nlm_cb_put(chan);
+
+  if(retval == RPC_SUCCESS)
     {
-      /* Wait for 5 seconds or a signal */
-      gettimeofday(&start, NULL);
-      gettimeofday(&now, NULL);
-      timeout.tv_sec = 5 + start.tv_sec;
-      timeout.tv_nsec = 0;
-      LogFullDebug(COMPONENT_NLM,
-                   "About to wait for signal for key %p",
-                   resp_key);
-      while(resp_key != NULL && now.tv_sec < (start.tv_sec + 5))
-        {
-          int rc = pthread_cond_timedwait(&nlm_async_resp_cond, &nlm_async_resp_mutex, &timeout);
-          LogFullDebug(COMPONENT_NLM,
-                       "pthread_cond_timedwait returned %d", rc);
-          gettimeofday(&now, NULL);
-        }
-      LogFullDebug(COMPONENT_NLM, "Done waiting");
+      atomic_inc_uint64_t(&nlm_async_stats.sent);
+      if(key != NULL)
+        nlm_resp_expect(key);
+    }
+  else
+    {
+      atomic_inc_uint64_t(&nlm_async_stats.errors);
     }
-  pthread_mutex_unlock(&nlm_async_resp_mutex);
 
   return retval;
 }
 
+/* nlm_signal_async_resp
+ *
+ * A client answered the message sent with key.
+ */
 void nlm_signal_async_resp(void *key)
 {
+  uint32_t bucket = ((uintptr_t) key >> 4) % NLM_RESP_BUCKETS;
+  struct glist_head *glist;
+  struct nlm_resp_pending *pend, *found = NULL;
+  struct timespec ts;
+
   pthread_mutex_lock(&nlm_async_resp_mutex);
-  if(resp_key == key)
+  if(nlm_resp_hash_inited)
     {
-      resp_key = NULL;
-      pthread_cond_signal(&nlm_async_resp_cond);
-      LogFullDebug(COMPONENT_NLM,
-                   "Signaled condition variable");
+      glist_for_each(glist, &nlm_resp_hash[bucket])
+        {
+          pend = glist_entry(glist, struct nlm_resp_pending, nrp_list);
+          if(pend->nrp_key == key)
+            {
+              found = pend;
+              glist_del(&pend->nrp_list);
+              break;
+            }
+        }
     }
-  else
+  pthread_mutex_unlock(&nlm_async_resp_mutex);
+
+  if(found == NULL)
     {
       LogFullDebug(COMPONENT_NLM,
-                   "Didn't signal condition variable");
+                   "No response expected for key %p",
+                   key);
+      return;
     }
-  pthread_mutex_unlock(&nlm_async_resp_mutex);
+
+  now(&ts);
+  atomic_inc_uint64_t(&nlm_async_stats.answered);
+  atomic_add_uint64_t(&nlm_async_stats.resp_latency,
+                      timespec_diff(&found->nrp_sent, &ts));
+  gsh_free(found);
+}
+
+/* nlm_async_flush
+ *
+ * Send everything queued on a host's channel, taking new arrivals as
+ * they come, until the queue stays empty.
+ */
+static void nlm_async_flush(state_async_queue_t *job,
+                            struct req_op_context *req_ctx)
+{
+  state_nlm_client_t *host =
+      job->state_async_data.state_nlm_async_data.nlm_async_host;
+  struct nlm_cb_chan *chan =
+      job->state_async_data.state_nlm_async_data.nlm_async_key;
+  struct glist_head batch, *glist, *glistn;
+  state_async_queue_t *arg;
+  uint64_t n;
+
+  for(;;)
+    {
+      init_glist(&batch);
+
+      pthread_mutex_lock(&chan->ncc_queue_mutex);
+      if(glist_empty(&chan->ncc_queue))
+        {
+          chan->ncc_flushing = false;
+          pthread_mutex_unlock(&chan->ncc_queue_mutex);
+          break;
+        }
+      glist_splice_tail(&batch, &chan->ncc_queue);
+      pthread_mutex_unlock(&chan->ncc_queue_mutex);
+
+      n = 0;
+      glist_for_each_safe(glist, glistn, &batch)
+        {
+          arg = glist_entry(glist, state_async_queue_t, state_async_glist);
+          glist_del(&arg->state_async_glist);
+          arg->state_async_func(arg, req_ctx);
+          n++;
+        }
+
+      atomic_inc_uint64_t(&nlm_async_stats.batches);
+      atomic_add_uint64_t(&nlm_async_stats.batched, n);
+    }
+
+  nlm_cb_put(chan);
+  dec_nlm_client_ref(host);
+  gsh_free(job);
+
+  nlm_async_report();
+}
+
+/* nlm_async_schedule
+ *
+ * Queue an asynchronous NLM message on its host's channel.  Messages
+ * to a host queue up while its previous ones are being sent, and then
+ * go out together.  arg->state_async_func sends one message, as it
+ * did when each message was scheduled on its own.
+ */
+state_status_t nlm_async_schedule(state_async_queue_t *arg)
+{
+  state_nlm_client_t *host =
+      arg->state_async_data.state_nlm_async_data.nlm_async_host;
+  struct nlm_cb_chan *chan;
+  state_async_queue_t *job;
+  state_status_t status;
+
+  chan = nlm_cb_get(host);
+  if(chan == NULL)
+    return STATE_MALLOC_ERROR;
+
+  /* Only used if we are the ones to start the flush */
+  job = gsh_calloc(1, sizeof(*job));
+  if(job == NULL)
+    {
+      nlm_cb_put(chan);
+      return STATE_MALLOC_ERROR;
+    }
+
+  /* state_async_schedule only queues the job, so this stays short */
+  pthread_mutex_lock(&chan->ncc_queue_mutex);
+  if(!chan->ncc_flushing)
+    {
+      inc_nlm_client_ref(host);
+      job->state_async_func = nlm_async_flush;
+      job->state_async_data.state_nlm_async_data.nlm_async_host = host;
+      job->state_async_data.state_nlm_async_data.nlm_async_key = chan;
+      status = state_async_schedule(job);
+      if(status != STATE_SUCCESS)
+        {
+          pthread_mutex_unlock(&chan->ncc_queue_mutex);
+          dec_nlm_client_ref(host);
+          gsh_free(job);
+          nlm_cb_put(chan);
+          return status;
+        }
+      /* The flush owns the job and our channel reference */
+      chan->ncc_flushing = true;
+      job = NULL;
+    }
+  glist_add_tail(&chan->ncc_queue, &arg->state_async_glist);
+  pthread_mutex_unlock(&chan->ncc_queue_mutex);
+
+  if(job != NULL)
+    {
+      gsh_free(job);
+      nlm_cb_put(chan);
+    }
+
+  return STATE_SUCCESS;
+}
+
+/* nlm_async_report
+ *
+ * Log how the asynchronous NLM messages are doing.
+ */
+void nlm_async_report(void)
+{
+  uint64_t answered = atomic_fetch_uint64_t(&nlm_async_stats.answered);
+  uint64_t batches = atomic_fetch_uint64_t(&nlm_async_stats.batches);
+
+  LogDebug(COMPONENT_NLM,
+           "NLM async: sent=%"PRIu64" errors=%"PRIu64" connects=%"PRIu64
+           " fast fails=%"PRIu64" batches=%"PRIu64" avg batch=%"PRIu64
+           " answered=%"PRIu64" unanswered=%"PRIu64" avg answer=%"PRIu64"us",
+           atomic_fetch_uint64_t(&nlm_async_stats.sent),
+           atomic_fetch_uint64_t(&nlm_async_stats.errors),
+           atomic_fetch_uint64_t(&nlm_async_stats.connects),
+           atomic_fetch_uint64_t(&nlm_async_stats.fast_fails),
+           batches,
+           batches ? atomic_fetch_uint64_t(&nlm_async_stats.batched) / batches : 0,
+           answered,
+           atomic_fetch_uint64_t(&nlm_async_stats.unanswered),
+           answered ? atomic_fetch_uint64_t(&nlm_async_stats.resp_latency) / answered / 1000 : 0);
 }
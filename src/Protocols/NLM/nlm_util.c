@@ -152,6 +152,9 @@ void nlm_init(void)
   granted_cookie.gc_seconds      = (unsigned long) nlm_grace_tv.tv_sec;
   granted_cookie.gc_microseconds = (unsigned long) nlm_grace_tv.tv_usec;
   granted_cookie.gc_cookie       = 0;
+
+  /* start the thread that talks to statd */
+  (void) nsm_async_init();
 }
 
 void free_grant_arg(state_async_queue_t *arg)
@@ -200,11 +203,13 @@ static void nlm4_send_grant_msg(state_async_queue_t *arg,
                           nlm_arg->nlm_async_key);
 
   dec_nlm_client_ref(nlm_arg->nlm_async_host);
-  free_grant_arg(arg);
 
   /* If success, we are done. */
   if(retval == RPC_SUCCESS)
-    return;
+    {
+      free_grant_arg(arg);
+      return;
+    }
 
   /*
    * We are not able call granted callback. Some client may retry
@@ -217,6 +222,7 @@ static void nlm4_send_grant_msg(state_async_queue_t *arg,
   state_status = state_find_grant(nlm_arg->nlm_async_args.nlm_async_grant.cookie.n_bytes,
 				  nlm_arg->nlm_async_args.nlm_async_grant.cookie.n_len,
 				  &cookie_entry);
+  free_grant_arg(arg);
   if(state_status != STATE_SUCCESS)
     {
       /* This must be an old NLM_GRANTED_RES */
@@ -690,7 +696,7 @@ state_status_t nlm_granted_callback(cache_entry_t *pentry,
     }
 
   /* Now try to schedule NLMPROC4_GRANTED_MSG call */
-  state_status = state_async_schedule(arg);
+  state_status = nlm_async_schedule(arg);
 
   if(state_status != STATE_SUCCESS)
     goto grant_fail;
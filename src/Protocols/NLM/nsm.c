@@ -29,6 +29,9 @@
 #include "ganesha_rpc.h"
 #include "nsm.h"
 #include "sal_data.h"
+#include "sal_functions.h"
+#include "fridgethr.h"
+#include "common_utils.h"
 
 pthread_mutex_t nsm_mutex = PTHREAD_MUTEX_INITIALIZER;
 CLIENT *nsm_clnt;
@@ -36,6 +39,36 @@ AUTH *nsm_auth;
 unsigned long nsm_count;
 char * nodename;
 
+/* A call to statd waiting for the NSM thread */
+struct nsm_req
+{
+  struct glist_head nsm_list;
+  state_nsm_client_t *host;  /* SM_MON: referenced host, NULL for SM_UNMON */
+  char *name;                /* Name to (un)monitor, owned for SM_UNMON */
+  struct timespec queued;
+  bool ok;
+};
+
+/* Calls are queued here and sent by a single thread, a batch at a
+   time, so they reach statd in the order they were made. */
+static pthread_mutex_t nsm_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct glist_head nsm_queue = { &nsm_queue, &nsm_queue };
+static uint64_t nsm_queue_depth;
+static bool nsm_draining;
+static struct fridgethr *nsm_fridge;
+
+static struct nsm_stats
+{
+  uint64_t queued;       /* Requests queued */
+  uint64_t batches;      /* Batches sent */
+  uint64_t calls;        /* Calls made to statd */
+  uint64_t failures;     /* Of which failed */
+  uint64_t latency;      /* Total nsecs spent in calls */
+  uint64_t max_latency;  /* Slowest call, under nsm_mutex */
+  uint64_t queue_wait;   /* Total nsecs requests waited to be sent */
+  uint64_t max_depth;    /* Deepest the queue got, under nsm_queue_mutex */
+} nsm_stats;
+
 bool nsm_connect()
 {
   struct utsname utsname;
@@ -88,43 +121,32 @@ void nsm_disconnect()
     }
 }
 
-bool nsm_monitor(state_nsm_client_t *host)
+/* nsm_call_mon
+ *
+ * Ask statd to monitor a host.  Called with nsm_mutex held.
+ */
+static bool nsm_call_mon(char *mon_name)
 {
   enum clnt_stat     ret;
   struct mon         nsm_mon;
   struct sm_stat_res res;
   struct timeval     tout = { 25, 0 };
 
-  if(host == NULL)
-    return true;
-
-  P(host->ssc_mutex);
-
-  if(atomic_fetch_int32_t(&host->ssc_monitored))
-    {
-      V(host->ssc_mutex);
-      return true;
-    }
-
-  nsm_mon.mon_id.mon_name      = host->ssc_nlm_caller_name;
+  nsm_mon.mon_id.mon_name      = mon_name;
   nsm_mon.mon_id.my_id.my_prog = NLMPROG;
   nsm_mon.mon_id.my_id.my_vers = NLM4_VERS;
   nsm_mon.mon_id.my_id.my_proc = NLMPROC4_SM_NOTIFY;
   /* nothing to put in the private data */
   LogDebug(COMPONENT_NLM,
            "Monitor %s",
-           host->ssc_nlm_caller_name);
-
-  P(nsm_mutex);
+           mon_name);
 
   /* create a connection to nsm on the localhost */
   if(!nsm_connect())
     {
       LogCrit(COMPONENT_NLM,
               "Can not monitor %s clnt_create returned NULL",
-              nsm_mon.mon_id.mon_name);
-      V(nsm_mutex);
-      V(host->ssc_mutex);
+              mon_name);
       return false;
     }
 
@@ -144,10 +166,8 @@ bool nsm_monitor(state_nsm_client_t *host)
     {
       LogCrit(COMPONENT_NLM,
               "Can not monitor %s SM_MON ret %d %s",
-              nsm_mon.mon_id.mon_name, ret, clnt_sperror(nsm_clnt, ""));
+              mon_name, ret, clnt_sperror(nsm_clnt, ""));
       nsm_disconnect();
-      V(nsm_mutex);
-      V(host->ssc_mutex);
       return false;
     }
 
@@ -155,56 +175,40 @@ bool nsm_monitor(state_nsm_client_t *host)
     {
       LogCrit(COMPONENT_NLM,
               "Can not monitor %s SM_MON status %d",
-              nsm_mon.mon_id.mon_name, res.res_stat);
+              mon_name, res.res_stat);
       nsm_disconnect();
-      V(nsm_mutex);
-      V(host->ssc_mutex);
       return false;
     }
 
   nsm_count++;
-  atomic_store_int32_t(&host->ssc_monitored, true);
   LogDebug(COMPONENT_NLM,
-           "Monitored %s for nodename %s", nsm_mon.mon_id.mon_name, nodename);
+           "Monitored %s for nodename %s", mon_name, nodename);
 
-  V(nsm_mutex);
-  V(host->ssc_mutex);
   return true;
 }
 
-bool nsm_unmonitor(state_nsm_client_t *host)
+/* nsm_call_unmon
+ *
+ * Ask statd to stop monitoring a host.  Called with nsm_mutex held.
+ */
+static bool nsm_call_unmon(char *mon_name)
 {
   enum clnt_stat ret;
   struct sm_stat res;
   struct mon_id  nsm_mon_id;
   struct timeval tout = { 25, 0 };
 
-  if(host == NULL)
-    return true;
-
-  P(host->ssc_mutex);
-
-  if(!atomic_fetch_int32_t(&host->ssc_monitored))
-    {
-      V(host->ssc_mutex);
-      return true;
-    }
-
-  nsm_mon_id.mon_name      = host->ssc_nlm_caller_name;
+  nsm_mon_id.mon_name      = mon_name;
   nsm_mon_id.my_id.my_prog = NLMPROG;
   nsm_mon_id.my_id.my_vers = NLM4_VERS;
   nsm_mon_id.my_id.my_proc = NLMPROC4_SM_NOTIFY;
 
-  P(nsm_mutex);
-
   /* create a connection to nsm on the localhost */
   if(!nsm_connect())
     {
       LogCrit(COMPONENT_NLM,
               "Can not unmonitor %s clnt_create returned NULL",
-              nsm_mon_id.mon_name);
-      V(nsm_mutex);
-      V(host->ssc_mutex);
+              mon_name);
       return false;
     }
 
@@ -224,26 +228,390 @@ bool nsm_unmonitor(state_nsm_client_t *host)
     {
       LogCrit(COMPONENT_NLM,
               "Can not unmonitor %s SM_MON ret %d %s",
-              nsm_mon_id.mon_name, ret, clnt_sperror(nsm_clnt, ""));
+              mon_name, ret, clnt_sperror(nsm_clnt, ""));
       nsm_disconnect();
-      V(nsm_mutex);
-      V(host->ssc_mutex);
       return false;
     }
 
-  atomic_store_int32_t(&host->ssc_monitored, false);
-  nsm_count--;
+  /* A monitor that failed after this unmonitor was queued may have
+     never been counted. */
+  if(nsm_count > 0)
+    nsm_count--;
 
   LogDebug(COMPONENT_NLM,
-           "Unonitored %s for nodename %s", nsm_mon_id.mon_name, nodename);
+           "Unonitored %s for nodename %s", mon_name, nodename);
+
+  return true;
+}
+
+/* nsm_req_done
+ *
+ * Account for a finished request and free it.  A monitor request
+ * that failed leaves the host unmonitored, so the next lock from it
+ * tries again.
+ */
+static void nsm_req_done(struct nsm_req *req)
+{
+  bool ok = req->ok;
+
+  if(req->host != NULL)
+    {
+      if(!ok)
+        {
+          P(req->host->ssc_mutex);
+          atomic_store_int32_t(&req->host->ssc_monitored, false);
+          V(req->host->ssc_mutex);
+        }
+      /* May free the host and queue its unmonitor */
+      dec_nsm_client_ref(req->host);
+    }
+  else
+    {
+      gsh_free(req->name);
+    }
+
+  if(!ok)
+    atomic_inc_uint64_t(&nsm_stats.failures);
+  gsh_free(req);
+}
+
+/* nsm_send_batch
+ *
+ * Send every request on batch to statd, in order, over one connection.
+ * No per-host mutex is held during the calls, so lock requests never
+ * wait on statd.
+ */
+static void nsm_send_batch(struct glist_head *batch)
+{
+  struct glist_head *glist;
+  struct nsm_req *req;
+  struct timespec start, end;
+  nsecs_elapsed_t latency;
+
+  P(nsm_mutex);
+
+  glist_for_each(glist, batch)
+    {
+      req = glist_entry(glist, struct nsm_req, nsm_list);
+
+      now(&start);
+      if(req->host != NULL)
+        req->ok = nsm_call_mon(req->name);
+      else
+        req->ok = nsm_call_unmon(req->name);
+      now(&end);
+
+      latency = timespec_diff(&start, &end);
+      atomic_inc_uint64_t(&nsm_stats.calls);
+      atomic_add_uint64_t(&nsm_stats.latency, latency);
+      if(latency > nsm_stats.max_latency)
+        nsm_stats.max_latency = latency;
+      atomic_add_uint64_t(&nsm_stats.queue_wait,
+                          timespec_diff(&req->queued, &start));
+    }
 
   nsm_disconnect();
 
   V(nsm_mutex);
-  V(host->ssc_mutex);
+}
+
+/* nsm_drain
+ *
+ * Take everything queued, as one batch, until the queue stays empty.
+ */
+static void nsm_drain(void)
+{
+  struct glist_head batch;
+  struct glist_head *glist, *glistn;
+  struct nsm_req *req;
+  uint64_t n;
+
+  for(;;)
+    {
+      init_glist(&batch);
+
+      P(nsm_queue_mutex);
+      if(glist_empty(&nsm_queue))
+        {
+          nsm_draining = false;
+          V(nsm_queue_mutex);
+          break;
+        }
+      glist_splice_tail(&batch, &nsm_queue);
+      n = nsm_queue_depth;
+      nsm_queue_depth = 0;
+      V(nsm_queue_mutex);
+
+      atomic_inc_uint64_t(&nsm_stats.batches);
+      nsm_send_batch(&batch);
+
+      glist_for_each_safe(glist, glistn, &batch)
+        {
+          req = glist_entry(glist, struct nsm_req, nsm_list);
+          glist_del(&req->nsm_list);
+          nsm_req_done(req);
+        }
+
+      LogDebug(COMPONENT_NLM,
+               "NSM batch of %"PRIu64" done", n);
+      nsm_report();
+    }
+}
+
+static void nsm_drain_caller(struct fridgethr_context *ctx)
+{
+  nsm_drain();
+}
+
+/* nsm_queue_req
+ *
+ * Queue a request for the NSM thread.  Returns false if the thread is
+ * not running, the caller then talks to statd itself.
+ */
+static bool nsm_queue_req(struct nsm_req *req)
+{
+  bool submit = false;
+  int rc;
+
+  now(&req->queued);
+
+  P(nsm_queue_mutex);
+  if(nsm_fridge == NULL)
+    {
+      V(nsm_queue_mutex);
+      return false;
+    }
+  glist_add_tail(&nsm_queue, &req->nsm_list);
+  if(++nsm_queue_depth > nsm_stats.max_depth)
+    nsm_stats.max_depth = nsm_queue_depth;
+  if(!nsm_draining)
+    {
+      nsm_draining = true;
+      submit = true;
+    }
+  atomic_inc_uint64_t(&nsm_stats.queued);
+
+  if(submit)
+    {
+      rc = fridgethr_submit(nsm_fridge, nsm_drain_caller, NULL);
+      if(rc != 0)
+        {
+          LogCrit(COMPONENT_NLM,
+                  "Unable to schedule NSM requests: %d",
+                  rc);
+          glist_del(&req->nsm_list);
+          nsm_queue_depth--;
+          nsm_draining = false;
+          V(nsm_queue_mutex);
+          return false;
+        }
+    }
+  V(nsm_queue_mutex);
+
   return true;
 }
 
+/* nsm_run_now
+ *
+ * Send a request to statd from the calling thread.
+ */
+static bool nsm_run_now(struct nsm_req *req)
+{
+  struct glist_head batch;
+  bool ok;
+
+  init_glist(&batch);
+  glist_add_tail(&batch, &req->nsm_list);
+  nsm_send_batch(&batch);
+  glist_del(&req->nsm_list);
+
+  ok = req->ok;
+  nsm_req_done(req);
+  return ok;
+}
+
+/* nsm_monitor
+ *
+ * Have statd monitor a host.  The call to statd is queued and this
+ * returns at once, optimistically, so the lock that brought the host
+ * here is not held up.  If statd fails, the host is left unmonitored
+ * and the next lock from it queues another attempt.
+ */
+bool nsm_monitor(state_nsm_client_t *host)
+{
+  struct nsm_req *req;
+
+  if(host == NULL)
+    return true;
+
+  P(host->ssc_mutex);
+
+  if(atomic_fetch_int32_t(&host->ssc_monitored))
+    {
+      /* Monitored, or about to be */
+      V(host->ssc_mutex);
+      return true;
+    }
+
+  req = gsh_malloc(sizeof(*req));
+  if(req == NULL)
+    {
+      LogCrit(COMPONENT_NLM,
+              "Can not monitor %s, no memory",
+              host->ssc_nlm_caller_name);
+      V(host->ssc_mutex);
+      return false;
+    }
+
+  atomic_store_int32_t(&host->ssc_monitored, true);
+  V(host->ssc_mutex);
+
+  /* The request holds a reference until statd has answered */
+  inc_nsm_client_ref(host);
+  req->host = host;
+  req->name = host->ssc_nlm_caller_name;
+  req->ok = false;
+
+  if(nsm_queue_req(req))
+    return true;
+
+  return nsm_run_now(req);
+}
+
+/* nsm_unmonitor
+ *
+ * Have statd stop monitoring a host.  Called as the host is freed, so
+ * the queued request carries its own copy of the name.
+ */
+bool nsm_unmonitor(state_nsm_client_t *host)
+{
+  struct nsm_req *req;
+
+  if(host == NULL)
+    return true;
+
+  P(host->ssc_mutex);
+
+  if(!atomic_fetch_int32_t(&host->ssc_monitored))
+    {
+      V(host->ssc_mutex);
+      return true;
+    }
+
+  req = gsh_malloc(sizeof(*req));
+  if(req != NULL)
+    req->name = gsh_strdup(host->ssc_nlm_caller_name);
+  if(req == NULL || req->name == NULL)
+    {
+      LogCrit(COMPONENT_NLM,
+              "Can not unmonitor %s, no memory",
+              host->ssc_nlm_caller_name);
+      gsh_free(req);
+      V(host->ssc_mutex);
+      return false;
+    }
+
+  atomic_store_int32_t(&host->ssc_monitored, false);
+  V(host->ssc_mutex);
+
+  req->host = NULL;
+  req->ok = false;
+
+  if(nsm_queue_req(req))
+    return true;
+
+  return nsm_run_now(req);
+}
+
+/* nsm_report
+ *
+ * Log how the NSM queue is doing.
+ */
+void nsm_report(void)
+{
+  uint64_t calls = atomic_fetch_uint64_t(&nsm_stats.calls);
+
+  LogDebug(COMPONENT_NLM,
+           "NSM: queued=%"PRIu64" batches=%"PRIu64" calls=%"PRIu64
+           " failures=%"PRIu64" avg latency=%"PRIu64"us max=%"PRIu64
+           "us avg wait=%"PRIu64"us max depth=%"PRIu64,
+           atomic_fetch_uint64_t(&nsm_stats.queued),
+           atomic_fetch_uint64_t(&nsm_stats.batches),
+           calls,
+           atomic_fetch_uint64_t(&nsm_stats.failures),
+           calls ? atomic_fetch_uint64_t(&nsm_stats.latency) / calls / 1000 : 0,
+           nsm_stats.max_latency / 1000,
+           calls ? atomic_fetch_uint64_t(&nsm_stats.queue_wait) / calls / 1000 : 0,
+           nsm_stats.max_depth);
+}
+
+/* nsm_async_init
+ *
+ * Start the thread that talks to statd.  Until it runs, and after
+ * nsm_async_shutdown, callers talk to statd themselves.
+ */
+int nsm_async_init(void)
+{
+  struct fridgethr_params frp;
+  struct fridgethr *fr;
+  int rc;
+
+  memset(&frp, 0, sizeof(struct fridgethr_params));
+  frp.thr_max = 1;
+  frp.deferment = fridgethr_defer_queue;
+  rc = fridgethr_init(&fr, "NSM", &frp);
+  if(rc != 0)
+    {
+      LogMajor(COMPONENT_NLM,
+               "Unable to initialize NSM thread fridge: %d",
+               rc);
+      return rc;
+    }
+
+  P(nsm_queue_mutex);
+  nsm_fridge = fr;
+  V(nsm_queue_mutex);
+
+  return 0;
+}
+
+/* nsm_async_shutdown
+ *
+ * Stop the NSM thread and send whatever it left queued.
+ */
+void nsm_async_shutdown(void)
+{
+  struct fridgethr *fr;
+  int rc;
+
+  P(nsm_queue_mutex);
+  fr = nsm_fridge;
+  nsm_fridge = NULL;
+  V(nsm_queue_mutex);
+
+  if(fr == NULL)
+    return;
+
+  rc = fridgethr_sync_command(fr, fridgethr_comm_stop, 120);
+  if(rc == ETIMEDOUT)
+    {
+      LogMajor(COMPONENT_NLM,
+               "Shutdown timed out, cancelling threads.");
+      fridgethr_cancel(fr);
+    }
+  else if(rc != 0)
+    {
+      LogMajor(COMPONENT_NLM,
+               "Failed shutting down NSM thread: %d",
+               rc);
+    }
+
+  P(nsm_queue_mutex);
+  nsm_draining = true;
+  V(nsm_queue_mutex);
+  nsm_drain();
+}
+
 void nsm_unmonitor_all(void)
 {
   enum clnt_stat ret;
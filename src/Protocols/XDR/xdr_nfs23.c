@@ -2387,6 +2387,9 @@ dirlistplus3 *objp;
   register long __attribute__ ((__unused__)) * buf;
 #endif
 
+  if(xdrs->x_op == XDR_ENCODE && objp->entries_xdr != NULL)
+    if(!xdr_opaque(xdrs, objp->entries_xdr, objp->entries_xdr_len))
+      return (false);
   if(!xdr_pointer
      (xdrs, (char **)&objp->entries, sizeof(entryplus3), (xdrproc_t) xdr_entryplus3))
     return (false);
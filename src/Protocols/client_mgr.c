@@ -257,6 +257,8 @@ struct gsh_client *get_gsh_client(sockaddr_t *client_ipaddr,
 		cl = avltree_container_of(node, struct gsh_client, node_k);
 	} else {
 		pthread_mutex_init(&cl->lock, NULL);
+		nfs_qos_init(&cl->qos, nfs_param.core_param.qos_client_ops,
+			     nfs_param.core_param.qos_client_bytes);
 	}
 
 out:
@@ -788,11 +790,99 @@ static struct gsh_dbus_method cltmgr_show_v41_layouts = {
 	}
 };
 
+/**
+ * DBUS method to report a client's rate limits
+ *
+ */
+
+static bool
+get_client_qos(DBusMessageIter *args,
+	       DBusMessage *reply)
+{
+	struct gsh_client *client = NULL;
+	bool success = true;
+	char *errormsg = NULL;
+	DBusMessageIter iter;
+
+	dbus_message_iter_init_append(reply, &iter);
+	client = lookup_client(args, &errormsg);
+	if(client == NULL) {
+		success = false;
+		if(errormsg == NULL)
+			errormsg = "Client IP address not found";
+	}
+	dbus_status_reply(&iter, success, errormsg);
+	if(success)
+		server_dbus_qos(&client->qos, &iter);
+
+	if(client != NULL)
+		put_gsh_client(client);
+	return true;
+}
+
+static struct gsh_dbus_method cltmgr_show_qos = {
+	.name = "GetQoS",
+	.method = get_client_qos,
+	.args = { IPADDR_ARG,
+		  STATUS_REPLY,
+		  QOS_REPLY,
+		  END_ARG_LIST
+	}
+};
+
+/**
+ * DBUS method to change a client's rate limits
+ *
+ * A client not yet seen is added, so it may be limited from its
+ * first request.  Limits last as long as the client is in the
+ * client manager.
+ */
+
+static bool
+set_client_qos(DBusMessageIter *args,
+	       DBusMessage *reply)
+{
+	struct gsh_client *client = NULL;
+	sockaddr_t sockaddr;
+	uint64_t ops_rate, bytes_rate;
+	bool success = true;
+	char *errormsg = "OK";
+	DBusMessageIter iter;
+
+	dbus_message_iter_init_append(reply, &iter);
+	success = arg_ipaddr(args, &sockaddr, &errormsg) &&
+		server_dbus_qos_args(args, &ops_rate, &bytes_rate, &errormsg);
+	if(success) {
+		client = get_gsh_client(&sockaddr, false);
+		if(client != NULL) {
+			nfs_qos_set(&client->qos, ops_rate, bytes_rate);
+			put_gsh_client(client);
+		} else {
+			success = false;
+			errormsg = "No memory to insert client";
+		}
+	}
+	dbus_status_reply(&iter, success, errormsg);
+	return true;
+}
+
+static struct gsh_dbus_method cltmgr_set_qos = {
+	.name = "SetQoS",
+	.method = set_client_qos,
+	.args = { IPADDR_ARG,
+		  QOS_ARGS,
+		  STATUS_REPLY,
+		  END_ARG_LIST
+	}
+};
+
 static struct gsh_dbus_method *cltmgr_stats_methods[] = {
 	&cltmgr_show_v3_io,
 	&cltmgr_show_v40_io,
 	&cltmgr_show_v41_io,
 	&cltmgr_show_v41_layouts,
+	&cltmgr_show_qos,
+	&cltmgr_set_qos,
 	NULL
 };
 
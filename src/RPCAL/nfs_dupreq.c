@@ -51,6 +51,7 @@
 #include "nfs_dupreq.h"
 #include "city.h"
 #include "abstract_mem.h"
+#include "pool_slab.h"
 #include "gsh_intrinsic.h"
 #include "wait_queue.h"
 
@@ -279,7 +280,7 @@ void dupreq2_pkginit(void)
 
     dupreq_pool = pool_init("Duplicate Request Pool",
                             sizeof(dupreq_entry_t),
-                            pool_basic_substrate,
+                            pool_slab_substrate,
                             NULL, NULL, NULL);
     if (unlikely(! (dupreq_pool))) {
         LogCrit(COMPONENT_INIT,
@@ -290,7 +291,7 @@ void dupreq2_pkginit(void)
 
     nfs_res_pool = pool_init("nfs_res_t pool",
                              sizeof(nfs_res_t),
-                             pool_basic_substrate,
+                             pool_slab_substrate,
                              NULL, NULL, NULL);
     if (unlikely(! (nfs_res_pool))) {
         LogCrit(COMPONENT_INIT,
@@ -1267,6 +1268,22 @@ out:
     return (status);
 }
 
+/**
+ * @brief Will the result of this request be released with the request?
+ *
+ * True when nfs_dupreq_start marked the request no-cache, so that the
+ * result is freed in nfs_dupreq_rele and never handed to another
+ * request.  Such results may be built in per-request storage.
+ *
+ * @param[in] req The svc_req structure.
+ *
+ * @return true if the result is not retained in a DRC.
+ */
+bool nfs_dupreq_nocache(struct svc_req *req)
+{
+    return (req->rq_u1 == (void*) DUPREQ_NOCACHE);
+}
+
 /**
  * @brief Decrement the call path refcnt on a cache entry.
  *
@@ -560,6 +560,7 @@ nfs_client_id_t *create_client_id(clientid4 clientid,
 	client_rec->cid_client_addr = *client_addr;
 	client_rec->cid_credential = *credential;
 	client_rec->cid_minorversion = minorversion;
+	client_rec->cid_reclaim_complete = false;
 
 	/* need to init the list_head */
 	init_glist(&client_rec->cid_openowners);
@@ -33,13 +33,13 @@
 #include "nfs_core.h"
 #include "nfs4.h"
 #include "sal_functions.h"
+#include "fridgethr.h"
+#include "murmur3.h"
+#include "nfs4_recovery.h"
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
-#define NFS_V4_RECOV_ROOT "/var/lib/nfs/ganesha"
-#define NFS_V4_RECOV_DIR "v4recov"
-#define NFS_V4_OLD_DIR "v4old"
-
 char v4_recov_dir[PATH_MAX + 1];
 char v4_old_dir[PATH_MAX + 1];
 
@@ -55,7 +55,9 @@ typedef struct grace
         pthread_mutex_t g_mutex; /*< Mutex */
         time_t g_start; /*< Start of grace period */
         time_t g_duration; /*< Duration of grace period */
-        struct glist_head g_clid_list; /*< Clients*/
+        struct clid_table g_clids; /*< Clients allowed to reclaim */
+        uint32_t g_outstanding; /*< Of which not done reclaiming */
+        bool g_lift_early; /*< End grace once g_outstanding is 0 */
 } grace_t;
 
 /**
@@ -68,22 +70,293 @@ static grace_t grace;
  */
 typedef struct clid_entry
 {
-        struct glist_head cl_list; /*< Link in the list */
-        char cl_name[256]; /*< Client name */
+        struct glist_head cl_list; /*< Link in the hash chain */
+        uint32_t cl_hash; /*< Hash of the name */
+        bool cl_reclaimed; /*< Done reclaiming, in the grace table */
+        char cl_name[NFS4_CLID_NAME_LEN]; /*< Client name */
 } clid_entry_t;
 
+/** Buckets in a client table when it gets its first name */
+#define CLID_TABLE_MIN 64
+
+/**
+ * @brief An add or remove waiting for the recovery thread
+ */
+struct recov_req
+{
+        struct glist_head rr_list; /*< Link in the queue */
+        bool rr_add; /*< Add, or remove */
+        char rr_name[NFS4_CLID_NAME_LEN]; /*< Client name */
+};
+
+/**
+ * @brief The recovery store in use
+ */
+static struct nfs4_recovery_backend *recov_backend = &nfs4_recovery_fs;
+
+/* Adds and removes are queued here and handed to the backend by a
+   single thread, a batch at a time, in the order they were made. */
+static pthread_mutex_t recov_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct glist_head recov_queue = { &recov_queue, &recov_queue };
+static uint64_t recov_queue_depth;
+static bool recov_draining;
+static struct fridgethr *recov_fridge;
+
+/* Changes are numbered as they are queued.  recov_committed is the
+   last one the backend has committed, signalled on recov_commit_cond,
+   so a caller can wait for its own batch. */
+static uint64_t recov_queued;
+static uint64_t recov_committed;
+static pthread_cond_t recov_commit_cond = PTHREAD_COND_INITIALIZER;
+
+/* Held while the backend is used.  Taken before the queue is emptied,
+   so whoever drains it first also commits first. */
+static pthread_mutex_t recov_backend_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct recov_stats
+{
+        uint64_t queued; /*< Adds and removes queued */
+        uint64_t batches; /*< Batches committed */
+        uint64_t max_batch; /*< Largest batch, under recov_backend_mutex */
+        uint64_t checks; /*< Clients checked for reclaim */
+        uint64_t reclaims; /*< Of which may reclaim */
+} recov_stats;
+
 static void nfs4_load_recov_clids_nolock(nfs_grace_start_t *gsp);
 extern hash_table_t *ht_nsm_client;
 static void nfs_release_nlm_state();
 static void nfs_release_v4_client(char *ip);
 
+static uint32_t
+clid_hash(const char *name)
+{
+        uint32_t hash;
+
+        MurmurHash3_x86_32(name, strlen(name), 67, &hash);
+        return hash;
+}
+
+/**
+ * @brief Initialize an empty client table
+ *
+ * @param[out] table The table
+ */
+void
+clid_table_init(struct clid_table *table)
+{
+        table->ct_buckets = NULL;
+        table->ct_mask = 0;
+        table->ct_count = 0;
+}
+
+static clid_entry_t *
+clid_table_lookup(struct clid_table *table, const char *name, uint32_t hash)
+{
+        struct glist_head *node;
+        clid_entry_t *clid_ent;
+
+        if (table->ct_buckets == NULL)
+                return NULL;
+
+        glist_for_each(node, &table->ct_buckets[hash & table->ct_mask]) {
+                clid_ent = glist_entry(node, clid_entry_t, cl_list);
+                if (clid_ent->cl_hash == hash &&
+                    !strcmp(clid_ent->cl_name, name))
+                        return clid_ent;
+        }
+        return NULL;
+}
+
+/**
+ * @brief Double the buckets of a client table
+ *
+ * @return false if there was no memory; the table is unchanged.
+ */
+static bool
+clid_table_grow(struct clid_table *table)
+{
+        uint32_t size = table->ct_buckets == NULL ?
+                CLID_TABLE_MIN : (table->ct_mask + 1) * 2;
+        struct glist_head *buckets;
+        struct glist_head *node, *noden;
+        clid_entry_t *clid_ent;
+        uint32_t i;
+
+        buckets = gsh_malloc(size * sizeof(*buckets));
+        if (buckets == NULL)
+                return false;
+
+        for (i = 0; i < size; i++)
+                init_glist(&buckets[i]);
+
+        if (table->ct_buckets != NULL) {
+                for (i = 0; i <= table->ct_mask; i++) {
+                        glist_for_each_safe(node, noden,
+                                            &table->ct_buckets[i]) {
+                                clid_ent = glist_entry(node, clid_entry_t,
+                                                       cl_list);
+                                glist_del(&clid_ent->cl_list);
+                                glist_add_tail(&buckets[clid_ent->cl_hash &
+                                                        (size - 1)],
+                                               &clid_ent->cl_list);
+                        }
+                }
+                gsh_free(table->ct_buckets);
+        }
+
+        table->ct_buckets = buckets;
+        table->ct_mask = size - 1;
+        return true;
+}
+
+/**
+ * @brief Add a client name to a table
+ *
+ * @param[in,out] table The table
+ * @param[in]     name  Client name
+ *
+ * @retval true if the name was added.
+ * @retval false if it was there already or there was no memory.
+ */
+bool
+clid_table_add(struct clid_table *table, const char *name)
+{
+        uint32_t hash = clid_hash(name);
+        clid_entry_t *clid_ent;
+
+        if (clid_table_lookup(table, name, hash) != NULL)
+                return false;
+
+        /* Keep chains at two names on average */
+        if (table->ct_buckets == NULL ||
+            table->ct_count >= 2 * (table->ct_mask + 1)) {
+                if (!clid_table_grow(table) && table->ct_buckets == NULL) {
+                        LogEvent(COMPONENT_CLIENTID,
+                                 "Unable to allocate memory.");
+                        return false;
+                }
+        }
+
+        clid_ent = gsh_malloc(sizeof(clid_entry_t));
+        if (clid_ent == NULL) {
+                LogEvent(COMPONENT_CLIENTID, "Unable to allocate memory.");
+                return false;
+        }
+        clid_ent->cl_hash = hash;
+        clid_ent->cl_reclaimed = false;
+        strmaxcpy(clid_ent->cl_name, name, sizeof(clid_ent->cl_name));
+        glist_add_tail(&table->ct_buckets[hash & table->ct_mask],
+                       &clid_ent->cl_list);
+        table->ct_count++;
+        return true;
+}
+
+/**
+ * @brief Remove a client name from a table
+ *
+ * @retval true if the name was there.
+ */
+bool
+clid_table_del(struct clid_table *table, const char *name)
+{
+        clid_entry_t *clid_ent;
+
+        clid_ent = clid_table_lookup(table, name, clid_hash(name));
+        if (clid_ent == NULL)
+                return false;
+
+        glist_del(&clid_ent->cl_list);
+        gsh_free(clid_ent);
+        table->ct_count--;
+        return true;
+}
+
+/**
+ * @brief Check whether a table holds a client name
+ */
+bool
+clid_table_find(struct clid_table *table, const char *name)
+{
+        return clid_table_lookup(table, name, clid_hash(name)) != NULL;
+}
+
+/**
+ * @brief Call cb on every name in a table
+ *
+ * cb must not change the table.
+ */
+void
+clid_table_foreach(struct clid_table *table,
+                   void (*cb)(const char *name, void *arg),
+                   void *arg)
+{
+        struct glist_head *node;
+        clid_entry_t *clid_ent;
+        uint32_t i;
+
+        if (table->ct_buckets == NULL)
+                return;
+
+        for (i = 0; i <= table->ct_mask; i++) {
+                glist_for_each(node, &table->ct_buckets[i]) {
+                        clid_ent = glist_entry(node, clid_entry_t, cl_list);
+                        cb(clid_ent->cl_name, arg);
+                }
+        }
+}
+
+/**
+ * @brief Empty a table and free its buckets
+ */
+void
+clid_table_clear(struct clid_table *table)
+{
+        struct glist_head *node, *noden;
+        clid_entry_t *clid_ent;
+        uint32_t i;
+
+        if (table->ct_buckets == NULL)
+                return;
+
+        for (i = 0; i <= table->ct_mask; i++) {
+                glist_for_each_safe(node, noden, &table->ct_buckets[i]) {
+                        clid_ent = glist_entry(node, clid_entry_t, cl_list);
+                        glist_del(&clid_ent->cl_list);
+                        gsh_free(clid_ent);
+                }
+        }
+        gsh_free(table->ct_buckets);
+        clid_table_init(table);
+}
+
+/**
+ * @brief End the grace period now
+ *
+ * Called with the grace mutex held.
+ *
+ * @param[in] why Reason to log
+ */
+static void
+nfs4_lift_grace(const char *why)
+{
+        time_t now = time(NULL);
+
+        if (grace.g_start + grace.g_duration <= now)
+                return;
+
+        LogEvent(COMPONENT_STATE,
+                 "NFS Server lifting grace after %d of %d seconds: %s",
+                 (int) (now - grace.g_start), (int) grace.g_duration, why);
+        grace.g_duration = now - grace.g_start;
+}
+
 /**
  * @brief Initialize grace/recovery
  */
 void
 nfs4_init_grace()
 {
-        init_glist(&grace.g_clid_list);
+        clid_table_init(&grace.g_clids);
         pthread_mutex_init(&grace.g_mutex, NULL);
 }
 
@@ -99,6 +372,8 @@ nfs4_init_grace()
 void nfs4_start_grace(nfs_grace_start_t *gsp)
 {
         int duration;
+        /* Whether the clients to wait for come from the store */
+        bool from_store = gsp == NULL;
 
         /* limit the grace period to a maximum of grace period or lease time */
 	duration = (nfs_param.nfsv4_param.graceless ?
@@ -128,10 +403,31 @@ void nfs4_start_grace(nfs_grace_start_t *gsp)
 			nfs_release_nlm_state();
 			if (gsp->event == EVENT_RELEASE_IP)
 				nfs_release_v4_client(gsp->ipaddr);
-			else
+			else {
 				nfs4_load_recov_clids_nolock(gsp);
+				from_store = true;
+			}
 		}
         }
+
+        /*
+         * Grace can end once every client recorded has reclaimed, but
+         * only if those are all the clients there are to wait for: NLM
+         * clients are not recorded, and a grace period asked for
+         * without a recovery event has no list to go by.
+         */
+        grace.g_lift_early = from_store &&
+                nfs_param.nfsv4_param.lift_grace_early &&
+                !nfs_param.core_param.enable_NLM;
+
+        if (grace.g_lift_early) {
+                LogEvent(COMPONENT_STATE,
+                         "Waiting for %"PRIu32" of %"PRIu32
+                         " clients to reclaim",
+                         grace.g_outstanding, grace.g_clids.ct_count);
+                if (grace.g_outstanding == 0)
+                        nfs4_lift_grace("no clients to reclaim");
+        }
         V(grace.g_mutex);
 }
 
@@ -213,62 +509,207 @@ nfs4_create_clid_name(nfs_client_record_t *cl_rec, nfs_client_id_t *clientid,
 }
 
 /**
- * @brief Create an entry in the recovery directory
+ * @brief Hand a batch of adds and removes to the backend
+ *
+ * Called with recov_backend_mutex held.  Frees the requests.
+ *
+ * @param[in,out] batch Requests, in the order they were made
+ */
+static void
+recov_commit_batch(struct glist_head *batch)
+{
+        struct glist_head *node, *noden;
+        struct recov_req *req;
+
+        glist_for_each_safe(node, noden, batch) {
+                req = glist_entry(node, struct recov_req, rr_list);
+                if (req->rr_add)
+                        recov_backend->add_clid(req->rr_name);
+                else
+                        recov_backend->rm_clid(req->rr_name);
+                glist_del(&req->rr_list);
+                gsh_free(req);
+        }
+
+        recov_backend->commit();
+}
+
+/**
+ * @brief Commit everything queued, a batch at a time
+ */
+static void
+recov_drain(void)
+{
+        struct glist_head batch;
+        uint64_t n, upto;
+
+        for (;;) {
+                init_glist(&batch);
+
+                P(recov_backend_mutex);
+                P(recov_queue_mutex);
+                if (glist_empty(&recov_queue)) {
+                        recov_draining = false;
+                        V(recov_queue_mutex);
+                        V(recov_backend_mutex);
+                        break;
+                }
+                glist_splice_tail(&batch, &recov_queue);
+                n = recov_queue_depth;
+                recov_queue_depth = 0;
+                upto = recov_queued;
+                V(recov_queue_mutex);
+
+                recov_commit_batch(&batch);
+                if (n > recov_stats.max_batch)
+                        recov_stats.max_batch = n;
+
+                P(recov_queue_mutex);
+                recov_committed = upto;
+                pthread_cond_broadcast(&recov_commit_cond);
+                V(recov_queue_mutex);
+                V(recov_backend_mutex);
+
+                atomic_inc_uint64_t(&recov_stats.batches);
+                LogDebug(COMPONENT_CLIENTID,
+                         "Recovery store: committed %"PRIu64" changes, "
+                         "queued=%"PRIu64" batches=%"PRIu64
+                         " max batch=%"PRIu64" reclaim checks=%"PRIu64
+                         " allowed=%"PRIu64,
+                         n,
+                         atomic_fetch_uint64_t(&recov_stats.queued),
+                         atomic_fetch_uint64_t(&recov_stats.batches),
+                         recov_stats.max_batch,
+                         atomic_fetch_uint64_t(&recov_stats.checks),
+                         atomic_fetch_uint64_t(&recov_stats.reclaims));
+        }
+}
+
+static void
+recov_drain_caller(struct fridgethr_context *ctx)
+{
+        recov_drain();
+}
+
+/**
+ * @brief Queue an add or remove for the recovery thread
+ *
+ * If the thread is not running the change is committed at once.
+ *
+ * @param[in] add  Whether to add or remove the client
+ * @param[in] name Client name
+ *
+ * @return The number to pass to recov_wait for the change to be
+ *         committed, or 0 if there is nothing to wait for.
+ */
+static uint64_t
+recov_queue_req(bool add, const char *name)
+{
+        struct glist_head batch;
+        struct recov_req *req;
+        bool submit = false;
+        uint64_t seq;
+        int rc;
+
+        req = gsh_malloc(sizeof(*req));
+        if (req == NULL) {
+                LogEvent(COMPONENT_CLIENTID,
+                         "Failed to %s client %s in recovery store, "
+                         "no memory", add ? "record" : "remove", name);
+                return 0;
+        }
+        req->rr_add = add;
+        strmaxcpy(req->rr_name, name, sizeof(req->rr_name));
+
+        P(recov_queue_mutex);
+        if (recov_fridge != NULL) {
+                glist_add_tail(&recov_queue, &req->rr_list);
+                recov_queue_depth++;
+                seq = ++recov_queued;
+                if (!recov_draining) {
+                        recov_draining = true;
+                        submit = true;
+                }
+                atomic_inc_uint64_t(&recov_stats.queued);
+
+                if (!submit) {
+                        V(recov_queue_mutex);
+                        return seq;
+                }
+
+                rc = fridgethr_submit(recov_fridge, recov_drain_caller, NULL);
+                if (rc == 0) {
+                        V(recov_queue_mutex);
+                        return seq;
+                }
+
+                LogCrit(COMPONENT_CLIENTID,
+                        "Unable to schedule recovery store update: %d", rc);
+                glist_del(&req->rr_list);
+                recov_queue_depth--;
+                recov_draining = false;
+        }
+        V(recov_queue_mutex);
+
+        init_glist(&batch);
+        glist_add_tail(&batch, &req->rr_list);
+        P(recov_backend_mutex);
+        recov_commit_batch(&batch);
+        V(recov_backend_mutex);
+        return 0;
+}
+
+/**
+ * @brief Wait for a queued change to be committed
+ *
+ * @param[in] seq As returned by recov_queue_req
+ */
+static void
+recov_wait(uint64_t seq)
+{
+        P(recov_queue_mutex);
+        while (recov_committed < seq)
+                pthread_cond_wait(&recov_commit_cond, &recov_queue_mutex);
+        V(recov_queue_mutex);
+}
+
+/**
+ * @brief Record a client in the recovery store
  *
  * This entry alows the client to reclaim state after a server
- * reboot/restart.
+ * reboot/restart.  The client is committed along with whatever else
+ * the recovery thread has queued, and this returns once that batch
+ * is stable, so the confirmation is not sent before the record is.
  *
  * @param[in] clientid Client record
  */
 void
 nfs4_add_clid(nfs_client_id_t *clientid)
 {
-        int err;
-        char path[PATH_MAX + 1];
-
         if (clientid->cid_recov_dir == NULL) {
                 LogEvent(COMPONENT_CLIENTID,
                     "Failed to create client in recovery dir, no name");
                 return;
         }
 
-	snprintf(path, sizeof(path), "%s/%s", v4_recov_dir,
-		 clientid->cid_recov_dir);
-
-        err = mkdir(path, 0700);
-        if (err == -1 && errno != EEXIST) {
-                LogEvent(COMPONENT_CLIENTID,
-                    "Failed to create client in recovery dir (%s), errno=%d",
-                    path, errno);
-        } else {
-                LogDebug(COMPONENT_CLIENTID, "Created client dir [%s]", path);
-        }
+        recov_wait(recov_queue_req(true, clientid->cid_recov_dir));
 }
 
 /**
- * @brief Remove a client entry from the recovery directory
+ * @brief Remove a client from the recovery store
  *
- * This function would be called when a client expires.
+ * This function would be called when a client expires.  It does not
+ * wait for the store to be updated.
  *
- * @param[in] recov_dir Recovery directory
+ * @param[in] recov_dir Client name
  */
 void
 nfs4_rm_clid(char *recov_dir)
 {
-        int err;
-        char path[PATH_MAX + 1];
-
         if (recov_dir == NULL)
                 return;
 
-	snprintf(path, sizeof(path), "%s/%s", v4_recov_dir, recov_dir);
-
-        err = rmdir(path);
-        if (err == -1) {
-                LogEvent(COMPONENT_CLIENTID,
-                    "Failed to remove client in recovery dir (%s), errno=%d",
-                    path, errno);
-        }
+        (void) recov_queue_req(false, recov_dir);
 }
 
 /**
@@ -281,47 +722,337 @@ nfs4_rm_clid(char *recov_dir)
 void
 nfs4_chk_clid(nfs_client_id_t *clientid)
 {
-        struct glist_head *node;
-        clid_entry_t *clid_ent;
+        bool found;
 
         /* If we aren't in grace period, then reclaim is not possible */
-        if (!nfs_in_grace())
+        if (!nfs_in_grace() || clientid->cid_recov_dir == NULL)
                 return;
 
+        atomic_inc_uint64_t(&recov_stats.checks);
+
         P(grace.g_mutex);
+        found = clid_table_find(&grace.g_clids, clientid->cid_recov_dir);
+        V(grace.g_mutex);
 
-        /* If there were no clients at time of restart, we're done */
-        if (glist_empty(&grace.g_clid_list)) {
-                V(grace.g_mutex);
+        if (!found) {
+                LogDebug(COMPONENT_CLIENTID, "%s may not reclaim",
+                         clientid->cid_recov_dir);
                 return;
         }
 
-        /*
-         * loop through the list and try to find this client.  if we
-         * find it, mark it to allow reclaims.  perhaps the client should
-         * be removed from the list at this point to make the list shorter?
-         */
-        glist_for_each(node, &grace.g_clid_list) {
-                clid_ent = glist_entry(node, clid_entry_t, cl_list);
-                LogDebug(COMPONENT_CLIENTID, "compare %s to %s",
-                    clid_ent->cl_name, clientid->cid_recov_dir);
-                if (!strncmp(clid_ent->cl_name, clientid->cid_recov_dir,
-                    256)) {
-                        if (isDebug(COMPONENT_CLIENTID)) {
-                            char str[HASHTABLE_DISPLAY_STRLEN];
-
-                            display_client_id_rec(clientid, str);
-
-                            LogFullDebug(COMPONENT_CLIENTID,
-                                         "Allowed to reclaim ClientId %s",
-                                         str);
+        if (isDebug(COMPONENT_CLIENTID)) {
+                char str[HASHTABLE_DISPLAY_STRLEN];
+
+                display_client_id_rec(clientid, str);
+
+                LogFullDebug(COMPONENT_CLIENTID,
+                             "Allowed to reclaim ClientId %s", str);
+        }
+        atomic_inc_uint64_t(&recov_stats.reclaims);
+        clientid->cid_allow_reclaim = 1;
+}
+
+/**
+ * @brief Note that a client has finished reclaiming
+ *
+ * Called on a global RECLAIM_COMPLETE, and for NFSv4.0, which has no
+ * such operation, on the client's first non-reclaim OPEN or LOCK
+ * during grace: a client reclaims all its state before it opens
+ * anything new.  Grace ends if this was the last client recorded.
+ *
+ * @param[in] clientid Client record
+ */
+void
+nfs4_reclaim_done(nfs_client_id_t *clientid)
+{
+        clid_entry_t *clid_ent;
+        const char *name = clientid->cid_recov_dir;
+
+        if (name == NULL)
+                return;
+
+        P(grace.g_mutex);
+
+        clid_ent = clid_table_lookup(&grace.g_clids, name, clid_hash(name));
+        if (clid_ent != NULL && !clid_ent->cl_reclaimed) {
+                clid_ent->cl_reclaimed = true;
+                grace.g_outstanding--;
+                LogDebug(COMPONENT_CLIENTID,
+                         "%s done reclaiming, %"PRIu32" clients to go",
+                         name, grace.g_outstanding);
+                if (grace.g_outstanding == 0 && grace.g_lift_early)
+                        nfs4_lift_grace("all clients have reclaimed");
+        }
+
+        V(grace.g_mutex);
+}
+
+/**
+ * @brief Report on the grace period
+ *
+ * @param[out] remaining Seconds of grace left, 0 if not in grace
+ * @param[out] recorded  Clients that may reclaim
+ * @param[in]  cb        Called with each client not done reclaiming
+ * @param[in]  arg       Passed to cb
+ *
+ * @retval true if in grace.
+ */
+bool
+nfs4_grace_status(time_t *remaining, uint32_t *recorded,
+                  void (*cb)(const char *name, void *arg), void *arg)
+{
+        struct glist_head *node;
+        clid_entry_t *clid_ent;
+        time_t now = time(NULL);
+        uint32_t i;
+        bool in_grace;
+
+        P(grace.g_mutex);
+
+        in_grace = !nfs_param.nfsv4_param.graceless &&
+                grace.g_start + grace.g_duration > now;
+        *remaining = in_grace ? grace.g_start + grace.g_duration - now : 0;
+        *recorded = grace.g_clids.ct_count;
+
+        if (grace.g_clids.ct_buckets != NULL) {
+                for (i = 0; i <= grace.g_clids.ct_mask; i++) {
+                        glist_for_each(node, &grace.g_clids.ct_buckets[i]) {
+                                clid_ent = glist_entry(node, clid_entry_t,
+                                                       cl_list);
+                                if (!clid_ent->cl_reclaimed)
+                                        cb(clid_ent->cl_name, arg);
                         }
-                        clientid->cid_allow_reclaim = 1;
-                        V(grace.g_mutex);
-                        return;
                 }
         }
+
         V(grace.g_mutex);
+
+        return in_grace;
+}
+
+/**
+ * @brief Allow a client to reclaim, called by the backend's load
+ *
+ * Called with the grace mutex held.
+ *
+ * @param[in] name Client name
+ */
+static void
+recov_add_reclaim(const char *name)
+{
+        if (clid_table_add(&grace.g_clids, name)) {
+                grace.g_outstanding++;
+                LogDebug(COMPONENT_CLIENTID, "added %s to clid list", name);
+        }
+}
+
+/**
+ * @brief Load clients for recovery, with no lock
+ *
+ * When not doing a take over the clients of the previous instance
+ * replace the list.  On a take over, the clients of the node taken
+ * over are added to it.  Whatever is still queued is committed first,
+ * so the store read is current.
+ *
+ * @param[in] gsp Grace period start information, NULL on restart
+ */
+static void
+nfs4_load_recov_clids_nolock(nfs_grace_start_t *gsp)
+{
+        /* when not doing a takeover, start with an empty list */
+        if (gsp == NULL) {
+                clid_table_clear(&grace.g_clids);
+                grace.g_outstanding = 0;
+        }
+
+        recov_drain();
+
+        P(recov_backend_mutex);
+        recov_backend->load(gsp, recov_add_reclaim);
+        V(recov_backend_mutex);
+
+        LogEvent(COMPONENT_CLIENTID,
+                 "%"PRIu32" clients may reclaim state",
+                 grace.g_clids.ct_count);
+}
+
+/**
+ * @brief Load clients for recovery
+ *
+ * @param[in] nodeid Node, on takeover
+ */
+void
+nfs4_load_recov_clids(nfs_grace_start_t *gsp)
+{
+        P(grace.g_mutex);
+
+        nfs4_load_recov_clids_nolock(gsp);
+
+        V(grace.g_mutex);
+}
+
+/**
+ * @brief Forget the clients of the previous instance
+ */
+void
+nfs4_clean_old_recov_dir(void)
+{
+        P(recov_backend_mutex);
+        recov_backend->clean_old();
+        V(recov_backend_mutex);
+}
+
+/**
+ * @brief Create the recovery directory
+ *
+ * The recovery directory may not exist yet, so create it.  This
+ * should only need to be done once (if at all).  Also, the location
+ * of the directory could be configurable.  Then set up the backend
+ * chosen with Recovery_Backend in it.
+ */
+void
+nfs4_create_recov_dir(void)
+{
+        int err;
+
+        err = mkdir(NFS_V4_RECOV_ROOT, 0755);
+        if (err == -1 && errno != EEXIST) {
+                LogEvent(COMPONENT_CLIENTID,
+                    "Failed to create v4 recovery dir (%s), errno=%d",
+                    NFS_V4_RECOV_ROOT, errno);
+        }
+
+        snprintf(v4_recov_dir, sizeof(v4_recov_dir), "%s/%s",
+		 NFS_V4_RECOV_ROOT, NFS_V4_RECOV_DIR);
+        err = mkdir(v4_recov_dir, 0755);
+        if (err == -1 && errno != EEXIST) {
+                LogEvent(COMPONENT_CLIENTID,
+                    "Failed to create v4 recovery dir(%s), errno=%d",
+                    v4_recov_dir, errno);
+        }
+
+        snprintf(v4_old_dir, sizeof(v4_old_dir), "%s/%s",
+		 NFS_V4_RECOV_ROOT, NFS_V4_OLD_DIR);
+        err = mkdir(v4_old_dir, 0755);
+        if (err == -1 && errno != EEXIST) {
+                LogEvent(COMPONENT_CLIENTID,
+                    "Failed to create v4 recovery dir(%s), errno=%d",
+                    v4_old_dir, errno);
+        }
+        if (nfs_param.core_param.clustered) {
+                snprintf(v4_recov_dir, sizeof(v4_recov_dir), "%s/%s/node%d",
+			 NFS_V4_RECOV_ROOT, NFS_V4_RECOV_DIR, g_nodeid);
+
+                err = mkdir(v4_recov_dir, 0755);
+                if (err == -1 && errno != EEXIST) {
+                        LogEvent(COMPONENT_CLIENTID,
+                            "Failed to create v4 recovery dir(%s), errno=%d",
+                            v4_recov_dir, errno);
+                }
+
+                snprintf(v4_old_dir, sizeof(v4_old_dir), "%s/%s/node%d",
+			 NFS_V4_RECOV_ROOT, NFS_V4_OLD_DIR, g_nodeid);
+
+                err = mkdir(v4_old_dir, 0755);
+                if (err == -1 && errno != EEXIST) {
+                        LogEvent(COMPONENT_CLIENTID,
+                            "Failed to create v4 recovery dir(%s), errno=%d",
+                            v4_old_dir, errno);
+                }
+        }
+
+        if (nfs_param.nfsv4_param.recovery_backend == RECOVERY_BACKEND_JOURNAL)
+                recov_backend = &nfs4_recovery_journal;
+        else
+                recov_backend = &nfs4_recovery_fs;
+
+        LogInfo(COMPONENT_CLIENTID, "NFSv4 recovery store: %s",
+                recov_backend->name);
+
+        P(recov_backend_mutex);
+        recov_backend->create();
+        V(recov_backend_mutex);
+}
+
+/**
+ * @brief Start the thread that updates the recovery store
+ *
+ * Until it runs, and after nfs4_recovery_async_shutdown, changes are
+ * committed by the thread making them.
+ *
+ * @return 0 or a POSIX error code.
+ */
+int
+nfs4_recovery_async_init(void)
+{
+        struct fridgethr_params frp;
+        struct fridgethr *fr;
+        int rc;
+
+        memset(&frp, 0, sizeof(struct fridgethr_params));
+        frp.thr_max = 1;
+        frp.deferment = fridgethr_defer_queue;
+        rc = fridgethr_init(&fr, "Recovery", &frp);
+        if (rc != 0) {
+                LogMajor(COMPONENT_CLIENTID,
+                         "Unable to initialize recovery store thread: %d",
+                         rc);
+                return rc;
+        }
+
+        P(recov_queue_mutex);
+        recov_fridge = fr;
+        V(recov_queue_mutex);
+
+        return 0;
+}
+
+/**
+ * @brief Stop the recovery store thread and commit what it left
+ */
+void
+nfs4_recovery_async_shutdown(void)
+{
+        struct fridgethr *fr;
+        int rc;
+
+        P(recov_queue_mutex);
+        fr = recov_fridge;
+        recov_fridge = NULL;
+        V(recov_queue_mutex);
+
+        if (fr == NULL)
+                return;
+
+        rc = fridgethr_sync_command(fr, fridgethr_comm_stop, 120);
+        if (rc == ETIMEDOUT) {
+                LogMajor(COMPONENT_CLIENTID,
+                         "Shutdown timed out, cancelling threads.");
+                fridgethr_cancel(fr);
+        } else if (rc != 0) {
+                LogMajor(COMPONENT_CLIENTID,
+                         "Failed shutting down recovery store thread: %d",
+                         rc);
+        }
+
+        P(recov_queue_mutex);
+        recov_draining = true;
+        V(recov_queue_mutex);
+        recov_drain();
+}
+
+/*
+ * The directory backend: a directory per client in v4_recov_dir.  On
+ * restart the directories are moved to v4_old_dir and removed from
+ * there once grace is over.
+ */
+
+/* Whether the recovery directory changed since the last commit */
+static bool recov_fs_dirty;
+
+static void
+recov_fs_create(void)
+{
 }
 
 /**
@@ -338,14 +1069,15 @@ nfs4_chk_clid(nfs_client_id_t *clientid)
  * @param[in] dp       Recovery directory
  * @param[in] srcdir   Path to the source directory on failover
  * @param[in] takeover Whether this is a takeover.
+ * @param[in] add      Called for each client
  *
  * @return POSIX error codes.
  */
 static int
-nfs4_read_recov_clids(DIR *dp, char *srcdir, bool takeover)
+nfs4_read_recov_clids(DIR *dp, char *srcdir, bool takeover,
+                      void (*add)(const char *name))
 {
         struct dirent *dentp;
-        clid_entry_t *new_ent;
         char src[PATH_MAX + 1], dest[PATH_MAX + 1];
         int rc;
 
@@ -353,16 +1085,7 @@ nfs4_read_recov_clids(DIR *dp, char *srcdir, bool takeover)
         while (dentp != NULL) {
                 /* don't add '.' and '..', or any '.*' entry */
                 if (dentp->d_name[0] != '.') {
-                        new_ent = gsh_malloc(sizeof(clid_entry_t));
-                        if (new_ent == NULL) {
-                                LogEvent(COMPONENT_CLIENTID,
-                                         "Unable to allocate memory.");
-                                return -1;
-                        }
-                        strmaxcpy(new_ent->cl_name, dentp->d_name, 256);
-                        glist_add(&grace.g_clid_list, &new_ent->cl_list);
-                        LogDebug(COMPONENT_CLIENTID, "added %s to clid list",
-                            new_ent->cl_name);
+                        add(dentp->d_name);
                         if (srcdir != NULL) {
                                 snprintf(src, sizeof(src), "%s/%s",
 					 srcdir, dentp->d_name);
@@ -385,31 +1108,14 @@ nfs4_read_recov_clids(DIR *dp, char *srcdir, bool takeover)
         return 0;
 }
 
-/**
- * @brief Load clients for recovery, with no lock
- *
- * @param[in] nodeid Node, on takeover
- */
 static void
-nfs4_load_recov_clids_nolock(nfs_grace_start_t *gsp)
+recov_fs_load(nfs_grace_start_t *gsp, void (*add)(const char *name))
 {
         DIR *dp;
-        struct glist_head *node;
-        clid_entry_t *clid_entry;
         int rc;
         char path[PATH_MAX + 1];
 
         if (gsp == NULL) {
-                /* when not doing a takeover, start with an empty list */
-                if (!glist_empty(&grace.g_clid_list)) {
-                        glist_for_each(node, &grace.g_clid_list) {
-                                glist_del(node);
-                                clid_entry = glist_entry(node,
-                                    clid_entry_t, cl_list);
-                                gsh_free(clid_entry);
-                        }
-                }
-
                 dp = opendir(v4_old_dir);
                 if (dp == NULL) {
                         LogEvent(COMPONENT_CLIENTID,
@@ -417,7 +1123,7 @@ nfs4_load_recov_clids_nolock(nfs_grace_start_t *gsp)
                             v4_old_dir, errno);
                         return;
                 }
-                rc = nfs4_read_recov_clids(dp, NULL, 0);
+                rc = nfs4_read_recov_clids(dp, NULL, 0, add);
                 if (rc == -1) {
                         (void) closedir(dp);
                         LogEvent(COMPONENT_CLIENTID,
@@ -434,7 +1140,7 @@ nfs4_load_recov_clids_nolock(nfs_grace_start_t *gsp)
                         return;
                 }
 
-                rc = nfs4_read_recov_clids(dp, v4_recov_dir, 0);
+                rc = nfs4_read_recov_clids(dp, v4_recov_dir, 0, add);
                 if (rc == -1) {
                         (void) closedir(dp);
                         LogEvent(COMPONENT_CLIENTID,
@@ -476,7 +1182,7 @@ nfs4_load_recov_clids_nolock(nfs_grace_start_t *gsp)
                         return;
                 }
 
-                rc = nfs4_read_recov_clids(dp, path, 1);
+                rc = nfs4_read_recov_clids(dp, path, 1, add);
                 if (rc == -1) {
                         (void) closedir(dp);
                         LogEvent(COMPONENT_CLIENTID,
@@ -493,26 +1199,67 @@ nfs4_load_recov_clids_nolock(nfs_grace_start_t *gsp)
         }
 }
 
-/**
- * @brief Load clients for recovery
- *
- * @param[in] nodeid Node, on takeover
- */
-void
-nfs4_load_recov_clids(nfs_grace_start_t *gsp)
+static void
+recov_fs_add_clid(const char *name)
 {
-        P(grace.g_mutex);
+        int err;
+        char path[PATH_MAX + 1];
 
-        nfs4_load_recov_clids_nolock(gsp);
+	snprintf(path, sizeof(path), "%s/%s", v4_recov_dir, name);
 
-        V(grace.g_mutex);
+        err = mkdir(path, 0700);
+        if (err == -1 && errno != EEXIST) {
+                LogEvent(COMPONENT_CLIENTID,
+                    "Failed to create client in recovery dir (%s), errno=%d",
+                    path, errno);
+        } else {
+                LogDebug(COMPONENT_CLIENTID, "Created client dir [%s]", path);
+                recov_fs_dirty = true;
+        }
+}
+
+static void
+recov_fs_rm_clid(const char *name)
+{
+        int err;
+        char path[PATH_MAX + 1];
+
+	snprintf(path, sizeof(path), "%s/%s", v4_recov_dir, name);
+
+        err = rmdir(path);
+        if (err == -1) {
+                LogEvent(COMPONENT_CLIENTID,
+                    "Failed to remove client in recovery dir (%s), errno=%d",
+                    path, errno);
+        } else {
+                recov_fs_dirty = true;
+        }
 }
 
 /**
- * @brief Clean up recovery directory
+ * @brief Sync the recovery directory once for the whole batch
  */
-void
-nfs4_clean_old_recov_dir(void)
+static void
+recov_fs_commit(void)
+{
+        int fd;
+
+        if (!recov_fs_dirty)
+                return;
+        recov_fs_dirty = false;
+
+        fd = open(v4_recov_dir, O_RDONLY | O_DIRECTORY);
+        if (fd == -1 || fsync(fd) == -1) {
+                LogEvent(COMPONENT_CLIENTID,
+                    "Failed to sync v4 recovery dir (%s), errno=%d",
+                    v4_recov_dir, errno);
+        }
+        if (fd != -1)
+                close(fd);
+}
+
+static void
+recov_fs_clean_old(void)
 {
         DIR *dp;
         struct dirent *dentp;
@@ -545,64 +1292,16 @@ nfs4_clean_old_recov_dir(void)
         closedir(dp);
 }
 
-/**
- * @brief Create the recovery directory
- *
- * The recovery directory may not exist yet, so create it.  This
- * should only need to be done once (if at all).  Also, the location
- * of the directory could be configurable.
- */
-void
-nfs4_create_recov_dir(void)
-{
-        int err;
-
-        err = mkdir(NFS_V4_RECOV_ROOT, 0755);
-        if (err == -1 && errno != EEXIST) {
-                LogEvent(COMPONENT_CLIENTID,
-                    "Failed to create v4 recovery dir (%s), errno=%d",
-                    NFS_V4_RECOV_ROOT, errno);
-        }
-
-        snprintf(v4_recov_dir, sizeof(v4_recov_dir), "%s/%s",
-		 NFS_V4_RECOV_ROOT, NFS_V4_RECOV_DIR);
-        err = mkdir(v4_recov_dir, 0755);
-        if (err == -1 && errno != EEXIST) {
-                LogEvent(COMPONENT_CLIENTID,
-                    "Failed to create v4 recovery dir(%s), errno=%d",
-                    v4_recov_dir, errno);
-        }
+struct nfs4_recovery_backend nfs4_recovery_fs = {
+        .name = "fs",
+        .create = recov_fs_create,
+        .load = recov_fs_load,
+        .add_clid = recov_fs_add_clid,
+        .rm_clid = recov_fs_rm_clid,
+        .commit = recov_fs_commit,
+        .clean_old = recov_fs_clean_old
+};
 
-        snprintf(v4_old_dir, sizeof(v4_old_dir), "%s/%s",
-		 NFS_V4_RECOV_ROOT, NFS_V4_OLD_DIR);
-        err = mkdir(v4_old_dir, 0755);
-        if (err == -1 && errno != EEXIST) {
-                LogEvent(COMPONENT_CLIENTID,
-                    "Failed to create v4 recovery dir(%s), errno=%d",
-                    v4_old_dir, errno);
-        }
-        if (nfs_param.core_param.clustered) {
-                snprintf(v4_recov_dir, sizeof(v4_recov_dir), "%s/%s/node%d",
-			 NFS_V4_RECOV_ROOT, NFS_V4_RECOV_DIR, g_nodeid);
-
-                err = mkdir(v4_recov_dir, 0755);
-                if (err == -1 && errno != EEXIST) {
-                        LogEvent(COMPONENT_CLIENTID,
-                            "Failed to create v4 recovery dir(%s), errno=%d",
-                            v4_recov_dir, errno);
-                }
-
-                snprintf(v4_old_dir, sizeof(v4_old_dir), "%s/%s/node%d",
-			 NFS_V4_RECOV_ROOT, NFS_V4_OLD_DIR, g_nodeid);
-
-                err = mkdir(v4_old_dir, 0755);
-                if (err == -1 && errno != EEXIST) {
-                        LogEvent(COMPONENT_CLIENTID,
-                            "Failed to create v4 recovery dir(%s), errno=%d",
-                            v4_old_dir, errno);
-                }
-        }
-}
 
 /**
  * @brief Release all NLM state
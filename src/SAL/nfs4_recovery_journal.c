@@ -0,0 +1,502 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @addtogroup SAL
+ * @{
+ */
+
+/**
+ * @file nfs4_recovery_journal.c
+ * @brief Journal backend for the NFSv4 recovery store
+ *
+ * Clients are recorded in a single append-only file in the recovery
+ * directory, one line per change: "+name" when a client is recorded
+ * and "-name" when it goes away.  A batch is appended with one write
+ * and made stable with one fdatasync, so a reclaim storm costs a few
+ * syncs rather than a mkdir and rmdir per client.
+ *
+ * The clients currently recorded are also kept in memory.  Once the
+ * file holds more than twice as many lines as there are clients it is
+ * rewritten with one line per client.  A line cut short by a crash is
+ * ignored on replay.
+ *
+ * On restart the clients of both the old and the current journal may
+ * reclaim.  They are written to the old journal, and the current one
+ * is emptied.  The old journal is removed once grace is over.
+ */
+
+#include "config.h"
+#include "log.h"
+#include "nfs_core.h"
+#include "sal_functions.h"
+#include "nfs4_recovery.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define JOURNAL_NAME "clients.log"
+
+/** Lines a journal may hold beyond twice its clients before compaction */
+#define JOURNAL_COMPACT_SLACK 1024
+
+static int journal_fd = -1;
+static char journal_path[PATH_MAX + 1];
+
+/** Clients recorded in the current journal */
+static struct clid_table journal_live;
+
+/** Lines in the current journal file */
+static uint64_t journal_lines;
+
+/** Lines appended since the last commit */
+static char *journal_buf;
+static size_t journal_len;
+static size_t journal_size;
+static uint64_t journal_pending;
+
+/**
+ * @brief Read a journal into a set of clients
+ *
+ * A missing journal is empty.
+ *
+ * @param[in]     path  Journal
+ * @param[in,out] set   Clients, changed by each line in turn
+ *
+ * @return Lines read, or -1 if the journal could not be read.
+ */
+static int64_t
+journal_replay(const char *path, struct clid_table *set)
+{
+        FILE *fp;
+        char line[NFS4_CLID_NAME_LEN + 2];
+        size_t len;
+        int64_t lines = 0;
+
+        fp = fopen(path, "r");
+        if (fp == NULL) {
+                if (errno == ENOENT)
+                        return 0;
+                LogEvent(COMPONENT_CLIENTID,
+                         "Failed to open v4 recovery journal (%s), errno=%d",
+                         path, errno);
+                return -1;
+        }
+
+        while (fgets(line, sizeof(line), fp) != NULL) {
+                len = strlen(line);
+                if (len < 3 || line[len - 1] != '\n') {
+                        /* Torn or overlong, skip the rest of it */
+                        LogEvent(COMPONENT_CLIENTID,
+                                 "Ignoring bad line in %s", path);
+                        while (len > 0 && line[len - 1] != '\n' &&
+                               fgets(line, sizeof(line), fp) != NULL)
+                                len = strlen(line);
+                        continue;
+                }
+                line[len - 1] = '\0';
+                if (line[0] == '+')
+                        clid_table_add(set, line + 1);
+                else if (line[0] == '-')
+                        clid_table_del(set, line + 1);
+                else
+                        LogEvent(COMPONENT_CLIENTID,
+                                 "Ignoring bad line in %s", path);
+                lines++;
+        }
+
+        fclose(fp);
+        return lines;
+}
+
+/**
+ * @brief Write all of a buffer
+ */
+static bool
+journal_write(int fd, const char *buf, size_t len)
+{
+        ssize_t n;
+
+        while (len > 0) {
+                n = write(fd, buf, len);
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return false;
+                }
+                buf += n;
+                len -= n;
+        }
+        return true;
+}
+
+static void
+journal_format(const char *name, void *arg)
+{
+        FILE *fp = arg;
+
+        fprintf(fp, "+%s\n", name);
+}
+
+/**
+ * @brief Sync the directory holding a file
+ *
+ * Makes a rename or create in it stable.
+ */
+static void
+journal_sync_dir(const char *path)
+{
+        char dir[PATH_MAX + 1];
+        char *slash;
+        int fd;
+
+        strmaxcpy(dir, path, sizeof(dir));
+        slash = strrchr(dir, '/');
+        if (slash == NULL)
+                return;
+        *slash = '\0';
+
+        fd = open(dir, O_RDONLY | O_DIRECTORY);
+        if (fd == -1 || fsync(fd) != 0)
+                LogEvent(COMPONENT_CLIENTID,
+                         "Failed to sync v4 recovery dir (%s), errno=%d",
+                         dir, errno);
+        if (fd != -1)
+                close(fd);
+}
+
+/**
+ * @brief Replace a journal with one line per client of a set
+ *
+ * The new journal is written aside, synced and renamed over the old,
+ * and the directory is synced, so a crash leaves one or the other.
+ *
+ * @return false if the journal could not be replaced.
+ */
+static bool
+journal_rewrite(const char *path, struct clid_table *set)
+{
+        char tmp[PATH_MAX + 1];
+        FILE *fp;
+        bool ok;
+
+        snprintf(tmp, sizeof(tmp), "%s.new", path);
+
+        fp = fopen(tmp, "w");
+        if (fp == NULL) {
+                LogEvent(COMPONENT_CLIENTID,
+                         "Failed to create v4 recovery journal (%s), errno=%d",
+                         tmp, errno);
+                return false;
+        }
+
+        clid_table_foreach(set, journal_format, fp);
+
+        ok = fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+        if (fclose(fp) != 0)
+                ok = false;
+        if (ok && rename(tmp, path) != 0)
+                ok = false;
+        if (!ok) {
+                LogEvent(COMPONENT_CLIENTID,
+                         "Failed to write v4 recovery journal (%s), errno=%d",
+                         path, errno);
+                (void) unlink(tmp);
+                return false;
+        }
+        journal_sync_dir(path);
+        return true;
+}
+
+/**
+ * @brief Open the current journal for appending
+ */
+static void
+journal_open(void)
+{
+        if (journal_fd != -1)
+                close(journal_fd);
+
+        journal_fd = open(journal_path, O_WRONLY | O_APPEND | O_CREAT, 0600);
+        if (journal_fd == -1)
+                LogCrit(COMPONENT_CLIENTID,
+                        "Failed to open v4 recovery journal (%s), errno=%d",
+                        journal_path, errno);
+}
+
+static void
+journal_create(void)
+{
+        snprintf(journal_path, sizeof(journal_path), "%s/%s",
+                 v4_recov_dir, JOURNAL_NAME);
+        clid_table_init(&journal_live);
+        journal_open();
+}
+
+struct journal_load {
+        void (*add)(const char *name);
+        FILE *fp;
+};
+
+static void
+journal_load_one(const char *name, void *arg)
+{
+        struct journal_load *jl = arg;
+
+        jl->add(name);
+        if (jl->fp != NULL)
+                fprintf(jl->fp, "+%s\n", name);
+}
+
+static void
+journal_load(nfs_grace_start_t *gsp, void (*add)(const char *name))
+{
+        struct journal_load jl = { .add = add, .fp = NULL };
+        struct clid_table set;
+        char old[PATH_MAX + 1];
+        char path[PATH_MAX + 1];
+
+        clid_table_init(&set);
+        snprintf(old, sizeof(old), "%s/%s", v4_old_dir, JOURNAL_NAME);
+
+        if (gsp == NULL) {
+                /* The old journal first, in case of a restart during
+                   grace, then the clients of the last instance */
+                if (journal_replay(old, &set) < 0 ||
+                    journal_replay(journal_path, &set) < 0) {
+                        clid_table_clear(&set);
+                        return;
+                }
+
+                clid_table_foreach(&set, journal_load_one, &jl);
+
+                /* Only once they are all in the old journal may the
+                   current one start again */
+                if (journal_rewrite(old, &set) && journal_fd != -1) {
+                        if (ftruncate(journal_fd, 0) != 0 ||
+                            fsync(journal_fd) != 0)
+                                LogEvent(COMPONENT_CLIENTID,
+                                         "Failed to empty v4 recovery "
+                                         "journal (%s), errno=%d",
+                                         journal_path, errno);
+                        clid_table_clear(&journal_live);
+                        journal_lines = 0;
+                }
+                clid_table_clear(&set);
+                return;
+        }
+
+        if (gsp->event == EVENT_UPDATE_CLIENTS)
+                snprintf(path, sizeof(path), "%s", journal_path);
+        else if (gsp->event == EVENT_TAKE_IP)
+                snprintf(path, sizeof(path), "%s/%s/%s/%s",
+                         NFS_V4_RECOV_ROOT, gsp->ipaddr, NFS_V4_RECOV_DIR,
+                         JOURNAL_NAME);
+        else if (gsp->event == EVENT_TAKE_NODEID)
+                snprintf(path, sizeof(path), "%s/%s/node%d/%s",
+                         NFS_V4_RECOV_ROOT, NFS_V4_RECOV_DIR, gsp->nodeid,
+                         JOURNAL_NAME);
+        else
+                return;
+
+        LogEvent(COMPONENT_CLIENTID,
+                 "Recovery for nodeid %d journal (%s)",
+                 gsp->nodeid, path);
+
+        if (journal_replay(path, &set) < 0) {
+                clid_table_clear(&set);
+                return;
+        }
+
+        /* The clients taken over stay allowed across our own restart */
+        jl.fp = fopen(old, "a");
+        if (jl.fp == NULL)
+                LogEvent(COMPONENT_CLIENTID,
+                         "Failed to open v4 recovery journal (%s), errno=%d",
+                         old, errno);
+
+        clid_table_foreach(&set, journal_load_one, &jl);
+
+        if (jl.fp != NULL) {
+                if (fflush(jl.fp) != 0 || fsync(fileno(jl.fp)) != 0)
+                        LogEvent(COMPONENT_CLIENTID,
+                                 "Failed to write v4 recovery journal (%s), "
+                                 "errno=%d", old, errno);
+                fclose(jl.fp);
+        }
+        clid_table_clear(&set);
+}
+
+/**
+ * @brief Queue a line for the next commit
+ *
+ * @return false if the line could not be queued.
+ */
+static bool
+journal_append(char op, const char *name)
+{
+        size_t need = strlen(name) + 2;
+        size_t size;
+        char *buf;
+
+        if (journal_len + need > journal_size) {
+                size = journal_size ? journal_size : 4096;
+                while (size < journal_len + need)
+                        size *= 2;
+                buf = gsh_realloc(journal_buf, size);
+                if (buf == NULL) {
+                        LogCrit(COMPONENT_CLIENTID,
+                                "Unable to allocate memory, client %s not "
+                                "journaled", name);
+                        return false;
+                }
+                journal_buf = buf;
+                journal_size = size;
+        }
+
+        journal_buf[journal_len++] = op;
+        memcpy(journal_buf + journal_len, name, need - 2);
+        journal_len += need - 2;
+        journal_buf[journal_len++] = '\n';
+        journal_pending++;
+        return true;
+}
+
+static void
+journal_add_clid(const char *name)
+{
+        if (clid_table_add(&journal_live, name) &&
+            !journal_append('+', name))
+                (void) clid_table_del(&journal_live, name);
+}
+
+static void
+journal_rm_clid(const char *name)
+{
+        if (clid_table_del(&journal_live, name) &&
+            !journal_append('-', name))
+                (void) clid_table_add(&journal_live, name);
+}
+
+/**
+ * @brief Forget the lines queued since the last commit
+ *
+ * Undoes them in journal_live, last first, so it matches the file
+ * again.
+ */
+static void
+journal_undo(void)
+{
+        char *end = journal_buf + journal_len;
+        char *line;
+
+        while (end > journal_buf) {
+                /* end is just past a '\n', find the start of its line */
+                *--end = '\0';
+                line = end;
+                while (line > journal_buf && line[-1] != '\n')
+                        line--;
+                if (line[0] == '+')
+                        (void) clid_table_del(&journal_live, line + 1);
+                else
+                        (void) clid_table_add(&journal_live, line + 1);
+                end = line;
+        }
+        journal_len = 0;
+        journal_pending = 0;
+}
+
+/**
+ * @brief Append the batch with one write and sync it once
+ *
+ * If that fails whatever part of the batch reached the file is cut
+ * off again and the batch is forgotten, in memory as on disk.
+ */
+static void
+journal_commit(void)
+{
+        off_t off = -1;
+
+        if (journal_len == 0)
+                return;
+
+        if (journal_fd != -1)
+                off = lseek(journal_fd, 0, SEEK_END);
+
+        if (off == -1 ||
+            !journal_write(journal_fd, journal_buf, journal_len) ||
+            fdatasync(journal_fd) != 0) {
+                LogCrit(COMPONENT_CLIENTID,
+                        "Failed to write v4 recovery journal (%s), errno=%d, "
+                        "%"PRIu64" changes lost",
+                        journal_path, errno, journal_pending);
+                if (off != -1 && ftruncate(journal_fd, off) != 0)
+                        LogCrit(COMPONENT_CLIENTID,
+                                "Failed to truncate v4 recovery journal "
+                                "(%s), errno=%d", journal_path, errno);
+                journal_undo();
+                return;
+        }
+
+        journal_lines += journal_pending;
+        LogFullDebug(COMPONENT_CLIENTID,
+                     "Journaled %"PRIu64" changes, %"PRIu64
+                     " lines for %"PRIu32" clients",
+                     journal_pending, journal_lines,
+                     journal_live.ct_count);
+        journal_len = 0;
+        journal_pending = 0;
+
+        if (journal_lines >
+            2 * (uint64_t) journal_live.ct_count + JOURNAL_COMPACT_SLACK &&
+            journal_rewrite(journal_path, &journal_live)) {
+                LogDebug(COMPONENT_CLIENTID,
+                         "Compacted v4 recovery journal from %"PRIu64
+                         " to %"PRIu32" lines",
+                         journal_lines, journal_live.ct_count);
+                journal_lines = journal_live.ct_count;
+                journal_open();
+        }
+}
+
+static void
+journal_clean_old(void)
+{
+        char old[PATH_MAX + 1];
+
+        snprintf(old, sizeof(old), "%s/%s", v4_old_dir, JOURNAL_NAME);
+        if (unlink(old) != 0 && errno != ENOENT)
+                LogEvent(COMPONENT_CLIENTID,
+                         "Failed to remove %s, errno=%d", old, errno);
+}
+
+struct nfs4_recovery_backend nfs4_recovery_journal = {
+        .name = "journal",
+        .create = journal_create,
+        .load = journal_load,
+        .add_clid = journal_add_clid,
+        .rm_clid = journal_rm_clid,
+        .commit = journal_commit,
+        .clean_old = journal_clean_old
+};
+
+/** @} */
@@ -130,6 +130,7 @@ state_status_t state_add_impl(cache_entry_t *entry,
   struct glist_head    * glist;
   cache_inode_status_t   cache_status;
   bool                   got_pinned = false;
+  bool                   conflict = false;
   state_status_t         status = 0;
 
   if(glist_empty(&entry->state_list))
@@ -163,27 +164,44 @@ state_status_t state_add_impl(cache_entry_t *entry,
       return status;
     }
 
-  /* Browse the state's list */
-  glist_for_each(glist, &entry->state_list)
+  /* The share counters on a file are the union of its share states,
+     so a new open is checked against them rather than against each
+     open in turn.  A delegation conflicts with any state and nothing
+     else conflicts at all, so only other objects need the list. */
+  if(state_type == STATE_TYPE_SHARE && entry->type == REGULAR_FILE)
+    conflict = state_share_check_conflict(entry,
+                                          state_data->share.share_access,
+                                          state_data->share.share_deny)
+               != STATE_SUCCESS;
+  else if(state_type == STATE_TYPE_DELEG)
+    conflict = !glist_empty(&entry->state_list);
+  else if(state_type == STATE_TYPE_SHARE)
+    glist_for_each(glist, &entry->state_list)
+      {
+        piter_state = glist_entry(glist, state_t, state_list);
+
+        if(state_conflict(piter_state, state_type, state_data))
+          {
+            conflict = true;
+            break;
+          }
+      }
+
+  if(conflict)
     {
-      piter_state = glist_entry(glist, state_t, state_list);
-
-      if(state_conflict(piter_state, state_type, state_data))
-        {
-          LogDebug(COMPONENT_STATE,
-                   "new state conflicts with another state for entry %p",
-                   entry);
+      LogDebug(COMPONENT_STATE,
+               "new state conflicts with another state for entry %p",
+               entry);
 
-          /* stat */
-          pool_free(state_v4_pool, pnew_state);
+      /* stat */
+      pool_free(state_v4_pool, pnew_state);
 
-          status = STATE_STATE_CONFLICT;
+      status = STATE_STATE_CONFLICT;
 
-          if(got_pinned)
-            cache_inode_dec_pin_ref(entry, FALSE);
+      if(got_pinned)
+        cache_inode_dec_pin_ref(entry, FALSE);
 
-          return status;
-        }
+      return status;
     }
 
   /* Add the stateid.other, this will increment cid_stateid_counter */
@@ -231,6 +249,7 @@ state_status_t state_add_impl(cache_entry_t *entry,
 
   /* Add state to list for cache entry */
   glist_add_tail(&entry->state_list, &pnew_state->state_list);
+  avltree_insert(&pnew_state->state_node, &entry->state_index);
 
   inc_state_owner_ref(owner_input);
 
@@ -348,6 +367,7 @@ state_status_t state_del_locked(state_t *state,
 
   /* Remove from the list of states for a particular cache entry */
   glist_del(&state->state_list);
+  avltree_remove(&state->state_node, &entry->state_index);
 
   /* Remove from the list of lock states for a particular open state */
   if(state->state_type == STATE_TYPE_LOCK)
@@ -0,0 +1,223 @@
+/* vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @addtogroup SAL
+ * @{
+ */
+
+/**
+ * @file state_index.c
+ * @brief Per-file state index and share counters
+ *
+ * The lookups OPEN and CLOSE make against a file's states.  Nothing
+ * here logs or takes locks, the callers hold the state lock, so
+ * test_state_index links this file on its own.
+ */
+
+#include "config.h"
+#include "sal_functions.h"
+
+/**
+ * @brief Order states in a file's state index
+ *
+ * States sort by type, then owning clientid, then owner, so all the
+ * states of one type and client, or of one owner, are adjacent.  The
+ * state's own address breaks ties.  A key with a NULL owner or state
+ * sorts before every state it would otherwise equal.
+ */
+static inline int state_index_cmpf(const struct avltree_node *lhs,
+                                   const struct avltree_node *rhs)
+{
+  state_t *lk = avltree_container_of(lhs, state_t, state_node);
+  state_t *rk = avltree_container_of(rhs, state_t, state_node);
+  clientid4 lc, rc;
+
+  if(lk->state_type != rk->state_type)
+    return lk->state_type < rk->state_type ? -1 : 1;
+
+  lc = lk->state_owner->so_owner.so_nfs4_owner.so_clientid;
+  rc = rk->state_owner->so_owner.so_nfs4_owner.so_clientid;
+  if(lc != rc)
+    return lc < rc ? -1 : 1;
+
+  if(lk->state_owner != rk->state_owner)
+    return lk->state_owner < rk->state_owner ? -1 : 1;
+
+  if(lhs != rhs)
+    return lhs < rhs ? -1 : 1;
+
+  return 0;
+}
+
+/**
+ * @brief Initialize the state index of a new cache entry
+ *
+ * @param[in,out] entry The entry
+ */
+void state_index_init(cache_entry_t *entry)
+{
+  avltree_init(&entry->state_index, state_index_cmpf, 0);
+}
+
+/**
+ * @brief Find the first state of a type, client and owner on a file
+ *
+ * The state lock must be held.
+ *
+ * @param[in] entry      File to search
+ * @param[in] state_type Type of state wanted
+ * @param[in] clientid   Client owning the state
+ * @param[in] owner      Owner of the state, or NULL for any owner of
+ *                       that client
+ *
+ * @return The state, or NULL if there is none.
+ */
+state_t *state_index_first(cache_entry_t *entry,
+                           state_type_t state_type,
+                           clientid4 clientid,
+                           state_owner_t *owner)
+{
+  struct avltree_node *node = entry->state_index.root;
+  state_t *best = NULL;
+  state_t *iter;
+
+  /* Descend to the leftmost state not before (type, clientid, owner) */
+  while(node)
+    {
+      iter = avltree_container_of(node, state_t, state_node);
+      if(iter->state_type < state_type ||
+         (iter->state_type == state_type &&
+          (iter->state_owner->so_owner.so_nfs4_owner.so_clientid < clientid ||
+           (iter->state_owner->so_owner.so_nfs4_owner.so_clientid == clientid &&
+            owner != NULL && iter->state_owner < owner))))
+        node = node->right;
+      else
+        {
+          best = iter;
+          node = node->left;
+        }
+    }
+
+  if(best == NULL || best->state_type != state_type ||
+     best->state_owner->so_owner.so_nfs4_owner.so_clientid != clientid ||
+     (owner != NULL && best->state_owner != owner))
+    return NULL;
+
+  return best;
+}
+
+/**
+ * @brief Step to the next state of a type, client and owner
+ *
+ * @param[in] state      State from state_index_first or state_index_next
+ * @param[in] state_type As passed to state_index_first
+ * @param[in] clientid   As passed to state_index_first
+ * @param[in] owner      As passed to state_index_first
+ *
+ * @return The next state, or NULL at the end of the run.
+ */
+state_t *state_index_next(state_t *state,
+                          state_type_t state_type,
+                          clientid4 clientid,
+                          state_owner_t *owner)
+{
+  struct avltree_node *node = avltree_next(&state->state_node);
+  state_t *next;
+
+  if(node == NULL)
+    return NULL;
+
+  next = avltree_container_of(node, state_t, state_node);
+  if(next->state_type != state_type ||
+     next->state_owner->so_owner.so_nfs4_owner.so_clientid != clientid ||
+     (owner != NULL && next->state_owner != owner))
+    return NULL;
+
+  return next;
+}
+
+/**
+ * @brief Apply a share change to the file's share counters
+ *
+ * The state lock must be held.
+ *
+ * @param[in,out] entry      File to update
+ * @param[in]     old_access Previous access mode
+ * @param[in]     old_deny   Previous deny mode
+ * @param[in]     new_access Current access mode
+ * @param[in]     new_deny   Current deny mode
+ * @param[in]     v4         True if this is a v4 share/open
+ */
+void state_share_count(cache_entry_t *entry,
+                       int old_access,
+                       int old_deny,
+                       int new_access,
+                       int new_deny,
+                       bool v4)
+{
+  int access_read_inc  = ((new_access & OPEN4_SHARE_ACCESS_READ) != 0) - ((old_access & OPEN4_SHARE_ACCESS_READ) != 0);
+  int access_write_inc = ((new_access & OPEN4_SHARE_ACCESS_WRITE) != 0) - ((old_access & OPEN4_SHARE_ACCESS_WRITE) != 0);
+  int deny_read_inc    = ((new_deny   & OPEN4_SHARE_ACCESS_READ) != 0) - ((old_deny   & OPEN4_SHARE_ACCESS_READ) != 0);
+  int deny_write_inc   = ((new_deny   & OPEN4_SHARE_ACCESS_WRITE) != 0) - ((old_deny   & OPEN4_SHARE_ACCESS_WRITE) != 0);
+
+  entry->object.file.share_state.share_access_read  += access_read_inc;
+  entry->object.file.share_state.share_access_write += access_write_inc;
+  entry->object.file.share_state.share_deny_read    += deny_read_inc;
+  entry->object.file.share_state.share_deny_write   += deny_write_inc;
+  if(v4)
+    entry->object.file.share_state.share_deny_write_v4 += deny_write_inc;
+}
+
+/**
+ * @brief Check a share against the file's share counters
+ *
+ * The state lock must be held.
+ *
+ * @param[in] entry        File to query
+ * @param[in] share_access Desired access mode
+ * @param[in] share_deny   Desired deny mode
+ *
+ * @return NULL if the share can be granted, else why not.
+ */
+const char *state_share_conflict(cache_entry_t *entry,
+                                 int share_access,
+                                 int share_deny)
+{
+  if((share_access & OPEN4_SHARE_ACCESS_READ) != 0 &&
+     entry->object.file.share_state.share_deny_read > 0)
+    return "access read denied by existing deny read";
+
+  if((share_access & OPEN4_SHARE_ACCESS_WRITE) != 0 &&
+     entry->object.file.share_state.share_deny_write > 0)
+    return "access write denied by existing deny write";
+
+  if((share_deny & OPEN4_SHARE_DENY_READ) != 0 &&
+     entry->object.file.share_state.share_access_read > 0)
+    return "deny read denied by existing access read";
+
+  if((share_deny & OPEN4_SHARE_DENY_WRITE) != 0 &&
+     entry->object.file.share_state.share_access_write > 0)
+    return "deny write denied by existing access write";
+
+  return NULL;
+}
+
+/** @} */
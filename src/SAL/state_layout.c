@@ -159,18 +159,19 @@ state_lookup_layout_state(cache_entry_t *entry,
                           layouttype4 type,
                           state_t **state)
 {
-     /* Pointer for iterating over the list of states on the file */
-     struct glist_head * glist_iter = NULL;
      /* The state under inspection in the loop */
      state_t *state_iter = NULL;
      /* The state found, if one exists */
      state_t *state_found = NULL;
-
-     glist_for_each(glist_iter, &entry->state_list) {
-          state_iter = glist_entry(glist_iter, state_t, state_list);
-          if ((state_iter->state_type == STATE_TYPE_LAYOUT) &&
-              (state_iter->state_owner == owner) &&
-              (state_iter->state_data.layout.state_layout_type == type)) {
+     /* The client owning the layouts */
+     clientid4 clientid = owner->so_owner.so_nfs4_owner.so_clientid;
+
+     for (state_iter = state_index_first(entry, STATE_TYPE_LAYOUT,
+                                         clientid, owner);
+          state_iter != NULL;
+          state_iter = state_index_next(state_iter, STATE_TYPE_LAYOUT,
+                                        clientid, owner)) {
+          if (state_iter->state_data.layout.state_layout_type == type) {
                state_found = state_iter;
                break;
           }
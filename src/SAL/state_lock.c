@@ -50,6 +50,7 @@
 #include "sal_functions.h"
 #include "nlm_util.h"
 #include "cache_inode_lru.h"
+#include "pool_slab.h"
 /* Forward declaration */
 state_status_t do_lock_op(cache_entry_t *entry,
                           exportlist_t *export,
@@ -101,6 +102,11 @@ static struct glist_head state_all_locks;
 pthread_mutex_t all_locks_mutex = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
+/**
+ * @brief Pool for lock entries
+ */
+static pool_t *state_lock_entry_pool;
+
 /**
  * @brief All locks blocked in FSAL
  */
@@ -167,13 +173,18 @@ state_status_t state_lock_init(hash_parameter_t cookie_param)
 
   state_owner_pool = pool_init("NFSv4 state owners",
                                sizeof(state_owner_t),
-                               pool_basic_substrate,
+                               pool_slab_substrate,
                                NULL, NULL, NULL);
 
   state_v4_pool = pool_init("NFSv4 files states",
                             sizeof(state_t),
-                            pool_basic_substrate,
+                            pool_slab_substrate,
                             NULL, NULL, NULL);
+
+  state_lock_entry_pool = pool_init("Lock entries",
+                                    sizeof(state_lock_entry_t),
+                                    pool_slab_substrate,
+                                    NULL, NULL, NULL);
   return status;
 }
 
@@ -544,18 +555,16 @@ static state_lock_entry_t *create_state_lock_entry(cache_entry_t *entry,
 {
   state_lock_entry_t *new_entry;
 
-  new_entry = gsh_malloc(sizeof(*new_entry));
+  new_entry = pool_alloc(state_lock_entry_pool, NULL);
   if(!new_entry)
       return NULL;
 
   LogFullDebug(COMPONENT_STATE,
                "new_entry = %p owner %p", new_entry, owner);
 
-  memset(new_entry, 0, sizeof(*new_entry));
-
   if(pthread_mutex_init(&new_entry->sle_mutex, NULL) == -1)
     {
-      gsh_free(new_entry);
+      pool_free(state_lock_entry_pool, new_entry);
       return NULL;
     }
 
@@ -689,7 +698,8 @@ void lock_entry_dec_ref(state_lock_entry_t *lock_entry)
       V(all_locks_mutex);
 #endif
 
-      gsh_free(lock_entry);
+      pthread_mutex_destroy(&lock_entry->sle_mutex);
+      pool_free(state_lock_entry_pool, lock_entry);
     }
 }
 
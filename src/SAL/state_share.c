@@ -514,39 +514,10 @@ state_status_t state_share_check_conflict(cache_entry_t *entry,
 					  int share_access,
 					  int share_deny)
 {
-  char *cause = "";
+  const char *cause = state_share_conflict(entry, share_access, share_deny);
 
-  if((share_access & OPEN4_SHARE_ACCESS_READ) != 0 &&
-     entry->object.file.share_state.share_deny_read > 0)
-    {
-      cause = "access read denied by existing deny read";
-      goto out_conflict;
-    }
-
-  if((share_access & OPEN4_SHARE_ACCESS_WRITE) != 0 &&
-     entry->object.file.share_state.share_deny_write > 0)
-    {
-      cause = "access write denied by existing deny write";
-      goto out_conflict;
-    }
-
-  if((share_deny & OPEN4_SHARE_DENY_READ) != 0 &&
-     entry->object.file.share_state.share_access_read > 0)
-    {
-      cause = "deny read denied by existing access read";
-      goto out_conflict;
-    }
-
-  if((share_deny & OPEN4_SHARE_DENY_WRITE) != 0 &&
-     entry->object.file.share_state.share_access_write > 0)
-    {
-      cause = "deny write denied by existing access write";
-      goto out_conflict;
-    }
-
-  return STATE_SUCCESS;
-
-out_conflict:
+  if(cause == NULL)
+    return STATE_SUCCESS;
 
   LogDebug(COMPONENT_STATE, "Share conflict detected: %s", cause);
   return STATE_STATE_CONFLICT;
@@ -571,17 +542,7 @@ static void state_share_update_counter(cache_entry_t *entry,
                                        int new_deny,
                                        bool v4)
 {
-  int access_read_inc  = ((new_access & OPEN4_SHARE_ACCESS_READ) != 0) - ((old_access & OPEN4_SHARE_ACCESS_READ) != 0);
-  int access_write_inc = ((new_access & OPEN4_SHARE_ACCESS_WRITE) != 0) - ((old_access & OPEN4_SHARE_ACCESS_WRITE) != 0);
-  int deny_read_inc    = ((new_deny   & OPEN4_SHARE_ACCESS_READ) != 0) - ((old_deny   & OPEN4_SHARE_ACCESS_READ) != 0);
-  int deny_write_inc   = ((new_deny   & OPEN4_SHARE_ACCESS_WRITE) != 0) - ((old_deny   & OPEN4_SHARE_ACCESS_WRITE) != 0);
-
-  entry->object.file.share_state.share_access_read  += access_read_inc;
-  entry->object.file.share_state.share_access_write += access_write_inc;
-  entry->object.file.share_state.share_deny_read    += deny_read_inc;
-  entry->object.file.share_state.share_deny_write   += deny_write_inc;
-  if(v4)
-    entry->object.file.share_state.share_deny_write_v4 += deny_write_inc;
+  state_share_count(entry, old_access, old_deny, new_access, new_deny, v4);
 
   LogFullDebug(COMPONENT_STATE, "entry %p: share counter: "
                "access_read %u, access_write %u, "
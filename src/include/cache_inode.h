@@ -54,6 +54,7 @@
 #include "nlm4.h"
 #include "nlm_list.h"
 #include "nfs4_acls.h"
+#include "abstract_atomic.h"
 
 /* Forward references */
 typedef struct cache_entry_t cache_entry_t;
@@ -98,6 +99,7 @@ typedef struct cache_inode_lru__ {
 			   we can lock the deque and decrement the correct
 			   counter when moving or deleting the entry. */
 	uint32_t cf; /*< Confounder */
+	uint32_t admitted; /*< When the entry last entered L1, in seconds */
 } cache_inode_lru_t;
 
 /**
@@ -107,7 +109,9 @@ typedef struct cache_inode_lru__ {
 
 typedef enum io_direction__ {
 	CACHE_INODE_READ = 1, /*< Reading */
-	CACHE_INODE_WRITE = 2 /*< Writing */
+	CACHE_INODE_WRITE = 2, /*< Writing */
+	CACHE_INODE_READ_FD = 3 /*< Reading, buffer receives a descriptor to
+				    send the data from (see read_fd) */
 } cache_inode_io_direction_t;
 
 /**
@@ -124,9 +128,45 @@ typedef enum cache_inode_dirent_op__ {
 typedef enum cache_inode_avl_which__ {
 	CACHE_INODE_AVL_NAMES = 1,
 	CACHE_INODE_AVL_COOKIES = 2,
-	CACHE_INODE_AVL_BOTH = 3
+	CACHE_INODE_AVL_BOTH = 3, /*< Names and cookies, and negatives */
+	CACHE_INODE_AVL_NEGATIVE = 4
 } cache_inode_avl_which_t;
 
+/**
+ * @brief What the memory charged to an entry is spent on
+ *
+ * There is no category for extended attributes: the cache keeps
+ * none.  Xattr names and values are fetched from the FSAL into
+ * buffers that live only as long as the request (nfs_xattr.c,
+ * nfs4_xattr.c, 9p_xattrwalk.c), so they never count against
+ * Cache_Memory_Budget.
+ *
+ * ACLs are shared between the entries whose ACEs are the same, so
+ * they are not charged to an entry.  nfs4_acls.c counts each ACL
+ * once for as long as it is referenced, and the ACL category reads
+ * that count, see cache_inode_mem_bytes().
+ */
+
+typedef enum cache_inode_mem_cat__ {
+	CACHE_INODE_MEM_ENTRY = 0, /*< cache_entry_t and its key */
+	CACHE_INODE_MEM_HANDLE = 1, /*< FSAL object handle (estimated) */
+	CACHE_INODE_MEM_DIRENT = 2, /*< Cached and negative dirents */
+	CACHE_INODE_MEM_ACL = 3, /*< Deduplicated ACLs, not per entry */
+	CACHE_INODE_MEM_ATTR_BLOB = 4, /*< Encoded attributes */
+	CACHE_INODE_MEM_CATS = 5
+} cache_inode_mem_cat_t;
+
+/**
+ * @brief Approximate bytes held by the inode cache
+ */
+
+struct cache_inode_mem_usage {
+	uint64_t bytes[CACHE_INODE_MEM_CATS];
+};
+
+extern struct cache_inode_mem_usage cache_inode_mem_usage;
+extern const char *cache_inode_mem_cat_names[CACHE_INODE_MEM_CATS];
+
 /* Flags set on cache_entry_t::flags*/
 
 /** Trust stored attributes */
@@ -155,6 +195,95 @@ typedef struct cache_inode_share__ {
 	unsigned int share_deny_write_v4; /**< Count of v4 share deny write */
 } cache_inode_share_t;
 
+/**
+ * @brief Number of read streams tracked per file
+ *
+ * Several clients, or several processes on one client, may stream
+ * through the same file at once; each gets its own slot.
+ */
+#define CACHE_INODE_RA_STREAMS 4
+
+/**
+ * @brief One sequential or strided read stream on a file
+ */
+struct cache_inode_ra_stream {
+	uint64_t last; /*< Offset of the last read in the stream */
+	uint64_t ra_end; /*< Read ahead up to here */
+	uint32_t len; /*< Length of the last read */
+	uint32_t stride; /*< Distance between reads, 0 if sequential */
+	uint32_t window; /*< Bytes to keep read ahead */
+	uint32_t hits; /*< Reads that continued the stream */
+	uint32_t used; /*< Clock of the last read, for replacement */
+};
+
+/**
+ * @brief Readahead state of a regular file
+ */
+struct cache_inode_readahead {
+	pthread_spinlock_t lock; /*< Protects the rest, readers run in
+				     parallel under the content lock */
+	uint32_t clock; /*< Reads seen on the file */
+	struct cache_inode_ra_stream s[CACHE_INODE_RA_STREAMS];
+};
+
+/**
+ * @brief Counters for readahead
+ */
+struct cache_inode_ra_stats {
+	uint64_t streams; /*< Streams detected */
+	uint64_t prefetches; /*< Prefetch calls to the FSAL */
+	uint64_t prefetch_bytes; /*< Bytes asked for */
+	uint64_t reads; /*< Reads on detected streams */
+	uint64_t hits; /*< Of which already read ahead */
+};
+
+extern struct cache_inode_ra_stats cache_inode_ra_stats;
+
+/** Encoded attribute blobs kept per entry */
+#define CACHE_INODE_ATTR_BLOBS 2
+
+/** Words in the key and mask of an attribute blob */
+#define CACHE_INODE_ATTR_BLOB_WORDS 6
+
+/** Largest encoding worth keeping */
+#define CACHE_INODE_ATTR_BLOB_MAX 1024
+
+/**
+ * @brief Attributes as a protocol encoded them, kept for reuse
+ *
+ * Cache_inode does not know the encoding.  It only knows that the
+ * blob answers the request described by key for as long as the
+ * attr_gen of the entry has not moved.
+ */
+struct cache_inode_attr_blob {
+	uint64_t gen; /*< attr_gen the blob was encoded from */
+	uint32_t key[CACHE_INODE_ATTR_BLOB_WORDS]; /*< What was asked for */
+	uint32_t mask[CACHE_INODE_ATTR_BLOB_WORDS]; /*< What was encoded */
+	uint32_t len; /*< Bytes in buf */
+	char *buf; /*< The encoding, NULL if the slot is free */
+};
+
+/**
+ * @brief Encoded attribute blobs of an entry
+ */
+struct cache_inode_attr_blobs {
+	pthread_spinlock_t lock; /*< Protects the rest, readers run in
+				     parallel under the attribute lock */
+	uint32_t next; /*< Slot to replace when none is stale */
+	struct cache_inode_attr_blob b[CACHE_INODE_ATTR_BLOBS];
+};
+
+/**
+ * @brief Counters for encoded attribute blobs
+ */
+struct cache_inode_attr_blob_stats {
+	uint64_t hits; /*< Requests answered from a blob */
+	uint64_t misses; /*< Cacheable requests that were encoded */
+	uint64_t stores; /*< Blobs stored */
+};
+
+extern struct cache_inode_attr_blob_stats cache_inode_attr_blob_stats;
+
 
 /**
  * @brief Structure representing a cache key.
@@ -220,6 +349,7 @@ cache_inode_key_delete(cache_inode_key_t *key)
 
 #define DIR_ENTRY_FLAG_NONE     0x0000
 #define DIR_ENTRY_FLAG_DELETED  0x0001
+#define DIR_ENTRY_FLAG_NEGATIVE 0x0002
 
 typedef struct cache_inode_dir_entry__ {
 	struct avltree_node node_hk; /*< AVL node in tree */
@@ -229,6 +359,7 @@ typedef struct cache_inode_dir_entry__ {
 	} hk;
 	cache_inode_key_t ckey; /*< Key of cache entry */
 	uint32_t flags; /*< Flags */
+	time_t neg_expire; /*< Negative dirents: when to stop trusting */
 	char name[]; /*< The NUL-terminated filename */
 } cache_inode_dir_entry_t;
 
@@ -249,6 +380,20 @@ cache_inode_free_dirent(cache_inode_dir_entry_t *dirent)
 	gsh_free(dirent);
 }
 
+/**
+ * @brief Approximate memory used by a dirent
+ *
+ * @param[in] dirent The dirent
+ *
+ * @return Bytes to charge to CACHE_INODE_MEM_DIRENT.
+ */
+static inline size_t
+cache_inode_dirent_footprint(const cache_inode_dir_entry_t *dirent)
+{
+	return sizeof(cache_inode_dir_entry_t) + strlen(dirent->name) + 1 +
+		dirent->ckey.kv.len;
+}
+
 /**
  * @brief Represents a cached inode
  *
@@ -329,8 +474,18 @@ struct cache_entry_t {
 	time_t change_time;
 	/** Time at which we last refreshed attributes. */
 	time_t attr_time;
+	/** Bumped, under the write lock on the attributes, every time
+	    they change.  Encoded attribute blobs are good while it
+	    stays put. */
+	uint64_t attr_gen;
+	/** Encoded attribute blobs */
+	struct cache_inode_attr_blobs attr_blobs;
 	/** New style LRU link */
 	cache_inode_lru_t lru;
+	/** Bytes charged to cache_inode_mem_usage on behalf of this
+	    entry.  Each category is only changed under the lock that
+	    protects what it measures. */
+	size_t mem_charged[CACHE_INODE_MEM_CATS];
 	/** This is separated out from the content lock, since there
 	    are state oerations that don't affect anything guarded by
 	    content (for example, a layout return or request has no
@@ -340,6 +495,8 @@ struct cache_entry_t {
 	pthread_rwlock_t state_lock;
 	/** States on this cache entry */
 	struct glist_head state_list;
+	/** The same states, ordered by type, clientid and owner */
+	struct avltree state_index;
 	/** Layout recalls on this entry */
 	struct glist_head layoutrecall_list;
 	/** Lock on type-specific cached content.  See locking
@@ -350,6 +507,8 @@ struct cache_entry_t {
 	    attributes.rawdev */
 	union cache_inode_fsobj {
 		struct cache_inode_file {
+			/** Read streams seen on this file */
+			struct cache_inode_readahead ra;
 			/** Pointers for lock list */
 			struct glist_head lock_list;
 			/** Pointers for NLM share list */
@@ -361,6 +520,13 @@ struct cache_entry_t {
 		struct {
 			/** Number of known active children */
 			uint32_t nbactive;
+			/** Bumped whenever a cached dirent may have gone
+			    stale: on remove, rename and invalidation,
+			    not when a dirent is added */
+			uint32_t gen;
+			/** Bumped whenever a dirent is added; a negative
+			    answer from before an add is not cached */
+			uint32_t add_gen;
 			/** The parent of this directory ('..') */
 			cache_inode_key_t parent;
 			struct {
@@ -368,6 +534,10 @@ struct cache_entry_t {
 				struct avltree t;
 				/** Persist cookies */
 				struct avltree c;
+				/** Names known not to exist */
+				struct avltree neg;
+				/** Number of negative dirents */
+				uint32_t nneg;
 				/** Heuristic. Expect 0. */
 				uint32_t collisions;
 			} avl;
@@ -578,6 +748,20 @@ cache_inode_status_t cache_inode_getattr(cache_entry_t *entry,
 					 void *opaque,
 					 cache_inode_getattr_cb_t cb);
 
+void cache_inode_attr_blobs_init(cache_entry_t *entry);
+void cache_inode_attr_blobs_release(cache_entry_t *entry);
+bool cache_inode_attr_blob_get(cache_entry_t *entry,
+			       const uint32_t *key,
+			       uint32_t *mask,
+			       char *buf,
+			       size_t buflen,
+			       size_t *len);
+void cache_inode_attr_blob_put(cache_entry_t *entry,
+			       const uint32_t *key,
+			       const uint32_t *mask,
+			       const char *buf,
+			       size_t len);
+
 cache_inode_status_t cache_inode_fileid(cache_entry_t *entry,
 					const struct req_op_context *req_ctx,
 					uint64_t *fileid);
@@ -599,6 +783,7 @@ bool cache_inode_create_verify(cache_entry_t *entry,
 			       uint32_t verf_hi,
 			       uint32_t verf_lo);
 
+void cache_inode_lookup_pkginit(void);
 cache_inode_status_t cache_inode_lookup_impl(cache_entry_t *entry_parent,
 					     const char *name,
 					     struct req_op_context *req_ctx,
@@ -672,6 +857,7 @@ cache_inode_status_t cache_inode_rdwr(cache_entry_t *entry,
 				      bool *eof,
 				      struct req_op_context *req_ctx,
 				      bool *sync);
+void cache_inode_readahead_init(cache_entry_t *entry);
 
 cache_inode_status_t cache_inode_commit(cache_entry_t *entry,
 					uint64_t offset,
@@ -735,6 +921,84 @@ int display_not_implemented(struct gsh_buffdesc *buff,
 			    char *str);
 int display_value(struct gsh_buffdesc *buff, char *str);
 void cache_inode_destroyer(void);
+int cache_inode_snapshot_write(void);
+int cache_inode_snapshot_pkginit(void);
+int cache_inode_snapshot_pkgshutdown(void);
+
+/**
+ * @brief Charge memory to the inode cache
+ *
+ * @param[in,out] entry The entry the memory belongs to
+ * @param[in]     cat   What it is used for
+ * @param[in]     bytes Approximate size
+ */
+
+static inline void cache_inode_mem_charge(cache_entry_t *entry,
+					  cache_inode_mem_cat_t cat,
+					  size_t bytes)
+{
+	entry->mem_charged[cat] += bytes;
+	(void) atomic_add_uint64_t(&cache_inode_mem_usage.bytes[cat], bytes);
+}
+
+/**
+ * @brief Give back memory charged with cache_inode_mem_charge()
+ *
+ * @param[in,out] entry The entry the memory belonged to
+ * @param[in]     cat   What it was used for
+ * @param[in]     bytes Size that was charged
+ */
+
+static inline void cache_inode_mem_discharge(cache_entry_t *entry,
+					     cache_inode_mem_cat_t cat,
+					     size_t bytes)
+{
+	entry->mem_charged[cat] -= bytes;
+	(void) atomic_sub_uint64_t(&cache_inode_mem_usage.bytes[cat], bytes);
+}
+
+/**
+ * @brief Memory charged to the inode cache for one use
+ *
+ * @param[in] cat What it is used for
+ *
+ * @return Bytes.
+ */
+
+static inline uint64_t cache_inode_mem_bytes(cache_inode_mem_cat_t cat)
+{
+	if (cat == CACHE_INODE_MEM_ACL)
+		return nfs4_acl_mem_usage();
+	return atomic_fetch_uint64_t(&cache_inode_mem_usage.bytes[cat]);
+}
+
+/**
+ * @brief Total memory charged to the inode cache
+ *
+ * @return Bytes.
+ */
+
+static inline uint64_t cache_inode_mem_total(void)
+{
+	uint64_t total = 0;
+	int cat;
+
+	for (cat = 0; cat < CACHE_INODE_MEM_CATS; cat++)
+		total += cache_inode_mem_bytes(cat);
+	return total;
+}
+
+/**
+ * @brief Is the inode cache over Cache_Memory_Budget?
+ *
+ * @return true if a budget is set and exceeded.
+ */
+
+static inline bool cache_inode_mem_over_budget(void)
+{
+	return (nfs_param.cache_param.mem_budget != 0) &&
+		(cache_inode_mem_total() > nfs_param.cache_param.mem_budget);
+}
 
 /**
  * @brief Update cache_entry metadata from its attributes
@@ -762,6 +1026,9 @@ static inline void cache_inode_fixup_md(cache_entry_t *entry)
 	entry->change_time =
             timespec_to_nsecs(&entry->obj_handle->attributes.chgtime);
 
+	/* Any encoding of the old attributes is stale */
+	entry->attr_gen++;
+
 	/* Almost certainly not necessary */
 	entry->type = entry->obj_handle->attributes.type;
 	/* We have just loaded the attributes from the FSAL. */
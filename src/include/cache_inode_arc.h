@@ -0,0 +1,207 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * -------------
+ */
+
+/**
+ * @addtogroup Cache_inode
+ * @{
+ */
+
+/**
+ * @file cache_inode_arc.h
+ * @brief Adaptive replacement bookkeeping for the inode LRU
+ *
+ * The LRU keeps ARC's two resident lists as the L1 (seen once,
+ * recency) and L2 (seen again, frequency) queues of every lane.  This
+ * file holds the rest of ARC: the ghost lists B1 and B2 of keys
+ * recently evicted from L1 and L2, and the target size p of L1.
+ *
+ * The ghost lists are approximated by one direct-mapped table of key
+ * hashes, each tagged with the list it was evicted from.  A newer
+ * eviction simply overwrites an older one in the same slot.  This
+ * costs eight bytes per remembered key and needs no locking.
+ *
+ * A hit in B1 means L1 was too small, so p grows.  A hit in B2 means
+ * L2 was too small, so p shrinks.  The reaper takes its victim from L1
+ * while L1 holds more than p entries, otherwise from L2.  A one-pass
+ * scan only ever fills L1 and B1, so it cannot push out the frequently
+ * used entries in L2.
+ *
+ * Nothing here knows about cache entries, so the replay benchmark in
+ * test/ drives the same code.
+ */
+
+#ifndef CACHE_INODE_ARC_H
+#define CACHE_INODE_ARC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include "abstract_atomic.h"
+#include "abstract_mem.h"
+
+/**
+ * @brief Ghost list an evicted key is remembered on
+ */
+
+enum lru_arc_ghost {
+	LRU_ARC_B1 = 0, /*< Evicted from L1 */
+	LRU_ARC_B2 = 1, /*< Evicted from L2 */
+	LRU_ARC_MISS = 2 /*< Not remembered */
+};
+
+struct lru_arc {
+	uint64_t *ghost; /*< Tagged key hashes, 0 is empty */
+	uint64_t mask; /*< Number of slots - 1 */
+	uint64_t c; /*< Cache size the targets are relative to */
+	uint64_t p; /*< Target size of L1 */
+	uint64_t nghost[2]; /*< Approximate sizes of B1 and B2 */
+	uint64_t hits[2]; /*< Ghost hits, for statistics */
+};
+
+/**
+ * @brief Set up ARC state for a cache of c entries
+ *
+ * The ghost table gets at least 2c slots, as ARC remembers up to c
+ * evicted keys on top of the c resident ones.
+ *
+ * @param[out] arc The state
+ * @param[in]  c   Cache size in entries
+ *
+ * @return 0 or ENOMEM.
+ */
+
+static inline int lru_arc_init(struct lru_arc *arc, uint64_t c)
+{
+	uint64_t nslots = 1024;
+
+	memset(arc, 0, sizeof(*arc));
+	while (nslots < 2 * c)
+		nslots <<= 1;
+	arc->ghost = gsh_calloc(nslots, sizeof(uint64_t));
+	if (arc->ghost == NULL)
+		return ENOMEM;
+	arc->mask = nslots - 1;
+	arc->c = c;
+	return 0;
+}
+
+static inline void lru_arc_destroy(struct lru_arc *arc)
+{
+	gsh_free(arc->ghost);
+	arc->ghost = NULL;
+}
+
+static inline uint64_t lru_arc_tag(uint64_t hk, enum lru_arc_ghost which)
+{
+	hk &= ~(uint64_t) 1;
+	if (hk == 0)
+		hk = 2;
+	return hk | which;
+}
+
+static inline uint64_t *lru_arc_slot(struct lru_arc *arc, uint64_t hk)
+{
+	/* hk is already a hash; fold the high half in for small tables */
+	return &arc->ghost[((hk >> 1) ^ (hk >> 33)) & arc->mask];
+}
+
+/**
+ * @brief Remember an evicted key
+ *
+ * @param[in,out] arc   The state
+ * @param[in]     hk    Hash of the key evicted
+ * @param[in]     which LRU_ARC_B1 if it left L1, LRU_ARC_B2 if L2
+ */
+
+static inline void lru_arc_remember(struct lru_arc *arc, uint64_t hk,
+				    enum lru_arc_ghost which)
+{
+	uint64_t *slot = lru_arc_slot(arc, hk);
+	uint64_t old = atomic_fetch_uint64_t(slot);
+
+	atomic_store_uint64_t(slot, lru_arc_tag(hk, which));
+	if (old != 0)
+		atomic_dec_uint64_t(&arc->nghost[old & 1]);
+	atomic_inc_uint64_t(&arc->nghost[which]);
+}
+
+/**
+ * @brief Check a key coming into the cache against the ghost lists
+ *
+ * On a ghost hit the key is forgotten and p adapts as in ARC.
+ *
+ * @param[in,out] arc The state
+ * @param[in]     hk  Hash of the key being admitted
+ *
+ * @return The ghost list hit, or LRU_ARC_MISS.
+ */
+
+static inline enum lru_arc_ghost lru_arc_admit(struct lru_arc *arc,
+					       uint64_t hk)
+{
+	uint64_t *slot = lru_arc_slot(arc, hk);
+	uint64_t v = atomic_fetch_uint64_t(slot);
+	uint64_t b1, b2, p, delta;
+	enum lru_arc_ghost which;
+
+	if (v == 0 || (v & ~(uint64_t) 1) != (lru_arc_tag(hk, 0)))
+		return LRU_ARC_MISS;
+
+	which = v & 1;
+	atomic_store_uint64_t(slot, 0);
+	atomic_inc_uint64_t(&arc->hits[which]);
+
+	b1 = atomic_fetch_uint64_t(&arc->nghost[LRU_ARC_B1]);
+	b2 = atomic_fetch_uint64_t(&arc->nghost[LRU_ARC_B2]);
+	atomic_dec_uint64_t(&arc->nghost[which]);
+	p = atomic_fetch_uint64_t(&arc->p);
+
+	if (which == LRU_ARC_B1) {
+		delta = (b1 != 0 && b2 > b1) ? b2 / b1 : 1;
+		p = (p + delta > arc->c) ? arc->c : p + delta;
+	} else {
+		delta = (b2 != 0 && b1 > b2) ? b1 / b2 : 1;
+		p = (p > delta) ? p - delta : 0;
+	}
+	atomic_store_uint64_t(&arc->p, p);
+
+	return which;
+}
+
+/**
+ * @brief Should the next victim come from L1?
+ *
+ * @param[in] arc     The state
+ * @param[in] l1_size Number of entries currently in L1
+ *
+ * @return true to reap L1 first, false to reap L2 first.
+ */
+
+static inline bool lru_arc_reap_l1(struct lru_arc *arc, uint64_t l1_size)
+{
+	return l1_size > atomic_fetch_uint64_t(&arc->p);
+}
+
+#endif /* CACHE_INODE_ARC_H */
+/** @} */
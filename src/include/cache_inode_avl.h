@@ -92,6 +92,22 @@ cache_inode_dir_entry_t *cache_inode_avl_qp_lookup_s(
 	const char *name,
 	int maxj);
 
+/**
+ * @brief Counters for negative dirents
+ */
+
+struct cache_inode_neg_stats {
+	uint64_t hits; /*< Lookups answered ENOENT from a negative dirent */
+	uint64_t misses; /*< ENOENT lookups that had to ask the FSAL */
+	uint64_t inserts; /*< Negative dirents created */
+};
+
+extern struct cache_inode_neg_stats neg_dirent_stats;
+
+bool cache_inode_avl_neg_lookup(cache_entry_t *entry, const char *name);
+void cache_inode_avl_neg_insert(cache_entry_t *entry, const char *name);
+void cache_inode_avl_neg_remove(cache_entry_t *entry, const char *name);
+
 static inline void cache_inode_avl_remove(cache_entry_t *entry,
 					  cache_inode_dir_entry_t *v)
 {
@@ -194,6 +194,19 @@ cih_fhcache_inline_lookup(
 #define CIH_HASH_NONE           0x0000
 #define CIH_HASH_KEY_PROTOTYPE  0x0001
 
+/**
+ * @brief Compute the hash of a cache key from its bytes
+ *
+ * @param key [in,out] Key, kv set, hk is computed
+ *
+ * @return (void)
+ */
+static inline void
+cih_hash_key(cache_inode_key_t *key)
+{
+	key->hk = CityHash64WithSeed(key->kv.addr, key->kv.len, 557);
+}
+
 /**
  * @brief Convenience function to compute hash for cache_entry_t
  *
@@ -220,8 +233,7 @@ cih_hash_entry(cache_entry_t *entry, const struct gsh_buffdesc *fh_desc,
 	}
 
 	/* hash it */
-	entry->fh_hk.key.hk =
-		CityHash64WithSeed(fh_desc->addr, fh_desc->len, 557);
+	cih_hash_key(&entry->fh_hk.key);
 }
 
 #define CIH_GET_NONE           0x0000
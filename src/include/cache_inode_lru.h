@@ -132,6 +132,14 @@ extern int cache_inode_lru_pkgshutdown(void);
 extern size_t open_fd_count;
 
 cache_inode_status_t cache_inode_lru_get(struct cache_entry_t **entry);
+void cache_inode_lru_admit(cache_entry_t *entry);
+void cache_inode_lru_walk_hot(uint32_t max_per_lane,
+                              bool (*visit)(cache_entry_t *entry,
+                                            enum lru_q_id qid,
+                                            uint32_t rank,
+                                            void *arg),
+                              void *arg);
+void cache_inode_lru_restore(cache_entry_t *entry, enum lru_q_id qid);
 void cache_inode_lru_ref(cache_entry_t *entry, uint32_t flags);
 
 /* XXX */
@@ -39,6 +39,8 @@
 #ifndef CLIENT_MGR_H
 #define CLIENT_MGR_H
 
+#include "nfs_qos.h"
+
 struct gsh_client {
 	struct avltree_node node_k;
 	pthread_mutex_t lock;
@@ -46,6 +48,7 @@ struct gsh_client {
 	int64_t refcnt;
 	nsecs_elapsed_t last_update;
 	char hostaddr_str[SOCK_NAME_MAX];
+	struct nfs_qos qos; /*< Rate limits, see QoS_Client_Ops_Per_Sec */
 	unsigned char addrbuf[];
 };
 
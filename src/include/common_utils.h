@@ -15,6 +15,7 @@
 #include <string.h>
 #include "ganesha_types.h"
 #include "log.h"
+#include "lock_profile.h"
 
 /**
  * BUILD_BUG_ON - break compile if a condition is true.
@@ -152,8 +153,8 @@ extern int portable_clock_gettime(struct timespec *ts);
 #endif
 
 /* My habit with mutex */
-#define P( _mutex_ ) pthread_mutex_lock( &_mutex_ )
-#define V( _mutex_ ) pthread_mutex_unlock( &_mutex_ )
+#define P( _mutex_ ) PROF_MUTEX_lock( &_mutex_ )
+#define V( _mutex_ ) PROF_MUTEX_unlock( &_mutex_ )
 
 /**
  * @brief Logging write-lock
@@ -165,7 +166,7 @@ extern int portable_clock_gettime(struct timespec *ts);
 	do {								\
 		int rc;							\
 									\
-		rc = pthread_rwlock_wrlock(_lock);			\
+		rc = PROF_RWLOCK_wrlock(_lock);			\
 		if (rc == 0) {						\
 			LogFullDebug(COMPONENT_RW_LOCK,			\
 				     "Got write lock on %p (%s) "	\
@@ -189,7 +190,7 @@ extern int portable_clock_gettime(struct timespec *ts);
 	do {								\
 		int rc;							\
 									\
-		rc = pthread_rwlock_rdlock(_lock);			\
+		rc = PROF_RWLOCK_rdlock(_lock);			\
 		if (rc == 0) {						\
 			LogFullDebug(COMPONENT_RW_LOCK,			\
 				     "Got read lock on %p (%s) "	\
@@ -213,7 +214,7 @@ extern int portable_clock_gettime(struct timespec *ts);
 	do {								\
 		int rc;							\
 									\
-		rc = pthread_rwlock_unlock(_lock);			\
+		rc = PROF_RWLOCK_unlock(_lock);			\
 		if (rc == 0) {						\
 			LogFullDebug(COMPONENT_RW_LOCK,			\
 				     "Unlocked %p (%s) at %s:%d",       \
@@ -237,7 +238,7 @@ extern int portable_clock_gettime(struct timespec *ts);
 	do {								\
 		int rc;							\
 									\
-		rc = pthread_mutex_lock(_mtx);				\
+		rc = PROF_MUTEX_lock(_mtx);				\
 		if (rc == 0) {						\
 			LogFullDebug(COMPONENT_RW_LOCK,			\
 				     "Acquired mutex %p (%s) at %s:%d",	\
@@ -261,7 +262,7 @@ extern int portable_clock_gettime(struct timespec *ts);
 	do {								\
 		int rc;							\
 									\
-		rc = pthread_mutex_unlock(_mtx);			\
+		rc = PROF_MUTEX_unlock(_mtx);			\
 		if (rc == 0) {						\
 			LogFullDebug(COMPONENT_RW_LOCK,			\
 				     "Released mutex %p (%s) at %s:%d",	\
@@ -24,6 +24,7 @@
 #cmakedefine _USE_9P 1
 #cmakedefine _USE_9P_RDMA 1
 #cmakedefine DEBUG_SAL 1
+#cmakedefine USE_LOCK_PROFILE 1
 #cmakedefine USE_NODELIST 1
 #cmakedefine _NO_MOUNT_LIST 1
 #cmakedefine HAVE_STDBOOL_H 1
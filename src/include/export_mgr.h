@@ -39,6 +39,8 @@
 #ifndef EXPORT_MGR_H
 #define EXPORT_MGR_H
 
+#include "nfs_qos.h"
+
 struct gsh_export {
 	struct avltree_node node_k;
 	pthread_mutex_t lock;
@@ -46,6 +48,11 @@ struct gsh_export {
 	exportlist_t export;
 	nsecs_elapsed_t last_update;
 	int export_id;
+	uint64_t generation; /*< Config generation that last published us */
+	bool retired;        /*< Replaced or removed by a reload */
+	uint64_t retired_gen; /*< Generation that retired us */
+	bool hdl_donated;    /*< export_hdl was handed to our replacement */
+	struct nfs_qos qos;  /*< Rate limits, see QoS_Ops_Per_Sec */
 };
 
 void export_pkginit(void);
@@ -60,5 +67,13 @@ int foreach_gsh_export(bool (*cb)(struct gsh_export *cl,
 				   void *state),
 		       void *state);
 
+/* Live reload: build a generation to the side, then publish it */
+struct gsh_export *get_staged_gsh_export(int export_id);
+bool remove_staged_gsh_export(int export_id);
+void abort_staged_exports(void);
+uint64_t publish_staged_exports(void);
+void export_pseudofs_rebuilt(uint64_t generation);
+int reap_retired_exports(void);
+
 #endif /* !EXPORT_MGR_H */
 /** @} */
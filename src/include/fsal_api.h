@@ -289,7 +289,7 @@
  * rules), increment the minor version
  */
 
-#define FSAL_MINOR_VERSION 0
+#define FSAL_MINOR_VERSION 1
 
 /* Forward references for object methods */
 
@@ -1950,6 +1950,49 @@ struct fsal_obj_ops {
                 const struct fsal_layoutcommit_arg *arg,
                 struct fsal_layoutcommit_res *res);
 /*@}*/
+
+/**
+ * @brief Start reading a range of a file ahead of the client
+ *
+ * Cache inode calls this when it sees a client stream through a file.
+ * The FSAL should start bringing the range into its cache and return
+ * without waiting for it.  It is called with the Cache inode content
+ * lock held for read and the file open.
+ *
+ * @param[in] obj_hdl File to read ahead
+ * @param[in] offset  Start of the range
+ * @param[in] len     Length of the range
+ *
+ * @return FSAL status, ERR_FSAL_NOTSUPP if the FSAL cannot prefetch.
+ */
+        fsal_status_t (*prefetch)(struct fsal_obj_handle *obj_hdl,
+                                  uint64_t offset,
+                                  size_t len);
+
+/**
+ * @brief Read a file without copying the data
+ *
+ * Like read, but instead of copying the data into a buffer, returns a
+ * new descriptor from which the caller sends read_amount bytes at
+ * offset (with sendfile or splice) and which it closes afterwards.
+ * It is called with the Cache inode content lock held for read and
+ * the file open.
+ *
+ * @param[in]  obj_hdl     File to read
+ * @param[in]  offset      Position from which to read
+ * @param[in]  buffer_size Amount of data to read
+ * @param[out] fd          Descriptor to send from, -1 if read_amount is 0
+ * @param[out] read_amount Amount of data available at offset
+ * @param[out] end_of_file true if the range reaches the end of file
+ *
+ * @return FSAL status, ERR_FSAL_NOTSUPP if the FSAL has no descriptor.
+ */
+        fsal_status_t (*read_fd)(struct fsal_obj_handle *obj_hdl,
+                                 uint64_t offset,
+                                 size_t buffer_size,
+                                 int *fd,
+                                 size_t *read_amount,
+                                 bool *end_of_file);
 };
 
 /**
@@ -165,6 +165,11 @@ struct req_op_context {
 	struct gsh_export *export; /*< current export info including stats */
 	nsecs_elapsed_t start_time; /*< start time of this op/request */
 	nsecs_elapsed_t queue_wait; /*< time in wait queue */
+	struct gsh_arena *arena; /*< per-request result storage, NULL if
+				     the reply may outlive the request */
+	struct nfs_zcopy *zcopy; /*< where READ may leave its payload to
+				     be sent from the file, NULL if it
+				     must not (see nfs_zcopy.h) */
         /* add new context members here */
 };
 
@@ -268,12 +273,15 @@ typedef struct fsal_ace__
   } who;
 } fsal_ace_t;
 
+struct fsal_acl_compiled;
+
 typedef struct fsal_acl__
 {
   uint32_t naces;
   fsal_ace_t *aces;
   pthread_rwlock_t lock;
   uint32_t ref;
+  struct fsal_acl_compiled *compiled; /*< Evaluation form, NULL if none */
 } fsal_acl_t;
 
 typedef struct fsal_acl_data__
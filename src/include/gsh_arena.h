@@ -0,0 +1,218 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @defgroup arena Per-request arena allocator
+ *
+ * A bump allocator for memory whose lifetime is exactly one request,
+ * such as the storage behind READ and READDIR results.  Each worker
+ * thread owns one arena; it is handed to the request it is running
+ * and reset once the reply is sent.  Individual objects are never
+ * freed, reset throws everything away at once and keeps one chunk
+ * around for the next request.
+ *
+ * Results that outlive the request (anything kept in a duplicate
+ * request or session slot cache) must not be built in an arena; the
+ * dispatcher leaves the arena pointer in the request context NULL
+ * for those, and gsh_arena_res_alloc() falls back to gsh_malloc().
+ *
+ * @{
+ */
+
+/**
+ * @file gsh_arena.h
+ * @brief Per-request arena allocator
+ */
+
+#ifndef GSH_ARENA_H
+#define GSH_ARENA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "abstract_mem.h"
+
+/**
+ * @brief Default chunk size of a worker arena
+ */
+#define GSH_ARENA_CHUNK_SIZE (64 * 1024)
+
+/**
+ * @brief Largest chunk kept across a reset
+ *
+ * Big enough to hold a full-sized READ buffer, so a steady stream of
+ * READs stops hitting the general allocator.
+ */
+#define GSH_ARENA_RETAIN_MAX ((1024 * 1024) + GSH_ARENA_CHUNK_SIZE)
+
+struct gsh_arena_chunk {
+	struct gsh_arena_chunk *next; /*< Older chunks */
+	size_t size;                  /*< Usable bytes in data */
+	size_t used;                  /*< Bytes handed out */
+	char data[] __attribute__((aligned(16)));
+};
+
+struct gsh_arena {
+	struct gsh_arena_chunk *chunks; /*< Current chunk first */
+	size_t chunk_size;              /*< Minimum size of a new chunk */
+	size_t retain_max;              /*< Largest chunk kept on reset */
+	uint64_t allocs;                /*< Objects handed out */
+	uint64_t chunk_allocs;          /*< Chunks obtained from gsh_malloc */
+	size_t high_water;              /*< Most bytes used by one request */
+	size_t in_use;                  /*< Bytes used since last reset */
+};
+
+void gsh_arena_init(struct gsh_arena *arena, size_t chunk_size,
+		    size_t retain_max);
+void gsh_arena_destroy(struct gsh_arena *arena);
+void *gsh_arena_alloc_aligned(struct gsh_arena *arena, size_t align,
+			      size_t n);
+void gsh_arena_reset(struct gsh_arena *arena);
+bool gsh_arena_owns(const struct gsh_arena *arena, const void *p);
+
+void gsh_arena_set_current(struct gsh_arena *arena);
+struct gsh_arena *gsh_arena_current(void);
+
+/**
+ * @brief Allocate from an arena
+ *
+ * @param[in] arena The arena
+ * @param[in] n     Number of bytes
+ *
+ * @return 8 byte aligned memory valid until the next reset, or NULL.
+ */
+
+static inline void *
+gsh_arena_alloc(struct gsh_arena *arena, size_t n)
+{
+	return gsh_arena_alloc_aligned(arena, sizeof(uint64_t), n);
+}
+
+/**
+ * @brief Allocate result storage
+ *
+ * @param[in] arena Arena from the request context, may be NULL
+ * @param[in] n     Number of bytes
+ *
+ * @return Memory to be released with gsh_arena_res_free().
+ */
+
+static inline void *
+gsh_arena_res_alloc(struct gsh_arena *arena, size_t n)
+{
+	if (arena == NULL)
+		return gsh_malloc(n);
+	return gsh_arena_alloc(arena, n);
+}
+
+/**
+ * @brief Allocate aligned result storage
+ *
+ * @param[in] arena Arena from the request context, may be NULL
+ * @param[in] align Power of two alignment
+ * @param[in] n     Number of bytes
+ *
+ * @return Memory to be released with gsh_arena_res_free().
+ */
+
+static inline void *
+gsh_arena_res_alloc_aligned(struct gsh_arena *arena, size_t align, size_t n)
+{
+	if (arena == NULL)
+		return gsh_malloc_aligned(align, n);
+	return gsh_arena_alloc_aligned(arena, align, n);
+}
+
+/**
+ * @brief Allocate zeroed result storage
+ *
+ * @param[in] arena Arena from the request context, may be NULL
+ * @param[in] count Number of objects
+ * @param[in] size  Size of each object
+ *
+ * @return Memory to be released with gsh_arena_res_free().
+ */
+
+static inline void *
+gsh_arena_res_calloc(struct gsh_arena *arena, size_t count, size_t size)
+{
+	void *p;
+
+	if (arena == NULL)
+		return gsh_calloc(count, size);
+	p = gsh_arena_alloc(arena, count * size);
+	if (p != NULL)
+		memset(p, 0, count * size);
+	return p;
+}
+
+/**
+ * @brief Duplicate a string into result storage
+ *
+ * @param[in] arena Arena from the request context, may be NULL
+ * @param[in] s     String to copy
+ *
+ * @return Copy to be released with gsh_arena_res_free().
+ */
+
+static inline char *
+gsh_arena_res_strdup(struct gsh_arena *arena, const char *s)
+{
+	size_t n;
+	char *p;
+
+	if (arena == NULL)
+		return gsh_strdup(s);
+	n = strlen(s) + 1;
+	p = gsh_arena_alloc(arena, n);
+	if (p != NULL)
+		memcpy(p, s, n);
+	return p;
+}
+
+/**
+ * @brief Release result storage
+ *
+ * Memory from the calling worker's arena is left for the reset,
+ * anything else came from the general allocator.  Result free
+ * functions run on the worker that built the result, or, for cached
+ * replies, on memory that never came from an arena.
+ *
+ * @param[in] p Memory to release, may be NULL
+ */
+
+static inline void
+gsh_arena_res_free(void *p)
+{
+	struct gsh_arena *arena;
+
+	if (p == NULL)
+		return;
+	arena = gsh_arena_current();
+	if (arena != NULL && gsh_arena_owns(arena, p))
+		return;
+	gsh_free(p);
+}
+
+#endif /* GSH_ARENA_H */
+/** @} */
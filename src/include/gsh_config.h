@@ -347,6 +347,24 @@ typedef struct nfs_core_param {
 	/** Whether to support the Remote Quota protocol.  Defaults
 	    to true and is settable with Enable_RQUOTA. */
 	bool enable_RQUOTA;
+	/** Whether NFSv3 READ replies over TCP send the data
+	    straight from the file with sendfile rather than through
+	    a buffer, when the FSAL supports it.  Defaults to false
+	    and is settable with Zero_Copy_Read. */
+	bool zero_copy_read;
+	/** Whether pools on the slab substrate keep their slabs per
+	    NUMA node, so threads get objects from memory local to
+	    them.  Defaults to false and is settable with
+	    NUMA_Local_Pools. */
+	bool numa_local_pools;
+	/** Requests per second each client may make before its
+	    requests are deferred.  Defaults to 0, no limit, and is
+	    settable with QoS_Client_Ops_Per_Sec. */
+	uint64_t qos_client_ops;
+	/** Bytes per second each client may read and write before
+	    its requests are deferred.  Defaults to 0, no limit, and
+	    is settable with QoS_Client_Bytes_Per_Sec. */
+	uint64_t qos_client_bytes;
 } nfs_core_parameter_t;
 
 /** @} */
@@ -382,6 +400,14 @@ typedef struct nfs_core_param {
  */
 #define IDMAPCONF_DEFAULT "/etc/idmapd.conf"
 
+/**
+ * @brief NFSv4 recovery stores
+ */
+typedef enum recovery_backend {
+	RECOVERY_BACKEND_FS, /*< A directory per client */
+	RECOVERY_BACKEND_JOURNAL /*< An append-only log of clients */
+} recovery_backend_t;
+
 typedef struct nfs_version4_parameter {
 	/** Whether to disable the NFSv4 grace period.  Defaults to
 	    false and settable with Graceless. */
@@ -413,6 +439,15 @@ typedef struct nfs_version4_parameter {
 	    group identifiers.  Defaults to true and is settable with
 	    Allow_Numeric_Owners. */
 	bool allow_numeric_owners;
+	/** Where clients allowed to reclaim are recorded.  Defaults
+	    to RECOVERY_BACKEND_FS and is settable with
+	    Recovery_Backend as "fs" or "journal". */
+	recovery_backend_t recovery_backend;
+	/** Whether to end grace as soon as every client in the
+	    recovery store has finished reclaiming.  Only done with
+	    NLM disabled, since NLM clients are not recorded.
+	    Defaults to true and is settable with Lift_Grace_Early. */
+	bool lift_grace_early;
 } nfs_version4_parameter_t;
 
 /** @} */
@@ -520,9 +555,27 @@ typedef struct cache_inode_parameter {
 	/** Use getattr for directory invalidation.  Defaults to
 	    false.  Settable with Use_Getattr_Directory_Invalidation. */
 	bool getattr_dir_invalidation;
+	/** How long, in seconds, a failed lookup is remembered in a
+	    directory that is not fully cached.  0 disables negative
+	    dirents.  Defaults to 10, settable with
+	    Negative_Dirent_Expiration_Time. */
+	time_t neg_dirent_ttl;
+	/** Most negative dirents kept per directory.  Defaults to
+	    1024, settable with Negative_Dirents_Max. */
+	uint32_t neg_dirent_max;
+	/** Most bytes read ahead of a sequential or strided reader.
+	    0 disables readahead.  Defaults to 4M, settable with
+	    Readahead_Max (bytes, K, M or G suffix allowed). */
+	uint64_t readahead_max;
 	/** High water mark for cache entries.  Defaults to 100000,
 	    settable by Entries_HWMark. */
 	uint32_t entries_hwmark;
+	/** Approximate bytes the inode cache may hold (entries,
+	    handles, dirents and ACLs).  Over it, entries are recycled
+	    and cached dirents trimmed as if over Entries_HWMark.  0,
+	    the default, means no budget.  Settable with
+	    Cache_Memory_Budget (bytes, K, M or G suffix allowed). */
+	uint64_t mem_budget;
 	/** Base interval in seconds between runs of the LRU cleaner
 	    thread. Defaults to 60, settable with LRU_Run_Interval. */
 	time_t lru_run_interval;
@@ -560,6 +613,18 @@ typedef struct cache_inode_parameter {
 	    we disable caching, when in extremis.  Defaults to 8,
 	    settable with Futility_Count */
 	uint32_t futility_count;
+	/** File the hottest cache entries are written to at shutdown,
+	    and reloaded from at startup.  NULL, the default, disables
+	    snapshots.  Settable with Snapshot_File. */
+	char *snapshot_file;
+	/** Most entries written to a snapshot.  0, the default, means
+	    Entries_HWMark.  Settable with Snapshot_Entries. */
+	uint32_t snapshot_entries;
+	/** Interval in seconds between snapshots written while
+	    running, besides the one written at shutdown.  0, the
+	    default, means only at shutdown.  Settable with
+	    Snapshot_Interval. */
+	time_t snapshot_interval;
 } cache_inode_parameter_t;
 
 /** @} */
@@ -0,0 +1,200 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @defgroup lock_profile Lock contention profiling
+ *
+ * Built with USE_LOCK_PROFILE, the lock wrappers (PTHREAD_MUTEX_*,
+ * PTHREAD_RWLOCK_*, P() and V() and the cache_inode lane locks) go
+ * through PROF_MUTEX_* and PROF_RWLOCK_*, which count, per call site,
+ * how often a lock was taken, how often it had to be waited for, and
+ * how long it was waited for and held.  Without it they are the bare
+ * pthread calls.
+ *
+ * Each call site is a static struct lock_prof_site, given an index
+ * the first time it is reached.  Counters are kept per thread, so
+ * recording touches no shared cache line.  A lock that is free is
+ * taken with a trylock and costs one clock read, for the hold time;
+ * only one that is not is timed while it is waited for.  Hold times
+ * are found by keeping the locks a thread holds on a short stack, so
+ * a lock released by a thread other than the one that took it has no
+ * hold time, and time spent in pthread_cond_wait() counts as held.
+ *
+ * Counters of other threads are read without locking, so a report
+ * taken under load is approximate.
+ *
+ * @{
+ */
+
+/**
+ * @file lock_profile.h
+ * @brief Lock contention profiling
+ */
+
+#ifndef LOCK_PROFILE_H
+#define LOCK_PROFILE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <pthread.h>
+
+/**
+ * @brief Kinds of lock acquisition
+ */
+
+enum lock_prof_kind {
+	LOCK_PROF_MUTEX,
+	LOCK_PROF_RDLOCK,
+	LOCK_PROF_WRLOCK
+};
+
+/** Most call sites that can be told apart */
+#define LOCK_PROF_MAX_SITES 4096
+
+/**
+ * @brief A call site taking a lock
+ */
+
+struct lock_prof_site {
+	const char *file;
+	const char *func;
+	const char *what; /*< The lock expression */
+	int line;
+	enum lock_prof_kind kind;
+	int32_t id; /*< Index, 0 until first reached, -1 if out of room */
+};
+
+/**
+ * @brief What was seen at a call site
+ */
+
+struct lock_prof_counts {
+	uint64_t acquired; /*< Times the lock was taken */
+	uint64_t contended; /*< Times it had to be waited for */
+	uint64_t wait_ns; /*< Total time waited */
+	uint64_t wait_max; /*< Longest wait */
+	uint64_t hold_ns; /*< Total time held */
+	uint64_t hold_max; /*< Longest hold */
+};
+
+/**
+ * @brief A call site and its counters summed over every thread
+ */
+
+struct lock_prof_report {
+	const struct lock_prof_site *site;
+	struct lock_prof_counts counts;
+};
+
+extern bool lock_prof_enabled;
+
+void lock_prof_acquired(void *lock, struct lock_prof_site *site,
+			uint64_t wait_start);
+void lock_prof_released(void *lock);
+uint64_t lock_prof_now(void);
+void lock_prof_enable(bool enable);
+void lock_prof_reset(void);
+int lock_prof_top(struct lock_prof_report *report, int max);
+const char *lock_prof_kind_name(enum lock_prof_kind kind);
+
+#ifdef USE_LOCK_PROFILE
+
+/**
+ * @brief Take a lock with a trylock first, timing the wait if it fails
+ */
+
+#define LOCK_PROF_TAKE(_lock, _site, _try, _take)			\
+	({								\
+		__typeof__(_lock) _l = (_lock);				\
+		int _rc;						\
+		uint64_t _start;					\
+									\
+		if (!lock_prof_enabled) {				\
+			_rc = _take(_l);				\
+		} else {						\
+			_rc = _try(_l);					\
+			if (_rc == EBUSY) {				\
+				_start = lock_prof_now();		\
+				_rc = _take(_l);			\
+			} else {					\
+				_start = 0;				\
+			}						\
+			if (_rc == 0)					\
+				lock_prof_acquired(_l, _site, _start);	\
+		}							\
+		_rc;							\
+	})
+
+#define LOCK_PROF_SITE(_kind, _what)					\
+	({								\
+		static struct lock_prof_site _lps = {			\
+			.file = __FILE__,				\
+			.func = __func__,				\
+			.what = _what,					\
+			.line = __LINE__,				\
+			.kind = _kind,					\
+		};							\
+		&_lps;							\
+	})
+
+#define PROF_MUTEX_lock(_mtx)						\
+	LOCK_PROF_TAKE(_mtx, LOCK_PROF_SITE(LOCK_PROF_MUTEX, #_mtx),	\
+		       pthread_mutex_trylock, pthread_mutex_lock)
+
+#define PROF_RWLOCK_rdlock(_lock)					\
+	LOCK_PROF_TAKE(_lock, LOCK_PROF_SITE(LOCK_PROF_RDLOCK, #_lock),	\
+		       pthread_rwlock_tryrdlock, pthread_rwlock_rdlock)
+
+#define PROF_RWLOCK_wrlock(_lock)					\
+	LOCK_PROF_TAKE(_lock, LOCK_PROF_SITE(LOCK_PROF_WRLOCK, #_lock),	\
+		       pthread_rwlock_trywrlock, pthread_rwlock_wrlock)
+
+#define LOCK_PROF_GIVE(_lock, _give)					\
+	({								\
+		__typeof__(_lock) _l = (_lock);				\
+									\
+		if (lock_prof_enabled)					\
+			lock_prof_released(_l);				\
+		_give(_l);						\
+	})
+
+#define PROF_MUTEX_unlock(_mtx)						\
+	LOCK_PROF_GIVE(_mtx, pthread_mutex_unlock)
+
+#define PROF_RWLOCK_unlock(_lock)					\
+	LOCK_PROF_GIVE(_lock, pthread_rwlock_unlock)
+
+#else /* USE_LOCK_PROFILE */
+
+#define PROF_MUTEX_lock(_mtx) pthread_mutex_lock(_mtx)
+#define PROF_MUTEX_unlock(_mtx) pthread_mutex_unlock(_mtx)
+#define PROF_RWLOCK_rdlock(_lock) pthread_rwlock_rdlock(_lock)
+#define PROF_RWLOCK_wrlock(_lock) pthread_rwlock_wrlock(_lock)
+#define PROF_RWLOCK_unlock(_lock) pthread_rwlock_unlock(_lock)
+
+#endif /* USE_LOCK_PROFILE */
+
+#endif /* LOCK_PROFILE_H */
+
+/** @} */
@@ -946,6 +946,10 @@ struct dirlistplus3
 {
   entryplus3 *entries;
   bool_t eof;
+  /* Entries already in XDR form, emitted ahead of entries on encode
+     (see nfs3_Readdirplus.c) */
+  char *entries_xdr;
+  u_int entries_xdr_len;
 };
 typedef struct dirlistplus3 dirlistplus3;
 
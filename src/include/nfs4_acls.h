@@ -24,7 +24,13 @@ fsal_acl_t *nfs4_acl_new_entry(fsal_acl_data_t *pacldata, fsal_acl_status_t *pst
 
 void nfs4_acl_release_entry(fsal_acl_t *pacl, fsal_acl_status_t *pstatus);
 
+bool nfs4_acl_check(fsal_acl_t *pacl, struct user_cred *creds,
+                    bool is_owner, bool is_group, bool is_dir,
+                    fsal_aceperm_t v4mask, bool *granted);
+
 int nfs4_acls_init();
 
+uint64_t nfs4_acl_mem_usage(void);
+
 #endif                          /* _NFS4_ACLS_H */
 
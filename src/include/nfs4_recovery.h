@@ -0,0 +1,106 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @addtogroup SAL
+ * @{
+ */
+
+/**
+ * @file nfs4_recovery.h
+ * @brief NFSv4 recovery store backends
+ *
+ * The recovery store remembers which clients hold state, so that
+ * after a restart or takeover those clients, and only those, may
+ * reclaim it during grace.  nfs4_recovery.c keeps the clients allowed
+ * to reclaim in a hash table and queues every add and remove for one
+ * thread that hands them to the backend a batch at a time, asking it
+ * to make each batch stable once.
+ *
+ * A backend is called only from that thread, or with the store
+ * quiesced, so it needs no locking of its own.
+ */
+
+#ifndef NFS4_RECOVERY_H
+#define NFS4_RECOVERY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "nlm_list.h"
+#include "sal_data.h"
+
+#define NFS_V4_RECOV_ROOT "/var/lib/nfs/ganesha"
+#define NFS_V4_RECOV_DIR "v4recov"
+#define NFS_V4_OLD_DIR "v4old"
+
+/** Longest client name kept, including the NUL */
+#define NFS4_CLID_NAME_LEN 256
+
+extern char v4_recov_dir[PATH_MAX + 1];
+extern char v4_old_dir[PATH_MAX + 1];
+
+/**
+ * @brief A set of client names
+ */
+struct clid_table {
+	struct glist_head *ct_buckets; /*< Chains of clid_entry_t */
+	uint32_t ct_mask; /*< Number of buckets less one */
+	uint32_t ct_count; /*< Names in the set */
+};
+
+void clid_table_init(struct clid_table *table);
+bool clid_table_add(struct clid_table *table, const char *name);
+bool clid_table_del(struct clid_table *table, const char *name);
+bool clid_table_find(struct clid_table *table, const char *name);
+void clid_table_foreach(struct clid_table *table,
+			void (*cb)(const char *name, void *arg),
+			void *arg);
+void clid_table_clear(struct clid_table *table);
+
+/**
+ * @brief Operations of a recovery store
+ */
+struct nfs4_recovery_backend {
+	/** Name, as given to Recovery_Backend */
+	const char *name;
+	/** Set up the store in v4_recov_dir and v4_old_dir */
+	void (*create)(void);
+	/** Pass every client allowed to reclaim to add.  With gsp NULL
+	    this is a restart: the clients recorded by the previous
+	    instance become the clients that may reclaim and the live
+	    record starts empty.  Otherwise gsp says whose clients this
+	    node takes over. */
+	void (*load)(nfs_grace_start_t *gsp, void (*add)(const char *name));
+	/** Record a client */
+	void (*add_clid)(const char *name);
+	/** Forget a client */
+	void (*rm_clid)(const char *name);
+	/** Make the adds and removes since the last commit stable */
+	void (*commit)(void);
+	/** Forget the clients of the previous instance once grace is over */
+	void (*clean_old)(void);
+};
+
+extern struct nfs4_recovery_backend nfs4_recovery_fs;
+extern struct nfs4_recovery_backend nfs4_recovery_journal;
+
+#endif /* NFS4_RECOVERY_H */
+
+/** @} */
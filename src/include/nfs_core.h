@@ -49,6 +49,7 @@
 #include "wait_queue.h"
 #include "err_HashTable.h"
 #include "gsh_config.h"
+#include "gsh_arena.h"
 #include "cache_inode.h"
 #ifdef _USE_9P
 #include "9p.h"
@@ -155,6 +156,7 @@ typedef struct request_data {
 	} r_u ;
 	struct timespec time_queued; /*< The time at which a request was added
 				     *  to the worker thread queue. */
+	bool qos_charged; /*< Charged against rate limits already */
 } request_data_t;
 
 /**
@@ -222,6 +224,10 @@ struct nfs_worker_data {
 
 	sockaddr_t hostaddr; /*< Client address */
 	struct fridgethr_context *ctx; /*< Link back to thread context */
+	struct gsh_arena arena; /*< Result storage, reset per request */
+	struct glist_head wd_list; /*< Link in the list of workers */
+	uint64_t req_seq; /*< Bumped as an NFS request starts and ends,
+			      odd while one is running */
 };
 
 
@@ -349,5 +355,6 @@ int worker_init(void);
 int worker_shutdown(void);
 int worker_pause(void);
 int worker_resume(void);
+void worker_synchronize(void);
 
 #endif /* !NFS_CORE_H */
@@ -177,6 +177,9 @@ typedef struct exportlist {
 	export_perms_t export_perms;  /*< available mount options */
 	unsigned char seckey[EXPORT_KEY_SIZE]; /*< Checksum for FH validity */
 	bool use_commit;
+	uint32_t config_epoch; /*< Differs for every build of an entry, so
+				  a reload that changes it is seen by
+				  caches keyed by export */
 	uint32_t MaxRead; /*< Max Read for this entry */
 	uint32_t MaxWrite; /*< Max Write for this entry */
 	uint32_t PrefRead; /*< Preferred Read size */
@@ -186,6 +189,8 @@ typedef struct exportlist {
 	uint64_t MaxOffsetRead; /*< Maximum Offset allowed for read */
 	uint64_t MaxCacheSize;  /*< Maximum Cache Size allowed */
 	bool UseCookieVerifier; /*< Is Cookie verifier to be used? */
+	uint64_t QoSOpsPerSec; /*< Request rate limit, 0 for none */
+	uint64_t QoSBytesPerSec; /*< Read and write rate limit, 0 for none */
 	exportlist_client_t clients; /*< Allowed clients */
 	struct fsal_export *export_hdl; /*< Handle into our FSAL */
 
@@ -1041,6 +1041,10 @@ void compound_data_Free(compound_data_t * data);
 
 /* Pseudo FS functions */
 int nfs4_ExportToPseudoFS(struct glist_head  *pexportlist);
+pseudofs_t *nfs4_PreparePseudoFS(struct glist_head *pexportlist);
+pseudofs_t *nfs4_InstallPseudoFS(pseudofs_t *PseudoFs,
+                                 struct glist_head *pexportlist);
+void nfs4_FreePseudoFS(pseudofs_t *PseudoFs);
 pseudofs_t *nfs4_GetPseudoFs(void);
 
 int nfs4_SetCompoundExport(compound_data_t * data);
@@ -1136,6 +1140,14 @@ int nfs4_FSALattr_To_Fattr(const struct attrlist *pattr,
                            nfs_fh4 *objFH,
                            struct bitmap4 *Bitmap);
 
+int nfs4_FSALattr_To_Fattr_buf(const struct attrlist *pattr,
+                               fattr4 *Fattr,
+                               compound_data_t *data,
+                               nfs_fh4 *objFH,
+                               struct bitmap4 *Bitmap,
+                               char *buf,
+                               u_int buflen);
+
 uint64_t nfs_htonl64(uint64_t arg64);
 uint64_t nfs_ntohl64(uint64_t arg64);
 void nfs4_bitmap4_Remove_Unsupported(struct bitmap4 *pbitmap) ;
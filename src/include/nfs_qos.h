@@ -0,0 +1,107 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @defgroup nfs_qos Request rate limits
+ *
+ * Every export and every client has two token buckets, one for
+ * requests per second and one for bytes read or written per second.
+ * A rate of 0 means no limit.  A bucket holds at most one second of
+ * tokens, so a tenant that has been idle may burst that much.
+ *
+ * A request takes its tokens when it is charged, even if that drives
+ * a bucket below zero.  The time it takes to pay that debt back is
+ * how long the request must be deferred.  So deferred requests run in
+ * the order they were charged, at exactly the configured rate, and
+ * are never charged twice.
+ *
+ * @{
+ */
+
+/**
+ * @file nfs_qos.h
+ * @brief Per export and per client rate limits
+ */
+
+#ifndef NFS_QOS_H
+#define NFS_QOS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "ganesha_types.h"
+
+/**
+ * @brief A token bucket
+ */
+
+struct nfs_qos_bucket {
+	uint64_t rate; /*< Tokens per second, 0 for no limit */
+	double tokens; /*< Negative while requests are deferred */
+	nsecs_elapsed_t last; /*< Last refill */
+};
+
+/**
+ * @brief Limits and counters of an export or client
+ */
+
+struct nfs_qos {
+	pthread_mutex_t mtx;
+	struct nfs_qos_bucket ops;
+	struct nfs_qos_bucket bytes;
+	uint64_t deferred; /*< Requests deferred */
+	nsecs_elapsed_t deferred_ns; /*< Total time they were deferred */
+};
+
+/**
+ * @brief Set once any limit has been set
+ *
+ * While false, the request path does not look for limits at all.
+ */
+
+extern bool nfs_qos_enabled;
+
+void nfs_qos_init(struct nfs_qos *qos, uint64_t ops_rate,
+		  uint64_t bytes_rate);
+void nfs_qos_set(struct nfs_qos *qos, uint64_t ops_rate,
+		 uint64_t bytes_rate);
+void nfs_qos_get(struct nfs_qos *qos, uint64_t *ops_rate,
+		 uint64_t *bytes_rate, uint64_t *deferred,
+		 nsecs_elapsed_t *deferred_ns);
+nsecs_elapsed_t nfs_qos_charge(struct nfs_qos *qos, uint64_t bytes,
+			       nsecs_elapsed_t now);
+
+/**
+ * @brief Whether a tenant has any limit
+ *
+ * Read without the lock, as a hint for skipping nfs_qos_charge().
+ */
+
+static inline bool nfs_qos_limited(const struct nfs_qos *qos)
+{
+	return qos->ops.rate != 0 || qos->bytes.rate != 0;
+}
+
+#endif /* NFS_QOS_H */
+
+/** @} */
@@ -53,6 +53,9 @@ int nfs_ParseConfLine(char *Argv[],
                       char separator);
 
 int ReadExports(config_file_t in_config, struct glist_head * pexportlist);
+int ReadStagedExports(config_file_t in_config, struct glist_head * pexportlist);
+bool export_same_backing(exportlist_t *a, exportlist_t *b);
+bool export_same_config(exportlist_t *a, exportlist_t *b);
 void free_export_resources(exportlist_t *export);
 void exports_pkginit(void);
 exportlist_t *BuildDefaultExport();
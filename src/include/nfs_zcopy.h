@@ -0,0 +1,81 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @defgroup zcopy Zero-copy READ replies
+ *
+ * With Zero_Copy_Read set, an NFSv3 READ over TCP does not read the
+ * data into a buffer for the RPC layer to copy into the socket.
+ * nfs_Read asks cache inode for a descriptor on the file instead
+ * (CACHE_INODE_READ_FD) and leaves it in the request's nfs_zcopy.
+ * The worker then writes the RPC record mark, reply header and
+ * READ3resok header itself and sends the data with sendfile().
+ *
+ * Only requests whose reply is not kept anywhere qualify: not over
+ * UDP, not under RPCSEC_GSS (integrity and privacy need the data in
+ * memory to checksum or seal it) and not held in the duplicate
+ * request cache.  Everything else, and any FSAL without read_fd,
+ * takes the buffered path.
+ *
+ * @{
+ */
+
+/**
+ * @file nfs_zcopy.h
+ * @brief Zero-copy READ replies
+ */
+
+#ifndef NFS_ZCOPY_H
+#define NFS_ZCOPY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ganesha_rpc.h"
+#include "nfs23.h"
+
+/**
+ * @brief READ payload left in a file
+ */
+struct nfs_zcopy {
+	int fd;          /*< Descriptor to send from, owned; -1 if none */
+	uint64_t offset; /*< Where the payload starts in the file */
+	uint32_t len;    /*< Payload length */
+};
+
+/**
+ * @brief Zero-copy counters
+ */
+struct nfs_zcopy_stats {
+	uint64_t replies; /*< READ replies sent from a file */
+	uint64_t bytes;   /*< Payload bytes sent from a file */
+	uint64_t short_files; /*< Files that shrank while being sent */
+};
+
+bool nfs_zcopy_eligible(struct svc_req *req);
+bool nfs_zcopy_sendreply(SVCXPRT *xprt, struct svc_req *req,
+			 READ3res *res, struct nfs_zcopy *zc);
+void nfs_zcopy_release(struct nfs_zcopy *zc);
+
+#endif /* NFS_ZCOPY_H */
+
+/** @} */
@@ -1843,6 +1843,10 @@ extern "C"
   {
     entry4 *entries;
     bool_t eof;
+    /* Entries already in XDR form, emitted ahead of entries on
+       encode (see nfs4_op_readdir.c) */
+    char *entries_xdr;
+    u_int entries_xdr_len;
   };
   typedef struct dirlist4 dirlist4;
 
@@ -5922,6 +5926,9 @@ static inline bool xdr_entry4(XDR * xdrs, entry4 * objp)
 
 static inline bool xdr_dirlist4(XDR * xdrs, dirlist4 * objp)
 {
+  if(xdrs->x_op == XDR_ENCODE && objp->entries_xdr != NULL)
+    if(!xdr_opaque(xdrs, objp->entries_xdr, objp->entries_xdr_len))
+      return false;
   if(!xdr_pointer(xdrs, (char **)&objp->entries, sizeof(entry4), (xdrproc_t) xdr_entry4))
     return false;
   if(!inline_xdr_bool(xdrs, &objp->eof))
@@ -35,7 +35,22 @@
 #include "sal_data.h"
 
 extern pthread_mutex_t                nlm_async_resp_mutex;
-extern pthread_cond_t                 nlm_async_resp_cond;
+
+/* Counters for asynchronous NLM messages */
+struct nlm_async_stats
+{
+  uint64_t sent;          /* Messages sent */
+  uint64_t errors;        /* Messages that could not be sent */
+  uint64_t connects;      /* Connections made to clients */
+  uint64_t fast_fails;    /* Sends refused while a client was backed off */
+  uint64_t batches;       /* Batches sent from a host's queue */
+  uint64_t batched;       /* Messages in those batches */
+  uint64_t answered;      /* GRANTED_MSGs answered */
+  uint64_t unanswered;    /* GRANTED_MSGs never answered */
+  uint64_t resp_latency;  /* Total nsecs clients took to answer */
+};
+
+extern struct nlm_async_stats nlm_async_stats;
 
 int nlm_async_callback_init();
 
@@ -55,4 +70,8 @@ int nlm_send_async(int                  proc,
 
 void nlm_signal_async_resp(void *key);
 
+state_status_t nlm_async_schedule(state_async_queue_t *arg);
+
+void nlm_async_report(void);
+
 #endif                          /* NLM_ASYNC_H */
@@ -129,6 +129,9 @@ static inline void glist_splice_tail(struct glist_head *tgt,
 #define glist_for_each(node, head) \
 	for(node = (head)->next; node != head; node = node->next)
 
+#define glist_for_each_prev(node, head) \
+	for(node = (head)->prev; node != head; node = node->prev)
+
 static inline size_t glist_length(struct glist_head *head)
 {
     size_t length = 0;
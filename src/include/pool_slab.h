@@ -0,0 +1,119 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @defgroup pool_slab Slab pool substrate
+ *
+ * A pool substrate for objects allocated and freed at a high rate
+ * from many threads at once.  Objects are carved out of slabs, blocks
+ * of memory aligned to their own size so the slab an object belongs
+ * to is found by masking its address.  The object size is rounded up
+ * to a multiple of POOL_SLAB_ALIGN, which gives the size classes.
+ *
+ * Each thread keeps two magazines of free objects per pool, the one
+ * it allocates from and frees to and the previous one, so most
+ * allocations and frees touch no lock and no shared cache line.  A
+ * thread that runs out swaps a magazine with the pool's depot, which
+ * holds full and empty magazines; only when the depot cannot help
+ * does it go to the slabs, under the lock of a slab list.
+ * pool_slab_trim(), run from the reaper, gives back the depot's
+ * magazines that sat idle since the previous trim, so memory taken
+ * in a burst is returned once the burst is over.
+ *
+ * With numa_local set a pool keeps slabs per NUMA node and a thread
+ * takes new objects from the slabs of the node it runs on.  A slab's
+ * memory is first written by the thread that creates it, so the
+ * kernel places it on that thread's node.  Freed objects always go
+ * back to the slabs they came from.
+ *
+ * pool_slab_substrate is selected per pool at pool_init(); pools not
+ * worth it stay on pool_basic_substrate.
+ *
+ * @{
+ */
+
+/**
+ * @file pool_slab.h
+ * @brief Slab pool substrate
+ */
+
+#ifndef POOL_SLAB_H
+#define POOL_SLAB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "abstract_mem.h"
+
+/** Objects are rounded up to a multiple of this */
+#define POOL_SLAB_ALIGN 16
+
+/** Default slab size, raised for large objects */
+#define POOL_SLAB_SIZE (64 * 1024)
+
+/** Default number of objects in a magazine */
+#define POOL_SLAB_MAGAZINE 32
+
+/**
+ * @brief Parameters of a slab pool
+ *
+ * Passed as the substrate parameters of pool_init().  NULL, or a zero
+ * field, means the value in pool_slab_defaults.
+ */
+struct pool_slab_params {
+	size_t slab_size; /*< Bytes per slab, a power of two */
+	uint32_t magazine_size; /*< Objects per magazine */
+	bool numa_local; /*< Keep slabs per NUMA node */
+};
+
+/**
+ * @brief Occupancy of a slab pool
+ *
+ * Counts are read without stopping the threads using the pool and
+ * may be slightly out of step with each other.
+ */
+struct pool_slab_stats {
+	uint32_t nodes; /*< Slab lists, one per NUMA node or one */
+	uint64_t slabs; /*< Slabs allocated */
+	uint64_t bytes; /*< Memory held in slabs */
+	uint64_t capacity; /*< Objects the slabs hold */
+	uint64_t in_use; /*< Objects handed out */
+	uint64_t cached; /*< Free objects in thread magazines and depot */
+	uint64_t slab_allocs; /*< Slabs ever created */
+	uint64_t slab_frees; /*< Slabs ever released */
+	uint64_t depot_misses; /*< Times a thread had to go to the slabs */
+};
+
+extern const struct pool_substrate_vector pool_slab_substrate[];
+
+/** Used for a NULL parameter; numa_local is set from the configuration */
+extern struct pool_slab_params pool_slab_defaults;
+
+bool pool_is_slab(pool_t *pool);
+void pool_slab_stats(pool_t *pool, struct pool_slab_stats *stats);
+uint64_t pool_slab_trim(pool_t *pool);
+void pool_slab_foreach(void (*cb)(pool_t *pool, void *arg), void *arg);
+
+#endif /* POOL_SLAB_H */
+
+/** @} */
@@ -267,6 +267,7 @@ extern char all_ones[OTHERSIZE];
 
 struct state_t {
 	struct glist_head state_list; /*< List of states on a file */
+	struct avltree_node state_node; /*< Node in the file's state index */
 	struct glist_head state_owner_list; /*< List of states for an owner */
 	struct glist_head state_export_list; /*< List of states on the same
 					         export */
@@ -372,8 +373,6 @@ struct state_nlm_client_t {
 	int32_t slc_refcount; /*< Reference count for disposal */
 	int32_t slc_nlm_caller_name_len; /*< Length of client name */
 	char *slc_nlm_caller_name; /*< Client name */
-	CLIENT *slc_callback_clnt; /*< Callback for blocking locks */
-	AUTH *slc_callback_auth; /*< Authentication for callback */
 };
 
 /**
@@ -520,6 +519,8 @@ struct nfs_client_id_t {
 				        per client. */
 	int cid_allow_reclaim; /*< Whether this client can still
 				   reclaim state */
+	bool cid_reclaim_complete; /*< Whether this client sent a global
+				       RECLAIM_COMPLETE */
 	char *cid_recov_dir; /*< Recovery directory */
 	nfs_client_record_t *cid_client_record; /*< Record for managing
 						    confirmation and
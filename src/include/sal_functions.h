@@ -544,6 +544,16 @@ bool state_conflict(state_t *state,
 		    state_type_t state_type,
 		    state_data_t *state_data);
 
+void state_index_init(cache_entry_t *entry);
+state_t *state_index_first(cache_entry_t *entry,
+			   state_type_t state_type,
+			   clientid4 clientid,
+			   state_owner_t *owner);
+state_t *state_index_next(state_t *state,
+			  state_type_t state_type,
+			  clientid4 clientid,
+			  state_owner_t *owner);
+
 state_status_t state_add_impl(cache_entry_t *entry,
                               state_type_t state_type,
                               state_data_t *state_data,
@@ -628,6 +638,17 @@ state_status_t state_share_check_conflict(cache_entry_t *entry,
                                           int share_acccess,
                                           int share_deny);
 
+void state_share_count(cache_entry_t *entry,
+                       int old_access,
+                       int old_deny,
+                       int new_access,
+                       int new_deny,
+                       bool v4);
+
+const char *state_share_conflict(cache_entry_t *entry,
+                                 int share_access,
+                                 int share_deny);
+
 state_status_t state_share_anonymous_io_start(cache_entry_t *entry,
                                               int share_access);
 
@@ -693,9 +714,14 @@ void nfs4_create_clid_name(nfs_client_record_t *, nfs_client_id_t *,
 void nfs4_add_clid(nfs_client_id_t *);
 void nfs4_rm_clid(char *);
 void nfs4_chk_clid(nfs_client_id_t *);
+void nfs4_reclaim_done(nfs_client_id_t *clientid);
+bool nfs4_grace_status(time_t *remaining, uint32_t *recorded,
+		       void (*cb)(const char *name, void *arg), void *arg);
 void nfs4_load_recov_clids(nfs_grace_start_t *gsp);
 void nfs4_clean_old_recov_dir(void);
 void nfs4_create_recov_dir(void);
+int nfs4_recovery_async_init(void);
+void nfs4_recovery_async_shutdown(void);
 
 #endif /* SAL_FUNCTIONS_H */
 
@@ -156,6 +156,30 @@ struct export_stats {
 	.direction = "out"	\
 }				\
 
+#define QOS_ARGS		\
+{				\
+	.name = "ops_per_sec",	\
+	.type = "t",		\
+	.direction = "in"	\
+},				\
+{				\
+	.name = "bytes_per_sec",\
+	.type = "t",		\
+	.direction = "in"	\
+}
+
+#define QOS_REPLY		\
+{				\
+	.name = "limits",	\
+	.type = "(tt)",		\
+	.direction = "out"	\
+},				\
+{				\
+	.name = "deferred",	\
+	.type = "(tt)",		\
+	.direction = "out"	\
+}
+
 void server_stats_summary(DBusMessageIter *iter,
 			  struct gsh_stats *st);
 void server_dbus_v3_iostats(struct nfsv3_stats *v3p,
@@ -166,6 +190,12 @@ void server_dbus_v41_iostats(struct nfsv41_stats *v41p,
 			     DBusMessageIter *iter);
 void server_dbus_v41_layouts(struct nfsv41_stats *v41p,
 			     DBusMessageIter *iter);
+void server_dbus_qos(struct nfs_qos *qos,
+		     DBusMessageIter *iter);
+bool server_dbus_qos_args(DBusMessageIter *args,
+			  uint64_t *ops_rate,
+			  uint64_t *bytes_rate,
+			  char **errormsg);
 
 #endif /* USE_DBUS_STATS */
 
@@ -0,0 +1,33 @@
+#!/usr/bin/python
+
+# You must initialize the gobject/dbus support for threading
+# before doing anything.
+import gobject
+
+gobject.threads_init()
+
+from dbus import glib
+glib.init_threads()
+
+# Create a session bus.
+import dbus
+bus = dbus.SystemBus()
+
+# Create an object that will proxy for a particular remote object.
+admin = bus.get_object("org.ganesha.nfsd",
+                       "/org/ganesha/nfsd/admin")
+
+# call method
+ganesha_grace_status = admin.get_dbus_method('grace_status',
+                                             'org.ganesha.nfsd.admin')
+
+status, msg, outstanding, in_grace, remaining, recorded = ganesha_grace_status()
+if not status:
+    print msg
+elif not in_grace:
+    print "Not in grace."
+else:
+    print "In grace for %d more seconds, %d of %d clients to reclaim:" % \
+        (remaining, len(outstanding), recorded)
+    for name in outstanding:
+        print "  ", name
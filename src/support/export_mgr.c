@@ -80,6 +80,35 @@ struct export_by_id
 
 static struct export_by_id export_by_id;
 
+/**
+ * @brief Exports parsed by a reload but not yet published.
+ *
+ * The staging tree has no front-end cache, only the admin thread
+ * looks things up in it.
+ */
+
+static struct export_by_id export_staged;
+
+/**
+ * @brief Generation of the currently published export set
+ */
+
+static uint64_t export_generation;
+
+/**
+ * @brief Exports removed from the live tree by a reload.
+ *
+ * They stay here, linked by their exp_list, until the last request
+ * holding a reference and the last state/lock on them is gone.
+ */
+
+static struct glist_head retired_exports;
+static pthread_mutex_t retired_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Newest generation the pseudo fs junctions were pointed at, protected
+ * by retired_mutex */
+static uint64_t pseudofs_generation;
+
 /**
  * @brief Compute cache slot for an entry
  *
@@ -244,6 +273,7 @@ get_gsh_export(int export_id, bool lookup_only)
 		exp = avltree_container_of(node, struct gsh_export, node_k);
 	} else {
 		pthread_mutex_init(&exp->lock, NULL);
+		nfs_qos_init(&exp->qos, 0, 0);
                 /* update cache */
 		atomic_store_voidptr(cache_slot, &exp->node_k);
 	}
@@ -267,54 +297,81 @@ void put_gsh_export(struct gsh_export *export)
 }
 
 /**
- * @brief Remove the export management struct
+ * @brief Free an export management struct and its stats block
  *
- * Remove it from the AVL tree.
+ * @param exp [IN] export to free, already unlinked from everything
  */
 
-bool remove_gsh_export(int export_id)
+static void free_gsh_export(struct gsh_export *exp)
+{
+	struct export_stats *export_st;
+
+	export_st = container_of(exp, struct export_stats, export);
+	server_stats_free(&export_st->st);
+	gsh_free(export_st);
+}
+
+/**
+ * @brief Remove an unreferenced export from one of the trees
+ *
+ * @param eid       [IN] tree to remove from
+ * @param export_id [IN] id of the export
+ *
+ * @return false if the export is still referenced.
+ */
+
+static bool remove_export_by_id(struct export_by_id *eid, int export_id)
 {
 	struct avltree_node *node = NULL;
 	struct avltree_node *cnode = NULL;
 	struct gsh_export *exp = NULL;
-	exportlist_t *export;
-	struct export_stats *export_st;
+	exportlist_t *export = NULL;
 	struct gsh_export v;
         void **cache_slot;
 	bool removed = true;
 
 	v.export_id = export_id;
 
-	PTHREAD_RWLOCK_wrlock(&export_by_id.lock);
-	node = avltree_lookup(&v.node_k, &export_by_id.t);
+	PTHREAD_RWLOCK_wrlock(&eid->lock);
+	node = avltree_lookup(&v.node_k, &eid->t);
 	if(node) {
 		exp = avltree_container_of(node, struct gsh_export, node_k);
 		if(exp->refcnt > 0) {
 			removed = false;
 			goto out;
 		}
-		cache_slot = (void **)
-			&(export_by_id.cache[eid_cache_offsetof(&export_by_id, export_id)]);
-		cnode = (struct avltree_node *) atomic_fetch_voidptr(cache_slot);
-		if(node == cnode)
-			atomic_store_voidptr(cache_slot, NULL);
-		avltree_remove(node, &export_by_id.t);
+		if(eid->cache != NULL) {
+			cache_slot = (void **)
+				&(eid->cache[eid_cache_offsetof(eid, export_id)]);
+			cnode = (struct avltree_node *)
+				atomic_fetch_voidptr(cache_slot);
+			if(node == cnode)
+				atomic_store_voidptr(cache_slot, NULL);
+		}
+		avltree_remove(node, &eid->t);
 		export = &exp->export;
 		glist_del(&export->exp_list);
 	}
 out:
-	PTHREAD_RWLOCK_unlock(&export_by_id.lock);
+	PTHREAD_RWLOCK_unlock(&eid->lock);
 	if(removed && node) {
 		free_export_resources(export);
-		export_st = container_of(exp, struct export_stats, export);
-		server_stats_free(&export_st->st);
-		export_st = container_of(exp, struct export_stats, export);
- 
-		gsh_free(exp);
+		free_gsh_export(exp);
 	}
 	return removed;
 }
 
+/**
+ * @brief Remove the export management struct
+ *
+ * Remove it from the AVL tree.
+ */
+
+bool remove_gsh_export(int export_id)
+{
+	return remove_export_by_id(&export_by_id, export_id);
+}
+
 /**
  * @ Walk the tree and do the callback on each node
  *
@@ -343,6 +400,345 @@ int foreach_gsh_export(bool (*cb)(struct gsh_export *cl,
 	return cnt;
 }
 
+/**
+ * @brief Get or create an export in the staging tree
+ *
+ * This is the reload counterpart of get_gsh_export(id, false).  The
+ * live tree is not touched, so a reload may reuse every export id
+ * currently in service.
+ *
+ * @param export_id [IN] the export id from the config block
+ *
+ * @return pointer to ref counted export or NULL on allocation failure.
+ */
+
+struct gsh_export *get_staged_gsh_export(int export_id)
+{
+	struct avltree_node *node;
+	struct gsh_export *exp;
+	struct export_stats *export_st;
+	struct gsh_export v;
+
+	v.export_id = export_id;
+
+	PTHREAD_RWLOCK_wrlock(&export_staged.lock);
+	node = avltree_lookup(&v.node_k, &export_staged.t);
+	if(node) {
+		exp = avltree_container_of(node, struct gsh_export, node_k);
+		goto out;
+	}
+	export_st = gsh_calloc(sizeof(struct export_stats), 1);
+	if(export_st == NULL) {
+		PTHREAD_RWLOCK_unlock(&export_staged.lock);
+		return NULL;
+	}
+	exp = &export_st->export;
+	exp->export_id = export_id;
+	exp->refcnt = 0;
+	pthread_mutex_init(&exp->lock, NULL);
+	nfs_qos_init(&exp->qos, 0, 0);
+	avltree_insert(&exp->node_k, &export_staged.t);
+out:
+	atomic_inc_int64_t(&exp->refcnt);
+	PTHREAD_RWLOCK_unlock(&export_staged.lock);
+	return exp;
+}
+
+/**
+ * @brief Remove an export from the staging tree
+ *
+ * Used by the config parser to drop an entry that had errors.
+ */
+
+bool remove_staged_gsh_export(int export_id)
+{
+	return remove_export_by_id(&export_staged, export_id);
+}
+
+/**
+ * @brief Throw away everything in the staging tree
+ *
+ * The live export set is left untouched.
+ */
+
+void abort_staged_exports(void)
+{
+	struct avltree_node *node;
+	struct gsh_export *exp;
+
+	PTHREAD_RWLOCK_wrlock(&export_staged.lock);
+	while((node = avltree_first(&export_staged.t)) != NULL) {
+		avltree_remove(node, &export_staged.t);
+		exp = avltree_container_of(node, struct gsh_export, node_k);
+		glist_del(&exp->export.exp_list);
+		free_export_resources(&exp->export);
+		free_gsh_export(exp);
+	}
+	PTHREAD_RWLOCK_unlock(&export_staged.lock);
+}
+
+/**
+ * @brief Put and release an FSAL export nobody will use
+ *
+ * @param exp_hdl [IN] the FSAL export
+ */
+
+static void release_export_hdl(struct fsal_export *exp_hdl)
+{
+	fsal_status_t fsal_status;
+
+	if(exp_hdl->ops->put(exp_hdl) != 0) {
+		LogCrit(COMPONENT_CONFIG,
+			"Cannot put export object");
+		return;
+	}
+	fsal_status = exp_hdl->ops->release(exp_hdl);
+	if(FSAL_IS_ERROR(fsal_status))
+		LogCrit(COMPONENT_CONFIG,
+			"Cannot release export object");
+}
+
+/**
+ * @brief Move a live export to the retired list
+ *
+ * Called with the live tree write locked.  The config reference is
+ * dropped, requests still holding the export finish against it.
+ *
+ * @param exp        [IN] the export to retire
+ * @param generation [IN] the generation replacing it
+ */
+
+static void retire_live_export(struct gsh_export *exp,
+			       uint64_t generation)
+{
+	void **cache_slot;
+
+	cache_slot = (void **)
+		&(export_by_id.cache[eid_cache_offsetof(&export_by_id,
+							exp->export_id)]);
+	if(atomic_fetch_voidptr(cache_slot) == &exp->node_k)
+		atomic_store_voidptr(cache_slot, NULL);
+	avltree_remove(&exp->node_k, &export_by_id.t);
+	glist_del(&exp->export.exp_list);
+	exp->retired = true;
+	exp->retired_gen = generation;
+	atomic_dec_int64_t(&exp->refcnt);
+
+	pthread_mutex_lock(&retired_mutex);
+	glist_add_tail(&retired_exports, &exp->export.exp_list);
+	pthread_mutex_unlock(&retired_mutex);
+}
+
+/**
+ * @brief Publish the staged export set
+ *
+ * The new generation goes live in one short write critical section
+ * on the export tree; workers and the state async thread are never
+ * paused.  A request that already holds an export finishes against
+ * it, new lookups only see the new generation.
+ *
+ * An export whose configuration did not change keeps its live
+ * gsh_export, so its cache_inode entries, state and stats survive.
+ * An export whose options changed but which is backed by the same
+ * FSAL and path is replaced, but takes over the old FSAL export so
+ * the cached handles stay valid.  Replaced and removed exports are
+ * freed by reap_retired_exports() once they are idle.
+ *
+ * Only the admin thread changes the live tree, so the comparison
+ * pass runs under the read lock.
+ *
+ * @return The new generation number.
+ */
+
+uint64_t publish_staged_exports(void)
+{
+	struct avltree_node *node, *lnode, *next;
+	struct gsh_export *sexp, *lexp;
+	struct glist_head discard;
+	struct glist_head *glist, *glistn;
+	struct fsal_export *unused_hdl;
+	uint64_t generation;
+	void **cache_slot;
+	int kept = 0, replaced = 0, added = 0, removed = 0;
+
+	init_glist(&discard);
+
+	PTHREAD_RWLOCK_wrlock(&export_staged.lock);
+
+	/* Pass 1: decide what survives, off the request path */
+	PTHREAD_RWLOCK_rdlock(&export_by_id.lock);
+	node = avltree_first(&export_staged.t);
+	while(node != NULL) {
+		next = avltree_next(node);
+		sexp = avltree_container_of(node, struct gsh_export, node_k);
+		lnode = avltree_lookup(node, &export_by_id.t);
+		if(lnode == NULL) {
+			node = next;
+			continue;
+		}
+		lexp = avltree_container_of(lnode, struct gsh_export, node_k);
+		if(export_same_config(&lexp->export, &sexp->export)) {
+			/* Limits are applied in place, a change in them
+			   alone does not replace the export */
+			if(lexp->export.QoSOpsPerSec !=
+			   sexp->export.QoSOpsPerSec ||
+			   lexp->export.QoSBytesPerSec !=
+			   sexp->export.QoSBytesPerSec) {
+				lexp->export.QoSOpsPerSec =
+					sexp->export.QoSOpsPerSec;
+				lexp->export.QoSBytesPerSec =
+					sexp->export.QoSBytesPerSec;
+				nfs_qos_set(&lexp->qos,
+					    lexp->export.QoSOpsPerSec,
+					    lexp->export.QoSBytesPerSec);
+			}
+			avltree_remove(node, &export_staged.t);
+			glist_del(&sexp->export.exp_list);
+			glist_add_tail(&discard, &sexp->export.exp_list);
+			kept++;
+		} else if(export_same_backing(&lexp->export, &sexp->export)) {
+			unused_hdl = sexp->export.export_hdl;
+			sexp->export.export_hdl = lexp->export.export_hdl;
+			lexp->hdl_donated = true;
+			release_export_hdl(unused_hdl);
+		}
+		node = next;
+	}
+	PTHREAD_RWLOCK_unlock(&export_by_id.lock);
+
+	/* Pass 2: swap the generation in */
+	PTHREAD_RWLOCK_wrlock(&export_by_id.lock);
+	generation = ++export_generation;
+	glist_for_each(glist, &discard) {
+		sexp = glist_entry(glist, struct gsh_export, export.exp_list);
+		lnode = avltree_lookup(&sexp->node_k, &export_by_id.t);
+		lexp = avltree_container_of(lnode, struct gsh_export, node_k);
+		lexp->generation = generation;
+	}
+	while((node = avltree_first(&export_staged.t)) != NULL) {
+		avltree_remove(node, &export_staged.t);
+		sexp = avltree_container_of(node, struct gsh_export, node_k);
+		glist_del(&sexp->export.exp_list);
+		lnode = avltree_lookup(node, &export_by_id.t);
+		if(lnode != NULL) {
+			lexp = avltree_container_of(lnode, struct gsh_export,
+						    node_k);
+			/* Handles of the donated FSAL export now belong
+			   to the replacement's export entry */
+			if(lexp->hdl_donated)
+				sexp->export.export_hdl->exp_entry =
+					&sexp->export;
+			retire_live_export(lexp, generation);
+			replaced++;
+		} else {
+			added++;
+		}
+		sexp->generation = generation;
+		avltree_insert(node, &export_by_id.t);
+		cache_slot = (void **)
+			&(export_by_id.cache[eid_cache_offsetof(&export_by_id,
+								sexp->export_id)]);
+		atomic_store_voidptr(cache_slot, node);
+		glist_add_tail(nfs_param.pexportlist, &sexp->export.exp_list);
+	}
+	node = avltree_first(&export_by_id.t);
+	while(node != NULL) {
+		next = avltree_next(node);
+		lexp = avltree_container_of(node, struct gsh_export, node_k);
+		if(lexp->generation != generation) {
+			retire_live_export(lexp, generation);
+			removed++;
+		}
+		node = next;
+	}
+	PTHREAD_RWLOCK_unlock(&export_by_id.lock);
+	PTHREAD_RWLOCK_unlock(&export_staged.lock);
+
+	/* Pass 3: drop the duplicates of unchanged exports */
+	glist_for_each_safe(glist, glistn, &discard) {
+		sexp = glist_entry(glist, struct gsh_export, export.exp_list);
+		glist_del(glist);
+		free_export_resources(&sexp->export);
+		free_gsh_export(sexp);
+	}
+
+	LogEvent(COMPONENT_CONFIG,
+		 "Export generation %"PRIu64" published: %d kept, %d replaced, "
+		 "%d added, %d removed",
+		 generation, kept, replaced, added, removed);
+	return generation;
+}
+
+/**
+ * @brief Note the pseudo fs no longer points at older generations
+ *
+ * Called once nfs4_ExportToPseudoFS() has dropped the junctions to
+ * the exports a generation retired, so they may be freed.
+ *
+ * @param generation [IN] the generation the pseudo fs was built from
+ */
+
+void export_pseudofs_rebuilt(uint64_t generation)
+{
+	pthread_mutex_lock(&retired_mutex);
+	if(generation > pseudofs_generation)
+		pseudofs_generation = generation;
+	pthread_mutex_unlock(&retired_mutex);
+}
+
+/**
+ * @brief Free retired exports nobody uses any more
+ *
+ * An export is idle once no request holds a reference, no NFSv4
+ * state or lock still points at it and the pseudo fs no longer has
+ * a junction to it.  Called periodically by the reaper thread and at
+ * the end of each reload.
+ *
+ * @return Number of exports freed.
+ */
+
+int reap_retired_exports(void)
+{
+	struct glist_head reap;
+	struct glist_head *glist, *glistn;
+	struct gsh_export *exp;
+	bool busy;
+	int cnt = 0;
+
+	init_glist(&reap);
+
+	pthread_mutex_lock(&retired_mutex);
+	glist_for_each_safe(glist, glistn, &retired_exports) {
+		exp = glist_entry(glist, struct gsh_export, export.exp_list);
+		if(exp->retired_gen > pseudofs_generation ||
+		   atomic_fetch_int64_t(&exp->refcnt) > 0)
+			continue;
+		pthread_mutex_lock(&exp->export.exp_state_mutex);
+		busy = !glist_empty(&exp->export.exp_state_list) ||
+			!glist_empty(&exp->export.exp_lock_list);
+		pthread_mutex_unlock(&exp->export.exp_state_mutex);
+		if(busy)
+			continue;
+		glist_del(glist);
+		glist_add_tail(&reap, glist);
+	}
+	pthread_mutex_unlock(&retired_mutex);
+
+	glist_for_each_safe(glist, glistn, &reap) {
+		exp = glist_entry(glist, struct gsh_export, export.exp_list);
+		glist_del(glist);
+		LogDebug(COMPONENT_CONFIG,
+			 "Freeing retired export %d (%s)",
+			 exp->export_id, exp->export.fullpath);
+		if(exp->hdl_donated)
+			exp->export.export_hdl = NULL;
+		free_export_resources(&exp->export);
+		free_gsh_export(exp);
+		cnt++;
+	}
+	return cnt;
+}
+
 #ifdef USE_DBUS_STATS
 
 /* DBUS interfaces
@@ -663,11 +1059,93 @@ static struct gsh_dbus_method export_show_v41_layouts = {
 	}
 };
 
+/**
+ * DBUS method to report an export's rate limits
+ *
+ */
+
+static bool
+get_export_qos(DBusMessageIter *args,
+	       DBusMessage *reply)
+{
+	struct gsh_export *export = NULL;
+	bool success = true;
+	char *errormsg = "OK";
+	DBusMessageIter iter;
+
+	dbus_message_iter_init_append(reply, &iter);
+	export = lookup_export(args, &errormsg);
+	if(export == NULL)
+		success = false;
+	dbus_status_reply(&iter, success, errormsg);
+	if(success)
+		server_dbus_qos(&export->qos, &iter);
+
+	if(export != NULL)
+		put_gsh_export(export);
+	return true;
+}
+
+static struct gsh_dbus_method export_show_qos = {
+	.name = "GetQoS",
+	.method = get_export_qos,
+	.args = { EXPORT_ID_ARG,
+		  STATUS_REPLY,
+		  QOS_REPLY,
+		  END_ARG_LIST
+	}
+};
+
+/**
+ * DBUS method to change an export's rate limits
+ *
+ * The change lasts until a configuration reload changes the
+ * export's configured limits.
+ */
+
+static bool
+set_export_qos(DBusMessageIter *args,
+	       DBusMessage *reply)
+{
+	struct gsh_export *export = NULL;
+	uint64_t ops_rate, bytes_rate;
+	bool success = true;
+	char *errormsg = "OK";
+	DBusMessageIter iter;
+
+	dbus_message_iter_init_append(reply, &iter);
+	export = lookup_export(args, &errormsg);
+	if(export == NULL)
+		success = false;
+	else
+		success = server_dbus_qos_args(args, &ops_rate, &bytes_rate,
+					       &errormsg);
+	if(success)
+		nfs_qos_set(&export->qos, ops_rate, bytes_rate);
+	dbus_status_reply(&iter, success, errormsg);
+
+	if(export != NULL)
+		put_gsh_export(export);
+	return true;
+}
+
+static struct gsh_dbus_method export_set_qos = {
+	.name = "SetQoS",
+	.method = set_export_qos,
+	.args = { EXPORT_ID_ARG,
+		  QOS_ARGS,
+		  STATUS_REPLY,
+		  END_ARG_LIST
+	}
+};
+
 static struct gsh_dbus_method *export_stats_methods[] ={
 	&export_show_v3_io,
 	&export_show_v40_io,
 	&export_show_v41_io,
 	&export_show_v41_layouts,
+	&export_show_qos,
+	&export_set_qos,
 	NULL
 };
 
@@ -710,6 +1188,11 @@ void export_pkginit(void)
 	export_by_id.cache_sz = 255;
 	export_by_id.cache = gsh_calloc(export_by_id.cache_sz,
 					sizeof(struct avltree_node *));
+	pthread_rwlock_init(&export_staged.lock, &rwlock_attr);
+	avltree_init(&export_staged.t, export_id_cmpf, 0);
+	export_staged.cache = NULL;
+	export_staged.cache_sz = 0;
+	init_glist(&retired_exports);
 }
 
 /** @} */
@@ -55,9 +55,13 @@
 #include <strings.h>
 #include <ctype.h>
 #include "export_mgr.h"
+#include "abstract_atomic.h"
 
 extern struct fsal_up_vector fsal_up_top;
 
+/* Source of exportlist_t config_epoch values */
+static uint32_t export_config_epoch;
+
 #define LASTDEFAULT 1048576
 
 #define STRCMP strcasecmp
@@ -104,6 +108,8 @@ extern struct fsal_up_vector fsal_up_top;
 #define CONF_EXPORT_USE_COMMIT          "Use_NFS_Commit"
 #define CONF_EXPORT_USE_COOKIE_VERIFIER "UseCookieVerifier"
 #define CONF_EXPORT_CLIENT_DEF         "Client"
+#define CONF_EXPORT_QOS_OPS            "QoS_Ops_Per_Sec"
+#define CONF_EXPORT_QOS_BYTES          "QoS_Bytes_Per_Sec"
 
 /** @todo : add encrypt handles option */
 
@@ -140,6 +146,8 @@ extern struct fsal_up_vector fsal_up_top;
 #define FLAG_EXPORT_USE_UQUOTA      0x100000000
 #define FLAG_EXPORT_USE_COMMIT      0x200000000
 #define FLAG_EXPORT_USE_COOKIE_VERIFIER 0x400000000
+#define FLAG_EXPORT_QOS_OPS         0x800000000
+#define FLAG_EXPORT_QOS_BYTES       0x1000000000
 
 /* limites for nfs_ParseConfLine */
 /* Used in BuildExportEntry() */
@@ -1266,13 +1274,15 @@ static int BuildExportClient(config_item_t block,
  *
  * @param[in]  block     Export configuration block
  * @param[out] pp_export Export entry being built
+ * @param[in]  staged    Build into the reload staging tree
  *
  * @return 0 on success.
  */
 
 static int BuildExportEntry(config_item_t block,
 			    exportlist_t ** pp_export,
-                            struct glist_head  * pexportlist)
+                            struct glist_head  * pexportlist,
+			    bool staged)
 {
   exportlist_t *p_entry = NULL;
   exportlist_t * p_found_entry = NULL;
@@ -1316,7 +1326,10 @@ static int BuildExportEntry(config_item_t block,
 		     label, var_name,
 		     &err_flag, &export_id))
       return -1;
-  exp = get_gsh_export(export_id, false);
+  if(staged)
+    exp = get_staged_gsh_export(export_id);
+  else
+    exp = get_gsh_export(export_id, false);
   if(exp == NULL) /* gsh_calloc error */
     {
       LogCrit(COMPONENT_CONFIG,
@@ -1336,6 +1349,7 @@ static int BuildExportEntry(config_item_t block,
     {  /* initialize the exportlist part with the id */
       p_entry = &exp->export;
       p_entry->id = export_id;
+      p_entry->config_epoch = atomic_inc_uint32_t(&export_config_epoch);
       set_options &= ~FLAG_EXPORT_ID; /* to warn defined twice nicely */
       if(pthread_mutex_init(&p_entry->exp_state_mutex, NULL) == -1)
         {
@@ -1343,7 +1357,10 @@ static int BuildExportEntry(config_item_t block,
 		  "NFS READ %s: could not initialize exp_state_mutex",
 		  label);
 	  put_gsh_export(exp);
-	  remove_gsh_export(export_id);
+	  if(staged)
+	    remove_staged_gsh_export(export_id);
+	  else
+	    remove_gsh_export(export_id);
 	  return -1;
 	}
       p_entry->use_commit = true;
@@ -2190,6 +2207,32 @@ static int BuildExportEntry(config_item_t block,
 		  continue;
 	  p_entry->UseCookieVerifier = on;
         }
+      else if(!STRCMP(var_name, CONF_EXPORT_QOS_OPS))
+        {
+          int64_t rate;
+
+	  if( !parse_int64_t(var_value,
+			      0, INT64_MAX,
+			      &set_options, FLAG_EXPORT_QOS_OPS,
+			      label, var_name,
+			      &err_flag,
+			      &rate))
+		  continue;
+          p_entry->QoSOpsPerSec = rate;
+        }
+      else if(!STRCMP(var_name, CONF_EXPORT_QOS_BYTES))
+        {
+          int64_t rate;
+
+	  if( !parse_int64_t(var_value,
+			      0, INT64_MAX,
+			      &set_options, FLAG_EXPORT_QOS_BYTES,
+			      label, var_name,
+			      &err_flag,
+			      &rate))
+		  continue;
+          p_entry->QoSBytesPerSec = rate;
+        }
       else if(!STRCMP(var_name, CONF_EXPORT_SQUASH))
         {
           /* check if it has not already been set */
@@ -2422,12 +2465,17 @@ static int BuildExportEntry(config_item_t block,
 	      "NFS READ %s: Export %d (%s) had errors, ignoring entry",
 	      label, p_entry->id, p_entry->fullpath);
       put_gsh_export(exp);
-      remove_gsh_export(export_id);
+      if(staged)
+        remove_staged_gsh_export(export_id);
+      else
+        remove_gsh_export(export_id);
       return -1;
     }
 
   *pp_export = p_entry;
 
+  nfs_qos_set(&exp->qos, p_entry->QoSOpsPerSec, p_entry->QoSBytesPerSec);
+
   LogEvent(COMPONENT_CONFIG,
            "NFS READ %s: Export %d (%s) successfully parsed",
            label, p_entry->id, p_entry->fullpath);
@@ -2569,14 +2617,16 @@ exportlist_t *BuildDefaultExport()
 /**
  * @brief Read the export entries from the parsed configuration file.
  *
- * @param[in]  in_config    The file that contains the export list
+ * @param[in]  in_config   The file that contains the export list
  * @param[out] pexportlist The export list
+ * @param[in]  staged      Build into the reload staging tree
  *
  * @return A negative value on error,
  *         the number of export entries else.
  */
-int ReadExports(config_file_t in_config,        /* The file that contains the export list */
-                struct glist_head *pexportlist)   /* Pointer to the export list */
+static int read_exports(config_file_t in_config,
+			struct glist_head *pexportlist,
+			bool staged)
 {
 
   int nb_blk, rc, i;
@@ -2620,7 +2670,8 @@ int ReadExports(config_file_t in_config,        /* The file that contains the ex
 
           rc = BuildExportEntry(block,
                                 &p_export_item,
-                                pexportlist);
+                                pexportlist,
+                                staged);
 
           /* If the entry is errorneous, ignore it
            * and continue checking syntax of other entries.
@@ -2646,6 +2697,131 @@ int ReadExports(config_file_t in_config,        /* The file that contains the ex
     return nb_entries;
 }
 
+/**
+ * @brief Read the export entries from the parsed configuration file.
+ *
+ * @param[in]  in_config    The file that contains the export list
+ * @param[out] pexportlist The export list
+ *
+ * @return A negative value on error,
+ *         the number of export entries else.
+ */
+int ReadExports(config_file_t in_config,        /* The file that contains the export list */
+                struct glist_head *pexportlist)   /* Pointer to the export list */
+{
+  return read_exports(in_config, pexportlist, false);
+}
+
+/**
+ * @brief Read the export entries of a reload into the staging tree
+ *
+ * The live exports are not touched.  The caller either publishes the
+ * result with publish_staged_exports() or throws it away with
+ * abort_staged_exports().
+ *
+ * @param[in]  in_config   The file that contains the export list
+ * @param[out] pexportlist List to link the staged entries on
+ *
+ * @return A negative value on error,
+ *         the number of export entries else.
+ */
+int ReadStagedExports(config_file_t in_config,
+                      struct glist_head *pexportlist)
+{
+  return read_exports(in_config, pexportlist, true);
+}
+
+/**
+ * @brief Compare two client access lists entry by entry
+ */
+
+static bool same_client_list(exportlist_client_t *a,
+			     exportlist_client_t *b)
+{
+  struct glist_head *ga, *gb;
+  exportlist_client_entry_t *ca, *cb;
+
+  if(a->num_clients != b->num_clients)
+    return false;
+
+  for(ga = a->client_list.next, gb = b->client_list.next;
+      ga != &a->client_list && gb != &b->client_list;
+      ga = ga->next, gb = gb->next)
+    {
+      ca = glist_entry(ga, exportlist_client_entry_t, cle_list);
+      cb = glist_entry(gb, exportlist_client_entry_t, cle_list);
+      if(ca->type != cb->type ||
+         memcmp(&ca->client_perms, &cb->client_perms,
+                sizeof(export_perms_t)) != 0 ||
+         memcmp(&ca->client, &cb->client,
+                sizeof(exportlist_client_union_t)) != 0)
+        return false;
+    }
+  return ga == &a->client_list && gb == &b->client_list;
+}
+
+static bool same_string(const char *a, const char *b)
+{
+  if(a == NULL || b == NULL)
+    return a == b;
+  return strcmp(a, b) == 0;
+}
+
+/**
+ * @brief Do two export entries sit on the same FSAL object?
+ *
+ * Used by a reload to decide whether the cached handles of the old
+ * entry are valid for the new one.
+ *
+ * @param[in] a Live entry
+ * @param[in] b Staged entry
+ *
+ * @return true if FSAL, path and FSAL options are identical.
+ */
+
+bool export_same_backing(exportlist_t *a, exportlist_t *b)
+{
+  if(a->export_hdl == NULL || b->export_hdl == NULL)
+    return false;
+
+  return a->export_hdl->fsal == b->export_hdl->fsal &&
+    same_string(a->fullpath, b->fullpath) &&
+    same_string(a->FS_specific, b->FS_specific);
+}
+
+/**
+ * @brief Is a staged export identical to the live one?
+ *
+ * @param[in] a Live entry
+ * @param[in] b Staged entry
+ *
+ * @return true if a reload can keep the live entry as is.
+ */
+
+bool export_same_config(exportlist_t *a, exportlist_t *b)
+{
+  return export_same_backing(a, b) &&
+    same_string(a->pseudopath, b->pseudopath) &&
+    same_string(a->FS_tag, b->FS_tag) &&
+    a->access_type == b->access_type &&
+    a->new_access_list_version == b->new_access_list_version &&
+    a->filesystem_id.major == b->filesystem_id.major &&
+    a->filesystem_id.minor == b->filesystem_id.minor &&
+    memcmp(&a->export_perms, &b->export_perms,
+           sizeof(export_perms_t)) == 0 &&
+    a->use_commit == b->use_commit &&
+    a->MaxRead == b->MaxRead &&
+    a->MaxWrite == b->MaxWrite &&
+    a->PrefRead == b->PrefRead &&
+    a->PrefWrite == b->PrefWrite &&
+    a->PrefReaddir == b->PrefReaddir &&
+    a->MaxOffsetWrite == b->MaxOffsetWrite &&
+    a->MaxOffsetRead == b->MaxOffsetRead &&
+    a->MaxCacheSize == b->MaxCacheSize &&
+    a->UseCookieVerifier == b->UseCookieVerifier &&
+    same_client_list(&a->clients, &b->clients);
+}
+
 /**
  * @brief pkginit callback to initialize exports from nfs_init
  */
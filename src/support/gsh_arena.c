@@ -0,0 +1,225 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @addtogroup arena
+ * @{
+ */
+
+/**
+ * @file gsh_arena.c
+ * @brief Per-request arena allocator
+ */
+
+#include "config.h"
+#include <pthread.h>
+#include "gsh_arena.h"
+
+/**
+ * @brief Key binding a worker thread to its arena
+ */
+
+static pthread_key_t arena_key;
+static pthread_once_t arena_key_once = PTHREAD_ONCE_INIT;
+
+static void arena_key_init(void)
+{
+	(void) pthread_key_create(&arena_key, NULL);
+}
+
+/**
+ * @brief Initialize an arena
+ *
+ * No memory is allocated until the first gsh_arena_alloc().
+ *
+ * @param[out] arena      The arena
+ * @param[in]  chunk_size Minimum size of each chunk
+ * @param[in]  retain_max Largest chunk kept across gsh_arena_reset()
+ */
+
+void gsh_arena_init(struct gsh_arena *arena, size_t chunk_size,
+		    size_t retain_max)
+{
+	memset(arena, 0, sizeof(*arena));
+	arena->chunk_size = chunk_size;
+	arena->retain_max = retain_max;
+}
+
+/**
+ * @brief Free every chunk of an arena
+ *
+ * @param[in,out] arena The arena
+ */
+
+void gsh_arena_destroy(struct gsh_arena *arena)
+{
+	struct gsh_arena_chunk *chunk, *next;
+
+	for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		gsh_free(chunk);
+	}
+	arena->chunks = NULL;
+	arena->in_use = 0;
+}
+
+/**
+ * @brief Bump allocate from an arena
+ *
+ * Requests larger than the chunk size get a chunk of their own.
+ *
+ * @param[in,out] arena The arena
+ * @param[in]     align Power of two alignment
+ * @param[in]     n     Number of bytes
+ *
+ * @return Memory valid until the next reset, or NULL.
+ */
+
+void *gsh_arena_alloc_aligned(struct gsh_arena *arena, size_t align,
+			      size_t n)
+{
+	struct gsh_arena_chunk *chunk = arena->chunks;
+	uintptr_t base, start;
+	size_t need, size;
+
+	if (chunk != NULL) {
+		base = (uintptr_t) chunk->data + chunk->used;
+		start = (base + align - 1) & ~((uintptr_t) align - 1);
+		need = (start - base) + n;
+		if (chunk->size - chunk->used >= need)
+			goto out;
+	}
+
+	size = n + align;
+	if (size < arena->chunk_size)
+		size = arena->chunk_size;
+	chunk = gsh_malloc(sizeof(struct gsh_arena_chunk) + size);
+	if (chunk == NULL)
+		return NULL;
+	chunk->size = size;
+	chunk->used = 0;
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+	arena->chunk_allocs++;
+
+	base = (uintptr_t) chunk->data;
+	start = (base + align - 1) & ~((uintptr_t) align - 1);
+	need = (start - base) + n;
+
+out:
+	chunk->used += need;
+	arena->in_use += need;
+	arena->allocs++;
+	return (void *) start;
+}
+
+/**
+ * @brief Throw away everything allocated from an arena
+ *
+ * If the request fit in a single chunk, that chunk is kept.  If it
+ * spilled over several, they are replaced by one chunk big enough
+ * for the whole request (up to retain_max), so the next request of
+ * the same shape is served from a single chunk again.
+ *
+ * @param[in,out] arena The arena
+ */
+
+void gsh_arena_reset(struct gsh_arena *arena)
+{
+	struct gsh_arena_chunk *chunk, *next, *keep = arena->chunks;
+	size_t size = arena->in_use + arena->chunk_size;
+
+	if (arena->in_use > arena->high_water)
+		arena->high_water = arena->in_use;
+
+	if (keep != NULL && (keep->next != NULL ||
+			     keep->size > arena->retain_max)) {
+		for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+			next = chunk->next;
+			gsh_free(chunk);
+		}
+		keep = NULL;
+		if (size > arena->retain_max)
+			size = arena->retain_max;
+		if (arena->in_use <= size) {
+			keep = gsh_malloc(sizeof(struct gsh_arena_chunk) +
+					  size);
+			if (keep != NULL) {
+				keep->size = size;
+				keep->next = NULL;
+				arena->chunk_allocs++;
+			}
+		}
+	}
+	if (keep != NULL)
+		keep->used = 0;
+	arena->chunks = keep;
+	arena->in_use = 0;
+}
+
+/**
+ * @brief Does this pointer live in one of the arena's chunks?
+ *
+ * @param[in] arena The arena
+ * @param[in] p     The pointer
+ *
+ * @return true if p was handed out by the arena.
+ */
+
+bool gsh_arena_owns(const struct gsh_arena *arena, const void *p)
+{
+	const struct gsh_arena_chunk *chunk;
+	const char *cp = p;
+
+	for (chunk = arena->chunks; chunk != NULL; chunk = chunk->next) {
+		if (cp >= chunk->data && cp < chunk->data + chunk->size)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Bind an arena to the calling thread
+ *
+ * @param[in] arena The arena, or NULL to unbind
+ */
+
+void gsh_arena_set_current(struct gsh_arena *arena)
+{
+	(void) pthread_once(&arena_key_once, arena_key_init);
+	(void) pthread_setspecific(arena_key, arena);
+}
+
+/**
+ * @brief Get the arena bound to the calling thread
+ *
+ * @return The arena or NULL.
+ */
+
+struct gsh_arena *gsh_arena_current(void)
+{
+	(void) pthread_once(&arena_key_once, arena_key_init);
+	return pthread_getspecific(arena_key);
+}
+
+/** @} */
@@ -0,0 +1,439 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @addtogroup lock_profile
+ * @{
+ */
+
+/**
+ * @file lock_profile.c
+ * @brief Lock contention profiling
+ *
+ * The locks here are bare pthread calls, so that the profiler does
+ * not profile itself.  Sites are registered once and kept for the
+ * life of the server; two sites with the same file, line and kind,
+ * as an inline function in a header makes in each file that uses it,
+ * share an index.  A thread's counters are allocated in chunks as it
+ * reaches new sites and are folded into the retired counters when it
+ * exits.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lock_profile.h"
+
+/** Sites per chunk of a thread's counters */
+#define LOCK_PROF_CHUNK 64
+
+/** Locks a thread can be tracked as holding at once */
+#define LOCK_PROF_HELD 16
+
+/**
+ * @brief A lock a thread holds
+ */
+
+struct lock_prof_held {
+	void *lock;
+	int32_t id; /*< Site that took it */
+	uint32_t generation; /*< lock_prof_generation when taken */
+	uint64_t since;
+};
+
+/**
+ * @brief The counters of one thread
+ */
+
+struct lock_prof_thread {
+	struct lock_prof_thread *next;
+	struct lock_prof_thread *prev;
+	struct lock_prof_counts
+		*chunks[LOCK_PROF_MAX_SITES / LOCK_PROF_CHUNK];
+	int nheld;
+	struct lock_prof_held held[LOCK_PROF_HELD];
+};
+
+#ifdef USE_LOCK_PROFILE
+bool lock_prof_enabled = true;
+#else
+bool lock_prof_enabled;
+#endif
+
+/** Protects everything below */
+static pthread_mutex_t lock_prof_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/** Sites by index, from 1 */
+static struct lock_prof_site *lock_prof_sites[LOCK_PROF_MAX_SITES];
+static int32_t lock_prof_nsites;
+
+/** Every live thread with counters */
+static struct lock_prof_thread *lock_prof_threads;
+
+/** Counters of threads that have exited */
+static struct lock_prof_thread lock_prof_retired;
+
+/** Bumped by enable and reset, so older holds are not counted */
+static uint32_t lock_prof_generation;
+
+static pthread_key_t lock_prof_key;
+static pthread_once_t lock_prof_once = PTHREAD_ONCE_INIT;
+static __thread struct lock_prof_thread *lock_prof_self;
+
+uint64_t lock_prof_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void lock_prof_add(struct lock_prof_counts *to,
+			  const struct lock_prof_counts *from)
+{
+	to->acquired += from->acquired;
+	to->contended += from->contended;
+	to->wait_ns += from->wait_ns;
+	to->hold_ns += from->hold_ns;
+	if (from->wait_max > to->wait_max)
+		to->wait_max = from->wait_max;
+	if (from->hold_max > to->hold_max)
+		to->hold_max = from->hold_max;
+}
+
+/**
+ * @brief Fold an exiting thread's counters into the retired ones
+ */
+
+static void lock_prof_thread_exit(void *arg)
+{
+	struct lock_prof_thread *thr = arg;
+	int chunk, i;
+
+	lock_prof_self = NULL;
+	pthread_mutex_lock(&lock_prof_mtx);
+	for (chunk = 0; chunk < LOCK_PROF_MAX_SITES / LOCK_PROF_CHUNK;
+	     chunk++) {
+		if (thr->chunks[chunk] == NULL)
+			continue;
+		if (lock_prof_retired.chunks[chunk] == NULL) {
+			/* Hand the chunk over whole */
+			lock_prof_retired.chunks[chunk] = thr->chunks[chunk];
+			continue;
+		}
+		for (i = 0; i < LOCK_PROF_CHUNK; i++)
+			lock_prof_add(&lock_prof_retired.chunks[chunk][i],
+				      &thr->chunks[chunk][i]);
+		free(thr->chunks[chunk]);
+	}
+	if (thr->prev != NULL)
+		thr->prev->next = thr->next;
+	else
+		lock_prof_threads = thr->next;
+	if (thr->next != NULL)
+		thr->next->prev = thr->prev;
+	pthread_mutex_unlock(&lock_prof_mtx);
+	free(thr);
+}
+
+static void lock_prof_init(void)
+{
+	pthread_key_create(&lock_prof_key, lock_prof_thread_exit);
+}
+
+static struct lock_prof_thread *lock_prof_thread(void)
+{
+	struct lock_prof_thread *thr = lock_prof_self;
+
+	if (thr != NULL)
+		return thr;
+
+	pthread_once(&lock_prof_once, lock_prof_init);
+	thr = calloc(1, sizeof(*thr));
+	if (thr == NULL)
+		return NULL;
+	pthread_mutex_lock(&lock_prof_mtx);
+	thr->next = lock_prof_threads;
+	if (thr->next != NULL)
+		thr->next->prev = thr;
+	lock_prof_threads = thr;
+	pthread_mutex_unlock(&lock_prof_mtx);
+	pthread_setspecific(lock_prof_key, thr);
+	lock_prof_self = thr;
+	return thr;
+}
+
+/**
+ * @brief Give a site its index
+ *
+ * @return The index, or -1 if there is no room for the site.
+ */
+
+static int32_t lock_prof_register(struct lock_prof_site *site)
+{
+	int32_t id;
+
+	pthread_mutex_lock(&lock_prof_mtx);
+	id = site->id;
+	if (id != 0)
+		goto out;
+	for (id = 1; id <= lock_prof_nsites; id++) {
+		struct lock_prof_site *known = lock_prof_sites[id];
+
+		if (known->line == site->line && known->kind == site->kind &&
+		    strcmp(known->file, site->file) == 0)
+			goto found;
+	}
+	if (lock_prof_nsites == LOCK_PROF_MAX_SITES - 1) {
+		id = -1;
+		goto found;
+	}
+	id = ++lock_prof_nsites;
+	lock_prof_sites[id] = site;
+found:
+	__sync_synchronize();
+	site->id = id;
+out:
+	pthread_mutex_unlock(&lock_prof_mtx);
+	return id;
+}
+
+static struct lock_prof_counts *lock_prof_counts(struct lock_prof_thread *thr,
+						 int32_t id)
+{
+	struct lock_prof_counts **chunk = &thr->chunks[id / LOCK_PROF_CHUNK];
+	struct lock_prof_counts *counts;
+
+	if (*chunk == NULL) {
+		counts = calloc(LOCK_PROF_CHUNK, sizeof(*counts));
+		if (counts == NULL)
+			return NULL;
+		/* Published under the lock so a report or reset never
+		   sees a chunk being handed to the retired counters */
+		pthread_mutex_lock(&lock_prof_mtx);
+		*chunk = counts;
+		pthread_mutex_unlock(&lock_prof_mtx);
+	}
+	return &(*chunk)[id % LOCK_PROF_CHUNK];
+}
+
+/**
+ * @brief Record that a lock was taken
+ *
+ * @param[in] lock       The lock
+ * @param[in] site       Where it was taken
+ * @param[in] wait_start When waiting for it began, 0 if it was free
+ */
+
+void lock_prof_acquired(void *lock, struct lock_prof_site *site,
+			uint64_t wait_start)
+{
+	struct lock_prof_thread *thr = lock_prof_thread();
+	struct lock_prof_counts *counts;
+	struct lock_prof_held *held;
+	uint64_t now = lock_prof_now();
+	uint64_t wait;
+	int32_t id = site->id;
+
+	if (id == 0)
+		id = lock_prof_register(site);
+	if (id < 0 || thr == NULL)
+		return;
+	counts = lock_prof_counts(thr, id);
+	if (counts == NULL)
+		return;
+
+	counts->acquired++;
+	if (wait_start != 0) {
+		wait = now - wait_start;
+		counts->contended++;
+		counts->wait_ns += wait;
+		if (wait > counts->wait_max)
+			counts->wait_max = wait;
+	}
+
+	if (thr->nheld == LOCK_PROF_HELD) {
+		/* Forget the oldest, most likely released elsewhere */
+		memmove(&thr->held[0], &thr->held[1],
+			sizeof(thr->held[0]) * (LOCK_PROF_HELD - 1));
+		thr->nheld--;
+	}
+	held = &thr->held[thr->nheld++];
+	held->lock = lock;
+	held->id = id;
+	held->generation = lock_prof_generation;
+	held->since = now;
+}
+
+/**
+ * @brief Record that a lock is being released
+ *
+ * @param[in] lock The lock
+ */
+
+void lock_prof_released(void *lock)
+{
+	struct lock_prof_thread *thr = lock_prof_self;
+	struct lock_prof_counts *counts;
+	struct lock_prof_held held;
+	uint64_t hold;
+	int i;
+
+	if (thr == NULL)
+		return;
+	for (i = thr->nheld - 1; i >= 0; i--)
+		if (thr->held[i].lock == lock)
+			break;
+	if (i < 0)
+		return;
+
+	held = thr->held[i];
+	memmove(&thr->held[i], &thr->held[i + 1],
+		sizeof(thr->held[0]) * (thr->nheld - i - 1));
+	thr->nheld--;
+	if (held.generation != lock_prof_generation)
+		return;
+
+	counts = lock_prof_counts(thr, held.id);
+	if (counts == NULL)
+		return;
+	hold = lock_prof_now() - held.since;
+	counts->hold_ns += hold;
+	if (hold > counts->hold_max)
+		counts->hold_max = hold;
+}
+
+/**
+ * @brief Start or stop profiling
+ *
+ * Does nothing unless built with USE_LOCK_PROFILE.
+ */
+
+void lock_prof_enable(bool enable)
+{
+#ifdef USE_LOCK_PROFILE
+	__sync_fetch_and_add(&lock_prof_generation, 1);
+	lock_prof_enabled = enable;
+#endif
+}
+
+/**
+ * @brief Zero every counter
+ *
+ * Counts made by other threads while this runs may be lost.
+ */
+
+void lock_prof_reset(void)
+{
+	struct lock_prof_thread *thr;
+	int chunk;
+
+	pthread_mutex_lock(&lock_prof_mtx);
+	__sync_fetch_and_add(&lock_prof_generation, 1);
+	for (thr = &lock_prof_retired; thr != NULL;
+	     thr = thr == &lock_prof_retired ? lock_prof_threads : thr->next)
+		for (chunk = 0; chunk < LOCK_PROF_MAX_SITES / LOCK_PROF_CHUNK;
+		     chunk++)
+			if (thr->chunks[chunk] != NULL)
+				memset(thr->chunks[chunk], 0,
+				       sizeof(struct lock_prof_counts) *
+				       LOCK_PROF_CHUNK);
+	pthread_mutex_unlock(&lock_prof_mtx);
+}
+
+static int lock_prof_cmp(const void *a, const void *b)
+{
+	const struct lock_prof_report *ra = a;
+	const struct lock_prof_report *rb = b;
+
+	if (ra->counts.wait_ns != rb->counts.wait_ns)
+		return ra->counts.wait_ns < rb->counts.wait_ns ? 1 : -1;
+	if (ra->counts.contended != rb->counts.contended)
+		return ra->counts.contended < rb->counts.contended ? 1 : -1;
+	return ra->counts.hold_ns < rb->counts.hold_ns ? 1 :
+		ra->counts.hold_ns > rb->counts.hold_ns ? -1 : 0;
+}
+
+/**
+ * @brief Get the most contended sites
+ *
+ * Sites are ordered by time waited, then by times waited and time
+ * held.  Sites never reached are left out.
+ *
+ * @param[out] report Filled in with the sites
+ * @param[in]  max    Length of report
+ *
+ * @return The number of sites filled in, or -1 if out of memory.
+ */
+
+int lock_prof_top(struct lock_prof_report *report, int max)
+{
+	struct lock_prof_report *all;
+	struct lock_prof_thread *thr;
+	int32_t id, nsites;
+	int n = 0;
+
+	all = calloc(LOCK_PROF_MAX_SITES, sizeof(*all));
+	if (all == NULL)
+		return -1;
+
+	pthread_mutex_lock(&lock_prof_mtx);
+	nsites = lock_prof_nsites;
+	for (thr = &lock_prof_retired; thr != NULL;
+	     thr = thr == &lock_prof_retired ? lock_prof_threads : thr->next)
+		for (id = 1; id <= nsites; id++)
+			if (thr->chunks[id / LOCK_PROF_CHUNK] != NULL)
+				lock_prof_add(&all[id].counts,
+					      &thr->chunks[id / LOCK_PROF_CHUNK]
+					      [id % LOCK_PROF_CHUNK]);
+	for (id = 1; id <= nsites; id++) {
+		if (all[id].counts.acquired == 0)
+			continue;
+		all[id].site = lock_prof_sites[id];
+		all[n++] = all[id];
+	}
+	pthread_mutex_unlock(&lock_prof_mtx);
+
+	qsort(all, n, sizeof(*all), lock_prof_cmp);
+	if (n > max)
+		n = max;
+	memcpy(report, all, sizeof(*all) * n);
+	free(all);
+	return n;
+}
+
+const char *lock_prof_kind_name(enum lock_prof_kind kind)
+{
+	switch (kind) {
+	case LOCK_PROF_MUTEX:
+		return "mutex";
+	case LOCK_PROF_RDLOCK:
+		return "rdlock";
+	case LOCK_PROF_WRLOCK:
+		return "wrlock";
+	}
+	return "unknown";
+}
+
+/** @} */
@@ -4,12 +4,83 @@
 #include "HashTable.h"
 #include "log.h"
 #include "nfs4_acls.h"
+#include "abstract_atomic.h"
 #include <pthread.h>
 #include "lookup3.h"
 #include "city.h"
 
 pool_t *fsal_acl_pool;
 
+/*
+ * Compiled ACLs
+ *
+ * Checking access against an ACL walks its ACEs in order, and every
+ * ACE naming a group scans the caller's groups.  Since ACLs are shared
+ * through fsal_acl_hash, each one is compiled once, when it is created:
+ * ACEs that never take part in an access check (inherit only, neither
+ * ALLOW nor DENY, unknown special who) are dropped, the others are put
+ * in a list for files and a list for directories, and the groups they
+ * name are collected in a sorted array, so that the caller's groups
+ * are matched against them once per check rather than once per ACE.
+ *
+ * A compiled ACL also remembers its last few decisions, keyed by the
+ * caller's credentials, whether the caller owns the object or is in
+ * its group, the object type and the access asked for.  Credentials
+ * are compared by uid, gid and number of groups, and by a hash of the
+ * group list.
+ */
+
+#define ACL_WHO_OWNER    0
+#define ACL_WHO_GROUP    1
+#define ACL_WHO_EVERYONE 2
+#define ACL_WHO_UID      3
+#define ACL_WHO_GID      4
+
+/* Most distinct named groups in a compiled ACL */
+#define ACL_COMPILED_MAX_GIDS 1024
+
+/* Decisions remembered per ACL */
+#define ACL_DECISION_BITS 4
+#define ACL_DECISION_SLOTS (1 << ACL_DECISION_BITS)
+
+#define ACL_DEC_VALID   0x01
+#define ACL_DEC_OWNER   0x02
+#define ACL_DEC_GROUP   0x04
+#define ACL_DEC_DIR     0x08
+#define ACL_DEC_GRANTED 0x10
+
+struct acl_cace
+{
+  fsal_aceperm_t perm;
+  bool allow;
+  uint8_t who;                  /* ACL_WHO_* */
+  uint32_t id;                  /* uid, or index in gids for ACL_WHO_GID */
+};
+
+struct acl_decision
+{
+  uint64_t fingerprint;         /* Hash of the caller's groups */
+  uid_t uid;
+  gid_t gid;
+  uint32_t glen;
+  fsal_aceperm_t mask;
+  uint8_t flags;                /* ACL_DEC_* */
+};
+
+struct fsal_acl_compiled
+{
+  struct acl_cace *file_aces;   /* ACEs applying to files, in order */
+  struct acl_cace *dir_aces;    /* ACEs applying to directories */
+  uint32_t nfile;
+  uint32_t ndir;
+  fsal_aceperm_t file_allowed;  /* Union of the ALLOW masks */
+  fsal_aceperm_t dir_allowed;
+  gid_t *gids;                  /* Named groups, sorted */
+  uint32_t ngids;
+  pthread_spinlock_t lock;      /* Protects decisions */
+  struct acl_decision decisions[ACL_DECISION_SLOTS];
+};
+
 static int fsal_acl_hash_both(hash_parameter_t *,
                               struct gsh_buffdesc *,
                               uint32_t *,
@@ -88,6 +159,296 @@ void nfs4_ace_free(fsal_ace_t *ace)
   gsh_free(ace);
 }
 
+static void nfs4_acl_compiled_free(struct fsal_acl_compiled *cacl)
+{
+  gsh_free(cacl->file_aces);
+  gsh_free(cacl->dir_aces);
+  gsh_free(cacl->gids);
+  gsh_free(cacl);
+}
+
+static int nfs4_acl_gid_cmp(const void *a, const void *b)
+{
+  gid_t ga = *(const gid_t *)a;
+  gid_t gb = *(const gid_t *)b;
+
+  return (ga > gb) - (ga < gb);
+}
+
+/**
+ * @brief Compile an ACL for access checks
+ *
+ * @param[in] acl The ACL, with its ACEs set
+ *
+ * @return The compiled form, or NULL if the ACL cannot be compiled
+ *         and access checks must walk its ACEs.
+ */
+static struct fsal_acl_compiled *nfs4_acl_compile(fsal_acl_t *acl)
+{
+  struct fsal_acl_compiled *cacl;
+  struct acl_cace cace;
+  fsal_ace_t *pace;
+  gid_t *found;
+  uint32_t n = 0, i;
+  size_t len = acl->naces ? acl->naces : 1;
+
+  cacl = gsh_calloc(1, sizeof(*cacl));
+  if(cacl == NULL)
+    return NULL;
+
+  cacl->file_aces = gsh_calloc(len, sizeof(struct acl_cace));
+  cacl->dir_aces = gsh_calloc(len, sizeof(struct acl_cace));
+  cacl->gids = gsh_calloc(len, sizeof(gid_t));
+  if(cacl->file_aces == NULL || cacl->dir_aces == NULL ||
+     cacl->gids == NULL)
+    goto fail;
+
+  for(pace = acl->aces; pace < acl->aces + acl->naces; pace++)
+    if((IS_FSAL_ACE_ALLOW(*pace) || IS_FSAL_ACE_DENY(*pace)) &&
+       !IS_FSAL_ACE_SPECIAL_ID(*pace) && IS_FSAL_ACE_GROUP_ID(*pace))
+      cacl->gids[n++] = pace->who.gid;
+
+  qsort(cacl->gids, n, sizeof(gid_t), nfs4_acl_gid_cmp);
+  for(i = 0; i < n; i++)
+    if(cacl->ngids == 0 || cacl->gids[cacl->ngids - 1] != cacl->gids[i])
+      cacl->gids[cacl->ngids++] = cacl->gids[i];
+  if(cacl->ngids > ACL_COMPILED_MAX_GIDS)
+    goto fail;
+
+  for(pace = acl->aces; pace < acl->aces + acl->naces; pace++)
+    {
+      if(!(IS_FSAL_ACE_ALLOW(*pace) || IS_FSAL_ACE_DENY(*pace)) ||
+         IS_FSAL_ACE_INHERIT_ONLY(*pace))
+        continue;
+
+      if(IS_FSAL_ACE_SPECIAL_ID(*pace))
+        {
+          switch(pace->who.uid)
+            {
+              case FSAL_ACE_SPECIAL_OWNER:
+                cace.who = ACL_WHO_OWNER;
+                break;
+
+              case FSAL_ACE_SPECIAL_GROUP:
+                cace.who = ACL_WHO_GROUP;
+                break;
+
+              case FSAL_ACE_SPECIAL_EVERYONE:
+                cace.who = ACL_WHO_EVERYONE;
+                break;
+
+              default:
+                /* Matches nobody */
+                continue;
+            }
+          cace.id = 0;
+        }
+      else if(IS_FSAL_ACE_GROUP_ID(*pace))
+        {
+          found = bsearch(&pace->who.gid, cacl->gids, cacl->ngids,
+                          sizeof(gid_t), nfs4_acl_gid_cmp);
+          cace.who = ACL_WHO_GID;
+          cace.id = found - cacl->gids;
+        }
+      else
+        {
+          cace.who = ACL_WHO_UID;
+          cace.id = pace->who.uid;
+        }
+
+      cace.perm = pace->perm;
+      cace.allow = IS_FSAL_ACE_ALLOW(*pace);
+
+      if(IS_FSAL_FILE_APPLICABLE(*pace))
+        {
+          cacl->file_aces[cacl->nfile++] = cace;
+          if(cace.allow)
+            cacl->file_allowed |= cace.perm;
+        }
+      if(IS_FSAL_DIR_APPLICABLE(*pace))
+        {
+          cacl->dir_aces[cacl->ndir++] = cace;
+          if(cace.allow)
+            cacl->dir_allowed |= cace.perm;
+        }
+    }
+
+  if(pthread_spin_init(&cacl->lock, PTHREAD_PROCESS_PRIVATE) != 0)
+    goto fail;
+
+  return cacl;
+
+ fail:
+  nfs4_acl_compiled_free(cacl);
+  return NULL;
+}
+
+static void nfs4_acl_mark_member(struct fsal_acl_compiled *cacl,
+                                 uint64_t *member, gid_t gid)
+{
+  gid_t *found = bsearch(&gid, cacl->gids, cacl->ngids, sizeof(gid_t),
+                         nfs4_acl_gid_cmp);
+
+  if(found != NULL)
+    member[(found - cacl->gids) / 64] |= 1ULL << ((found - cacl->gids) % 64);
+}
+
+/**
+ * @brief Evaluate a compiled ACL
+ *
+ * Gives the same answer as walking the ACEs in access_check.c.
+ */
+static bool nfs4_acl_eval(struct fsal_acl_compiled *cacl,
+                          struct user_cred *creds,
+                          bool is_owner, bool is_group, bool is_dir,
+                          fsal_aceperm_t v4mask)
+{
+  uint64_t member[ACL_COMPILED_MAX_GIDS / 64];
+  struct acl_cace *cace, *end;
+  fsal_aceperm_t missing = v4mask;
+  bool matches;
+  uint32_t i;
+
+  /* Access no ACE allows is denied whatever the order */
+  if(v4mask & ~(is_dir ? cacl->dir_allowed : cacl->file_allowed))
+    return false;
+
+  if(cacl->ngids != 0)
+    {
+      memset(member, 0, ((cacl->ngids + 63) / 64) * sizeof(uint64_t));
+      nfs4_acl_mark_member(cacl, member, creds->caller_gid);
+      for(i = 0; i < creds->caller_glen; i++)
+        nfs4_acl_mark_member(cacl, member, creds->caller_garray[i]);
+    }
+
+  cace = is_dir ? cacl->dir_aces : cacl->file_aces;
+  end = cace + (is_dir ? cacl->ndir : cacl->nfile);
+  for(; cace < end; cace++)
+    {
+      switch(cace->who)
+        {
+          case ACL_WHO_OWNER:
+            matches = is_owner;
+            break;
+
+          case ACL_WHO_GROUP:
+            matches = is_group;
+            break;
+
+          case ACL_WHO_EVERYONE:
+            matches = true;
+            break;
+
+          case ACL_WHO_UID:
+            matches = creds->caller_uid == cace->id;
+            break;
+
+          default:
+            matches = (member[cace->id / 64] >> (cace->id % 64)) & 1;
+            break;
+        }
+
+      if(!matches)
+        continue;
+
+      if(cace->allow)
+        {
+          missing &= ~cace->perm;
+          if(!missing)
+            return true;
+        }
+      else if(cace->perm & missing)
+        return false;
+    }
+
+  return !missing;
+}
+
+/**
+ * @brief Check access against an ACL through its compiled form
+ *
+ * @param[in]  acl      The ACL
+ * @param[in]  creds    Caller's credentials
+ * @param[in]  is_owner Whether the caller owns the object
+ * @param[in]  is_group Whether the caller is in the object's group
+ * @param[in]  is_dir   Whether the object is a directory
+ * @param[in]  v4mask   Access asked for, not empty
+ * @param[out] granted  Whether it is granted
+ *
+ * @return false if the ACL is not compiled; the caller must then walk
+ *         its ACEs.
+ */
+bool nfs4_acl_check(fsal_acl_t *acl, struct user_cred *creds,
+                    bool is_owner, bool is_group, bool is_dir,
+                    fsal_aceperm_t v4mask, bool *granted)
+{
+  struct fsal_acl_compiled *cacl = acl->compiled;
+  struct acl_decision *dec;
+  uint64_t fingerprint;
+  uint8_t flags;
+
+  if(cacl == NULL)
+    return false;
+
+  fingerprint = CityHash64WithSeed((char *)creds->caller_garray,
+                                   creds->caller_glen * sizeof(gid_t),
+                                   ((uint64_t) creds->caller_uid << 32) |
+                                   creds->caller_gid);
+  flags = ACL_DEC_VALID |
+          (is_owner ? ACL_DEC_OWNER : 0) |
+          (is_group ? ACL_DEC_GROUP : 0) |
+          (is_dir ? ACL_DEC_DIR : 0);
+  dec = &cacl->decisions[((fingerprint ^ ((uint64_t) v4mask << 8) ^ flags) *
+                          0x9e3779b97f4a7c15ULL) >> (64 - ACL_DECISION_BITS)];
+
+  pthread_spin_lock(&cacl->lock);
+  if((dec->flags & ~ACL_DEC_GRANTED) == flags &&
+     dec->fingerprint == fingerprint &&
+     dec->uid == creds->caller_uid &&
+     dec->gid == creds->caller_gid &&
+     dec->glen == creds->caller_glen &&
+     dec->mask == v4mask)
+    {
+      *granted = (dec->flags & ACL_DEC_GRANTED) != 0;
+      pthread_spin_unlock(&cacl->lock);
+      return true;
+    }
+  pthread_spin_unlock(&cacl->lock);
+
+  *granted = nfs4_acl_eval(cacl, creds, is_owner, is_group, is_dir, v4mask);
+
+  pthread_spin_lock(&cacl->lock);
+  dec->fingerprint = fingerprint;
+  dec->uid = creds->caller_uid;
+  dec->gid = creds->caller_gid;
+  dec->glen = creds->caller_glen;
+  dec->mask = v4mask;
+  dec->flags = flags | (*granted ? ACL_DEC_GRANTED : 0);
+  pthread_spin_unlock(&cacl->lock);
+
+  return true;
+}
+
+/* Bytes held by the ACLs in fsal_acl_hash.  An ACL shared by many
+   entries is counted once, from its insertion until its last
+   reference goes. */
+static uint64_t nfs4_acl_mem_bytes;
+
+static inline size_t nfs4_acl_size(fsal_acl_t *acl)
+{
+  return sizeof(fsal_acl_t) + acl->naces * sizeof(fsal_ace_t);
+}
+
+/**
+ * @brief Memory held by deduplicated ACLs
+ *
+ * @return Approximate bytes.
+ */
+uint64_t nfs4_acl_mem_usage(void)
+{
+  return atomic_fetch_uint64_t(&nfs4_acl_mem_bytes);
+}
+
 static void nfs4_acl_free(fsal_acl_t *acl)
 {
   if(!acl)
@@ -96,6 +457,13 @@ static void nfs4_acl_free(fsal_acl_t *acl)
   if(acl->aces)
     nfs4_ace_free(acl->aces);
 
+  if(acl->compiled)
+    {
+      pthread_spin_destroy(&acl->compiled->lock);
+      nfs4_acl_compiled_free(acl->compiled);
+      acl->compiled = NULL;
+    }
+
   pool_free(fsal_acl_pool, acl);
  }
 
@@ -181,6 +549,12 @@ fsal_acl_t *nfs4_acl_new_entry(fsal_acl_data_t *acldata, fsal_acl_status_t *stat
   acl->aces  = acldata->aces;
   acl->ref   = 1;               /* We give out one reference */
 
+  /* Without a compiled form access checks walk the ACEs */
+  acl->compiled = nfs4_acl_compile(acl);
+  if(acl->compiled == NULL)
+    LogDebug(COMPONENT_NFS_V4_ACL,
+             "ACL %p with %u ACEs not compiled", acl, acl->naces);
+
   /* Build the value */
   value.addr = acl;
   value.len = sizeof(fsal_acl_t);
@@ -205,6 +579,8 @@ fsal_acl_t *nfs4_acl_new_entry(fsal_acl_data_t *acldata, fsal_acl_status_t *stat
       return NULL;
     }
 
+  (void) atomic_add_uint64_t(&nfs4_acl_mem_bytes, nfs4_acl_size(acl));
+
   return acl;
 }
 
@@ -284,6 +660,8 @@ void nfs4_acl_release_entry(fsal_acl_t *acl, fsal_acl_status_t *status)
 
   PTHREAD_RWLOCK_unlock(&acl->lock);
 
+  (void) atomic_sub_uint64_t(&nfs4_acl_mem_bytes, nfs4_acl_size(acl));
+
   /* Release acl */
   nfs4_acl_free(acl);
 }
@@ -0,0 +1,167 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @addtogroup nfs_qos
+ * @{
+ */
+
+/**
+ * @file nfs_qos.c
+ * @brief Token buckets for per export and per client rate limits
+ */
+
+#include "config.h"
+#include <string.h>
+#include "nfs_qos.h"
+
+bool nfs_qos_enabled;
+
+static void bucket_set(struct nfs_qos_bucket *b, uint64_t rate)
+{
+	b->rate = rate;
+	/* Start full, and forget any debt run up at the old rate */
+	b->tokens = rate;
+	b->last = 0;
+}
+
+/**
+ * @brief Take tokens from a bucket
+ *
+ * @return How long the caller must wait for the bucket to be out of
+ *         debt.
+ */
+
+static nsecs_elapsed_t bucket_take(struct nfs_qos_bucket *b, uint64_t cost,
+				   nsecs_elapsed_t now)
+{
+	if (b->rate == 0)
+		return 0;
+
+	/* Refill, up to one second's worth.  The clock is read before
+	   the lock is taken, so it may seem to go back a little. */
+	if (b->last == 0)
+		b->last = now;
+	if (now > b->last) {
+		b->tokens += (double)(now - b->last) * b->rate / NS_PER_SEC;
+		if (b->tokens > b->rate)
+			b->tokens = b->rate;
+		b->last = now;
+	}
+
+	b->tokens -= cost;
+	if (b->tokens >= 0)
+		return 0;
+	return (nsecs_elapsed_t) (-b->tokens * NS_PER_SEC / b->rate);
+}
+
+/**
+ * @brief Initialize the limits of a new export or client
+ *
+ * @param[out] qos        Limits to initialize
+ * @param[in]  ops_rate   Requests per second, 0 for no limit
+ * @param[in]  bytes_rate Bytes per second, 0 for no limit
+ */
+
+void nfs_qos_init(struct nfs_qos *qos, uint64_t ops_rate,
+		  uint64_t bytes_rate)
+{
+	memset(qos, 0, sizeof(*qos));
+	pthread_mutex_init(&qos->mtx, NULL);
+	nfs_qos_set(qos, ops_rate, bytes_rate);
+}
+
+/**
+ * @brief Change the limits of an export or client
+ *
+ * Requests already deferred keep the time they were given.
+ *
+ * @param[in,out] qos        Limits to change
+ * @param[in]     ops_rate   Requests per second, 0 for no limit
+ * @param[in]     bytes_rate Bytes per second, 0 for no limit
+ */
+
+void nfs_qos_set(struct nfs_qos *qos, uint64_t ops_rate,
+		 uint64_t bytes_rate)
+{
+	pthread_mutex_lock(&qos->mtx);
+	bucket_set(&qos->ops, ops_rate);
+	bucket_set(&qos->bytes, bytes_rate);
+	pthread_mutex_unlock(&qos->mtx);
+
+	if (ops_rate != 0 || bytes_rate != 0)
+		nfs_qos_enabled = true;
+}
+
+/**
+ * @brief Read the limits and counters of an export or client
+ */
+
+void nfs_qos_get(struct nfs_qos *qos, uint64_t *ops_rate,
+		 uint64_t *bytes_rate, uint64_t *deferred,
+		 nsecs_elapsed_t *deferred_ns)
+{
+	pthread_mutex_lock(&qos->mtx);
+	*ops_rate = qos->ops.rate;
+	*bytes_rate = qos->bytes.rate;
+	*deferred = qos->deferred;
+	*deferred_ns = qos->deferred_ns;
+	pthread_mutex_unlock(&qos->mtx);
+}
+
+/**
+ * @brief Charge a request to an export or client
+ *
+ * @param[in,out] qos   Limits to charge
+ * @param[in]     bytes Bytes the request reads or writes
+ * @param[in]     now   Current time, in nanoseconds since any epoch
+ *                      but 0
+ *
+ * @return How long the request must be deferred, 0 if not at all.
+ */
+
+nsecs_elapsed_t nfs_qos_charge(struct nfs_qos *qos, uint64_t bytes,
+			       nsecs_elapsed_t now)
+{
+	nsecs_elapsed_t delay, bytes_delay;
+
+	if (!nfs_qos_limited(qos))
+		return 0;
+
+	pthread_mutex_lock(&qos->mtx);
+	delay = bucket_take(&qos->ops, 1, now);
+	if (bytes != 0) {
+		bytes_delay = bucket_take(&qos->bytes, bytes, now);
+		if (bytes_delay > delay)
+			delay = bytes_delay;
+	}
+	if (delay != 0) {
+		qos->deferred++;
+		qos->deferred_ns += delay;
+	}
+	pthread_mutex_unlock(&qos->mtx);
+
+	return delay;
+}
+
+/** @} */
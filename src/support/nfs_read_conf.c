@@ -337,6 +337,22 @@ int nfs_read_core_conf(config_file_t in_config,
         {
           pparam->enable_RQUOTA = StrToBoolean(key_value);
         }
+      else if(!strcasecmp(key_name, "Zero_Copy_Read"))
+        {
+          pparam->zero_copy_read = StrToBoolean(key_value);
+        }
+      else if(!strcasecmp(key_name, "NUMA_Local_Pools"))
+        {
+          pparam->numa_local_pools = StrToBoolean(key_value);
+        }
+      else if(!strcasecmp(key_name, "QoS_Client_Ops_Per_Sec"))
+        {
+          pparam->qos_client_ops = strtoull(key_value, NULL, 10);
+        }
+      else if(!strcasecmp(key_name, "QoS_Client_Bytes_Per_Sec"))
+        {
+          pparam->qos_client_bytes = strtoull(key_value, NULL, 10);
+        }
       else
         {
           LogCrit(COMPONENT_CONFIG,
@@ -630,6 +646,24 @@ int nfs_read_version4_conf(config_file_t in_config,
         {
           pparam->allow_numeric_owners = StrToBoolean(key_value);
         }
+      else if(!strcasecmp(key_name, "Lift_Grace_Early"))
+        {
+          pparam->lift_grace_early = StrToBoolean(key_value);
+        }
+      else if(!strcasecmp(key_name, "Recovery_Backend"))
+        {
+          if(!strcasecmp(key_value, "fs"))
+            pparam->recovery_backend = RECOVERY_BACKEND_FS;
+          else if(!strcasecmp(key_value, "journal"))
+            pparam->recovery_backend = RECOVERY_BACKEND_JOURNAL;
+          else
+            {
+              LogCrit(COMPONENT_CONFIG,
+                      "Invalid value for %s: %s (expected fs or journal)",
+                      key_name, key_value);
+              return -1;
+            }
+        }
       else
         {
           LogCrit(COMPONENT_CONFIG,
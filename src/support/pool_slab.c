@@ -0,0 +1,789 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @addtogroup pool_slab
+ * @{
+ */
+
+/**
+ * @file pool_slab.c
+ * @brief Slab pool substrate
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "nlm_list.h"
+#include "abstract_atomic.h"
+#include "pool_slab.h"
+
+/** Most NUMA nodes given slab lists of their own */
+#define SLAB_MAX_NODES 64
+
+/** Fewest objects a slab is made to hold */
+#define SLAB_MIN_OBJS 8
+
+/** Full magazines the depot holds before objects go back to slabs */
+#define SLAB_DEPOT_MAX 64
+
+/** Full and empty magazines a trim leaves in the depot */
+#define SLAB_DEPOT_LOW 4
+
+/** Slab headers are padded to this */
+#define SLAB_CACHE_LINE 64
+
+struct slab_node;
+
+/**
+ * @brief Header at the start of every slab
+ */
+struct slab {
+	struct glist_head sb_list; /*< On its node's partial or full list */
+	struct slab_node *sb_home; /*< Node whose lists hold this slab */
+	void *sb_free; /*< Free objects, linked through their first word */
+	uint32_t sb_nfree; /*< Length of sb_free */
+};
+
+/**
+ * @brief The slabs of one NUMA node
+ */
+struct slab_node {
+	pthread_mutex_t sn_mutex;
+	struct glist_head sn_partial; /*< Slabs with some objects free */
+	struct glist_head sn_full; /*< Slabs with none free */
+	struct slab *sn_empty; /*< One slab with all free, kept for reuse */
+	uint64_t sn_slabs; /*< Slabs on this node */
+	uint64_t sn_nfree; /*< Free objects in those slabs */
+} __attribute__((aligned(SLAB_CACHE_LINE)));
+
+/**
+ * @brief A stack of free objects
+ */
+struct slab_magazine {
+	struct glist_head mg_list; /*< In the depot */
+	uint32_t mg_rounds; /*< Objects in mg_objs */
+	void *mg_objs[]; /*< sp_mag_size of them */
+};
+
+/**
+ * @brief What one thread keeps of one pool
+ */
+struct slab_tcache {
+	struct glist_head tc_list; /*< On the pool's sp_tcaches */
+	struct slab_pool *tc_pool;
+	struct slab_node *tc_home; /*< Node new objects come from */
+	struct slab_magazine *tc_loaded; /*< Allocated from and freed to */
+	struct slab_magazine *tc_prev; /*< Full or empty, swapped in */
+};
+
+/**
+ * @brief Substrate data of a slab pool, after its pool_t
+ */
+struct slab_pool {
+	pool_t *sp_pool;
+	size_t sp_stride; /*< Object size rounded to POOL_SLAB_ALIGN */
+	size_t sp_slab_size;
+	uintptr_t sp_mask; /*< Clears the offset of an object in its slab */
+	uint32_t sp_hdr; /*< Offset of the first object */
+	uint32_t sp_objs; /*< Objects per slab */
+	uint32_t sp_mag_size;
+	uint32_t sp_nnodes;
+	struct slab_node *sp_nodes;
+	bool sp_have_key; /*< Without a key threads go straight to slabs */
+	pthread_key_t sp_key; /*< The calling thread's slab_tcache */
+	pthread_mutex_t sp_mutex; /*< Protects the depot and sp_tcaches */
+	struct glist_head sp_full; /*< Full magazines */
+	struct glist_head sp_empty; /*< Empty magazines */
+	uint32_t sp_nfull;
+	uint32_t sp_nempty;
+	uint32_t sp_idle; /*< Fewest full magazines since the last trim */
+	struct glist_head sp_tcaches;
+	struct glist_head sp_pools; /*< On slab_pools */
+	uint64_t sp_slab_allocs;
+	uint64_t sp_slab_frees;
+	uint64_t sp_misses;
+};
+
+struct pool_slab_params pool_slab_defaults = {
+	.slab_size = POOL_SLAB_SIZE,
+	.magazine_size = POOL_SLAB_MAGAZINE,
+	.numa_local = false
+};
+
+/** Every slab pool, for pool_slab_foreach */
+static struct glist_head slab_pools = {&slab_pools, &slab_pools};
+static pthread_mutex_t slab_pools_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t slab_numa_nodes;
+static pthread_once_t slab_numa_once = PTHREAD_ONCE_INIT;
+
+static inline struct slab_pool *slab_pool(pool_t *pool)
+{
+	return (struct slab_pool *)pool->substrate_data;
+}
+
+/**
+ * @brief Count the NUMA nodes from sysfs
+ *
+ * Without sysfs, or on a machine with one node, every pool keeps a
+ * single slab list.
+ */
+
+static void slab_numa_init(void)
+{
+	DIR *dir = opendir("/sys/devices/system/node");
+	struct dirent *dent;
+	unsigned int node;
+
+	slab_numa_nodes = 1;
+	if (dir == NULL)
+		return;
+	while ((dent = readdir(dir)) != NULL) {
+		if (sscanf(dent->d_name, "node%u", &node) == 1 &&
+		    node < SLAB_MAX_NODES && node >= slab_numa_nodes)
+			slab_numa_nodes = node + 1;
+	}
+	closedir(dir);
+}
+
+/**
+ * @brief The slab list for the node the calling thread runs on
+ */
+
+static struct slab_node *slab_local_node(struct slab_pool *sp)
+{
+	unsigned int cpu, node = 0;
+
+	if (sp->sp_nnodes > 1 &&
+	    syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+		return &sp->sp_nodes[node % sp->sp_nnodes];
+	return &sp->sp_nodes[0];
+}
+
+/**
+ * @brief Map a new slab and thread its objects on the free list
+ *
+ * The mapping is over-sized and trimmed so the slab is aligned to its
+ * size.  Building the free list writes to every page, so they are
+ * placed on the node of the calling thread.
+ */
+
+static struct slab *slab_create(struct slab_pool *sp, struct slab_node *sn)
+{
+	size_t size = sp->sp_slab_size;
+	char *map, *base, *obj;
+	uintptr_t lead;
+	struct slab *slab;
+	uint32_t i;
+
+	map = mmap(NULL, 2 * size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED)
+		return NULL;
+	lead = (size - ((uintptr_t) map & (size - 1))) & (size - 1);
+	base = map + lead;
+	if (lead != 0)
+		(void) munmap(map, lead);
+	(void) munmap(base + size, size - lead);
+
+	slab = (struct slab *)base;
+	slab->sb_home = sn;
+	slab->sb_free = NULL;
+	slab->sb_nfree = sp->sp_objs;
+	for (i = sp->sp_objs; i > 0; i--) {
+		obj = base + sp->sp_hdr + (i - 1) * sp->sp_stride;
+		*(void **)obj = slab->sb_free;
+		slab->sb_free = obj;
+	}
+	atomic_inc_uint64_t(&sp->sp_slab_allocs);
+	return slab;
+}
+
+static void slab_release(struct slab_pool *sp, struct slab *slab)
+{
+	(void) munmap(slab, sp->sp_slab_size);
+	atomic_inc_uint64_t(&sp->sp_slab_frees);
+}
+
+/**
+ * @brief Take objects from the slabs of a node
+ *
+ * @param[in]  sp   The pool
+ * @param[in]  sn   The node
+ * @param[out] objs Where to put the objects
+ * @param[in]  n    How many to take
+ *
+ * @return The number taken, less than n only if no slab could be made.
+ */
+
+static uint32_t slab_get(struct slab_pool *sp, struct slab_node *sn,
+			 void **objs, uint32_t n)
+{
+	struct slab *slab;
+	uint32_t got = 0, taken;
+
+	pthread_mutex_lock(&sn->sn_mutex);
+	while (got < n) {
+		slab = glist_first_entry(&sn->sn_partial, struct slab,
+					 sb_list);
+		if (slab == NULL && sn->sn_empty != NULL) {
+			slab = sn->sn_empty;
+			sn->sn_empty = NULL;
+			glist_add(&sn->sn_partial, &slab->sb_list);
+		}
+		if (slab == NULL) {
+			pthread_mutex_unlock(&sn->sn_mutex);
+			slab = slab_create(sp, sn);
+			pthread_mutex_lock(&sn->sn_mutex);
+			if (slab == NULL)
+				break;
+			glist_add(&sn->sn_partial, &slab->sb_list);
+			sn->sn_slabs++;
+			sn->sn_nfree += sp->sp_objs;
+		}
+		for (taken = 0; got < n && slab->sb_free != NULL; taken++) {
+			objs[got] = slab->sb_free;
+			slab->sb_free = *(void **)objs[got];
+			got++;
+		}
+		slab->sb_nfree -= taken;
+		sn->sn_nfree -= taken;
+		if (slab->sb_nfree == 0) {
+			glist_del(&slab->sb_list);
+			glist_add(&sn->sn_full, &slab->sb_list);
+		}
+	}
+	pthread_mutex_unlock(&sn->sn_mutex);
+	return got;
+}
+
+/**
+ * @brief Return objects to the slabs they came from
+ *
+ * A slab whose objects are all free is kept if its node has no other
+ * such slab, and unmapped otherwise.
+ */
+
+static void slab_put(struct slab_pool *sp, void **objs, uint32_t n)
+{
+	struct slab_node *sn = NULL;
+	struct slab *slab;
+	uint32_t i;
+
+	for (i = 0; i < n; i++) {
+		slab = (struct slab *)((uintptr_t) objs[i] & sp->sp_mask);
+		if (slab->sb_home != sn) {
+			if (sn != NULL)
+				pthread_mutex_unlock(&sn->sn_mutex);
+			sn = slab->sb_home;
+			pthread_mutex_lock(&sn->sn_mutex);
+		}
+		*(void **)objs[i] = slab->sb_free;
+		slab->sb_free = objs[i];
+		sn->sn_nfree++;
+		if (slab->sb_nfree++ == 0) {
+			glist_del(&slab->sb_list);
+			glist_add(&sn->sn_partial, &slab->sb_list);
+		}
+		if (slab->sb_nfree < sp->sp_objs)
+			continue;
+		glist_del(&slab->sb_list);
+		if (sn->sn_empty == NULL) {
+			sn->sn_empty = slab;
+			continue;
+		}
+		sn->sn_slabs--;
+		sn->sn_nfree -= sp->sp_objs;
+		pthread_mutex_unlock(&sn->sn_mutex);
+		sn = NULL;
+		slab_release(sp, slab);
+	}
+	if (sn != NULL)
+		pthread_mutex_unlock(&sn->sn_mutex);
+}
+
+static struct slab_magazine *slab_magazine_alloc(struct slab_pool *sp)
+{
+	struct slab_magazine *mag;
+
+	mag = gsh_malloc(sizeof(*mag) + sp->sp_mag_size * sizeof(void *));
+	if (mag != NULL) {
+		mag->mg_list.next = mag->mg_list.prev = NULL;
+		mag->mg_rounds = 0;
+	}
+	return mag;
+}
+
+/**
+ * @brief Give a thread's magazines back when it exits
+ */
+
+static void slab_tcache_destroy(void *arg)
+{
+	struct slab_tcache *tc = arg;
+	struct slab_pool *sp = tc->tc_pool;
+
+	slab_put(sp, tc->tc_loaded->mg_objs, tc->tc_loaded->mg_rounds);
+	slab_put(sp, tc->tc_prev->mg_objs, tc->tc_prev->mg_rounds);
+	pthread_mutex_lock(&sp->sp_mutex);
+	glist_del(&tc->tc_list);
+	pthread_mutex_unlock(&sp->sp_mutex);
+	gsh_free(tc->tc_loaded);
+	gsh_free(tc->tc_prev);
+	gsh_free(tc);
+}
+
+static struct slab_tcache *slab_tcache_create(struct slab_pool *sp)
+{
+	struct slab_tcache *tc = gsh_calloc(1, sizeof(*tc));
+
+	if (tc == NULL)
+		return NULL;
+	tc->tc_pool = sp;
+	tc->tc_home = slab_local_node(sp);
+	tc->tc_loaded = slab_magazine_alloc(sp);
+	tc->tc_prev = slab_magazine_alloc(sp);
+	if (tc->tc_loaded == NULL || tc->tc_prev == NULL ||
+	    pthread_setspecific(sp->sp_key, tc) != 0) {
+		gsh_free(tc->tc_loaded);
+		gsh_free(tc->tc_prev);
+		gsh_free(tc);
+		return NULL;
+	}
+	pthread_mutex_lock(&sp->sp_mutex);
+	glist_add_tail(&sp->sp_tcaches, &tc->tc_list);
+	pthread_mutex_unlock(&sp->sp_mutex);
+	return tc;
+}
+
+static inline struct slab_tcache *slab_tcache(struct slab_pool *sp)
+{
+	struct slab_tcache *tc;
+
+	if (!sp->sp_have_key)
+		return NULL;
+	tc = pthread_getspecific(sp->sp_key);
+	if (tc == NULL)
+		tc = slab_tcache_create(sp);
+	return tc;
+}
+
+/**
+ * @brief Refill an empty loaded magazine
+ *
+ * Swap in the previous magazine if it has anything, else trade the
+ * empty previous one for a full one from the depot, else take half a
+ * magazine from the slabs.
+ *
+ * @return false if no object could be had.
+ */
+
+static bool slab_reload(struct slab_pool *sp, struct slab_tcache *tc)
+{
+	struct slab_magazine *mag = tc->tc_prev;
+
+	if (mag->mg_rounds > 0) {
+		tc->tc_prev = tc->tc_loaded;
+		tc->tc_loaded = mag;
+		return true;
+	}
+
+	pthread_mutex_lock(&sp->sp_mutex);
+	mag = glist_first_entry(&sp->sp_full, struct slab_magazine, mg_list);
+	if (mag != NULL) {
+		glist_del(&mag->mg_list);
+		sp->sp_nfull--;
+		if (sp->sp_nfull < sp->sp_idle)
+			sp->sp_idle = sp->sp_nfull;
+		glist_add(&sp->sp_empty, &tc->tc_prev->mg_list);
+		sp->sp_nempty++;
+		pthread_mutex_unlock(&sp->sp_mutex);
+		tc->tc_prev = tc->tc_loaded;
+		tc->tc_loaded = mag;
+		return true;
+	}
+	pthread_mutex_unlock(&sp->sp_mutex);
+
+	atomic_inc_uint64_t(&sp->sp_misses);
+	mag = tc->tc_loaded;
+	mag->mg_rounds = slab_get(sp, tc->tc_home, mag->mg_objs,
+				  (sp->sp_mag_size + 1) / 2);
+	return mag->mg_rounds > 0;
+}
+
+/**
+ * @brief Make room in a full loaded magazine
+ *
+ * Swap in the previous magazine if it has room, else hand the full
+ * previous one to the depot for an empty one.  If the depot already
+ * holds SLAB_DEPOT_MAX full magazines, or no magazine can be had, the
+ * previous magazine is emptied into the slabs instead.
+ */
+
+static void slab_unload(struct slab_pool *sp, struct slab_tcache *tc)
+{
+	struct slab_magazine *mag = tc->tc_prev;
+
+	if (mag->mg_rounds < sp->sp_mag_size) {
+		tc->tc_prev = tc->tc_loaded;
+		tc->tc_loaded = mag;
+		return;
+	}
+
+	pthread_mutex_lock(&sp->sp_mutex);
+	if (sp->sp_nfull < SLAB_DEPOT_MAX) {
+		mag = glist_first_entry(&sp->sp_empty, struct slab_magazine,
+					mg_list);
+		if (mag != NULL) {
+			glist_del(&mag->mg_list);
+			sp->sp_nempty--;
+		} else {
+			pthread_mutex_unlock(&sp->sp_mutex);
+			mag = slab_magazine_alloc(sp);
+			pthread_mutex_lock(&sp->sp_mutex);
+		}
+		if (mag != NULL) {
+			glist_add(&sp->sp_full, &tc->tc_prev->mg_list);
+			sp->sp_nfull++;
+			pthread_mutex_unlock(&sp->sp_mutex);
+			tc->tc_prev = tc->tc_loaded;
+			tc->tc_loaded = mag;
+			return;
+		}
+	}
+	pthread_mutex_unlock(&sp->sp_mutex);
+
+	mag = tc->tc_prev;
+	slab_put(sp, mag->mg_objs, mag->mg_rounds);
+	mag->mg_rounds = 0;
+	tc->tc_prev = tc->tc_loaded;
+	tc->tc_loaded = mag;
+}
+
+/**
+ * @brief Create a slab pool
+ *
+ * @param[in] size  Object size
+ * @param[in] param struct pool_slab_params, or NULL for the defaults
+ */
+
+static pool_t *pool_slab_initializer(size_t size, void *param)
+{
+	struct pool_slab_params *p = param ? param : &pool_slab_defaults;
+	size_t page = sysconf(_SC_PAGESIZE);
+	struct slab_pool *sp;
+	pool_t *pool;
+	size_t slab_size;
+	uint32_t i;
+
+	pool = gsh_calloc(1, sizeof(pool_t) + sizeof(struct slab_pool));
+	if (pool == NULL)
+		return NULL;
+	sp = slab_pool(pool);
+	sp->sp_pool = pool;
+	sp->sp_stride = (size + POOL_SLAB_ALIGN - 1) & ~(POOL_SLAB_ALIGN - 1);
+	if (sp->sp_stride == 0)
+		sp->sp_stride = POOL_SLAB_ALIGN;
+	sp->sp_hdr = (sizeof(struct slab) + SLAB_CACHE_LINE - 1) &
+		     ~(SLAB_CACHE_LINE - 1);
+
+	slab_size = p->slab_size ? p->slab_size : pool_slab_defaults.slab_size;
+	if (slab_size < page)
+		slab_size = page;
+	while (slab_size & (slab_size - 1))
+		slab_size += slab_size & -slab_size;
+	while ((slab_size - sp->sp_hdr) / sp->sp_stride < SLAB_MIN_OBJS)
+		slab_size <<= 1;
+	sp->sp_slab_size = slab_size;
+	sp->sp_mask = ~((uintptr_t) slab_size - 1);
+	sp->sp_objs = (slab_size - sp->sp_hdr) / sp->sp_stride;
+
+	sp->sp_mag_size = p->magazine_size ? p->magazine_size
+					   : pool_slab_defaults.magazine_size;
+	if (p->numa_local) {
+		(void) pthread_once(&slab_numa_once, slab_numa_init);
+		sp->sp_nnodes = slab_numa_nodes;
+	} else {
+		sp->sp_nnodes = 1;
+	}
+	sp->sp_nodes = gsh_malloc_aligned(SLAB_CACHE_LINE,
+					  sp->sp_nnodes *
+					  sizeof(struct slab_node));
+	if (sp->sp_nodes == NULL) {
+		gsh_free(pool);
+		return NULL;
+	}
+	memset(sp->sp_nodes, 0, sp->sp_nnodes * sizeof(struct slab_node));
+	for (i = 0; i < sp->sp_nnodes; i++) {
+		pthread_mutex_init(&sp->sp_nodes[i].sn_mutex, NULL);
+		init_glist(&sp->sp_nodes[i].sn_partial);
+		init_glist(&sp->sp_nodes[i].sn_full);
+	}
+
+	pthread_mutex_init(&sp->sp_mutex, NULL);
+	init_glist(&sp->sp_full);
+	init_glist(&sp->sp_empty);
+	init_glist(&sp->sp_tcaches);
+	sp->sp_have_key = sp->sp_mag_size > 0 &&
+		pthread_key_create(&sp->sp_key, slab_tcache_destroy) == 0;
+
+	pthread_mutex_lock(&slab_pools_mutex);
+	glist_add_tail(&slab_pools, &sp->sp_pools);
+	pthread_mutex_unlock(&slab_pools_mutex);
+	return pool;
+}
+
+static void slab_release_list(struct slab_pool *sp, struct glist_head *head)
+{
+	struct glist_head *glist, *glistn;
+
+	glist_for_each_safe(glist, glistn, head)
+		slab_release(sp, glist_entry(glist, struct slab, sb_list));
+}
+
+static void slab_free_magazines(struct glist_head *head)
+{
+	struct glist_head *glist, *glistn;
+
+	glist_for_each_safe(glist, glistn, head)
+		gsh_free(glist_entry(glist, struct slab_magazine, mg_list));
+}
+
+/**
+ * @brief Destroy a slab pool
+ *
+ * All objects must have been freed, and no thread may use the pool
+ * again.  The magazines of threads still running are freed here,
+ * since their key no longer runs its destructor.
+ */
+
+static void pool_slab_destroy(pool_t *pool)
+{
+	struct slab_pool *sp = slab_pool(pool);
+	struct glist_head *glist, *glistn;
+	struct slab_tcache *tc;
+	struct slab_node *sn;
+	uint32_t i;
+
+	pthread_mutex_lock(&slab_pools_mutex);
+	glist_del(&sp->sp_pools);
+	pthread_mutex_unlock(&slab_pools_mutex);
+
+	if (sp->sp_have_key)
+		(void) pthread_key_delete(sp->sp_key);
+	glist_for_each_safe(glist, glistn, &sp->sp_tcaches) {
+		tc = glist_entry(glist, struct slab_tcache, tc_list);
+		gsh_free(tc->tc_loaded);
+		gsh_free(tc->tc_prev);
+		gsh_free(tc);
+	}
+	slab_free_magazines(&sp->sp_full);
+	slab_free_magazines(&sp->sp_empty);
+
+	for (i = 0; i < sp->sp_nnodes; i++) {
+		sn = &sp->sp_nodes[i];
+		slab_release_list(sp, &sn->sn_partial);
+		slab_release_list(sp, &sn->sn_full);
+		if (sn->sn_empty != NULL)
+			slab_release(sp, sn->sn_empty);
+		pthread_mutex_destroy(&sn->sn_mutex);
+	}
+	gsh_free(sp->sp_nodes);
+	pthread_mutex_destroy(&sp->sp_mutex);
+	gsh_free(pool);
+}
+
+/**
+ * @brief Allocate an object from a slab pool
+ *
+ * As with the basic substrate, the object is zeroed unless the pool
+ * has a constructor.
+ */
+
+static void *pool_slab_alloc(pool_t *pool)
+{
+	struct slab_pool *sp = slab_pool(pool);
+	struct slab_tcache *tc = slab_tcache(sp);
+	void *obj;
+
+	if (tc == NULL) {
+		if (slab_get(sp, slab_local_node(sp), &obj, 1) == 0)
+			return NULL;
+	} else {
+		if (tc->tc_loaded->mg_rounds == 0 && !slab_reload(sp, tc))
+			return NULL;
+		obj = tc->tc_loaded->mg_objs[--tc->tc_loaded->mg_rounds];
+	}
+	if (pool->constructor == NULL)
+		memset(obj, 0, pool->object_size);
+	return obj;
+}
+
+static void pool_slab_free(pool_t *pool, void *object)
+{
+	struct slab_pool *sp = slab_pool(pool);
+	struct slab_tcache *tc = slab_tcache(sp);
+
+	if (tc == NULL) {
+		slab_put(sp, &object, 1);
+		return;
+	}
+	if (tc->tc_loaded->mg_rounds == sp->sp_mag_size)
+		slab_unload(sp, tc);
+	tc->tc_loaded->mg_objs[tc->tc_loaded->mg_rounds++] = object;
+}
+
+const struct pool_substrate_vector pool_slab_substrate[] = {
+	{.initializer = pool_slab_initializer,
+	 .destroyer = pool_slab_destroy,
+	 .allocator = pool_slab_alloc,
+	 .freer = pool_slab_free}
+};
+
+/**
+ * @brief Tell whether a pool uses the slab substrate
+ */
+
+bool pool_is_slab(pool_t *pool)
+{
+	return pool->substrate_vector == pool_slab_substrate;
+}
+
+/**
+ * @brief Report the occupancy of a slab pool
+ *
+ * @param[in]  pool  A pool using pool_slab_substrate
+ * @param[out] stats Its occupancy
+ */
+
+void pool_slab_stats(pool_t *pool, struct pool_slab_stats *stats)
+{
+	struct slab_pool *sp = slab_pool(pool);
+	struct glist_head *glist;
+	struct slab_tcache *tc;
+	struct slab_node *sn;
+	uint64_t nfree = 0;
+	uint32_t i;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->nodes = sp->sp_nnodes;
+	for (i = 0; i < sp->sp_nnodes; i++) {
+		sn = &sp->sp_nodes[i];
+		pthread_mutex_lock(&sn->sn_mutex);
+		stats->slabs += sn->sn_slabs;
+		nfree += sn->sn_nfree;
+		pthread_mutex_unlock(&sn->sn_mutex);
+	}
+	stats->bytes = stats->slabs * sp->sp_slab_size;
+	stats->capacity = stats->slabs * sp->sp_objs;
+
+	pthread_mutex_lock(&sp->sp_mutex);
+	stats->cached = (uint64_t) sp->sp_nfull * sp->sp_mag_size;
+	glist_for_each(glist, &sp->sp_tcaches) {
+		tc = glist_entry(glist, struct slab_tcache, tc_list);
+		stats->cached += tc->tc_loaded->mg_rounds +
+				 tc->tc_prev->mg_rounds;
+	}
+	pthread_mutex_unlock(&sp->sp_mutex);
+
+	if (stats->capacity > nfree + stats->cached)
+		stats->in_use = stats->capacity - nfree - stats->cached;
+	stats->slab_allocs = atomic_fetch_uint64_t(&sp->sp_slab_allocs);
+	stats->slab_frees = atomic_fetch_uint64_t(&sp->sp_slab_frees);
+	stats->depot_misses = atomic_fetch_uint64_t(&sp->sp_misses);
+}
+
+/**
+ * @brief Give idle depot magazines back to the slabs
+ *
+ * Full magazines that stayed in the depot since the last trim were
+ * not needed in that time.  Those above SLAB_DEPOT_LOW are emptied
+ * into their slabs, which unmaps slabs left wholly free, and empty
+ * magazines above SLAB_DEPOT_LOW are freed.  Thread magazines are
+ * left alone.
+ *
+ * @param[in] pool A pool using pool_slab_substrate
+ *
+ * @return The number of objects returned to the slabs.
+ */
+
+uint64_t pool_slab_trim(pool_t *pool)
+{
+	struct slab_pool *sp = slab_pool(pool);
+	struct glist_head idle, *glist, *glistn;
+	struct slab_magazine *mag;
+	uint64_t objs = 0;
+	uint32_t n;
+
+	init_glist(&idle);
+
+	pthread_mutex_lock(&sp->sp_mutex);
+	n = (sp->sp_idle > SLAB_DEPOT_LOW) ? sp->sp_idle - SLAB_DEPOT_LOW : 0;
+	for (; n > 0; n--) {
+		mag = glist_first_entry(&sp->sp_full, struct slab_magazine,
+					mg_list);
+		glist_del(&mag->mg_list);
+		glist_add(&idle, &mag->mg_list);
+		sp->sp_nfull--;
+	}
+	for (; sp->sp_nempty > SLAB_DEPOT_LOW; sp->sp_nempty--) {
+		mag = glist_first_entry(&sp->sp_empty, struct slab_magazine,
+					mg_list);
+		glist_del(&mag->mg_list);
+		glist_add(&idle, &mag->mg_list);
+	}
+	sp->sp_idle = sp->sp_nfull;
+	pthread_mutex_unlock(&sp->sp_mutex);
+
+	glist_for_each_safe(glist, glistn, &idle) {
+		mag = glist_entry(glist, struct slab_magazine, mg_list);
+		slab_put(sp, mag->mg_objs, mag->mg_rounds);
+		objs += mag->mg_rounds;
+		gsh_free(mag);
+	}
+	return objs;
+}
+
+/**
+ * @brief Call a function on every slab pool
+ *
+ * The function must not create or destroy a slab pool.
+ */
+
+void pool_slab_foreach(void (*cb)(pool_t *pool, void *arg), void *arg)
+{
+	struct glist_head *glist;
+
+	pthread_mutex_lock(&slab_pools_mutex);
+	glist_for_each(glist, &slab_pools)
+		cb(glist_entry(glist, struct slab_pool, sp_pools)->sp_pool,
+		   arg);
+	pthread_mutex_unlock(&slab_pools_mutex);
+}
+
+/** @} */
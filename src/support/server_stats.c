@@ -1034,6 +1034,64 @@ void server_dbus_v41_layouts(struct nfsv41_stats *v41p,
 	server_dbus_layouts(&v41p->recall, iter);
 }
 
+/**
+ * @brief Report the rate limits of an export or client
+ *
+ * Replies with (ops/sec, bytes/sec), 0 meaning no limit, and with
+ * (requests deferred, total nsecs they were deferred).
+ */
+
+void server_dbus_qos(struct nfs_qos *qos,
+		     DBusMessageIter *iter)
+{
+	DBusMessageIter struct_iter;
+	uint64_t ops_rate, bytes_rate, deferred;
+	nsecs_elapsed_t deferred_ns;
+
+	nfs_qos_get(qos, &ops_rate, &bytes_rate, &deferred, &deferred_ns);
+	dbus_message_iter_open_container(iter, DBUS_TYPE_STRUCT,
+					 NULL, &struct_iter);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+				       &ops_rate);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+				       &bytes_rate);
+	dbus_message_iter_close_container(iter, &struct_iter);
+	dbus_message_iter_open_container(iter, DBUS_TYPE_STRUCT,
+					 NULL, &struct_iter);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+				       &deferred);
+	dbus_message_iter_append_basic(&struct_iter, DBUS_TYPE_UINT64,
+				       &deferred_ns);
+	dbus_message_iter_close_container(iter, &struct_iter);
+}
+
+/**
+ * @brief Parse the new rate limits of an export or client
+ *
+ * @param args [IN] dbus argument stream, at the argument naming the
+ *                  export or client
+ */
+
+bool server_dbus_qos_args(DBusMessageIter *args,
+			  uint64_t *ops_rate,
+			  uint64_t *bytes_rate,
+			  char **errormsg)
+{
+	if(!dbus_message_iter_next(args) ||
+	   dbus_message_iter_get_arg_type(args) != DBUS_TYPE_UINT64) {
+		*errormsg = "ops per second not a 64 bit integer";
+		return false;
+	}
+	dbus_message_iter_get_basic(args, ops_rate);
+	if(!dbus_message_iter_next(args) ||
+	   dbus_message_iter_get_arg_type(args) != DBUS_TYPE_UINT64) {
+		*errormsg = "bytes per second not a 64 bit integer";
+		return false;
+	}
+	dbus_message_iter_get_basic(args, bytes_rate);
+	return true;
+}
+
 #endif /* USE_DBUS_STATS */
 
 /**
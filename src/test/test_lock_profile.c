@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_lock_profile.c
+ * @brief Lock profiler counts and overhead
+ *
+ * Each thread takes a mutex shared by all of them, holding it for a
+ * little work, and a read lock and a mutex of its own that nothing
+ * contends for.  The run is made with profiling off, to time the
+ * bare locks, and on, after which the report must show the shared
+ * mutex as the most contended site with every acquisition counted.
+ *
+ * Usage: test_lock_profile [-t threads] [-n iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "lock_profile.h"
+
+static unsigned int nthreads = 4;
+static unsigned int iterations = 200000;
+static pthread_mutex_t hot = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t cold = PTHREAD_RWLOCK_INITIALIZER;
+static volatile uint64_t shared_work;
+
+static void *worker(void *arg)
+{
+	pthread_mutex_t own = PTHREAD_MUTEX_INITIALIZER;
+	unsigned int i, j;
+
+	for (i = 0; i < iterations; i++) {
+		PROF_MUTEX_lock(&hot);
+		for (j = 0; j < 16; j++)
+			shared_work++;
+		PROF_MUTEX_unlock(&hot);
+
+		PROF_RWLOCK_rdlock(&cold);
+		PROF_RWLOCK_unlock(&cold);
+
+		PROF_MUTEX_lock(&own);
+		PROF_MUTEX_unlock(&own);
+	}
+	return NULL;
+}
+
+static double run(void)
+{
+	pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+	uint64_t start;
+	unsigned int i;
+
+	start = lock_prof_now();
+	for (i = 0; i < nthreads; i++)
+		pthread_create(&threads[i], NULL, worker, NULL);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	/* Three lock and unlock pairs per iteration */
+	return (double)(lock_prof_now() - start) /
+		((double)nthreads * iterations * 3);
+}
+
+int main(int argc, char **argv)
+{
+	struct lock_prof_report report[8];
+	double off, on;
+	int opt, n, i;
+
+	while ((opt = getopt(argc, argv, "t:n:")) != -1) {
+		switch (opt) {
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-t threads] [-n iterations]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	lock_prof_enable(false);
+	off = run();
+	lock_prof_enable(true);
+	on = run();
+
+	printf("%u threads, %u iterations: %.1f ns per lock pair off, "
+	       "%.1f ns on\n", nthreads, iterations, off, on);
+
+	n = lock_prof_top(report, 8);
+	for (i = 0; i < n; i++)
+		printf("%-7s %-6s %s:%d acquired %llu contended %llu "
+		       "wait %llu ns (max %llu) hold %llu ns (max %llu)\n",
+		       lock_prof_kind_name(report[i].site->kind),
+		       report[i].site->what, report[i].site->file,
+		       report[i].site->line,
+		       (unsigned long long)report[i].counts.acquired,
+		       (unsigned long long)report[i].counts.contended,
+		       (unsigned long long)report[i].counts.wait_ns,
+		       (unsigned long long)report[i].counts.wait_max,
+		       (unsigned long long)report[i].counts.hold_ns,
+		       (unsigned long long)report[i].counts.hold_max);
+
+	if (n != 3 || report[0].site->kind != LOCK_PROF_MUTEX ||
+	    report[0].counts.acquired != (uint64_t) nthreads * iterations ||
+	    (nthreads > 1 && report[0].counts.contended == 0)) {
+		fprintf(stderr, "unexpected profile\n");
+		return 1;
+	}
+	return 0;
+}
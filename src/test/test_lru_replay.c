@@ -0,0 +1,372 @@
+/*
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_lru_replay.c
+ * @brief Replay a reference trace against inode cache replacement policies
+ *
+ * Reports the hit ratio of a cache of the given size under
+ *
+ *  - lru:    plain LRU
+ *  - legacy: the former L1 scheme (loads at the LRU end, every third
+ *            initial reference moves an entry to the MRU end), which is
+ *            what the cache did whenever the FD reaper was idle
+ *  - arc:    the current policy, driven by cache_inode_arc.h
+ *
+ * A trace has one reference per line: a key (any string), optionally
+ * followed by "s" for a scan reference (READDIR).  Without a trace
+ * file, -g generates a drifting hot working set interleaved with
+ * find(1)-like sweeps over fresh keys.
+ *
+ * Usage: test_lru_replay -c <entries> [-k <refs>] [trace | -g hot,scan,rounds]
+ *
+ * -k is the correlated reference period, counted in references since
+ * traces carry no time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include "nlm_list.h"
+#include "cache_inode_arc.h"
+
+enum sim_policy {
+	SIM_LRU,
+	SIM_LEGACY,
+	SIM_ARC,
+	SIM_POLICIES
+};
+
+static const char *sim_policy_names[SIM_POLICIES] = {
+	"lru", "legacy", "arc"
+};
+
+struct sim_ent {
+	struct glist_head q;
+	uint64_t key;
+	int qid;		/* 1 = L1, 2 = L2 */
+	uint64_t admitted;
+	uint32_t cf;
+};
+
+struct sim {
+	enum sim_policy policy;
+	uint64_t c;
+	uint64_t k;
+	struct sim_ent *ents;
+	uint64_t nents;
+	struct sim_ent **map;	/* open addressing, linear probing */
+	uint64_t mapmask;
+	struct glist_head L1, L2;
+	uint64_t l1_size;
+	struct lru_arc arc;
+	uint64_t now;
+	uint64_t refs, hits;
+};
+
+static uint64_t mix64(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+static uint64_t fnv1a(const char *s, size_t n)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (n--) {
+		h ^= (unsigned char) *s++;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static uint64_t map_find(struct sim *sim, uint64_t key)
+{
+	uint64_t i = mix64(key) & sim->mapmask;
+
+	while (sim->map[i] != NULL && sim->map[i]->key != key)
+		i = (i + 1) & sim->mapmask;
+	return i;
+}
+
+static void map_del(struct sim *sim, uint64_t key)
+{
+	uint64_t i = map_find(sim, key), j, home;
+
+	sim->map[i] = NULL;
+	/* backward shift so later probes still find their keys */
+	for (j = (i + 1) & sim->mapmask; sim->map[j] != NULL;
+	     j = (j + 1) & sim->mapmask) {
+		home = mix64(sim->map[j]->key) & sim->mapmask;
+		if (((j - home) & sim->mapmask) >= ((j - i) & sim->mapmask)) {
+			sim->map[i] = sim->map[j];
+			sim->map[j] = NULL;
+			i = j;
+		}
+	}
+}
+
+static int sim_init(struct sim *sim, enum sim_policy policy, uint64_t c,
+		    uint64_t k)
+{
+	uint64_t nslots = 16;
+
+	memset(sim, 0, sizeof(*sim));
+	sim->policy = policy;
+	sim->c = c;
+	sim->k = k;
+	while (nslots < 4 * c)
+		nslots <<= 1;
+	sim->ents = calloc(c, sizeof(struct sim_ent));
+	sim->map = calloc(nslots, sizeof(struct sim_ent *));
+	if (sim->ents == NULL || sim->map == NULL)
+		return -1;
+	sim->mapmask = nslots - 1;
+	init_glist(&sim->L1);
+	init_glist(&sim->L2);
+	if (policy == SIM_ARC)
+		return lru_arc_init(&sim->arc, c);
+	return 0;
+}
+
+static void sim_destroy(struct sim *sim)
+{
+	if (sim->policy == SIM_ARC)
+		lru_arc_destroy(&sim->arc);
+	free(sim->ents);
+	free(sim->map);
+}
+
+static void sim_move(struct sim *sim, struct sim_ent *e, int qid, bool mru)
+{
+	if (e->qid == 1)
+		sim->l1_size--;
+	glist_del(&e->q);
+	e->qid = qid;
+	if (qid == 1)
+		sim->l1_size++;
+	if (mru)
+		glist_add_tail(qid == 1 ? &sim->L1 : &sim->L2, &e->q);
+	else
+		glist_add(qid == 1 ? &sim->L1 : &sim->L2, &e->q);
+}
+
+static struct sim_ent *sim_evict(struct sim *sim)
+{
+	struct sim_ent *e;
+	struct glist_head *from;
+
+	if (sim->policy == SIM_ARC) {
+		if ((lru_arc_reap_l1(&sim->arc, sim->l1_size) &&
+		     !glist_empty(&sim->L1)) || glist_empty(&sim->L2))
+			from = &sim->L1;
+		else
+			from = &sim->L2;
+	} else {
+		from = glist_empty(&sim->L2) ? &sim->L1 : &sim->L2;
+	}
+	e = glist_first_entry(from, struct sim_ent, q);
+	if (sim->policy == SIM_ARC)
+		lru_arc_remember(&sim->arc, mix64(e->key),
+				 e->qid == 1 ? LRU_ARC_B1 : LRU_ARC_B2);
+	if (e->qid == 1)
+		sim->l1_size--;
+	glist_del(&e->q);
+	map_del(sim, e->key);
+	return e;
+}
+
+static void sim_ref(struct sim *sim, uint64_t key, bool scan)
+{
+	uint64_t slot = map_find(sim, key);
+	struct sim_ent *e = sim->map[slot];
+
+	sim->refs++;
+	sim->now++;
+
+	if (e != NULL) {
+		sim->hits++;
+		switch (sim->policy) {
+		case SIM_LRU:
+			sim_move(sim, e, 1, true);
+			break;
+		case SIM_LEGACY:
+			if (!scan && (++e->cf % 3) == 0)
+				sim_move(sim, e, 1, true);
+			break;
+		case SIM_ARC:
+			if (scan)
+				break;
+			if (e->qid == 1 && sim->now - e->admitted > sim->k)
+				sim_move(sim, e, 2, true);
+			else if ((++e->cf % 3) == 0)
+				sim_move(sim, e, e->qid, true);
+			break;
+		default:
+			break;
+		}
+		return;
+	}
+
+	/* miss: load */
+	if (sim->nents < sim->c) {
+		e = &sim->ents[sim->nents++];
+	} else {
+		e = sim_evict(sim);
+		slot = map_find(sim, key);
+	}
+	memset(e, 0, sizeof(*e));
+	e->key = key;
+	e->admitted = sim->now;
+	init_glist(&e->q);
+	sim->map[slot] = e;
+	e->qid = 1;
+	sim->l1_size++;
+
+	switch (sim->policy) {
+	case SIM_LEGACY:
+		glist_add(&sim->L1, &e->q);
+		break;
+	case SIM_ARC:
+		glist_add_tail(&sim->L1, &e->q);
+		if (lru_arc_admit(&sim->arc, mix64(key)) != LRU_ARC_MISS)
+			sim_move(sim, e, 2, true);
+		break;
+	default:
+		glist_add_tail(&sim->L1, &e->q);
+		break;
+	}
+}
+
+static struct sim sims[SIM_POLICIES];
+
+static void ref_all(uint64_t key, bool scan)
+{
+	int i;
+
+	for (i = 0; i < SIM_POLICIES; i++)
+		sim_ref(&sims[i], key, scan);
+}
+
+static int replay_file(const char *path)
+{
+	FILE *f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	char line[1024];
+
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		size_t n = strcspn(line, " \t\r\n");
+		char *flag = line + n + strspn(line + n, " \t");
+
+		if (n == 0)
+			continue;
+		ref_all(fnv1a(line, n), *flag == 's');
+	}
+	if (f != stdin)
+		fclose(f);
+	return 0;
+}
+
+static void generate(uint64_t hot, uint64_t scan, uint64_t rounds)
+{
+	uint64_t base = 0, fresh = 1ULL << 62, r, i;
+
+	srandom(1);
+	for (r = 0; r < rounds; r++) {
+		/* daytime: working set, half of it new every day */
+		for (i = 0; i < 10 * hot; i++)
+			ref_all(base + random() % hot, false);
+		base += hot / 2;
+		/* night: find over files never seen before, each one
+		   looked up and then stat'd */
+		for (i = 0; i < scan; i++, fresh++) {
+			ref_all(fresh, false);
+			ref_all(fresh, false);
+		}
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s -c <entries> [-k <refs>] "
+		"[trace | -g hot,scan,rounds]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t c = 0, k = 0, hot = 0, scan = 0, rounds = 0;
+	bool gen = false;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "c:k:g:")) != -1) {
+		switch (opt) {
+		case 'c':
+			c = strtoull(optarg, NULL, 10);
+			break;
+		case 'k':
+			k = strtoull(optarg, NULL, 10);
+			break;
+		case 'g':
+			if (sscanf(optarg, "%lu,%lu,%lu", &hot, &scan,
+				   &rounds) != 3)
+				usage(argv[0]);
+			gen = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (c == 0 || (!gen && optind >= argc))
+		usage(argv[0]);
+
+	for (i = 0; i < SIM_POLICIES; i++) {
+		if (sim_init(&sims[i], i, c, k) != 0) {
+			fprintf(stderr, "Out of memory\n");
+			return 1;
+		}
+	}
+
+	if (gen)
+		generate(hot, scan, rounds);
+	else if (replay_file(argv[optind]) != 0)
+		return 1;
+
+	printf("%-8s %12s %12s %8s\n", "policy", "refs", "hits", "ratio");
+	for (i = 0; i < SIM_POLICIES; i++) {
+		printf("%-8s %12lu %12lu %7.2f%%\n", sim_policy_names[i],
+		       sims[i].refs, sims[i].hits,
+		       sims[i].refs ? 100.0 * sims[i].hits / sims[i].refs : 0);
+		sim_destroy(&sims[i]);
+	}
+	return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_pool_slab.c
+ * @brief Pool allocation throughput, basic against slab substrate
+ *
+ * Each thread keeps a window of live objects, as a worker keeps the
+ * duplicate request entries and results of the requests it has in
+ * flight: it allocates the window, touches every object, frees it in
+ * a different order and starts again.  The same run is made on a pool
+ * with pool_basic_substrate and one with pool_slab_substrate, which
+ * is then asked for its occupancy.
+ *
+ * Usage: test_pool_slab [-t threads] [-s object size] [-w window]
+ *                       [-r rounds] [-n]
+ *
+ * -n keeps the slabs per NUMA node.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "abstract_mem.h"
+#include "pool_slab.h"
+
+static unsigned long nthreads = 8, obj_size = 512, window = 64;
+static unsigned long rounds = 20000;
+static pool_t *bench_pool;
+
+static void *bench_thread(void *arg)
+{
+	void **objs = calloc(window, sizeof(void *));
+	unsigned long r, i;
+
+	if (objs == NULL)
+		return (void *)1;
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < window; i++) {
+			objs[i] = pool_alloc(bench_pool, NULL);
+			if (objs[i] == NULL)
+				return (void *)1;
+			*(unsigned long *)objs[i] = i;
+		}
+		/* Requests do not finish in the order they came */
+		for (i = 0; i < window; i += 2)
+			pool_free(bench_pool, objs[i]);
+		for (i = 1; i < window; i += 2)
+			pool_free(bench_pool, objs[i]);
+	}
+	free(objs);
+	return NULL;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench(const char *name, const struct pool_substrate_vector *sub,
+		 void *param)
+{
+	pthread_t *thr = calloc(nthreads, sizeof(pthread_t));
+	struct pool_slab_stats st;
+	unsigned long i;
+	void *ret;
+	double t;
+	int err = 0;
+
+	bench_pool = pool_init(name, obj_size, sub, param, NULL, NULL);
+	if (thr == NULL || bench_pool == NULL) {
+		fprintf(stderr, "%s: cannot create pool\n", name);
+		return 1;
+	}
+	t = now();
+	for (i = 0; i < nthreads; i++)
+		if (pthread_create(&thr[i], NULL, bench_thread, NULL) != 0) {
+			perror("pthread_create");
+			return 1;
+		}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(thr[i], &ret);
+		err |= ret != NULL;
+	}
+	t = now() - t;
+	printf("%-6s %14.0f alloc+free/s\n", name,
+	       t > 0 ? nthreads * rounds * window / t : 0.0);
+	if (pool_is_slab(bench_pool)) {
+		pool_slab_stats(bench_pool, &st);
+		printf("       %u node(s), %lu slabs, %lu bytes, %lu objects, "
+		       "%lu in use, %lu cached, %lu slabs made, "
+		       "%lu depot misses\n",
+		       st.nodes, (unsigned long)st.slabs,
+		       (unsigned long)st.bytes, (unsigned long)st.capacity,
+		       (unsigned long)st.in_use, (unsigned long)st.cached,
+		       (unsigned long)st.slab_allocs,
+		       (unsigned long)st.depot_misses);
+		/* The first trim marks the depot, the second returns
+		   what stayed idle in between */
+		pool_slab_trim(bench_pool);
+		pool_slab_trim(bench_pool);
+		pool_slab_stats(bench_pool, &st);
+		printf("       after trim: %lu slabs, %lu cached\n",
+		       (unsigned long)st.slabs, (unsigned long)st.cached);
+	}
+	pool_destroy(bench_pool);
+	free(thr);
+	return err;
+}
+
+int main(int argc, char *argv[])
+{
+	struct pool_slab_params params = pool_slab_defaults;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:s:w:r:n")) != -1) {
+		switch (opt) {
+		case 't':
+			nthreads = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			obj_size = strtoul(optarg, NULL, 10);
+			break;
+		case 'w':
+			window = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			rounds = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			params.numa_local = true;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-t threads] [-s size] "
+				"[-w window] [-r rounds] [-n]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (nthreads == 0 || window == 0 || obj_size < sizeof(unsigned long)) {
+		fprintf(stderr, "threads and window must be positive and "
+			"objects hold at least a long\n");
+		return 1;
+	}
+
+	printf("%lu threads, %lu-byte objects, window %lu, %lu rounds\n",
+	       nthreads, obj_size, window, rounds);
+	return bench("basic", pool_basic_substrate, NULL) ||
+	       bench("slab", pool_slab_substrate, &params);
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_qos.c
+ * @brief Token bucket deferral times
+ *
+ * A burst of requests at one instant must be let through up to the
+ * bucket size, and each one after that deferred one more interval of
+ * the rate, so the burst drains at exactly the configured rate.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "nfs_qos.h"
+
+static int failures;
+
+static void check(const char *what, nsecs_elapsed_t got,
+		  nsecs_elapsed_t want)
+{
+	/* Allow for rounding of the floating point tokens */
+	if (got + 1000 < want || got > want + 1000) {
+		fprintf(stderr, "%s: got %llu ns, want %llu ns\n", what,
+			(unsigned long long)got, (unsigned long long)want);
+		failures++;
+	}
+}
+
+int main(void)
+{
+	struct nfs_qos qos;
+	nsecs_elapsed_t t0 = NS_PER_SEC, delay = 0;
+	uint64_t ops, bytes, deferred;
+	nsecs_elapsed_t deferred_ns;
+	int i;
+
+	/* 100 requests per second: the first 100 pass, then every
+	   request waits 10 ms longer than the one before */
+	nfs_qos_init(&qos, 100, 0);
+	for (i = 0; i < 300; i++)
+		delay = nfs_qos_charge(&qos, 0, t0);
+	check("ops burst", delay, 2 * NS_PER_SEC);
+
+	/* After a second, the debt is a second less */
+	check("ops refill", nfs_qos_charge(&qos, 0, t0 + NS_PER_SEC),
+	      (nsecs_elapsed_t) 101 * NS_PER_SEC / 100);
+
+	nfs_qos_get(&qos, &ops, &bytes, &deferred, &deferred_ns);
+	if (ops != 100 || bytes != 0 || deferred != 201) {
+		fprintf(stderr, "counters: rate %llu deferred %llu\n",
+			(unsigned long long)ops,
+			(unsigned long long)deferred);
+		failures++;
+	}
+
+	/* A megabyte per second, one request of 3 MB: it may start
+	   after the 2 MB it overdraws are paid back */
+	nfs_qos_set(&qos, 0, 1 << 20);
+	check("bytes", nfs_qos_charge(&qos, 3 << 20, t0), 2 * NS_PER_SEC);
+
+	/* An idle bucket fills up to one second, no more */
+	check("idle", nfs_qos_charge(&qos, 1 << 20, t0 + 100 * NS_PER_SEC),
+	      0);
+	check("idle cap", nfs_qos_charge(&qos, 1 << 20, t0 + 100 * NS_PER_SEC),
+	      NS_PER_SEC);
+
+	/* No limit, no delay */
+	nfs_qos_set(&qos, 0, 0);
+	check("unlimited", nfs_qos_charge(&qos, 1 << 30, t0), 0);
+
+	if (failures == 0)
+		printf("ok\n");
+	return failures != 0;
+}
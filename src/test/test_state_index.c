@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file test_state_index.c
+ * @brief OPEN/CLOSE throughput on one file with many open owners
+ *
+ * Replays what OPEN and CLOSE do to the states of a single file while
+ * it is held open by many owners at once:
+ *
+ *  - list:  the former scheme, a walk of the file's state list to find
+ *           the owner's open, another to check the new share against
+ *           every open and another on CLOSE for the last close of the
+ *           client
+ *  - index: the file's state index and share counters, driven through
+ *           state_index_first, state_share_conflict and
+ *           state_share_count from SAL/state_index.c
+ *
+ * Each round every owner opens the file, then every owner closes it.
+ * Owners, states and the file are the daemon's own structures, with
+ * only the fields the lookups look at filled in.
+ *
+ * Usage: test_state_index [-o owners] [-c clients] [-r rounds]
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "sal_functions.h"
+
+static clientid4 clientid_of(state_t *s)
+{
+	return s->state_owner->so_owner.so_nfs4_owner.so_clientid;
+}
+
+static bool list_open(cache_entry_t *f, state_t *s)
+{
+	struct glist_head *glist;
+	state_t *it;
+
+	glist_for_each(glist, &f->state_list) {
+		it = glist_entry(glist, state_t, state_list);
+		if (it->state_type == STATE_TYPE_SHARE &&
+		    it->state_owner == s->state_owner)
+			return false;
+	}
+	glist_for_each(glist, &f->state_list) {
+		it = glist_entry(glist, state_t, state_list);
+		if ((it->state_data.share.share_access &
+		     s->state_data.share.share_deny) ||
+		    (it->state_data.share.share_deny &
+		     s->state_data.share.share_access))
+			return false;
+	}
+	glist_add_tail(&f->state_list, &s->state_list);
+	return true;
+}
+
+static bool list_close(cache_entry_t *f, state_t *s)
+{
+	struct glist_head *glist;
+	state_t *it;
+
+	glist_del(&s->state_list);
+	glist_for_each(glist, &f->state_list) {
+		it = glist_entry(glist, state_t, state_list);
+		if (it->state_type == STATE_TYPE_SHARE &&
+		    clientid_of(it) == clientid_of(s))
+			return false;
+	}
+	return true;
+}
+
+static bool index_open(cache_entry_t *f, state_t *s)
+{
+	if (state_index_first(f, STATE_TYPE_SHARE, clientid_of(s),
+			      s->state_owner))
+		return false;
+	if (state_share_conflict(f, s->state_data.share.share_access,
+				 s->state_data.share.share_deny))
+		return false;
+	glist_add_tail(&f->state_list, &s->state_list);
+	avltree_insert(&s->state_node, &f->state_index);
+	state_share_count(f, OPEN4_SHARE_ACCESS_NONE, OPEN4_SHARE_DENY_NONE,
+			  s->state_data.share.share_access,
+			  s->state_data.share.share_deny, true);
+	return true;
+}
+
+static bool index_close(cache_entry_t *f, state_t *s)
+{
+	glist_del(&s->state_list);
+	avltree_remove(&s->state_node, &f->state_index);
+	state_share_count(f, s->state_data.share.share_access,
+			  s->state_data.share.share_deny,
+			  OPEN4_SHARE_ACCESS_NONE, OPEN4_SHARE_DENY_NONE,
+			  true);
+	return state_index_first(f, STATE_TYPE_SHARE, clientid_of(s),
+				 NULL) == NULL;
+}
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long owners = 1000, clients = 10, rounds = 100;
+	unsigned long i, r, last;
+	state_owner_t *own;
+	state_t *st;
+	cache_entry_t *f;
+	double t;
+	int pass, opt;
+
+	while ((opt = getopt(argc, argv, "o:c:r:")) != -1) {
+		switch (opt) {
+		case 'o':
+			owners = strtoul(optarg, NULL, 10);
+			break;
+		case 'c':
+			clients = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			rounds = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-o owners] [-c clients] "
+				"[-r rounds]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (owners == 0 || clients == 0) {
+		fprintf(stderr, "owners and clients must be positive\n");
+		return 1;
+	}
+
+	own = calloc(owners, sizeof(*own));
+	st = calloc(owners, sizeof(*st));
+	f = malloc(sizeof(*f));
+	if (own == NULL || st == NULL || f == NULL) {
+		perror("calloc");
+		return 1;
+	}
+	for (i = 0; i < owners; i++) {
+		own[i].so_type = STATE_OPEN_OWNER_NFSV4;
+		own[i].so_owner.so_nfs4_owner.so_clientid = i % clients;
+		st[i].state_type = STATE_TYPE_SHARE;
+		st[i].state_owner = &own[i];
+		/* Readers and writers, none denying, as with a shared log */
+		st[i].state_data.share.share_access =
+			(i % 4) ? OPEN4_SHARE_ACCESS_READ
+				: OPEN4_SHARE_ACCESS_BOTH;
+		st[i].state_data.share.share_deny = OPEN4_SHARE_DENY_NONE;
+	}
+
+	printf("%lu owners from %lu clients on one file, %lu rounds\n",
+	       owners, clients, rounds);
+
+	for (pass = 0; pass < 2; pass++) {
+		memset(f, 0, sizeof(*f));
+		init_glist(&f->state_list);
+		state_index_init(f);
+		last = 0;
+		t = bench_now();
+		for (r = 0; r < rounds; r++) {
+			for (i = 0; i < owners; i++)
+				if (!(pass ? index_open(f, &st[i])
+				      : list_open(f, &st[i]))) {
+					fprintf(stderr, "open %lu refused\n",
+						i);
+					return 1;
+				}
+			for (i = 0; i < owners; i++)
+				last += pass ? index_close(f, &st[i])
+					     : list_close(f, &st[i]);
+		}
+		t = bench_now() - t;
+		printf("%-6s %12.0f OPEN+CLOSE/s  (%lu last closes)\n",
+		       pass ? "index" : "list",
+		       t > 0 ? owners * rounds / t : 0.0, last);
+	}
+
+	free(f);
+	free(st);
+	free(own);
+	return 0;
+}
@@ -0,0 +1,868 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file   nfsload.c
+ * @brief Multi-threaded NFS load generator
+ *
+ * Each thread runs a mix of workloads against a directory of its own
+ * and, for readdir and lock, against objects shared by every thread.
+ * A workload is a small state machine that makes one call each time
+ * it is stepped, and a thread picks the workload to step by weight.
+ *
+ * In closed loop each thread makes its next call as soon as the last
+ * one is answered.  In open loop the calls are scheduled at a fixed
+ * rate and latency is measured from when a call was due rather than
+ * when it was sent, so a server that falls behind is charged for the
+ * queue it builds.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "nfsload.h"
+
+/** Status of a create or mkdir of a name that exists, v3 and v4 */
+#define NL_EXIST 17
+
+/** Length of each range of the lock workload */
+#define NL_LOCK_SIZE 4096
+
+enum nl_op {
+	NL_OP_LOOKUP,
+	NL_OP_GETATTR,
+	NL_OP_ACCESS,
+	NL_OP_CREATE,
+	NL_OP_CLOSE,
+	NL_OP_READ,
+	NL_OP_WRITE,
+	NL_OP_COMMIT,
+	NL_OP_REMOVE,
+	NL_OP_READDIR,
+	NL_OP_LOCK,
+	NL_OP_UNLOCK,
+	NL_OP_COUNT
+};
+
+static const char *const nl_op_names[NL_OP_COUNT] = {
+	[NL_OP_LOOKUP] = "lookup",
+	[NL_OP_GETATTR] = "getattr",
+	[NL_OP_ACCESS] = "access",
+	[NL_OP_CREATE] = "create",
+	[NL_OP_CLOSE] = "close",
+	[NL_OP_READ] = "read",
+	[NL_OP_WRITE] = "write",
+	[NL_OP_COMMIT] = "commit",
+	[NL_OP_REMOVE] = "remove",
+	[NL_OP_READDIR] = "readdir",
+	[NL_OP_LOCK] = "lock",
+	[NL_OP_UNLOCK] = "unlock",
+};
+
+enum nl_workload {
+	NL_WL_META,
+	NL_WL_CREATE,
+	NL_WL_SEQIO,
+	NL_WL_LOCK,
+	NL_WL_READDIR,
+	NL_WL_COUNT
+};
+
+static const char *const nl_wl_names[NL_WL_COUNT] = {
+	[NL_WL_META] = "meta",
+	[NL_WL_CREATE] = "create",
+	[NL_WL_SEQIO] = "seqio",
+	[NL_WL_LOCK] = "lock",
+	[NL_WL_READDIR] = "readdir",
+};
+
+/**
+ * @brief A load generating thread
+ */
+
+struct nl_thread {
+	pthread_t tid;
+	unsigned int index;
+	struct nl_client clnt;
+	uint64_t rng;
+	bool failed;
+	struct nl_fh dir; /*< Directory of this thread */
+	struct nl_hist hist[NL_OP_COUNT];
+	/* meta */
+	struct nl_fh *files;
+	unsigned int meta_step;
+	/* create */
+	unsigned int create_step;
+	uint64_t create_seq;
+	char create_name[32];
+	struct nl_file create_file;
+	/* seqio */
+	unsigned int seqio_step;
+	uint64_t seqio_offset;
+	struct nl_file seqio_file;
+	/* lock */
+	unsigned int lock_step;
+	uint64_t lock_offset;
+	struct nl_file lock_file;
+	/* readdir */
+	uint64_t readdir_cookie;
+	unsigned char readdir_verf[8];
+};
+
+const char *nl_host = "127.0.0.1";
+static int nl_port = 2049;
+static uint32_t nl_minor = 1;
+static const struct nl_proto *nl_proto = &nl_nfs4_proto;
+static const char *nl_export = "/";
+static const char *nl_workdir = "nfsload";
+static unsigned int nl_threads = 8;
+static unsigned int nl_duration = 30;
+static unsigned int nl_warmup = 5;
+static double nl_rate;
+static unsigned int nl_weights[NL_WL_COUNT] = {[NL_WL_META] = 1};
+static unsigned int nl_weight_total = 1;
+static unsigned int nl_nfiles = 100;
+static unsigned int nl_entries = 10000;
+static uint32_t nl_iosize = 65536;
+static uint64_t nl_filesize = 64 * 1024 * 1024;
+static uint32_t nl_smallsize = 4096;
+static unsigned int nl_slots = 64;
+static uint32_t nl_uid;
+static uint32_t nl_gid;
+static uint64_t nl_seed = 1;
+static const char *nl_histprefix;
+
+static struct nl_fh nl_work_fh;
+static struct nl_fh nl_shared_fh;
+static pthread_barrier_t nl_barrier;
+static uint64_t nl_start; /*< When the first call is due */
+static uint64_t nl_measure; /*< End of the warmup */
+static uint64_t nl_end; /*< End of the run */
+
+static const char usage[] =
+	"usage: nfsload [options]\n"
+	"  -s host      server (127.0.0.1)\n"
+	"  -p port      NFS port (2049)\n"
+	"  -m port      MOUNT port for NFSv3, 0 for the NFS port (0)\n"
+	"  -v version   3, 4.0 or 4.1 (4.1)\n"
+	"  -e path      export, or NFSv4 pseudo path (/)\n"
+	"  -d name      directory to work in, made under the export (nfsload)\n"
+	"  -T threads   threads, each a client of its own (8)\n"
+	"  -t seconds   length of the run, after the warmup (30)\n"
+	"  -W seconds   warmup, not measured (5)\n"
+	"  -r rate      calls per second over all threads, open loop;\n"
+	"               0 for closed loop (0)\n"
+	"  -w mix       workloads with weights, e.g. meta:4,create:1 (meta)\n"
+	"               meta     getattr, lookup and access of existing files\n"
+	"               create   create, write, close and remove small files\n"
+	"               seqio    sequential write, commit and read of a file\n"
+	"               lock     lock and unlock ranges of a shared file (v4)\n"
+	"               readdir  read a shared directory from end to end\n"
+	"  -F files     files per thread for meta (100)\n"
+	"  -N entries   entries in the readdir directory (10000)\n"
+	"  -b bytes     size of each seqio read and write (65536)\n"
+	"  -S bytes     size of each seqio file (67108864)\n"
+	"  -f bytes     size of each create file (4096)\n"
+	"  -L slots     ranges the lock workload contends for (64)\n"
+	"  -u uid       AUTH_SYS uid (0)\n"
+	"  -g gid       AUTH_SYS gid (0)\n"
+	"  -x seed      random seed (1)\n"
+	"  -H prefix    write latency histograms to prefix-<op>.csv\n";
+
+static uint64_t nl_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void nl_sleep_until(uint64_t ns)
+{
+	struct timespec ts = {
+		.tv_sec = ns / 1000000000ULL,
+		.tv_nsec = ns % 1000000000ULL
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)
+	       == EINTR)
+		;
+}
+
+static uint64_t nl_random(struct nl_thread *t)
+{
+	t->rng ^= t->rng >> 12;
+	t->rng ^= t->rng << 25;
+	t->rng ^= t->rng >> 27;
+	return t->rng * 2685821657736338717ULL;
+}
+
+/**
+ * @brief Make a directory, or look it up if it exists
+ */
+
+static int nl_mkdir(struct nl_client *clnt, const struct nl_fh *dir,
+		    const char *name, struct nl_fh *fh)
+{
+	int status = clnt->proto->mkdir(clnt, dir, name, fh);
+
+	if (status == NL_EXIST)
+		status = clnt->proto->lookup(clnt, dir, name, fh);
+	if (status > 0)
+		fprintf(stderr, "mkdir of %s failed (%d)\n", name, status);
+	return status;
+}
+
+/**
+ * @brief Make a file, and close it for NFSv4
+ */
+
+static int nl_touch(struct nl_client *clnt, const struct nl_fh *dir,
+		    const char *name, struct nl_fh *fh)
+{
+	struct nl_file file;
+	int status;
+
+	memset(&file, 0, sizeof(file));
+	status = clnt->proto->create(clnt, dir, name, &file);
+	if (status == 0 && clnt->proto->close != NULL)
+		status = clnt->proto->close(clnt, &file);
+	if (status > 0)
+		fprintf(stderr, "create of %s failed (%d)\n", name, status);
+	if (fh != NULL)
+		*fh = file.fh;
+	return status;
+}
+
+static int nl_client_init(struct nl_client *clnt, const char *name)
+{
+	char host[32];
+
+	memset(clnt, 0, sizeof(*clnt));
+	clnt->proto = nl_proto;
+	clnt->minor = nl_minor;
+	if (gethostname(host, sizeof(host)) != 0)
+		strcpy(host, "localhost");
+	host[sizeof(host) - 1] = '\0';
+	snprintf(clnt->owner, sizeof(clnt->owner), "nfsload.%s.%d.%s",
+		 host, (int)getpid(), name);
+	if (nl_connect(&clnt->conn, nl_host, nl_port, nl_uid, nl_gid) != 0)
+		return -1;
+	if (clnt->proto->setup != NULL && clnt->proto->setup(clnt) != 0) {
+		nl_disconnect(&clnt->conn);
+		return -1;
+	}
+	return 0;
+}
+
+static void nl_client_fini(struct nl_client *clnt)
+{
+	if (clnt->proto->teardown != NULL)
+		clnt->proto->teardown(clnt);
+	nl_disconnect(&clnt->conn);
+}
+
+/**
+ * @brief Make the objects shared by every thread
+ */
+
+static int nl_prepare(void)
+{
+	struct nl_client clnt;
+	struct nl_fh root, fh;
+	char name[32];
+	unsigned int i;
+	int status;
+
+	if (nl_client_init(&clnt, "setup") != 0)
+		return -1;
+
+	status = clnt.proto->root(&clnt, nl_export, &root);
+	if (status == 0)
+		status = nl_mkdir(&clnt, &root, nl_workdir, &nl_work_fh);
+
+	if (status == 0 && nl_weights[NL_WL_READDIR] > 0) {
+		status = nl_mkdir(&clnt, &nl_work_fh, "shared", &nl_shared_fh);
+		/* The last entry is made last, so if it is there so
+		   is every other */
+		snprintf(name, sizeof(name), "e%06u", nl_entries - 1);
+		if (status == 0 && nl_entries > 0 &&
+		    clnt.proto->lookup(&clnt, &nl_shared_fh, name, &fh) != 0) {
+			printf("making %u entries in %s/shared\n", nl_entries,
+			       nl_workdir);
+			for (i = 0; i < nl_entries && status == 0; i++) {
+				snprintf(name, sizeof(name), "e%06u", i);
+				status = nl_touch(&clnt, &nl_shared_fh, name,
+						  NULL);
+			}
+		}
+	}
+
+	if (status == 0 && nl_weights[NL_WL_LOCK] > 0)
+		status = nl_touch(&clnt, &nl_work_fh, "lockfile", NULL);
+
+	nl_client_fini(&clnt);
+	return status == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Make and open what a thread works on by itself
+ */
+
+static int nl_thread_prepare(struct nl_thread *t)
+{
+	struct nl_client *clnt = &t->clnt;
+	char name[32];
+	unsigned int i;
+	int status;
+
+	snprintf(name, sizeof(name), "t%u", t->index);
+	status = nl_mkdir(clnt, &nl_work_fh, name, &t->dir);
+
+	if (status == 0 && nl_weights[NL_WL_META] > 0) {
+		t->files = calloc(nl_nfiles, sizeof(struct nl_fh));
+		if (t->files == NULL)
+			return -1;
+		for (i = 0; i < nl_nfiles && status == 0; i++) {
+			snprintf(name, sizeof(name), "f%u", i);
+			status = nl_touch(clnt, &t->dir, name, &t->files[i]);
+		}
+	}
+
+	if (status == 0 && nl_weights[NL_WL_SEQIO] > 0) {
+		status = clnt->proto->create(clnt, &t->dir, "big",
+					     &t->seqio_file);
+		if (status > 0)
+			fprintf(stderr, "create of big failed (%d)\n", status);
+	}
+
+	/* The lock owner is made with a lock on a byte of this
+	   thread's own, past the ranges contended for, so that every
+	   lock the workload takes is by an existing owner. */
+	if (status == 0 && nl_weights[NL_WL_LOCK] > 0) {
+		status = clnt->proto->open(clnt, &nl_work_fh, "lockfile",
+					   &t->lock_file);
+		if (status == 0)
+			status = clnt->proto->lock(clnt, &t->lock_file,
+						   (uint64_t) nl_slots *
+						   NL_LOCK_SIZE + t->index, 1);
+		if (status > 0)
+			fprintf(stderr, "lock of lockfile failed (%d)\n",
+				status);
+	}
+
+	return status == 0 ? 0 : -1;
+}
+
+static void nl_thread_finish(struct nl_thread *t)
+{
+	struct nl_client *clnt = &t->clnt;
+
+	if (clnt->proto->close == NULL)
+		return;
+	if (t->create_file.open)
+		clnt->proto->close(clnt, &t->create_file);
+	if (t->seqio_file.open)
+		clnt->proto->close(clnt, &t->seqio_file);
+	if (t->lock_file.open)
+		clnt->proto->close(clnt, &t->lock_file);
+}
+
+static int nl_step_meta(struct nl_thread *t, enum nl_op *op)
+{
+	struct nl_client *clnt = &t->clnt;
+	unsigned int i = nl_random(t) % nl_nfiles;
+	struct nl_fh fh;
+	char name[32];
+
+	switch (t->meta_step++ % 3) {
+	case 0:
+		*op = NL_OP_GETATTR;
+		return clnt->proto->getattr(clnt, &t->files[i]);
+	case 1:
+		*op = NL_OP_LOOKUP;
+		snprintf(name, sizeof(name), "f%u", i);
+		return clnt->proto->lookup(clnt, &t->dir, name, &fh);
+	default:
+		*op = NL_OP_ACCESS;
+		return clnt->proto->access(clnt, &t->files[i]);
+	}
+}
+
+static int nl_step_create(struct nl_thread *t, enum nl_op *op)
+{
+	struct nl_client *clnt = &t->clnt;
+	int status;
+
+	switch (t->create_step) {
+	case 0:
+		*op = NL_OP_CREATE;
+		snprintf(t->create_name, sizeof(t->create_name), "c%llu",
+			 (unsigned long long)t->create_seq++);
+		status = clnt->proto->create(clnt, &t->dir, t->create_name,
+					     &t->create_file);
+		if (status == 0)
+			t->create_step = nl_smallsize > 0 ? 1 : 2;
+		return status;
+	case 1:
+		*op = NL_OP_WRITE;
+		t->create_step = 2;
+		return clnt->proto->write(clnt, &t->create_file, 0,
+					  nl_smallsize, true);
+	case 2:
+		if (clnt->proto->close != NULL) {
+			*op = NL_OP_CLOSE;
+			t->create_step = 3;
+			return clnt->proto->close(clnt, &t->create_file);
+		}
+		/* Fall through */
+	default:
+		*op = NL_OP_REMOVE;
+		t->create_step = 0;
+		return clnt->proto->remove(clnt, &t->dir, t->create_name);
+	}
+}
+
+static int nl_step_seqio(struct nl_thread *t, enum nl_op *op)
+{
+	struct nl_client *clnt = &t->clnt;
+	uint64_t offset = t->seqio_offset;
+	bool eof = false;
+	int status;
+
+	switch (t->seqio_step) {
+	case 0:
+		*op = NL_OP_WRITE;
+		t->seqio_offset += nl_iosize;
+		if (t->seqio_offset >= nl_filesize)
+			t->seqio_step = 1;
+		return clnt->proto->write(clnt, &t->seqio_file, offset,
+					  nl_iosize, false);
+	case 1:
+		*op = NL_OP_COMMIT;
+		t->seqio_step = 2;
+		t->seqio_offset = 0;
+		return clnt->proto->commit(clnt, &t->seqio_file);
+	default:
+		*op = NL_OP_READ;
+		status = clnt->proto->read(clnt, &t->seqio_file, offset,
+					   nl_iosize, &eof);
+		t->seqio_offset += nl_iosize;
+		if (eof || status != 0 || t->seqio_offset >= nl_filesize) {
+			t->seqio_step = 0;
+			t->seqio_offset = 0;
+		}
+		return status;
+	}
+}
+
+static int nl_step_lock(struct nl_thread *t, enum nl_op *op)
+{
+	struct nl_client *clnt = &t->clnt;
+	int status;
+
+	if (t->lock_step == 0) {
+		*op = NL_OP_LOCK;
+		t->lock_offset = (nl_random(t) % nl_slots) * NL_LOCK_SIZE;
+		status = clnt->proto->lock(clnt, &t->lock_file,
+					   t->lock_offset, NL_LOCK_SIZE);
+		if (status == 0)
+			t->lock_step = 1;
+		return status;
+	}
+
+	*op = NL_OP_UNLOCK;
+	t->lock_step = 0;
+	return clnt->proto->unlock(clnt, &t->lock_file, t->lock_offset,
+				   NL_LOCK_SIZE);
+}
+
+static int nl_step_readdir(struct nl_thread *t, enum nl_op *op)
+{
+	struct nl_client *clnt = &t->clnt;
+	uint32_t entries = 0;
+	bool eof = false;
+	int status;
+
+	*op = NL_OP_READDIR;
+	status = clnt->proto->readdir(clnt, &nl_shared_fh, &t->readdir_cookie,
+				      t->readdir_verf, &entries, &eof);
+	if (eof || status != 0) {
+		t->readdir_cookie = 0;
+		memset(t->readdir_verf, 0, sizeof(t->readdir_verf));
+	}
+	return status;
+}
+
+static int (*const nl_steps[NL_WL_COUNT])(struct nl_thread *, enum nl_op *) = {
+	[NL_WL_META] = nl_step_meta,
+	[NL_WL_CREATE] = nl_step_create,
+	[NL_WL_SEQIO] = nl_step_seqio,
+	[NL_WL_LOCK] = nl_step_lock,
+	[NL_WL_READDIR] = nl_step_readdir,
+};
+
+static enum nl_workload nl_pick(struct nl_thread *t)
+{
+	unsigned int r = nl_random(t) % nl_weight_total;
+	enum nl_workload wl;
+
+	for (wl = 0; r >= nl_weights[wl]; wl++)
+		r -= nl_weights[wl];
+	return wl;
+}
+
+static void nl_run(struct nl_thread *t)
+{
+	uint64_t interval = 0, due, done;
+	uint64_t n = 0;
+	struct nl_hist *h;
+	enum nl_op op;
+	int status;
+
+	if (nl_rate > 0)
+		interval = nl_threads * 1e9 / nl_rate;
+
+	for (;;) {
+		if (interval != 0) {
+			due = nl_start + interval * t->index / nl_threads +
+				interval * n++;
+			if (due >= nl_end)
+				break;
+			if (nl_now() < due)
+				nl_sleep_until(due);
+		} else {
+			due = nl_now();
+			if (due >= nl_end)
+				break;
+		}
+
+		status = nl_steps[nl_pick(t)](t, &op);
+		done = nl_now();
+		if (status < 0) {
+			t->failed = true;
+			break;
+		}
+
+		if (due >= nl_measure) {
+			h = &t->hist[op];
+			nl_hist_record(h, done - due);
+			if (status == NL_DENIED)
+				h->denied++;
+			else if (status != 0)
+				h->errors++;
+		}
+
+		if (t->clnt.proto->keepalive != NULL &&
+		    t->clnt.proto->keepalive(&t->clnt) < 0) {
+			t->failed = true;
+			break;
+		}
+	}
+}
+
+static void *nl_thread_main(void *arg)
+{
+	struct nl_thread *t = arg;
+	char name[16];
+	bool ready;
+
+	snprintf(name, sizeof(name), "%u", t->index);
+	ready = nl_client_init(&t->clnt, name) == 0;
+	if (ready && nl_thread_prepare(t) != 0)
+		t->failed = true;
+	t->failed = t->failed || !ready;
+
+	/* Once for every thread to be ready, once for the start time */
+	pthread_barrier_wait(&nl_barrier);
+	pthread_barrier_wait(&nl_barrier);
+
+	if (!t->failed)
+		nl_run(t);
+	if (ready) {
+		nl_thread_finish(t);
+		nl_client_fini(&t->clnt);
+	}
+	free(t->files);
+	return NULL;
+}
+
+static void nl_report_line(const char *name, const struct nl_hist *h,
+			   double seconds)
+{
+	printf("%-8s %10llu %7llu %7llu %10.1f %9.1f %9.1f %9.1f %9.1f "
+	       "%9.1f %9.1f\n", name,
+	       (unsigned long long)h->count, (unsigned long long)h->errors,
+	       (unsigned long long)h->denied, h->count / seconds,
+	       h->count ? h->sum / 1e3 / h->count : 0.0,
+	       nl_hist_percentile(h, 50) / 1e3,
+	       nl_hist_percentile(h, 90) / 1e3,
+	       nl_hist_percentile(h, 99) / 1e3,
+	       nl_hist_percentile(h, 99.9) / 1e3, h->max / 1e3);
+}
+
+static int nl_report(struct nl_thread *threads)
+{
+	static struct nl_hist ops[NL_OP_COUNT], total;
+	double seconds = (nl_end - nl_measure) / 1e9;
+	char path[1024];
+	unsigned int i, op;
+	int rc = 0;
+
+	for (i = 0; i < nl_threads; i++)
+		for (op = 0; op < NL_OP_COUNT; op++)
+			nl_hist_merge(&ops[op], &threads[i].hist[op]);
+
+	printf("%s%s, %u threads, %s, %u s after %u s warmup\n",
+	       nl_proto->name, nl_proto == &nl_nfs4_proto ?
+	       (nl_minor ? ".1" : ".0") : "", nl_threads,
+	       nl_rate > 0 ? "open loop" : "closed loop", nl_duration,
+	       nl_warmup);
+	if (nl_rate > 0)
+		printf("target rate %.1f calls/s\n", nl_rate);
+	printf("%-8s %10s %7s %7s %10s %9s %9s %9s %9s %9s %9s\n", "op",
+	       "count", "errors", "denied", "ops/s", "mean_us", "p50_us",
+	       "p90_us", "p99_us", "p99.9_us", "max_us");
+
+	for (op = 0; op < NL_OP_COUNT; op++) {
+		if (ops[op].count == 0)
+			continue;
+		nl_hist_merge(&total, &ops[op]);
+		nl_report_line(nl_op_names[op], &ops[op], seconds);
+		if (nl_histprefix != NULL) {
+			snprintf(path, sizeof(path), "%s-%s.csv", nl_histprefix,
+				 nl_op_names[op]);
+			rc |= nl_hist_dump(&ops[op], path);
+		}
+	}
+	nl_report_line("total", &total, seconds);
+	if (nl_histprefix != NULL && total.count > 0) {
+		snprintf(path, sizeof(path), "%s-total.csv", nl_histprefix);
+		rc |= nl_hist_dump(&total, path);
+	}
+	return rc;
+}
+
+static int nl_parse_mix(char *mix)
+{
+	char *item, *save, *colon;
+	unsigned int wl;
+
+	memset(nl_weights, 0, sizeof(nl_weights));
+	nl_weight_total = 0;
+	for (item = strtok_r(mix, ",", &save); item != NULL;
+	     item = strtok_r(NULL, ",", &save)) {
+		colon = strchr(item, ':');
+		if (colon != NULL)
+			*colon++ = '\0';
+		for (wl = 0; wl < NL_WL_COUNT; wl++)
+			if (strcmp(item, nl_wl_names[wl]) == 0)
+				break;
+		if (wl == NL_WL_COUNT) {
+			fprintf(stderr, "unknown workload %s\n", item);
+			return -1;
+		}
+		nl_weights[wl] = colon != NULL ? strtoul(colon, NULL, 0) : 1;
+		nl_weight_total += nl_weights[wl];
+	}
+	if (nl_weight_total == 0) {
+		fprintf(stderr, "no workload to run\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int nl_parse_version(const char *version)
+{
+	if (strcmp(version, "3") == 0) {
+		nl_proto = &nl_nfs3_proto;
+	} else if (strcmp(version, "4") == 0 || strcmp(version, "4.0") == 0) {
+		nl_proto = &nl_nfs4_proto;
+		nl_minor = 0;
+	} else if (strcmp(version, "4.1") == 0) {
+		nl_proto = &nl_nfs4_proto;
+		nl_minor = 1;
+	} else {
+		fprintf(stderr, "unknown version %s\n", version);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct nl_thread *threads;
+	bool prepared = true;
+	unsigned int i;
+	int failed = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv,
+			     "s:p:m:v:e:d:T:t:W:r:w:F:N:b:S:f:L:u:g:x:H:"))
+	       != -1) {
+		switch (opt) {
+		case 's':
+			nl_host = optarg;
+			break;
+		case 'p':
+			nl_port = atoi(optarg);
+			break;
+		case 'm':
+			nl_mount_port = atoi(optarg);
+			break;
+		case 'v':
+			if (nl_parse_version(optarg) != 0)
+				return 1;
+			break;
+		case 'e':
+			nl_export = optarg;
+			break;
+		case 'd':
+			nl_workdir = optarg;
+			break;
+		case 'T':
+			nl_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			nl_duration = strtoul(optarg, NULL, 0);
+			break;
+		case 'W':
+			nl_warmup = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			nl_rate = strtod(optarg, NULL);
+			break;
+		case 'w':
+			if (nl_parse_mix(optarg) != 0)
+				return 1;
+			break;
+		case 'F':
+			nl_nfiles = strtoul(optarg, NULL, 0);
+			break;
+		case 'N':
+			nl_entries = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			nl_iosize = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			nl_filesize = strtoull(optarg, NULL, 0);
+			break;
+		case 'f':
+			nl_smallsize = strtoul(optarg, NULL, 0);
+			break;
+		case 'L':
+			nl_slots = strtoul(optarg, NULL, 0);
+			break;
+		case 'u':
+			nl_uid = strtoul(optarg, NULL, 0);
+			break;
+		case 'g':
+			nl_gid = strtoul(optarg, NULL, 0);
+			break;
+		case 'x':
+			nl_seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'H':
+			nl_histprefix = optarg;
+			break;
+		default:
+			fprintf(stderr, "%s", usage);
+			return 1;
+		}
+	}
+
+	if (optind != argc || nl_threads == 0 || nl_duration == 0) {
+		fprintf(stderr, "%s", usage);
+		return 1;
+	}
+	if (nl_iosize == 0 || nl_iosize > NL_MAXIO ||
+	    nl_smallsize > NL_MAXIO) {
+		fprintf(stderr, "reads and writes are at most %u bytes\n",
+			NL_MAXIO);
+		return 1;
+	}
+	if (nl_weights[NL_WL_META] > 0 && nl_nfiles == 0) {
+		fprintf(stderr, "meta needs at least one file\n");
+		return 1;
+	}
+	if (nl_weights[NL_WL_LOCK] > 0 && (!nl_proto->can_lock ||
+					   nl_slots == 0)) {
+		fprintf(stderr, "lock needs NFSv4 and at least one slot\n");
+		return 1;
+	}
+	if (nl_mount_port == 0)
+		nl_mount_port = nl_port;
+	if (nl_mount_port == nl_port)
+		nl_mount_port = 0;
+	srandom(nl_seed);
+
+	if (nl_prepare() != 0)
+		return 1;
+
+	threads = calloc(nl_threads, sizeof(struct nl_thread));
+	if (threads == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	pthread_barrier_init(&nl_barrier, NULL, nl_threads + 1);
+	for (i = 0; i < nl_threads; i++) {
+		threads[i].index = i;
+		threads[i].rng = nl_seed * 0x9e3779b97f4a7c15ULL + i + 1;
+		if (pthread_create(&threads[i].tid, NULL, nl_thread_main,
+				   &threads[i]) != 0) {
+			fprintf(stderr, "unable to start threads\n");
+			return 1;
+		}
+	}
+
+	pthread_barrier_wait(&nl_barrier);
+	for (i = 0; i < nl_threads; i++)
+		failed |= threads[i].failed;
+	if (failed) {
+		/* Nothing is run, every thread goes straight to cleanup */
+		nl_start = nl_measure = nl_end = nl_now();
+		prepared = false;
+	} else {
+		nl_start = nl_now();
+		nl_measure = nl_start + nl_warmup * 1000000000ULL;
+		nl_end = nl_measure + nl_duration * 1000000000ULL;
+	}
+	pthread_barrier_wait(&nl_barrier);
+
+	for (i = 0; i < nl_threads; i++) {
+		pthread_join(threads[i].tid, NULL);
+		failed |= threads[i].failed;
+	}
+	if (prepared && failed)
+		fprintf(stderr, "some threads failed, results are partial\n");
+	if (prepared && nl_report(threads) != 0)
+		failed = 1;
+
+	pthread_barrier_destroy(&nl_barrier);
+	free(threads);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,230 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file   nfsload.h
+ * @brief Declarations shared by the parts of the load generator
+ *
+ * nfsload talks ONC RPC over TCP itself, with just enough XDR for the
+ * calls it makes, so that it depends on nothing but libc and can be
+ * pointed at a server on the loopback without a kernel client in the
+ * way.  Each thread has a connection, and for NFSv4 a client and
+ * (4.1) a session, of its own and keeps one call outstanding.
+ *
+ * The protocol versions are reached through struct nl_proto.  Each
+ * operation in it is exactly one RPC, so that the workloads can time
+ * it, and returns 0, a positive NFS status or -1 if the connection
+ * failed.
+ */
+
+#ifndef NFSLOAD_H
+#define NFSLOAD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#define NL_PROG_NFS 100003
+#define NL_PROG_MOUNT 100005
+
+/** Largest NFSv4 handle, which also covers NFSv3 */
+#define NL_FHSIZE 128
+
+/** Largest single read or write */
+#define NL_MAXIO (1024 * 1024)
+
+/** Status returned when a lock is held by someone else */
+#define NL_DENIED 10010
+
+/**
+ * @brief An XDR buffer, for encoding or decoding
+ */
+
+struct nl_xdr {
+	unsigned char *buf;
+	size_t cap; /*< Allocated length of buf */
+	size_t len; /*< Bytes in buf */
+	size_t pos; /*< Next byte to decode */
+	bool bad; /*< A decode ran past len */
+};
+
+void nl_put_u32(struct nl_xdr *x, uint32_t v);
+void nl_put_u64(struct nl_xdr *x, uint64_t v);
+void nl_put_fixed(struct nl_xdr *x, const void *p, size_t len);
+void nl_put_opaque(struct nl_xdr *x, const void *p, uint32_t len);
+void nl_put_string(struct nl_xdr *x, const char *s);
+void nl_put_zeros(struct nl_xdr *x, uint32_t len);
+uint32_t nl_get_u32(struct nl_xdr *x);
+uint64_t nl_get_u64(struct nl_xdr *x);
+void nl_get_fixed(struct nl_xdr *x, void *p, size_t len);
+uint32_t nl_get_opaque(struct nl_xdr *x, void *p, uint32_t max);
+void nl_skip(struct nl_xdr *x, size_t len);
+void nl_skip_opaque(struct nl_xdr *x);
+
+/**
+ * @brief A connection to the server
+ */
+
+struct nl_conn {
+	int fd;
+	uint32_t xid;
+	uint32_t uid;
+	uint32_t gid;
+	struct nl_xdr call; /*< Call being built */
+	struct nl_xdr reply; /*< Results of the last call */
+};
+
+int nl_connect(struct nl_conn *conn, const char *host, int port,
+	       uint32_t uid, uint32_t gid);
+void nl_disconnect(struct nl_conn *conn);
+struct nl_xdr *nl_call_begin(struct nl_conn *conn, uint32_t prog,
+			     uint32_t vers, uint32_t proc);
+int nl_call(struct nl_conn *conn);
+
+/**
+ * @brief A file handle
+ */
+
+struct nl_fh {
+	uint32_t len;
+	unsigned char data[NL_FHSIZE];
+};
+
+/**
+ * @brief An NFSv4 stateid
+ */
+
+struct nl_stateid {
+	uint32_t seqid;
+	unsigned char other[12];
+};
+
+/**
+ * @brief A file, and for NFSv4 its open and lock state
+ */
+
+struct nl_file {
+	struct nl_fh fh;
+	bool open; /*< open_stateid is valid */
+	struct nl_stateid open_stateid;
+	bool locker; /*< lock_stateid is valid */
+	struct nl_stateid lock_stateid;
+	uint32_t lock_seqid; /*< Next lock seqid, 4.0 */
+};
+
+/**
+ * @brief One client of the server
+ *
+ * For NFSv4 each thread is a client of its own, with one open owner
+ * and, for 4.1, one session of one slot.
+ */
+
+struct nl_client {
+	struct nl_conn conn;
+	const struct nl_proto *proto;
+	uint32_t minor; /*< NFSv4 minor version */
+	char owner[64]; /*< Client and owner name */
+	uint64_t clientid;
+	unsigned char sessionid[16];
+	uint32_t slot_seqid; /*< Sequence of the next call on the slot */
+	uint32_t open_seqid; /*< Next seqid of the open owner, 4.0 */
+	bool owner_confirmed; /*< Open owner needs no OPEN_CONFIRM */
+	time_t renewed; /*< Last RENEW, 4.0 */
+};
+
+/**
+ * @brief The operations of one protocol version
+ */
+
+struct nl_proto {
+	const char *name;
+	bool can_lock;
+	int (*setup)(struct nl_client *clnt);
+	void (*teardown)(struct nl_client *clnt);
+	int (*root)(struct nl_client *clnt, const char *path,
+		    struct nl_fh *fh);
+	int (*lookup)(struct nl_client *clnt, const struct nl_fh *dir,
+		      const char *name, struct nl_fh *fh);
+	int (*getattr)(struct nl_client *clnt, const struct nl_fh *fh);
+	int (*access)(struct nl_client *clnt, const struct nl_fh *fh);
+	int (*mkdir)(struct nl_client *clnt, const struct nl_fh *dir,
+		     const char *name, struct nl_fh *fh);
+	int (*create)(struct nl_client *clnt, const struct nl_fh *dir,
+		      const char *name, struct nl_file *file);
+	int (*open)(struct nl_client *clnt, const struct nl_fh *dir,
+		    const char *name, struct nl_file *file);
+	int (*close)(struct nl_client *clnt, struct nl_file *file);
+	int (*read)(struct nl_client *clnt, struct nl_file *file,
+		    uint64_t offset, uint32_t count, bool *eof);
+	int (*write)(struct nl_client *clnt, struct nl_file *file,
+		     uint64_t offset, uint32_t count, bool stable);
+	int (*commit)(struct nl_client *clnt, struct nl_file *file);
+	int (*remove)(struct nl_client *clnt, const struct nl_fh *dir,
+		      const char *name);
+	int (*readdir)(struct nl_client *clnt, const struct nl_fh *dir,
+		       uint64_t *cookie, unsigned char *verf,
+		       uint32_t *entries, bool *eof);
+	int (*lock)(struct nl_client *clnt, struct nl_file *file,
+		    uint64_t offset, uint64_t length);
+	int (*unlock)(struct nl_client *clnt, struct nl_file *file,
+		      uint64_t offset, uint64_t length);
+	int (*keepalive)(struct nl_client *clnt);
+};
+
+extern const struct nl_proto nl_nfs3_proto;
+extern const struct nl_proto nl_nfs4_proto;
+
+/** Port the MOUNT program is reached on, set before nfs3 root */
+extern int nl_mount_port;
+
+/** Server, for connections other than the client's own */
+extern const char *nl_host;
+
+/**
+ * @brief Latency histogram
+ *
+ * Buckets are log-linear: exact below 2^NL_HIST_SUB_BITS ns, and
+ * from there on 2^NL_HIST_SUB_BITS buckets per power of two, so the
+ * error of any percentile is under 1/2^NL_HIST_SUB_BITS.
+ */
+
+#define NL_HIST_SUB_BITS 5
+#define NL_HIST_SUB (1 << NL_HIST_SUB_BITS)
+#define NL_HIST_BUCKETS ((64 - NL_HIST_SUB_BITS + 1) * NL_HIST_SUB)
+
+struct nl_hist {
+	uint64_t count;
+	uint64_t errors; /*< Calls that failed */
+	uint64_t denied; /*< Locks that were held by another */
+	uint64_t sum; /*< Of the latencies, in ns */
+	uint64_t max;
+	uint64_t bucket[NL_HIST_BUCKETS];
+};
+
+void nl_hist_record(struct nl_hist *h, uint64_t ns);
+void nl_hist_merge(struct nl_hist *to, const struct nl_hist *from);
+uint64_t nl_hist_percentile(const struct nl_hist *h, double pct);
+int nl_hist_dump(const struct nl_hist *h, const char *path);
+
+#endif /* !NFSLOAD_H */
@@ -0,0 +1,141 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file   nl_hist.c
+ * @brief Latency histograms for the load generator
+ *
+ * Each thread records into histograms of its own, which are merged
+ * once the run is over, so recording is a few instructions and takes
+ * no lock.
+ */
+
+#include <stdio.h>
+#include "nfsload.h"
+
+static unsigned int nl_hist_index(uint64_t ns)
+{
+	unsigned int shift;
+
+	if (ns < NL_HIST_SUB)
+		return ns;
+	shift = 63 - __builtin_clzll(ns) - NL_HIST_SUB_BITS;
+	return (shift + 1) * NL_HIST_SUB + ((ns >> shift) & (NL_HIST_SUB - 1));
+}
+
+/**
+ * @brief Least latency counted in a bucket
+ */
+
+static uint64_t nl_hist_value(unsigned int idx)
+{
+	unsigned int shift;
+
+	if (idx < NL_HIST_SUB)
+		return idx;
+	shift = idx / NL_HIST_SUB - 1;
+	return (uint64_t) (NL_HIST_SUB + idx % NL_HIST_SUB) << shift;
+}
+
+void nl_hist_record(struct nl_hist *h, uint64_t ns)
+{
+	h->count++;
+	h->sum += ns;
+	if (ns > h->max)
+		h->max = ns;
+	h->bucket[nl_hist_index(ns)]++;
+}
+
+void nl_hist_merge(struct nl_hist *to, const struct nl_hist *from)
+{
+	unsigned int i;
+
+	to->count += from->count;
+	to->errors += from->errors;
+	to->denied += from->denied;
+	to->sum += from->sum;
+	if (from->max > to->max)
+		to->max = from->max;
+	for (i = 0; i < NL_HIST_BUCKETS; i++)
+		to->bucket[i] += from->bucket[i];
+}
+
+/**
+ * @brief Latency below which pct percent of the calls completed
+ *
+ * The value is the top of the bucket the percentile falls in, so it
+ * errs on the high side.
+ */
+
+uint64_t nl_hist_percentile(const struct nl_hist *h, double pct)
+{
+	uint64_t want = (uint64_t) (h->count * pct / 100.0 + 0.5);
+	uint64_t seen = 0;
+	uint64_t top;
+	unsigned int i;
+
+	if (want == 0)
+		want = 1;
+	for (i = 0; i < NL_HIST_BUCKETS - 1; i++) {
+		seen += h->bucket[i];
+		if (seen >= want)
+			break;
+	}
+	top = nl_hist_value(i + 1) - 1;
+	return top < h->max ? top : h->max;
+}
+
+/**
+ * @brief Write the non-empty buckets of a histogram as CSV
+ *
+ * Each line is the least latency of a bucket in microseconds, the
+ * number of calls in it and the fraction of calls at or below it.
+ *
+ * @return 0, or -1 if the file could not be written.
+ */
+
+int nl_hist_dump(const struct nl_hist *h, const char *path)
+{
+	FILE *f = fopen(path, "w");
+	uint64_t seen = 0;
+	unsigned int i;
+
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	fprintf(f, "latency_us,count,cumulative\n");
+	for (i = 0; i < NL_HIST_BUCKETS; i++) {
+		if (h->bucket[i] == 0)
+			continue;
+		seen += h->bucket[i];
+		fprintf(f, "%.3f,%llu,%.6f\n", nl_hist_value(i) / 1000.0,
+			(unsigned long long)h->bucket[i],
+			(double)seen / h->count);
+	}
+	if (fclose(f) != 0) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,370 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file   nl_nfs3.c
+ * @brief NFSv3 and MOUNTv3 for the load generator
+ *
+ * Only the results the workloads use are decoded; everything else in
+ * a reply is skipped over.  Byte-range locks would need NLM, which is
+ * not spoken, so the lock workload is refused for NFSv3.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "nfsload.h"
+
+#define NFSPROC3_GETATTR 1
+#define NFSPROC3_LOOKUP 3
+#define NFSPROC3_ACCESS 4
+#define NFSPROC3_READ 6
+#define NFSPROC3_WRITE 7
+#define NFSPROC3_CREATE 8
+#define NFSPROC3_MKDIR 9
+#define NFSPROC3_REMOVE 12
+#define NFSPROC3_READDIRPLUS 17
+#define NFSPROC3_COMMIT 21
+
+#define MOUNTPROC3_MNT 1
+
+#define NFS3_OK 0
+#define NFS3_FATTR_SIZE 84
+#define NFS3_PRE_OP_SIZE 24
+#define NFS3_UNSTABLE 0
+#define NFS3_FILE_SYNC 2
+#define NFS3_UNCHECKED 0
+#define NFS3_ACCESS_ALL 0x3f
+
+/** Port of the MOUNT program, 0 for the NFS port */
+int nl_mount_port;
+
+static struct nl_xdr *nfs3_begin(struct nl_client *clnt, uint32_t proc)
+{
+	return nl_call_begin(&clnt->conn, NL_PROG_NFS, 3, proc);
+}
+
+static void put_fh(struct nl_xdr *x, const struct nl_fh *fh)
+{
+	nl_put_opaque(x, fh->data, fh->len);
+}
+
+static void get_fh(struct nl_xdr *x, struct nl_fh *fh)
+{
+	fh->len = nl_get_opaque(x, fh->data, sizeof(fh->data));
+}
+
+static void skip_post_op_attr(struct nl_xdr *x)
+{
+	if (nl_get_u32(x))
+		nl_skip(x, NFS3_FATTR_SIZE);
+}
+
+static void skip_wcc_data(struct nl_xdr *x)
+{
+	if (nl_get_u32(x))
+		nl_skip(x, NFS3_PRE_OP_SIZE);
+	skip_post_op_attr(x);
+}
+
+/**
+ * @brief Put an sattr3 setting nothing but the mode
+ */
+
+static void put_sattr_mode(struct nl_xdr *x, uint32_t mode)
+{
+	nl_put_u32(x, 1);
+	nl_put_u32(x, mode);
+	nl_put_u32(x, 0);	/* uid */
+	nl_put_u32(x, 0);	/* gid */
+	nl_put_u32(x, 0);	/* size */
+	nl_put_u32(x, 0);	/* atime, DONT_CHANGE */
+	nl_put_u32(x, 0);	/* mtime, DONT_CHANGE */
+}
+
+/**
+ * @brief Make a call and get the status at the head of its results
+ *
+ * @return The status, or -1 if the call failed.
+ */
+
+static int nfs3_call(struct nl_client *clnt, struct nl_xdr **res)
+{
+	if (nl_call(&clnt->conn) != 0)
+		return -1;
+	*res = &clnt->conn.reply;
+	return nl_get_u32(*res);
+}
+
+/**
+ * @brief Check a reply was decoded within its bounds
+ */
+
+static int nfs3_done(struct nl_xdr *res, int status)
+{
+	if (res->bad) {
+		fprintf(stderr, "garbled NFSv3 reply\n");
+		return -1;
+	}
+	return status;
+}
+
+static int nfs3_root(struct nl_client *clnt, const char *path,
+		     struct nl_fh *fh)
+{
+	struct nl_conn conn;
+	struct nl_conn *mnt = &clnt->conn;
+	struct nl_xdr *x;
+	uint32_t status;
+	int rc = -1;
+
+	if (nl_mount_port != 0) {
+		if (nl_connect(&conn, nl_host, nl_mount_port, clnt->conn.uid,
+			       clnt->conn.gid) != 0)
+			return -1;
+		mnt = &conn;
+	}
+
+	x = nl_call_begin(mnt, NL_PROG_MOUNT, 3, MOUNTPROC3_MNT);
+	nl_put_string(x, path);
+	if (nl_call(mnt) == 0) {
+		x = &mnt->reply;
+		status = nl_get_u32(x);
+		if (status == 0)
+			get_fh(x, fh);
+		rc = nfs3_done(x, status);
+		if (rc > 0)
+			fprintf(stderr, "mount of %s failed (%d)\n", path, rc);
+	}
+
+	if (mnt == &conn)
+		nl_disconnect(&conn);
+	return rc;
+}
+
+static int nfs3_lookup(struct nl_client *clnt, const struct nl_fh *dir,
+		       const char *name, struct nl_fh *fh)
+{
+	struct nl_xdr *x = nfs3_begin(clnt, NFSPROC3_LOOKUP);
+	int status;
+
+	put_fh(x, dir);
+	nl_put_string(x, name);
+	status = nfs3_call(clnt, &x);
+	if (status == NFS3_OK)
+		get_fh(x, fh);
+	return status < 0 ? status : nfs3_done(x, status);
+}
+
+static int nfs3_getattr(struct nl_client *clnt, const struct nl_fh *fh)
+{
+	struct nl_xdr *x = nfs3_begin(clnt, NFSPROC3_GETATTR);
+	int status;
+
+	put_fh(x, fh);
+	status = nfs3_call(clnt, &x);
+	if (status == NFS3_OK)
+		nl_skip(x, NFS3_FATTR_SIZE);
+	return status < 0 ? status : nfs3_done(x, status);
+}
+
+static int nfs3_access(struct nl_client *clnt, const struct nl_fh *fh)
+{
+	struct nl_xdr *x = nfs3_begin(clnt, NFSPROC3_ACCESS);
+	int status;
+
+	put_fh(x, fh);
+	nl_put_u32(x, NFS3_ACCESS_ALL);
+	status = nfs3_call(clnt, &x);
+	return status < 0 ? status : nfs3_done(x, status);
+}
+
+/**
+ * @brief Finish a CREATE or MKDIR, looking the object up if the
+ *        server did not return its handle
+ */
+
+static int nfs3_created(struct nl_client *clnt, struct nl_xdr *x,
+			int status, const struct nl_fh *dir,
+			const char *name, struct nl_fh *fh)
+{
+	bool have_fh = false;
+
+	if (status == NFS3_OK) {
+		have_fh = nl_get_u32(x);
+		if (have_fh)
+			get_fh(x, fh);
+	}
+	status = nfs3_done(x, status);
+	if (status == NFS3_OK && !have_fh)
+		return nfs3_lookup(clnt, dir, name, fh);
+	return status;
+}
+
+static int nfs3_mkdir(struct nl_client *clnt, const struct nl_fh *dir,
+		      const char *name, struct nl_fh *fh)
+{
+	struct nl_xdr *x = nfs3_begin(clnt, NFSPROC3_MKDIR);
+	int status;
+
+	put_fh(x, dir);
+	nl_put_string(x, name);
+	put_sattr_mode(x, 0755);
+	status = nfs3_call(clnt, &x);
+	if (status < 0)
+		return status;
+	return nfs3_created(clnt, x, status, dir, name, fh);
+}
+
+static int nfs3_create(struct nl_client *clnt, const struct nl_fh *dir,
+		       const char *name, struct nl_file *file)
+{
+	struct nl_xdr *x = nfs3_begin(clnt, NFSPROC3_CREATE);
+	int status;
+
+	put_fh(x, dir);
+	nl_put_string(x, name);
+	nl_put_u32(x, NFS3_UNCHECKED);
+	put_sattr_mode(x, 0644);
+	status = nfs3_call(clnt, &x);
+	if (status < 0)
+		return status;
+	return nfs3_created(clnt, x, status, dir, name, &file->fh);
+}
+
+static int nfs3_open(struct nl_client *clnt, const struct nl_fh *dir,
+		     const char *name, struct nl_file *file)
+{
+	return nfs3_lookup(clnt, dir, name, &file->fh);
+}
+
+static int nfs3_read(struct nl_client *clnt, struct nl_file *file,
+		     uint64_t offset, uint32_t count, bool *eof)
+{
+	struct nl_xdr *x = nfs3_begin(clnt, NFSPROC3_READ);
+	int status;
+
+	put_fh(x, &file->fh);
+	nl_put_u64(x, offset);
+	nl_put_u32(x, count);
+	status = nfs3_call(clnt, &x);
+	if (status < 0)
+		return status;
+	skip_post_op_attr(x);
+	if (status == NFS3_OK) {
+		nl_get_u32(x);	/* count */
+		*eof = nl_get_u32(x);
+		nl_skip_opaque(x);
+	}
+	return nfs3_done(x, status);
+}
+
+static int nfs3_write(struct nl_client *clnt, struct nl_file *file,
+		      uint64_t offset, uint32_t count, bool stable)
+{
+	struct nl_xdr *x = nfs3_begin(clnt, NFSPROC3_WRITE);
+	int status;
+
+	put_fh(x, &file->fh);
+	nl_put_u64(x, offset);
+	nl_put_u32(x, count);
+	nl_put_u32(x, stable ? NFS3_FILE_SYNC : NFS3_UNSTABLE);
+	nl_put_zeros(x, count);
+	status = nfs3_call(clnt, &x);
+	return status < 0 ? status : nfs3_done(x, status);
+}
+
+static int nfs3_commit(struct nl_client *clnt, struct nl_file *file)
+{
+	struct nl_xdr *x = nfs3_begin(clnt, NFSPROC3_COMMIT);
+	int status;
+
+	put_fh(x, &file->fh);
+	nl_put_u64(x, 0);
+	nl_put_u32(x, 0);
+	status = nfs3_call(clnt, &x);
+	return status < 0 ? status : nfs3_done(x, status);
+}
+
+static int nfs3_remove(struct nl_client *clnt, const struct nl_fh *dir,
+		       const char *name)
+{
+	struct nl_xdr *x = nfs3_begin(clnt, NFSPROC3_REMOVE);
+	int status;
+
+	put_fh(x, dir);
+	nl_put_string(x, name);
+	status = nfs3_call(clnt, &x);
+	if (status >= 0)
+		skip_wcc_data(x);
+	return status < 0 ? status : nfs3_done(x, status);
+}
+
+static int nfs3_readdir(struct nl_client *clnt, const struct nl_fh *dir,
+			uint64_t *cookie, unsigned char *verf,
+			uint32_t *entries, bool *eof)
+{
+	struct nl_xdr *x = nfs3_begin(clnt, NFSPROC3_READDIRPLUS);
+	int status;
+
+	put_fh(x, dir);
+	nl_put_u64(x, *cookie);
+	nl_put_fixed(x, verf, 8);
+	nl_put_u32(x, 8192);	/* dircount */
+	nl_put_u32(x, 32768);	/* maxcount */
+	status = nfs3_call(clnt, &x);
+	if (status < 0)
+		return status;
+	skip_post_op_attr(x);
+	if (status == NFS3_OK) {
+		nl_get_fixed(x, verf, 8);
+		*entries = 0;
+		while (nl_get_u32(x) && !x->bad) {
+			nl_get_u64(x);	/* fileid */
+			nl_skip_opaque(x);	/* name */
+			*cookie = nl_get_u64(x);
+			skip_post_op_attr(x);
+			if (nl_get_u32(x))
+				nl_skip_opaque(x);	/* handle */
+			(*entries)++;
+		}
+		*eof = nl_get_u32(x);
+	}
+	return nfs3_done(x, status);
+}
+
+const struct nl_proto nl_nfs3_proto = {
+	.name = "NFSv3",
+	.can_lock = false,
+	.root = nfs3_root,
+	.lookup = nfs3_lookup,
+	.getattr = nfs3_getattr,
+	.access = nfs3_access,
+	.mkdir = nfs3_mkdir,
+	.create = nfs3_create,
+	.open = nfs3_open,
+	.read = nfs3_read,
+	.write = nfs3_write,
+	.commit = nfs3_commit,
+	.remove = nfs3_remove,
+	.readdir = nfs3_readdir,
+};
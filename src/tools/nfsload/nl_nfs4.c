@@ -0,0 +1,1026 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file   nl_nfs4.c
+ * @brief NFSv4.0 and 4.1 for the load generator
+ *
+ * Every operation of struct nl_proto is one COMPOUND, led by
+ * SEQUENCE for 4.1.  A 4.0 client has one open owner whose seqid is
+ * tracked here, confirms it on its first OPEN and renews its lease
+ * from nfs4_keepalive; a 4.1 client has a session with a single
+ * slot.  Each file has at most one lock owner, which is created by
+ * the first LOCK on it.
+ *
+ * No callback path is offered, so the server should not hand out
+ * delegations; any it does are decoded and left alone.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "nfsload.h"
+
+#define NFS4_OK 0
+#define NFS4ERR_RESOURCE 10018
+#define NFS4ERR_MOVED 10019
+#define NFS4ERR_NOFILEHANDLE 10020
+#define NFS4ERR_STALE_CLIENTID 10022
+#define NFS4ERR_STALE_STATEID 10023
+#define NFS4ERR_BAD_STATEID 10025
+#define NFS4ERR_BAD_SEQID 10026
+#define NFS4ERR_BADXDR 10036
+
+#define OP_ACCESS 3
+#define OP_CLOSE 4
+#define OP_COMMIT 5
+#define OP_CREATE 6
+#define OP_GETATTR 9
+#define OP_GETFH 10
+#define OP_LOCK 12
+#define OP_LOCKU 14
+#define OP_LOOKUP 15
+#define OP_OPEN 18
+#define OP_OPEN_CONFIRM 20
+#define OP_PUTFH 22
+#define OP_PUTROOTFH 24
+#define OP_READ 25
+#define OP_READDIR 26
+#define OP_REMOVE 28
+#define OP_RENEW 30
+#define OP_SETCLIENTID 35
+#define OP_SETCLIENTID_CONFIRM 36
+#define OP_WRITE 38
+#define OP_EXCHANGE_ID 42
+#define OP_CREATE_SESSION 43
+#define OP_DESTROY_SESSION 44
+#define OP_SEQUENCE 53
+#define OP_DESTROY_CLIENTID 57
+#define OP_RECLAIM_COMPLETE 58
+
+#define NF4DIR 2
+#define WRITE_LT 2
+#define UNSTABLE4 0
+#define FILE_SYNC4 2
+#define OPEN4_NOCREATE 0
+#define OPEN4_CREATE 1
+#define UNCHECKED4 0
+#define CLAIM_NULL 0
+#define OPEN4_SHARE_ACCESS_BOTH 3
+#define OPEN4_SHARE_DENY_NONE 0
+#define OPEN4_RESULT_CONFIRM 0x2
+#define OPEN_DELEGATE_NONE 0
+#define OPEN_DELEGATE_READ 1
+#define OPEN_DELEGATE_WRITE 2
+#define OPEN_DELEGATE_NONE_EXT 3
+#define WND4_CONTENTION 1
+#define WND4_RESOURCE 2
+#define EXCHGID4_FLAG_USE_NON_PNFS 0x00010000
+#define SP4_NONE 0
+#define ACCESS4_ALL 0x3f
+
+/** Bits of word 0 of a bitmap */
+#define FATTR4_TYPE (1U << 1)
+#define FATTR4_CHANGE (1U << 3)
+#define FATTR4_SIZE (1U << 4)
+#define FATTR4_FILEID (1U << 20)
+/** Bits of word 1 */
+#define FATTR4_MODE (1U << (33 - 32))
+#define FATTR4_NUMLINKS (1U << (35 - 32))
+#define FATTR4_TIME_MODIFY (1U << (53 - 32))
+
+/** Callback program offered, which nothing listens on */
+#define NL_CB_PROGRAM 0x40000000
+
+/** Seconds between RENEWs of a 4.0 lease */
+#define NL_RENEW_INTERVAL 15
+
+/**
+ * @brief Results of a COMPOUND being decoded
+ */
+
+struct nfs4_res {
+	struct nl_xdr *x;
+	uint32_t status; /*< Status of the whole COMPOUND */
+	uint32_t left; /*< Results not yet decoded */
+};
+
+/**
+ * @brief Start a COMPOUND of nops operations
+ *
+ * For 4.1 the SEQUENCE is put here, and is not counted in nops.
+ */
+
+static struct nl_xdr *nfs4_begin(struct nl_client *clnt, uint32_t nops,
+				 bool sequence)
+{
+	struct nl_xdr *x = nl_call_begin(&clnt->conn, NL_PROG_NFS, 4, 1);
+
+	sequence = sequence && clnt->minor > 0;
+	nl_put_u32(x, 0);	/* Empty tag */
+	nl_put_u32(x, clnt->minor);
+	nl_put_u32(x, nops + (sequence ? 1 : 0));
+	if (sequence) {
+		nl_put_u32(x, OP_SEQUENCE);
+		nl_put_fixed(x, clnt->sessionid, sizeof(clnt->sessionid));
+		nl_put_u32(x, clnt->slot_seqid);
+		nl_put_u32(x, 0);	/* Slot */
+		nl_put_u32(x, 0);	/* Highest slot */
+		nl_put_u32(x, 0);	/* Do not cache */
+	}
+	return x;
+}
+
+/**
+ * @brief Get the status and result of the next operation
+ *
+ * @return The status of the operation, or -1 if the reply does not
+ *         match the call.
+ */
+
+static int nfs4_op(struct nfs4_res *res, uint32_t op)
+{
+	if (res->left == 0)
+		return res->status != NFS4_OK ? (int)res->status : -1;
+	res->left--;
+	if (nl_get_u32(res->x) != op)
+		res->x->bad = true;
+	return res->x->bad ? -1 : (int)nl_get_u32(res->x);
+}
+
+/**
+ * @brief Make the COMPOUND and decode the SEQUENCE result, if any
+ *
+ * @return 0, the status of a failed SEQUENCE, or -1.
+ */
+
+static int nfs4_call(struct nl_client *clnt, struct nfs4_res *res,
+		     bool sequence)
+{
+	int status;
+
+	if (nl_call(&clnt->conn) != 0)
+		return -1;
+	res->x = &clnt->conn.reply;
+	res->status = nl_get_u32(res->x);
+	nl_skip_opaque(res->x);	/* Tag */
+	res->left = nl_get_u32(res->x);
+	if (!sequence || clnt->minor == 0)
+		return 0;
+
+	status = nfs4_op(res, OP_SEQUENCE);
+	if (status != NFS4_OK)
+		return status;
+	nl_skip(res->x, 16 + 5 * 4);
+	clnt->slot_seqid++;
+	return 0;
+}
+
+/**
+ * @brief Check a reply was decoded within its bounds
+ */
+
+static int nfs4_done(struct nfs4_res *res, int status)
+{
+	if (status >= 0 && res->x->bad) {
+		fprintf(stderr, "garbled NFSv4 reply\n");
+		return -1;
+	}
+	return status;
+}
+
+/**
+ * @brief Whether a 4.0 seqid-mutating operation consumed its seqid
+ */
+
+static bool nfs4_seqid_used(int status)
+{
+	switch (status) {
+	case -1:
+	case NFS4ERR_STALE_CLIENTID:
+	case NFS4ERR_STALE_STATEID:
+	case NFS4ERR_BAD_STATEID:
+	case NFS4ERR_BAD_SEQID:
+	case NFS4ERR_BADXDR:
+	case NFS4ERR_RESOURCE:
+	case NFS4ERR_NOFILEHANDLE:
+	case NFS4ERR_MOVED:
+		return false;
+	default:
+		return true;
+	}
+}
+
+/**
+ * @brief The seqid to send, which 4.1 ignores
+ */
+
+static uint32_t nfs4_seqid(const struct nl_client *clnt, uint32_t seqid)
+{
+	return clnt->minor > 0 ? 0 : seqid;
+}
+
+static void put_putfh(struct nl_xdr *x, const struct nl_fh *fh)
+{
+	nl_put_u32(x, OP_PUTFH);
+	nl_put_opaque(x, fh->data, fh->len);
+}
+
+static void put_stateid(struct nl_xdr *x, const struct nl_stateid *sid)
+{
+	nl_put_u32(x, sid->seqid);
+	nl_put_fixed(x, sid->other, sizeof(sid->other));
+}
+
+static void get_stateid(struct nl_xdr *x, struct nl_stateid *sid)
+{
+	sid->seqid = nl_get_u32(x);
+	nl_get_fixed(x, sid->other, sizeof(sid->other));
+}
+
+static void get_fh(struct nl_xdr *x, struct nl_fh *fh)
+{
+	fh->len = nl_get_opaque(x, fh->data, sizeof(fh->data));
+}
+
+static void put_bitmap2(struct nl_xdr *x, uint32_t word0, uint32_t word1)
+{
+	nl_put_u32(x, 2);
+	nl_put_u32(x, word0);
+	nl_put_u32(x, word1);
+}
+
+static void skip_bitmap(struct nl_xdr *x)
+{
+	nl_skip(x, (size_t) nl_get_u32(x) * 4);
+}
+
+static void skip_fattr4(struct nl_xdr *x)
+{
+	skip_bitmap(x);
+	nl_skip_opaque(x);
+}
+
+static void skip_change_info(struct nl_xdr *x)
+{
+	nl_skip(x, 4 + 8 + 8);
+}
+
+/**
+ * @brief Put a fattr4 setting only the mode
+ */
+
+static void put_fattr_mode(struct nl_xdr *x, uint32_t mode)
+{
+	put_bitmap2(x, 0, FATTR4_MODE);
+	nl_put_u32(x, 4);
+	nl_put_u32(x, mode);
+}
+
+static void skip_nfsace4(struct nl_xdr *x)
+{
+	nl_skip(x, 3 * 4);
+	nl_skip_opaque(x);
+}
+
+static void skip_delegation(struct nl_xdr *x)
+{
+	switch (nl_get_u32(x)) {
+	case OPEN_DELEGATE_READ:
+		nl_skip(x, 16 + 4);
+		skip_nfsace4(x);
+		break;
+	case OPEN_DELEGATE_WRITE:
+		/* stateid, recall and a space limit of either kind */
+		nl_skip(x, 16 + 4 + 4 + 8);
+		skip_nfsace4(x);
+		break;
+	case OPEN_DELEGATE_NONE_EXT:
+		switch (nl_get_u32(x)) {
+		case WND4_CONTENTION:
+		case WND4_RESOURCE:
+			nl_skip(x, 4);
+			break;
+		}
+		break;
+	case OPEN_DELEGATE_NONE:
+		break;
+	default:
+		x->bad = true;
+	}
+}
+
+static int nfs4_setclientid(struct nl_client *clnt, const unsigned char *verf)
+{
+	struct nfs4_res res;
+	struct nl_xdr *x = nfs4_begin(clnt, 1, false);
+	unsigned char confirm[8];
+	int status;
+
+	nl_put_u32(x, OP_SETCLIENTID);
+	nl_put_fixed(x, verf, 8);
+	nl_put_string(x, clnt->owner);
+	nl_put_u32(x, NL_CB_PROGRAM);
+	nl_put_string(x, "tcp");
+	nl_put_string(x, "127.0.0.1.0.0");
+	nl_put_u32(x, 1);	/* callback_ident */
+	status = nfs4_call(clnt, &res, false);
+	if (status == 0)
+		status = nfs4_op(&res, OP_SETCLIENTID);
+	if (status == NFS4_OK) {
+		clnt->clientid = nl_get_u64(res.x);
+		nl_get_fixed(res.x, confirm, sizeof(confirm));
+	}
+	status = nfs4_done(&res, status);
+	if (status != NFS4_OK)
+		return status;
+
+	x = nfs4_begin(clnt, 1, false);
+	nl_put_u32(x, OP_SETCLIENTID_CONFIRM);
+	nl_put_u64(x, clnt->clientid);
+	nl_put_fixed(x, confirm, sizeof(confirm));
+	status = nfs4_call(clnt, &res, false);
+	if (status == 0)
+		status = nfs4_op(&res, OP_SETCLIENTID_CONFIRM);
+	clnt->renewed = time(NULL);
+	return nfs4_done(&res, status);
+}
+
+static void put_channel_attrs(struct nl_xdr *x, uint32_t maxsize,
+			      uint32_t cached, uint32_t maxops)
+{
+	nl_put_u32(x, 0);	/* headerpadsize */
+	nl_put_u32(x, maxsize);	/* maxrequestsize */
+	nl_put_u32(x, maxsize);	/* maxresponsesize */
+	nl_put_u32(x, cached);
+	nl_put_u32(x, maxops);
+	nl_put_u32(x, 1);	/* maxrequests, a single slot */
+	nl_put_u32(x, 0);	/* No rdma_ird */
+}
+
+static int nfs4_exchange_id(struct nl_client *clnt, const unsigned char *verf)
+{
+	struct nfs4_res res;
+	struct nl_xdr *x = nfs4_begin(clnt, 1, false);
+	uint32_t sequence = 0;
+	uint32_t n;
+	int status;
+
+	nl_put_u32(x, OP_EXCHANGE_ID);
+	nl_put_fixed(x, verf, 8);
+	nl_put_string(x, clnt->owner);
+	nl_put_u32(x, EXCHGID4_FLAG_USE_NON_PNFS);
+	nl_put_u32(x, SP4_NONE);
+	nl_put_u32(x, 0);	/* No implementation id */
+	status = nfs4_call(clnt, &res, false);
+	if (status == 0)
+		status = nfs4_op(&res, OP_EXCHANGE_ID);
+	if (status == NFS4_OK) {
+		clnt->clientid = nl_get_u64(res.x);
+		sequence = nl_get_u32(res.x);
+		nl_get_u32(res.x);	/* flags */
+		if (nl_get_u32(res.x) != SP4_NONE)
+			res.x->bad = true;
+		nl_skip(res.x, 8);	/* so_minor_id */
+		nl_skip_opaque(res.x);	/* so_major_id */
+		nl_skip_opaque(res.x);	/* server_scope */
+		for (n = nl_get_u32(res.x); n > 0 && !res.x->bad; n--) {
+			nl_skip_opaque(res.x);
+			nl_skip_opaque(res.x);
+			nl_skip(res.x, 12);
+		}
+	}
+	status = nfs4_done(&res, status);
+	if (status != NFS4_OK)
+		return status;
+
+	x = nfs4_begin(clnt, 1, false);
+	nl_put_u32(x, OP_CREATE_SESSION);
+	nl_put_u64(x, clnt->clientid);
+	nl_put_u32(x, sequence);
+	nl_put_u32(x, 0);	/* flags */
+	put_channel_attrs(x, NL_MAXIO + 8192, 8192, 16);
+	put_channel_attrs(x, 4096, 0, 2);
+	nl_put_u32(x, NL_CB_PROGRAM);
+	nl_put_u32(x, 1);	/* One security parameter, */
+	nl_put_u32(x, 0);	/* AUTH_NONE */
+	status = nfs4_call(clnt, &res, false);
+	if (status == 0)
+		status = nfs4_op(&res, OP_CREATE_SESSION);
+	if (status == NFS4_OK)
+		nl_get_fixed(res.x, clnt->sessionid, sizeof(clnt->sessionid));
+	status = nfs4_done(&res, status);
+	if (status != NFS4_OK)
+		return status;
+	clnt->slot_seqid = 1;
+
+	x = nfs4_begin(clnt, 1, true);
+	nl_put_u32(x, OP_RECLAIM_COMPLETE);
+	nl_put_u32(x, 0);	/* Not for one filesystem */
+	status = nfs4_call(clnt, &res, true);
+	if (status == 0)
+		status = nfs4_op(&res, OP_RECLAIM_COMPLETE);
+	return nfs4_done(&res, status);
+}
+
+static int nfs4_setup(struct nl_client *clnt)
+{
+	unsigned char verf[8];
+	uint32_t pid = getpid();
+	uint32_t now = time(NULL);
+	int status;
+
+	memcpy(verf, &pid, 4);
+	memcpy(verf + 4, &now, 4);
+	if (clnt->minor == 0)
+		status = nfs4_setclientid(clnt, verf);
+	else
+		status = nfs4_exchange_id(clnt, verf);
+	if (status > 0)
+		fprintf(stderr, "NFSv4.%u client setup failed (%d)\n",
+			clnt->minor, status);
+	return status;
+}
+
+/**
+ * @brief Let go of the session and client of a 4.1 client
+ *
+ * A 4.0 client is left for its lease to run out.  Failures are of no
+ * interest.
+ */
+
+static void nfs4_teardown(struct nl_client *clnt)
+{
+	struct nfs4_res res;
+	struct nl_xdr *x;
+
+	if (clnt->minor == 0)
+		return;
+
+	x = nfs4_begin(clnt, 1, false);
+	nl_put_u32(x, OP_DESTROY_SESSION);
+	nl_put_fixed(x, clnt->sessionid, sizeof(clnt->sessionid));
+	if (nfs4_call(clnt, &res, false) != 0)
+		return;
+
+	x = nfs4_begin(clnt, 1, false);
+	nl_put_u32(x, OP_DESTROY_CLIENTID);
+	nl_put_u64(x, clnt->clientid);
+	nfs4_call(clnt, &res, false);
+}
+
+static int nfs4_root(struct nl_client *clnt, const char *path,
+		     struct nl_fh *fh)
+{
+	struct nfs4_res res;
+	struct nl_xdr *x;
+	char copy[1024];
+	char *names[64];
+	char *name, *save;
+	uint32_t n = 0, i;
+	int status;
+
+	if (strlen(path) >= sizeof(copy)) {
+		fprintf(stderr, "%s: path too long\n", path);
+		return -1;
+	}
+	strcpy(copy, path);
+	for (name = strtok_r(copy, "/", &save); name != NULL;
+	     name = strtok_r(NULL, "/", &save)) {
+		if (n == sizeof(names) / sizeof(names[0])) {
+			fprintf(stderr, "%s: path too deep\n", path);
+			return -1;
+		}
+		names[n++] = name;
+	}
+
+	x = nfs4_begin(clnt, n + 2, true);
+	nl_put_u32(x, OP_PUTROOTFH);
+	for (i = 0; i < n; i++) {
+		nl_put_u32(x, OP_LOOKUP);
+		nl_put_string(x, names[i]);
+	}
+	nl_put_u32(x, OP_GETFH);
+
+	status = nfs4_call(clnt, &res, true);
+	if (status == 0)
+		status = nfs4_op(&res, OP_PUTROOTFH);
+	for (i = 0; i < n && status == NFS4_OK; i++)
+		status = nfs4_op(&res, OP_LOOKUP);
+	if (status == NFS4_OK)
+		status = nfs4_op(&res, OP_GETFH);
+	if (status == NFS4_OK)
+		get_fh(res.x, fh);
+	status = nfs4_done(&res, status);
+	if (status > 0)
+		fprintf(stderr, "lookup of %s failed (%d)\n", path, status);
+	return status;
+}
+
+static int nfs4_lookup(struct nl_client *clnt, const struct nl_fh *dir,
+		       const char *name, struct nl_fh *fh)
+{
+	struct nfs4_res res;
+	struct nl_xdr *x = nfs4_begin(clnt, 4, true);
+	int status;
+
+	put_putfh(x, dir);
+	nl_put_u32(x, OP_LOOKUP);
+	nl_put_string(x, name);
+	nl_put_u32(x, OP_GETFH);
+	nl_put_u32(x, OP_GETATTR);
+	put_bitmap2(x, FATTR4_TYPE | FATTR4_CHANGE | FATTR4_SIZE |
+		    FATTR4_FILEID,
+		    FATTR4_MODE | FATTR4_NUMLINKS | FATTR4_TIME_MODIFY);
+
+	status = nfs4_call(clnt, &res, true);
+	if (status == 0)
+		status = nfs4_op(&res, OP_PUTFH);
+	if (status == NFS4_OK)
+		status = nfs4_op(&res, OP_LOOKUP);
+	if (status == NFS4_OK)
+		status = nfs4_op(&res, OP_GETFH);
+	if (status == NFS4_OK) {
+		get_fh(res.x, fh);
+		status = nfs4_op(&res, OP_GETATTR);
+	}
+	if (status == NFS4_OK)
+		skip_fattr4(res.x);
+	return nfs4_done(&res, status);
+}
+
+static int nfs4_getattr(struct nl_client *clnt, const struct nl_fh *fh)
+{
+	struct nfs4_res res;
+	struct nl_xdr *x = nfs4_begin(clnt, 2, true);
+	int status;
+
+	put_putfh(x, fh);
+	nl_put_u32(x, OP_GETATTR);
+	put_bitmap2(x, FATTR4_TYPE | FATTR4_CHANGE | FATTR4_SIZE |
+		    FATTR4_FILEID,
+		    FATTR4_MODE | FATTR4_NUMLINKS | FATTR4_TIME_MODIFY);
+
+	status = nfs4_call(clnt, &res, true);
+	if (status == 0)
+		status = nfs4_op(&res, OP_PUTFH);
+	if (status == NFS4_OK)
+		status = nfs4_op(&res, OP_GETATTR);
+	if (status == NFS4_OK)
+		skip_fattr4(res.x);
+	return nfs4_done(&res, status);
+}
+
+static int nfs4_access(struct nl_client *clnt, const struct nl_fh *fh)
+{
+	struct nfs4_res res;
+	struct nl_xdr *x = nfs4_begin(clnt, 2, true);
+	int status;
+
+	put_putfh(x, fh);
+	nl_put_u32(x, OP_ACCESS);
+	nl_put_u32(x, ACCESS4_ALL);
+
+	status = nfs4_call(clnt, &res, true);
+	if (status == 0)
+		status = nfs4_op(&res, OP_PUTFH);
+	if (status == NFS4_OK)
+		status = nfs4_op(&res, OP_ACCESS);
+	if (status == NFS4_OK)
+		nl_skip(res.x, 8);
+	return nfs4_done(&res, status);
+}
+
+static int nfs4_mkdir(struct nl_client *clnt, const struct nl_fh *dir,
+		      const char *name, struct nl_fh *fh)
+{
+	struct nfs4_res res;
+	struct nl_xdr *x = nfs4_begin(clnt, 3, true);
+	int status;
+
+	put_putfh(x, dir);
+	nl_put_u32(x, OP_CREATE);
+	nl_put_u32(x, NF4DIR);
+	nl_put_string(x, name);
+	put_fattr_mode(x, 0755);
+	nl_put_u32(x, OP_GETFH);
+
+	status = nfs4_call(clnt, &res, true);
+	if (status == 0)
+		status = nfs4_op(&res, OP_PUTFH);
+	if (status == NFS4_OK)
+		status = nfs4_op(&res, OP_CREATE);
+	if (status == NFS4_OK) {
+		skip_change_info(res.x);
+		skip_bitmap(res.x);
+		status = nfs4_op(&res, OP_GETFH);
+	}
+	if (status == NFS4_OK)
+		get_fh(res.x, fh);
+	return nfs4_done(&res, status);
+}
+
+/**
+ * @brief Confirm the open owner of a 4.0 client after its first OPEN
+ */
+
+static int nfs4_open_confirm(struct nl_client *clnt, struct nl_file *file)
+{
+	struct nfs4_res res;
+	struct nl_xdr *x = nfs4_begin(clnt, 2, true);
+	int status;
+
+	put_putfh(x, &file->fh);
+	nl_put_u32(x, OP_OPEN_CONFIRM);
+	put_stateid(x, &file->open_stateid);
+	nl_put_u32(x, clnt->open_seqid);
+
+	status = nfs4_call(clnt, &res, true);
+	if (status == 0)
+		status = nfs4_op(&res, OP_PUTFH);
+	if (status == NFS4_OK) {
+		status = nfs4_op(&res, OP_OPEN_CONFIRM);
+		if (nfs4_seqid_used(status))
+			clnt->open_seqid++;
+	}
+	if (status == NFS4_OK) {
+		get_stateid(res.x, &file->open_stateid);
+		clnt->owner_confirmed = true;
+	}
+	return nfs4_done(&res, status);
+}
+
+static int nfs4_open_common(struct nl_client *clnt, const struct nl_fh *dir,
+			    const char *name, struct nl_file *file,
+			    bool create)
+{
+	struct nfs4_res res;
+	struct nl_xdr *x = nfs4_begin(clnt, 3, true);
+	uint32_t rflags = 0;
+	int status;
+
+	put_putfh(x, dir);
+	nl_put_u32(x, OP_OPEN);
+	nl_put_u32(x, nfs4_seqid(clnt, clnt->open_seqid));
+	nl_put_u32(x, OPEN4_SHARE_ACCESS_BOTH);
+	nl_put_u32(x, OPEN4_SHARE_DENY_NONE);
+	nl_put_u64(x, clnt->clientid);
+	nl_put_string(x, clnt->owner);
+	if (create) {
+		nl_put_u32(x, OPEN4_CREATE);
+		nl_put_u32(x, UNCHECKED4);
+		put_fattr_mode(x, 0644);
+	} else {
+		nl_put_u32(x, OPEN4_NOCREATE);
+	}
+	nl_put_u32(x, CLAIM_NULL);
+	nl_put_string(x, name);
+	nl_put_u32(x, OP_GETFH);
+
+	status = nfs4_call(clnt, &res, true);
+	if (status == 0)
+		status = nfs4_op(&res, OP_PUTFH);
+	if (status == NFS4_OK) {
+		status = nfs4_op(&res, OP_OPEN);
+		if (nfs4_seqid_used(status))
+			clnt->open_seqid++;
+	}
+	if (status == NFS4_OK) {
+		get_stateid(res.x, &file->open_stateid);
+		skip_change_info(res.x);
+		rflags = nl_get_u32(res.x);
+		skip_bitmap(res.x);
+		skip_delegation(res.x);
+		status = nfs4_op(&res, OP_GETFH);
+	}
+	if (status == NFS4_OK)
+		get_fh(res.x, &file->fh);
+	status = nfs4_done(&res, status);
+	if (status != NFS4_OK)
+		return status;
+
+	file->open = true;
+	file->locker = false;
+	if (clnt->minor == 0 && (rflags & OPEN4_RESULT_CONFIRM))
+		return nfs4_open_confirm(clnt, file);
+	return NFS4_OK;
+}
+
+static int nfs4_create(struct nl_client *clnt, const struct nl_fh *dir,
+		       const char *name, struct nl_file *file)
+{
+	return nfs4_open_common(clnt, dir, name, file, true);
+}
+
+static int nfs4_open(struct nl_client *clnt, const struct nl_fh *dir,
+		     const char *name, struct nl_file *file)
+{
+	return nfs4_open_common(clnt, dir, name, file, false);
+}
+
+static int nfs4_close(struct nl_client *clnt, struct nl_file *file)
+{
+	struct nfs4_res res;
+	struct nl_xdr *x = nfs4_begin(clnt, 2, true);
+	int status;
+
+	put_putfh(x, &file->fh);
+	nl_put_u32(x, OP_CLOSE);
+	nl_put_u32(x, nfs4_seqid(clnt, clnt->open_seqid));
+	put_stateid(x, &file->open_stateid);
+
+	status = nfs4_call(clnt, &res, true);
+	if (status == 0)
+		status = nfs4_op(&res, OP_PUTFH);
+	if (status == NFS4_OK) {
+		status = nfs4_op(&res, OP_CLOSE);
+		if (nfs4_seqid_used(status))
+			clnt->open_seqid++;
+	}
+	if (status == NFS4_OK)
+		nl_skip(res.x, 16);
+	file->open = false;
+	file->locker = false;
+	return nfs4_done(&res, status);
+}
+
+static int nfs4_read(struct nl_client *clnt, struct nl_file *file,
+		     uint64_t offset, uint32_t count, bool *eof)
+{
+	struct nfs4_res res;
+	struct nl_xdr *x = nfs4_begin(clnt, 2, true);
+	int status;
+
+	put_putfh(x, &file->fh);
+	nl_put_u32(x, OP_READ);
+	put_stateid(x, &file->open_stateid);
+	nl_put_u64(x, offset);
+	nl_put_u32(x, count);
+
+	status = nfs4_call(clnt, &res, true);
+	if (status == 0)
+		status = nfs4_op(&res, OP_PUTFH);
+	if (status == NFS4_OK)
+		status = nfs4_op(&res, OP_READ);
+	if (status == NFS4_OK) {
+		*eof = nl_get_u32(res.x);
+		nl_skip_opaque(res.x);
+	}
+	return nfs4_done(&res, status);
+}
+
+static int nfs4_write(struct nl_client *clnt, struct nl_file *file,
+		      uint64_t offset, uint32_t count, bool stable)
+{
+	struct nfs4_res res;
+	struct nl_xdr *x = nfs4_begin(clnt, 2, true);
+	int status;
+
+	put_putfh(x, &file->fh);
+	nl_put_u32(x, OP_WRITE);
+	put_stateid(x, &file->open_stateid);
+	nl_put_u64(x, offset);
+	nl_put_u32(x, stable ? FILE_SYNC4 : UNSTABLE4);
+	nl_put_zeros(x, count);
+
+	status = nfs4_call(clnt, &res, true);
+	if (status == 0)
+		status = nfs4_op(&res, OP_PUTFH);
+	if (status == NFS4_OK)
+		status = nfs4_op(&res, OP_WRITE);
+	if (status == NFS4_OK)
+		nl_skip(res.x, 4 + 4 + 8);
+	return nfs4_done(&res, status);
+}
+
+static int nfs4_commit(struct nl_client *clnt, struct nl_file *file)
+{
+	struct nfs4_res res;
+	struct nl_xdr *x = nfs4_begin(clnt, 2, true);
+	int status;
+
+	put_putfh(x, &file->fh);
+	nl_put_u32(x, OP_COMMIT);
+	nl_put_u64(x, 0);
+	nl_put_u32(x, 0);
+
+	status = nfs4_call(clnt, &res, true);
+	if (status == 0)
+		status = nfs4_op(&res, OP_PUTFH);
+	if (status == NFS4_OK)
+		status = nfs4_op(&res, OP_COMMIT);
+	if (status == NFS4_OK)
+		nl_skip(res.x, 8);
+	return nfs4_done(&res, status);
+}
+
+static int nfs4_remove(struct nl_client *clnt, const struct nl_fh *dir,
+		       const char *name)
+{
+	struct nfs4_res res;
+	struct nl_xdr *x = nfs4_begin(clnt, 2, true);
+	int status;
+
+	put_putfh(x, dir);
+	nl_put_u32(x, OP_REMOVE);
+	nl_put_string(x, name);
+
+	status = nfs4_call(clnt, &res, true);
+	if (status == 0)
+		status = nfs4_op(&res, OP_PUTFH);
+	if (status == NFS4_OK)
+		status = nfs4_op(&res, OP_REMOVE);
+	if (status == NFS4_OK)
+		skip_change_info(res.x);
+	return nfs4_done(&res, status);
+}
+
+static int nfs4_readdir(struct nl_client *clnt, const struct nl_fh *dir,
+			uint64_t *cookie, unsigned char *verf,
+			uint32_t *entries, bool *eof)
+{
+	struct nfs4_res res;
+	struct nl_xdr *x = nfs4_begin(clnt, 2, true);
+	int status;
+
+	put_putfh(x, dir);
+	nl_put_u32(x, OP_READDIR);
+	nl_put_u64(x, *cookie);
+	nl_put_fixed(x, verf, 8);
+	nl_put_u32(x, 8192);	/* dircount */
+	nl_put_u32(x, 32768);	/* maxcount */
+	put_bitmap2(x, FATTR4_TYPE | FATTR4_FILEID, 0);
+
+	status = nfs4_call(clnt, &res, true);
+	if (status == 0)
+		status = nfs4_op(&res, OP_PUTFH);
+	if (status == NFS4_OK)
+		status = nfs4_op(&res, OP_READDIR);
+	if (status == NFS4_OK) {
+		nl_get_fixed(res.x, verf, 8);
+		*entries = 0;
+		while (nl_get_u32(res.x) && !res.x->bad) {
+			*cookie = nl_get_u64(res.x);
+			nl_skip_opaque(res.x);	/* name */
+			skip_fattr4(res.x);
+			(*entries)++;
+		}
+		*eof = nl_get_u32(res.x);
+	}
+	return nfs4_done(&res, status);
+}
+
+/**
+ * @brief Take a write lock on a range of an open file
+ *
+ * @return 0, NL_DENIED if the range is locked by another owner, another
+ *         NFS status or -1.
+ */
+
+static int nfs4_lock(struct nl_client *clnt, struct nl_file *file,
+		     uint64_t offset, uint64_t length)
+{
+	struct nfs4_res res;
+	struct nl_xdr *x = nfs4_begin(clnt, 2, true);
+	bool new_owner = !file->locker;
+	int status;
+
+	put_putfh(x, &file->fh);
+	nl_put_u32(x, OP_LOCK);
+	nl_put_u32(x, WRITE_LT);
+	nl_put_u32(x, 0);	/* Not a reclaim */
+	nl_put_u64(x, offset);
+	nl_put_u64(x, length);
+	nl_put_u32(x, new_owner);
+	if (new_owner) {
+		nl_put_u32(x, nfs4_seqid(clnt, clnt->open_seqid));
+		put_stateid(x, &file->open_stateid);
+		nl_put_u32(x, 0);	/* lock_seqid */
+		nl_put_u64(x, clnt->clientid);
+		nl_put_string(x, clnt->owner);
+	} else {
+		put_stateid(x, &file->lock_stateid);
+		nl_put_u32(x, nfs4_seqid(clnt, file->lock_seqid));
+	}
+
+	status = nfs4_call(clnt, &res, true);
+	if (status == 0)
+		status = nfs4_op(&res, OP_PUTFH);
+	if (status == NFS4_OK) {
+		status = nfs4_op(&res, OP_LOCK);
+		if (nfs4_seqid_used(status)) {
+			if (new_owner)
+				clnt->open_seqid++;
+			else
+				file->lock_seqid++;
+		}
+	}
+	if (status == NFS4_OK) {
+		get_stateid(res.x, &file->lock_stateid);
+		if (new_owner) {
+			file->locker = true;
+			file->lock_seqid = 1;
+		}
+	} else if (status == NL_DENIED) {
+		nl_skip(res.x, 8 + 8 + 4 + 8);
+		nl_skip_opaque(res.x);
+	}
+	return nfs4_done(&res, status);
+}
+
+static int nfs4_unlock(struct nl_client *clnt, struct nl_file *file,
+		       uint64_t offset, uint64_t length)
+{
+	struct nfs4_res res;
+	struct nl_xdr *x = nfs4_begin(clnt, 2, true);
+	int status;
+
+	put_putfh(x, &file->fh);
+	nl_put_u32(x, OP_LOCKU);
+	nl_put_u32(x, WRITE_LT);
+	nl_put_u32(x, nfs4_seqid(clnt, file->lock_seqid));
+	put_stateid(x, &file->lock_stateid);
+	nl_put_u64(x, offset);
+	nl_put_u64(x, length);
+
+	status = nfs4_call(clnt, &res, true);
+	if (status == 0)
+		status = nfs4_op(&res, OP_PUTFH);
+	if (status == NFS4_OK) {
+		status = nfs4_op(&res, OP_LOCKU);
+		if (nfs4_seqid_used(status))
+			file->lock_seqid++;
+	}
+	if (status == NFS4_OK)
+		get_stateid(res.x, &file->lock_stateid);
+	return nfs4_done(&res, status);
+}
+
+/**
+ * @brief Renew the lease of a 4.0 client when it is due
+ *
+ * A 4.1 client renews with every SEQUENCE.
+ */
+
+static int nfs4_keepalive(struct nl_client *clnt)
+{
+	struct nfs4_res res;
+	struct nl_xdr *x;
+	time_t now = time(NULL);
+	int status;
+
+	if (clnt->minor > 0 || now - clnt->renewed < NL_RENEW_INTERVAL)
+		return NFS4_OK;
+
+	x = nfs4_begin(clnt, 1, false);
+	nl_put_u32(x, OP_RENEW);
+	nl_put_u64(x, clnt->clientid);
+	status = nfs4_call(clnt, &res, false);
+	if (status == 0)
+		status = nfs4_op(&res, OP_RENEW);
+	clnt->renewed = now;
+	return nfs4_done(&res, status);
+}
+
+const struct nl_proto nl_nfs4_proto = {
+	.name = "NFSv4",
+	.can_lock = true,
+	.setup = nfs4_setup,
+	.teardown = nfs4_teardown,
+	.root = nfs4_root,
+	.lookup = nfs4_lookup,
+	.getattr = nfs4_getattr,
+	.access = nfs4_access,
+	.mkdir = nfs4_mkdir,
+	.create = nfs4_create,
+	.open = nfs4_open,
+	.close = nfs4_close,
+	.read = nfs4_read,
+	.write = nfs4_write,
+	.commit = nfs4_commit,
+	.remove = nfs4_remove,
+	.readdir = nfs4_readdir,
+	.lock = nfs4_lock,
+	.unlock = nfs4_unlock,
+	.keepalive = nfs4_keepalive,
+};
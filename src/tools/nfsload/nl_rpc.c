@@ -0,0 +1,390 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ * ---------------------------------------
+ */
+
+/**
+ * @file   nl_rpc.c
+ * @brief XDR and ONC RPC over TCP for the load generator
+ *
+ * Calls carry AUTH_SYS credentials and are sent as one record; replies
+ * may come in several fragments and are put back together before they
+ * are decoded.  There is one call outstanding on a connection at a
+ * time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "nfsload.h"
+
+#define RPC_CALL 0
+#define RPC_REPLY 1
+#define RPC_MSG_ACCEPTED 0
+#define RPC_SUCCESS 0
+#define RPC_AUTH_NONE 0
+#define RPC_AUTH_SYS 1
+#define RPC_LAST_FRAG 0x80000000U
+
+/**
+ * @brief Make room for len more bytes in an XDR buffer
+ */
+
+static void nl_reserve(struct nl_xdr *x, size_t len)
+{
+	size_t cap = x->cap ? x->cap : 4096;
+
+	if (x->len + len <= x->cap)
+		return;
+	while (cap < x->len + len)
+		cap *= 2;
+	x->buf = realloc(x->buf, cap);
+	if (x->buf == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	x->cap = cap;
+}
+
+void nl_put_u32(struct nl_xdr *x, uint32_t v)
+{
+	nl_reserve(x, 4);
+	x->buf[x->len++] = v >> 24;
+	x->buf[x->len++] = v >> 16;
+	x->buf[x->len++] = v >> 8;
+	x->buf[x->len++] = v;
+}
+
+void nl_put_u64(struct nl_xdr *x, uint64_t v)
+{
+	nl_put_u32(x, v >> 32);
+	nl_put_u32(x, v);
+}
+
+/**
+ * @brief Put bytes that are padded but have no length, such as a verifier
+ */
+
+void nl_put_fixed(struct nl_xdr *x, const void *p, size_t len)
+{
+	size_t pad = (4 - (len & 3)) & 3;
+
+	nl_reserve(x, len + pad);
+	memcpy(x->buf + x->len, p, len);
+	memset(x->buf + x->len + len, 0, pad);
+	x->len += len + pad;
+}
+
+void nl_put_opaque(struct nl_xdr *x, const void *p, uint32_t len)
+{
+	nl_put_u32(x, len);
+	nl_put_fixed(x, p, len);
+}
+
+void nl_put_string(struct nl_xdr *x, const char *s)
+{
+	nl_put_opaque(x, s, strlen(s));
+}
+
+/**
+ * @brief Put a counted opaque of zeros, the data of a write
+ */
+
+void nl_put_zeros(struct nl_xdr *x, uint32_t len)
+{
+	size_t padded = (len + 3) & ~3U;
+
+	nl_put_u32(x, len);
+	nl_reserve(x, padded);
+	memset(x->buf + x->len, 0, padded);
+	x->len += padded;
+}
+
+uint32_t nl_get_u32(struct nl_xdr *x)
+{
+	unsigned char *p;
+
+	if (x->bad || x->len - x->pos < 4) {
+		x->bad = true;
+		return 0;
+	}
+	p = x->buf + x->pos;
+	x->pos += 4;
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+		((uint32_t) p[2] << 8) | p[3];
+}
+
+uint64_t nl_get_u64(struct nl_xdr *x)
+{
+	uint64_t hi = nl_get_u32(x);
+
+	return (hi << 32) | nl_get_u32(x);
+}
+
+void nl_skip(struct nl_xdr *x, size_t len)
+{
+	len = (len + 3) & ~(size_t) 3;
+	if (x->bad || x->len - x->pos < len) {
+		x->bad = true;
+		return;
+	}
+	x->pos += len;
+}
+
+void nl_get_fixed(struct nl_xdr *x, void *p, size_t len)
+{
+	if (x->bad || x->len - x->pos < len) {
+		x->bad = true;
+		return;
+	}
+	memcpy(p, x->buf + x->pos, len);
+	nl_skip(x, len);
+}
+
+/**
+ * @brief Get a counted opaque of at most max bytes
+ *
+ * @return The length of the opaque.
+ */
+
+uint32_t nl_get_opaque(struct nl_xdr *x, void *p, uint32_t max)
+{
+	uint32_t len = nl_get_u32(x);
+
+	if (len > max) {
+		x->bad = true;
+		return 0;
+	}
+	nl_get_fixed(x, p, len);
+	return len;
+}
+
+void nl_skip_opaque(struct nl_xdr *x)
+{
+	nl_skip(x, nl_get_u32(x));
+}
+
+/**
+ * @brief Connect to the server
+ *
+ * @return 0, or -1 with a message printed.
+ */
+
+int nl_connect(struct nl_conn *conn, const char *host, int port,
+	       uint32_t uid, uint32_t gid)
+{
+	struct addrinfo hints, *res, *ai;
+	char service[16];
+	int one = 1;
+	int rc;
+
+	memset(conn, 0, sizeof(*conn));
+	conn->fd = -1;
+	conn->uid = uid;
+	conn->gid = gid;
+	conn->xid = (uint32_t) random();
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(service, sizeof(service), "%d", port);
+	rc = getaddrinfo(host, service, &hints, &res);
+	if (rc != 0) {
+		fprintf(stderr, "%s: %s\n", host, gai_strerror(rc));
+		return -1;
+	}
+
+	for (ai = res; ai != NULL; ai = ai->ai_next) {
+		conn->fd = socket(ai->ai_family, ai->ai_socktype,
+				  ai->ai_protocol);
+		if (conn->fd < 0)
+			continue;
+		if (connect(conn->fd, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		close(conn->fd);
+		conn->fd = -1;
+	}
+	freeaddrinfo(res);
+
+	if (conn->fd < 0) {
+		fprintf(stderr, "%s:%d: %s\n", host, port, strerror(errno));
+		return -1;
+	}
+	setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return 0;
+}
+
+void nl_disconnect(struct nl_conn *conn)
+{
+	if (conn->fd >= 0)
+		close(conn->fd);
+	conn->fd = -1;
+	free(conn->call.buf);
+	free(conn->reply.buf);
+	memset(&conn->call, 0, sizeof(conn->call));
+	memset(&conn->reply, 0, sizeof(conn->reply));
+}
+
+/**
+ * @brief Start a call
+ *
+ * @return The buffer to put the arguments in.
+ */
+
+struct nl_xdr *nl_call_begin(struct nl_conn *conn, uint32_t prog,
+			     uint32_t vers, uint32_t proc)
+{
+	struct nl_xdr *x = &conn->call;
+	static const char machine[] = "nfsload";
+
+	x->len = 0;
+	nl_put_u32(x, 0);	/* Record mark, filled in by nl_call */
+	nl_put_u32(x, ++conn->xid);
+	nl_put_u32(x, RPC_CALL);
+	nl_put_u32(x, 2);
+	nl_put_u32(x, prog);
+	nl_put_u32(x, vers);
+	nl_put_u32(x, proc);
+
+	nl_put_u32(x, RPC_AUTH_SYS);
+	nl_put_u32(x, 5 * 4 + ((sizeof(machine) - 1 + 3) & ~3U));
+	nl_put_u32(x, 0);	/* Stamp */
+	nl_put_string(x, machine);
+	nl_put_u32(x, conn->uid);
+	nl_put_u32(x, conn->gid);
+	nl_put_u32(x, 0);	/* No supplementary groups */
+
+	nl_put_u32(x, RPC_AUTH_NONE);
+	nl_put_u32(x, 0);
+	return x;
+}
+
+static int nl_read_full(int fd, void *p, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = read(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p = (char *)p + n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int nl_write_full(int fd, const void *p, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p = (const char *)p + n;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * @brief Read one whole record into the reply buffer
+ */
+
+static int nl_read_record(struct nl_conn *conn)
+{
+	struct nl_xdr *x = &conn->reply;
+	unsigned char mark[4];
+	uint32_t frag;
+
+	x->len = 0;
+	x->pos = 0;
+	x->bad = false;
+	do {
+		if (nl_read_full(conn->fd, mark, sizeof(mark)) != 0)
+			return -1;
+		frag = ((uint32_t) mark[0] << 24) | (mark[1] << 16) |
+			(mark[2] << 8) | mark[3];
+		nl_reserve(x, frag & ~RPC_LAST_FRAG);
+		if (nl_read_full(conn->fd, x->buf + x->len,
+				 frag & ~RPC_LAST_FRAG) != 0)
+			return -1;
+		x->len += frag & ~RPC_LAST_FRAG;
+	} while (!(frag & RPC_LAST_FRAG));
+	return 0;
+}
+
+/**
+ * @brief Send the call built and wait for its reply
+ *
+ * On success conn->reply is positioned at the results.
+ *
+ * @return 0, or -1 with a message printed if the call could not be
+ *         made or was not accepted.
+ */
+
+int nl_call(struct nl_conn *conn)
+{
+	struct nl_xdr *x = &conn->call;
+	struct nl_xdr *r = &conn->reply;
+	uint32_t mark = RPC_LAST_FRAG | (x->len - 4);
+	uint32_t stat;
+
+	x->buf[0] = mark >> 24;
+	x->buf[1] = mark >> 16;
+	x->buf[2] = mark >> 8;
+	x->buf[3] = mark;
+	if (nl_write_full(conn->fd, x->buf, x->len) != 0) {
+		perror("send");
+		return -1;
+	}
+
+	do {
+		if (nl_read_record(conn) != 0) {
+			fprintf(stderr, "connection closed by server\n");
+			return -1;
+		}
+	} while (nl_get_u32(r) != conn->xid && !r->bad);
+
+	if (nl_get_u32(r) != RPC_REPLY || nl_get_u32(r) != RPC_MSG_ACCEPTED) {
+		fprintf(stderr, "call denied by server\n");
+		return -1;
+	}
+	nl_get_u32(r);		/* Verifier flavor */
+	nl_skip_opaque(r);
+	stat = nl_get_u32(r);
+	if (r->bad || stat != RPC_SUCCESS) {
+		fprintf(stderr, "call not accepted by server (%u)\n", stat);
+		return -1;
+	}
+	return 0;
+}